@@ -0,0 +1,147 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the letters they're made of.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "anagram_index.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    LetterCounts class.
+----------------------------------------------------------*/
+const unsigned LetterCounts::kMaxCount;
+const size_t LetterCounts::kLettersPerLane;
+
+/**
+ * Count the letters of a word.
+ */
+bool LetterCounts::count(const std::string& word) {
+    lanes[0] = 0;
+    lanes[1] = 0;
+    
+    for (size_t i = 0; i < word.length(); i++) {
+        if (word[i] < 'A' || word[i] > 'Z') {
+            return false;
+        }
+        
+        const size_t letter = static_cast<size_t>(word[i] - 'A');
+        boost::uint64_t& lane = lanes[letter / kLettersPerLane];
+        const size_t shift = 4 * (letter % kLettersPerLane);
+        
+        if (((lane >> shift) & 0xF) == kMaxCount) {
+            return false;
+        }
+        
+        lane += static_cast<boost::uint64_t>(1) << shift;
+    }
+    
+    return true;
+}
+
+/*---------------------------------------------------------
+                    AnagramIndex class.
+----------------------------------------------------------*/
+/**
+ * Add the next word.
+ */
+void AnagramIndex::add(const std::string& word) {
+    LetterCounts counts;
+    is_counted_.push_back(counts.count(word));
+    counts_.push_back(counts);
+}
+
+/**
+ * Prepare the index for lookups.
+ */
+void AnagramIndex::finish(const std::vector<size_t>& word_length_ends) {
+    word_length_ends_ = word_length_ends;
+    ids_by_counts_.resize(counts_.size());
+    
+    for (size_t id = 0; id < counts_.size(); id++) {
+        ids_by_counts_[id] = static_cast<WordId>(id);
+    }
+    
+    //Sort each group of words of the same length separately.
+    CountsOrder order(counts_);
+    
+    for (size_t length = 1; length < word_length_ends_.size(); length++) {
+        std::sort(ids_by_counts_.begin() + word_length_ends_[length - 1],
+                  ids_by_counts_.begin() + word_length_ends_[length],
+                  order);
+    }
+}
+
+/**
+ * Find the words made of exactly the letters of the rack.
+ */
+bool AnagramIndex::find_anagrams(const std::string& rack, WordIdList& ids) const {
+    LetterCounts rack_counts;
+    
+    if (!rack_counts.count(rack)) {
+        return false;
+    }
+    
+    if (rack.empty() || rack.length() >= word_length_ends_.size()) {
+        return true;
+    }
+    
+    std::pair<std::vector<WordId>::const_iterator, std::vector<WordId>::const_iterator> matches =
+        std::equal_range(ids_by_counts_.begin() + word_length_ends_[rack.length() - 1],
+                         ids_by_counts_.begin() + word_length_ends_[rack.length()],
+                         rack_counts,
+                         CountsOrder(counts_));
+    
+    //Words that couldn't be counted have fewer letters counted than
+    //their length, so they never match.
+    const size_t first_match = ids.size();
+    ids.insert(ids.end(), matches.first, matches.second);
+    std::sort(ids.begin() + first_match, ids.end());
+    return true;
+}
+
+/**
+ * Find the words that can be made from some of the letters of the rack.
+ */
+bool AnagramIndex::find_subwords(const std::string& rack, 
+                                 size_t max_length, 
+                                 WordIdList& ids) const {
+    LetterCounts rack_counts;
+    
+    if (!rack_counts.count(rack)) {
+        return false;
+    }
+    
+    //Words longer than the rack can't be made from it.
+    const size_t end = this->length_end(std::min(max_length, rack.length()));
+    
+    for (size_t id = 0; id < end; id++) {
+        if (rack_counts.contains(counts_[id]) && is_counted_[id]) {
+            ids.push_back(static_cast<WordId>(id));
+        }
+    }
+    
+    return true;
+}
+
+} /* namespace isaword */
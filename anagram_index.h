@@ -0,0 +1,169 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the letters they're made of, used to find
+// anagrams of a rack of letters and the words that can be made from it.
+
+#ifndef ISAWORD_ANAGRAM_INDEX_H
+#define ISAWORD_ANAGRAM_INDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    LetterCounts class.
+----------------------------------------------------------*/
+/**
+ * How many times each letter 'A' to 'Z' occurs in a word, packed into
+ * 4-bit fields: 16 letters per 64-bit lane.  Each count takes 3 bits,
+ * and the top bit of each field is kept clear, so that a whole lane of
+ * counts can be compared at once (see contains()).
+ */
+class LetterCounts {
+public:
+    /// The highest count that can be stored for a letter.
+    static const unsigned kMaxCount = 7;
+    
+    /// Number of letters in a lane.
+    static const size_t kLettersPerLane = 16;
+    
+    LetterCounts() {
+        lanes[0] = 0;
+        lanes[1] = 0;
+    }
+    
+    /**
+     * Count the letters of a word.
+     * @return true on success, false if the word has characters other
+     * than 'A' to 'Z' or more than kMaxCount of the same letter.
+     */
+    bool count(const std::string& word);
+    
+    /// Check whether every letter occurs here at least as many
+    /// times as it occurs in other, i.e. other can be made from this.
+    bool contains(const LetterCounts& other) const {
+        //Set the top bit of each field and subtract: the bit survives
+        //exactly where this count is no less than the other count.
+        //Counts are never above 7, so the fields can't borrow from 
+        //each other.
+        const boost::uint64_t kTopBits = 0x8888888888888888ULL;
+        return (((lanes[0] | kTopBits) - other.lanes[0]) & kTopBits) == kTopBits &&
+               (((lanes[1] | kTopBits) - other.lanes[1]) & kTopBits) == kTopBits;
+    }
+    
+    bool operator==(const LetterCounts& other) const {
+        return lanes[0] == other.lanes[0] && lanes[1] == other.lanes[1];
+    }
+    
+    bool operator<(const LetterCounts& other) const {
+        return lanes[0] < other.lanes[0] || 
+               (lanes[0] == other.lanes[0] && lanes[1] < other.lanes[1]);
+    }
+    
+    /// The packed counts.
+    boost::uint64_t lanes[2];
+};
+
+/*---------------------------------------------------------
+                    AnagramIndex class.
+----------------------------------------------------------*/
+/**
+ * Letter counts of all words, by word id, for finding the words that can
+ * be made from a rack of letters.  Word ids must be grouped by length,
+ * as in WordPicker::words_by_length(), so that only the words short
+ * enough to be made from a rack need to be checked.  Within each length,
+ * the ids are also kept sorted by letter counts, which serve as the
+ * sorted-letter key for finding exact anagrams with a binary search.
+ */
+class AnagramIndex {
+public:
+    /**
+     * Add the next word.  Words must be added in order of their ids,
+     * starting with 0.  Words that can't be counted (see 
+     * LetterCounts::count()) are never found.
+     */
+    void add(const std::string& word);
+    
+    /**
+     * Prepare the index for lookups once all words have been added.
+     * @param word_length_ends the id where the words of each length end,
+     * as in WordPicker::word_length_ends().
+     */
+    void finish(const std::vector<size_t>& word_length_ends);
+    
+    /**
+     * Find the words made of exactly the letters of the rack.
+     * @return false if the rack can't be counted, true otherwise.
+     */
+    bool find_anagrams(const std::string& rack, WordIdList& ids) const;
+    
+    /**
+     * Find the words of up to max_length letters that can be made from
+     * some of the letters of the rack, in order of their ids.
+     * @return false if the rack can't be counted, true otherwise.
+     */
+    bool find_subwords(const std::string& rack, size_t max_length, WordIdList& ids) const;
+    
+private:
+    /// Orders word ids by their letter counts.
+    class CountsOrder {
+    public:
+        CountsOrder(const std::vector<LetterCounts>& counts) : counts_(counts) {}
+        
+        bool operator()(WordId first, WordId second) const {
+            return counts_[first] < counts_[second];
+        }
+        
+        bool operator()(WordId id, const LetterCounts& counts) const {
+            return counts_[id] < counts;
+        }
+        
+        bool operator()(const LetterCounts& counts, WordId id) const {
+            return counts < counts_[id];
+        }
+        
+    private:
+        const std::vector<LetterCounts>& counts_;
+    };
+    
+    /// Get the end of the ids of words no longer than length.
+    size_t length_end(size_t length) const {
+        return length < word_length_ends_.size() ? word_length_ends_[length] : 
+                                                   word_length_ends_.back();
+    }
+    
+    /// Letter counts by word id.
+    std::vector<LetterCounts> counts_;
+    
+    /// Whether each word could be counted.
+    std::vector<bool> is_counted_;
+    
+    /// Word ids, sorted by length and then by letter counts.
+    std::vector<WordId> ids_by_counts_;
+    
+    /// Where the words of each length end.
+    std::vector<size_t> word_length_ends_;
+};
+
+} /* namespace isaword */
+#endif
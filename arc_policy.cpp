@@ -0,0 +1,190 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Deciding which entries of a cache limited by size to evict.
+
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "arc_policy.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    ArcPolicy class.
+----------------------------------------------------------*/
+/**
+ * Record a hit on a key.  A resident key moves to the front of T2.
+ * @return true if the key is resident, false otherwise.
+ */
+bool ArcPolicy::touch(const std::string& key) {
+    NodeMap::iterator node = nodes_.find(key);
+    
+    if (node == nodes_.end() || 
+        (node->second.list != RECENT && node->second.list != FREQUENT)) {
+        return false;
+    }
+    
+    this->move_to(node, FREQUENT);
+    return true;
+}
+
+/**
+ * Add a key that has just been loaded.  A key remembered as a ghost 
+ * goes to T2, and adapts the target size of T1: a ghost of T1 means 
+ * T1 should have been larger, a ghost of T2 that it should have been 
+ * smaller.  The adjustment is larger when the other ghost list is.
+ */
+void ArcPolicy::insert(const std::string& key, size_t size, std::vector<std::string>& evicted) {
+    NodeMap::iterator node = nodes_.find(key);
+    bool is_frequent_ghost_hit = false;
+    
+    if (node == nodes_.end()) {
+        lists_[RECENT].push_front(key);
+        Node new_node;
+        new_node.list = RECENT;
+        new_node.position = lists_[RECENT].begin();
+        new_node.size = size;
+        nodes_[key] = new_node;
+        list_bytes_[RECENT] += size;
+    
+    } else if (node->second.list == RECENT_GHOST) {
+        const size_t recent_ghost_bytes = std::max<size_t>(list_bytes_[RECENT_GHOST], 1);
+        const size_t delta = std::max(size, size * list_bytes_[FREQUENT_GHOST] / recent_ghost_bytes);
+        target_recent_bytes_ = std::min(capacity_, target_recent_bytes_ + delta);
+        list_bytes_[RECENT_GHOST] -= node->second.size;
+        node->second.size = size;
+        list_bytes_[RECENT_GHOST] += size;
+        this->move_to(node, FREQUENT);
+    
+    } else if (node->second.list == FREQUENT_GHOST) {
+        const size_t frequent_ghost_bytes = std::max<size_t>(list_bytes_[FREQUENT_GHOST], 1);
+        const size_t delta = std::max(size, size * list_bytes_[RECENT_GHOST] / frequent_ghost_bytes);
+        target_recent_bytes_ = target_recent_bytes_ > delta ? target_recent_bytes_ - delta : 0;
+        list_bytes_[FREQUENT_GHOST] -= node->second.size;
+        node->second.size = size;
+        list_bytes_[FREQUENT_GHOST] += size;
+        this->move_to(node, FREQUENT);
+        is_frequent_ghost_hit = true;
+    
+    } else {
+        // Already resident.
+        this->resize(key, size, evicted);
+        this->move_to(node, FREQUENT);
+        return;
+    }
+    
+    this->replace(is_frequent_ghost_hit, evicted);
+}
+
+/**
+ * Change the size of a resident key, evicting keys as needed.
+ */
+void ArcPolicy::resize(const std::string& key, size_t size, std::vector<std::string>& evicted) {
+    NodeMap::iterator node = nodes_.find(key);
+    
+    if (node == nodes_.end()) {
+        return;
+    }
+    
+    list_bytes_[node->second.list] -= node->second.size;
+    node->second.size = size;
+    list_bytes_[node->second.list] += size;
+    this->replace(false, evicted);
+}
+
+/**
+ * Forget a key, resident or not, without remembering it as a ghost.
+ */
+void ArcPolicy::erase(const std::string& key) {
+    NodeMap::iterator node = nodes_.find(key);
+    
+    if (node != nodes_.end()) {
+        this->remove(node);
+    }
+}
+
+/**
+ * Change the capacity, evicting keys as needed.
+ */
+void ArcPolicy::set_capacity(size_t capacity, std::vector<std::string>& evicted) {
+    capacity_ = capacity;
+    target_recent_bytes_ = std::min(target_recent_bytes_, capacity_);
+    this->replace(false, evicted);
+}
+
+/// Check whether a key is resident.
+bool ArcPolicy::is_resident(const std::string& key) const {
+    NodeMap::const_iterator node = nodes_.find(key);
+    return node != nodes_.end() 
+        && (node->second.list == RECENT || node->second.list == FREQUENT);
+}
+
+/// Move a key to the front of a list.
+void ArcPolicy::move_to(NodeMap::iterator node, ListId list) {
+    Node& moved = node->second;
+    list_bytes_[moved.list] -= moved.size;
+    lists_[list].splice(lists_[list].begin(), lists_[moved.list], moved.position);
+    moved.list = list;
+    moved.position = lists_[list].begin();
+    list_bytes_[list] += moved.size;
+}
+
+/// Remove a key from its list and from the map.
+void ArcPolicy::remove(NodeMap::iterator node) {
+    list_bytes_[node->second.list] -= node->second.size;
+    lists_[node->second.list].erase(node->second.position);
+    nodes_.erase(node);
+}
+
+/**
+ * Evict resident keys into the ghost lists until the resident keys
+ * fit into the capacity: from T1 while it's over its target size, and
+ * from T2 otherwise.  Then trim the ghost lists, so that T1 and B1 
+ * together fit into the capacity, and all the lists into twice that.
+ */
+void ArcPolicy::replace(bool is_frequent_ghost_hit, std::vector<std::string>& evicted) {
+    while (this->resident_bytes() > capacity_) {
+        const bool evict_recent = 
+            !lists_[RECENT].empty() 
+            && (lists_[FREQUENT].empty()
+                || list_bytes_[RECENT] > target_recent_bytes_
+                || (is_frequent_ghost_hit && list_bytes_[RECENT] == target_recent_bytes_));
+        const ListId from = evict_recent ? RECENT : FREQUENT;
+        const ListId to = evict_recent ? RECENT_GHOST : FREQUENT_GHOST;
+        
+        NodeMap::iterator victim = nodes_.find(lists_[from].back());
+        evicted.push_back(victim->first);
+        this->move_to(victim, to);
+    }
+    
+    while (!lists_[RECENT_GHOST].empty() 
+           && list_bytes_[RECENT] + list_bytes_[RECENT_GHOST] > capacity_) {
+        this->remove(nodes_.find(lists_[RECENT_GHOST].back()));
+    }
+    
+    while (!lists_[FREQUENT_GHOST].empty()
+           && this->resident_bytes() + list_bytes_[RECENT_GHOST] 
+              + list_bytes_[FREQUENT_GHOST] > 2 * capacity_) {
+        this->remove(nodes_.find(lists_[FREQUENT_GHOST].back()));
+    }
+}
+
+} /* namespace isaword */
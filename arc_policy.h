@@ -0,0 +1,166 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Deciding which entries of a cache limited by size to evict.
+
+#ifndef ISAWORD_ARC_POLICY_H
+#define ISAWORD_ARC_POLICY_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <google/dense_hash_map>
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    ArcPolicy class.
+----------------------------------------------------------*/
+/**
+ * An Adaptive Replacement Cache policy (Megiddo and Modha), with the
+ * entries weighed by their size in bytes.  The resident entries are 
+ * split into those seen once recently (T1) and those seen at least 
+ * twice (T2); the keys recently evicted from either list are remembered
+ * as "ghosts" (B1 and B2).  A miss on a ghost tells whether recency or
+ * frequency would have paid off, and moves the target size of T1 
+ * accordingly.  This way one-off requests (e.g. a scan of many URLs) 
+ * only churn T1, and can't push the frequently used entries out.
+ *
+ * The policy only tracks keys and sizes; the owner keeps the entries,
+ * and drops the ones the policy evicts.
+ */
+class ArcPolicy {
+public:
+    ArcPolicy(size_t capacity)
+    : capacity_(capacity),
+      target_recent_bytes_(0) {
+        for (size_t i = 0; i < kNumLists; ++i) {
+            list_bytes_[i] = 0;
+        }
+        
+        nodes_.set_empty_key("");
+        nodes_.set_deleted_key("\x01");
+    }
+    
+    /**
+     * Record a hit on a key.
+     * @return true if the key is resident, false otherwise.
+     */
+    bool touch(const std::string& key);
+    
+    /**
+     * Add a key that has just been loaded, and evict as many resident
+     * keys as needed to stay within the capacity.  An entry larger than
+     * the capacity is evicted right away.  The evicted keys are appended
+     * to evicted.
+     */
+    void insert(const std::string& key, size_t size, std::vector<std::string>& evicted);
+    
+    /**
+     * Change the size of a resident key, e.g. once the entry has been 
+     * reloaded, evicting keys as needed.
+     */
+    void resize(const std::string& key, size_t size, std::vector<std::string>& evicted);
+    
+    /**
+     * Forget a key, resident or not, without remembering it as a ghost.
+     */
+    void erase(const std::string& key);
+    
+    /**
+     * Change the capacity, evicting keys as needed.
+     */
+    void set_capacity(size_t capacity, std::vector<std::string>& evicted);
+    
+    /*=============== Getters/Setters ====================*/
+    /// Check whether a key is resident.
+    bool is_resident(const std::string& key) const;
+    
+    /// Get the total size of the resident keys.
+    size_t resident_bytes() const   {return list_bytes_[RECENT] + list_bytes_[FREQUENT];}
+    
+    /// Get the number of resident keys.
+    size_t num_resident() const     {return lists_[RECENT].size() + lists_[FREQUENT].size();}
+    
+    /// Get the number of keys remembered as ghosts.
+    size_t num_ghosts() const       {return lists_[RECENT_GHOST].size() + lists_[FREQUENT_GHOST].size();}
+    
+    /// Get the maximum total size of the resident keys.
+    size_t capacity() const         {return capacity_;}
+    
+    /// Get the current target size of the keys seen once.
+    size_t target_recent_bytes() const {return target_recent_bytes_;}
+    
+private:
+    /// The lists of keys, from the most recently used.
+    enum ListId {
+        RECENT = 0,         // T1
+        FREQUENT = 1,       // T2
+        RECENT_GHOST = 2,   // B1
+        FREQUENT_GHOST = 3, // B2
+        kNumLists = 4
+    };
+    
+    typedef std::list<std::string> KeyList;
+    
+    class Node {
+    public:
+        ListId list;
+        KeyList::iterator position;
+        size_t size;
+    };
+    
+    /**
+     * A functor used to compare the strings in the hash map.
+     */
+    struct eqstr {
+        bool operator()(const std::string& first, const std::string& second) const {
+            return (first == second);
+        }
+    };
+    
+    typedef google::dense_hash_map<std::string, 
+                                   Node, 
+                                   boost::hash<std::string>, 
+                                   eqstr>
+            NodeMap;
+    
+    /// Move a key to the front of a list.
+    void move_to(NodeMap::iterator node, ListId list);
+    
+    /// Remove a key from its list and from the map.
+    void remove(NodeMap::iterator node);
+    
+    /**
+     * Evict resident keys into the ghost lists until the resident keys
+     * fit into the capacity, then trim the ghost lists.
+     */
+    void replace(bool is_frequent_ghost_hit, std::vector<std::string>& evicted);
+    
+    KeyList lists_[kNumLists];
+    size_t list_bytes_[kNumLists];
+    NodeMap nodes_;
+    size_t capacity_;
+    
+    /// Target size of T1 ("p" in the paper).
+    size_t target_recent_bytes_;
+};
+
+} /* namespace isaword */
+#endif
@@ -0,0 +1,611 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Bundling the scripts and styles of the pages, and referring to the
+// static files by URLs that change with their contents.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+
+#include "asset_pipeline.h"
+#include "file_handler.h"
+#include "worker_pool.h"
+
+namespace isaword {
+
+/// Check whether a path ends with an extension.
+static bool has_extension(const std::string& path, const std::string& extension) {
+    return path.size() > extension.size() 
+           && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+/**
+ * Copy a string literal of a script or style sheet, starting at its 
+ * opening quote.  An unterminated literal ends with the line.
+ * @return the position following the literal.
+ */
+static size_t copy_string_literal(const std::string& source, size_t start, std::string& output) {
+    const char quote = source[start];
+    size_t i = start;
+    output += source[i++];
+    
+    while (i < source.size()) {
+        const char c = source[i++];
+        output += c;
+        
+        if (c == '\\' && i < source.size()) {
+            output += source[i++];
+        
+        } else if (c == quote || (c == '\n' && quote != '`')) {
+            break;
+        }
+    }
+    
+    return i;
+}
+
+/**
+ * Copy a regular expression literal of a script, starting at its 
+ * opening slash.  Slashes within a character class don't end it.
+ * @return the position following the literal, before the flags.
+ */
+static size_t copy_regex_literal(const std::string& source, size_t start, std::string& output) {
+    bool is_in_class = false;
+    size_t i = start;
+    output += source[i++];
+    
+    while (i < source.size()) {
+        const char c = source[i++];
+        output += c;
+        
+        if (c == '\\' && i < source.size()) {
+            output += source[i++];
+        
+        } else if (c == '[') {
+            is_in_class = true;
+        
+        } else if (c == ']') {
+            is_in_class = false;
+        
+        } else if ((c == '/' && !is_in_class) || c == '\n') {
+            break;
+        }
+    }
+    
+    return i;
+}
+
+/**
+ * Check whether a slash following the minified script so far starts a 
+ * regular expression rather than a division: it does at the start, 
+ * after an opening bracket, most operators, and "return".  Taking a 
+ * regular expression for a division is harmless unless it holds a 
+ * quote or a comment, so the arithmetic operators are left out.
+ */
+static bool starts_regex(const std::string& minified) {
+    const size_t last = minified.find_last_not_of(" \n");
+    
+    if (last == std::string::npos) {
+        return true;
+    }
+    
+    if (strchr("(,=:[!&|?{};~", minified[last]) != NULL) {
+        return true;
+    }
+    
+    const std::string keyword("return");
+    return last + 1 >= keyword.size() 
+           && minified.compare(last + 1 - keyword.size(), keyword.size(), keyword) == 0;
+}
+
+/// Read a whole file.
+static bool read_file(const std::string& path, std::string& contents) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    
+    if (!file.is_open()) {
+        return false;
+    }
+    
+    contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !file.bad();
+}
+
+/// Write a file.  The file is replaced at once, so it's never served
+/// half written.
+static bool write_file(const std::string& path, const std::string& contents) {
+    //A hidden name, so that the file is never served.
+    const size_t name_start = path.rfind('/') == std::string::npos ? 0 : path.rfind('/') + 1;
+    const std::string temp_path(path.substr(0, name_start) + '.' + path.substr(name_start) + ".tmp");
+    std::ofstream file(temp_path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    file << contents;
+    file.close();
+    
+    if (file.fail() || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * Find the next URL under a URL root in a page or a style sheet: one
+ * following a quote, '(', '=' or whitespace.
+ * @return the start of the URL, or std::string::npos if there's none
+ * left; the end of the URL is returned in url_end.
+ */
+static size_t find_url(const std::string& text, 
+                       const std::string& url_root, 
+                       size_t from, 
+                       size_t& url_end) {
+    const char* path_chars = 
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-./";
+    
+    if (url_root.empty()) {
+        return std::string::npos;
+    }
+    
+    for (size_t url_start = text.find(url_root, from); 
+         url_start != std::string::npos; 
+         url_start = text.find(url_root, url_start + 1)) {
+        if (url_start == 0 || strchr("\"'(= \t\n", text[url_start - 1]) == NULL) {
+            continue;
+        }
+        
+        url_end = text.find_first_not_of(path_chars, url_start + url_root.size());
+        
+        if (url_end == std::string::npos) {
+            url_end = text.size();
+        }
+        
+        return url_start;
+    }
+    
+    return std::string::npos;
+}
+
+/*---------------------------------------------------------
+                    AssetPipeline class.
+----------------------------------------------------------*/
+/**
+ * Stop watching the files.  The refresh under way, if any, is finished
+ * first.
+ */
+AssetPipeline::~AssetPipeline() {
+    if (refresh_pool_) {
+        refresh_pool_.reset();
+        file_handler_->set_change_callback(NULL, NULL);
+        bundle_handler_->set_change_callback(NULL, NULL);
+    }
+}
+
+/**
+ * Concatenate and minify a number of files into a bundle.  The files
+ * of a script bundle are separated with ";" in case one of them 
+ * doesn't end its last statement.
+ */
+bool AssetPipeline::build_bundle(const std::string& bundle_path, 
+                                 const std::vector<std::string>& source_paths) {
+    const bool is_script = has_extension(bundle_path, ".js");
+    const bool is_style = has_extension(bundle_path, ".css");
+    std::string bundle;
+    
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        std::vector<Bundle>::iterator it = bundles_.begin();
+        
+        while (it != bundles_.end() && it->path != bundle_path) {
+            ++it;
+        }
+        
+        if (it == bundles_.end()) {
+            it = bundles_.insert(bundles_.end(), Bundle());
+            it->path = bundle_path;
+        }
+        
+        it->source_paths = source_paths;
+    }
+    
+    for (std::vector<std::string>::const_iterator it = source_paths.begin();
+         it != source_paths.end();
+         ++it) {
+        std::string source;
+        
+        if (!read_file(file_handler_->file_root() + *it, source)) {
+            return false;
+        }
+        
+        if (is_script) {
+            bundle += minify_js(source) + ";\n";
+        
+        } else if (is_style) {
+            bundle += minify_css(source) + "\n";
+        
+        } else {
+            bundle += source;
+        }
+    }
+    
+    if (is_style) {
+        this->track_urls(bundle);
+        bundle = this->rewrite_urls(bundle);
+    }
+    
+    std::string old_bundle;
+    
+    if (read_file(bundle_handler_->file_root() + bundle_path, old_bundle) 
+            && old_bundle == bundle) {
+        return true;
+    }
+    
+    if (!write_file(bundle_handler_->file_root() + bundle_path, bundle)) {
+        return false;
+    }
+    
+    //Don't wait for the file watcher to drop an older bundle from the 
+    //cache: the bundle is about to be fingerprinted.  The watcher still
+    //reports the change, from the event loop.
+    bundle_handler_->invalidate_file(bundle_path);
+    return true;
+}
+
+/**
+ * Record the fingerprinted URLs of the static files and the bundles.
+ */
+void AssetPipeline::track_urls(const std::string& text) {
+    this->track_urls(text, *file_handler_);
+    this->track_urls(text, *bundle_handler_);
+}
+
+/**
+ * Record the fingerprinted URLs of the files served by one handler.
+ */
+void AssetPipeline::track_urls(const std::string& text, FileHandler& file_handler) {
+    const std::string url_root(file_handler.url_root());
+    std::vector<TrackedUrl> tracked_urls;
+    size_t url_end = 0;
+    
+    for (size_t url_start = find_url(text, url_root, 0, url_end); 
+         url_start != std::string::npos; 
+         url_start = find_url(text, url_root, url_end, url_end)) {
+        TrackedUrl tracked_url;
+        tracked_url.handler = &file_handler;
+        tracked_url.path = text.substr(url_start + url_root.size(), 
+                                       url_end - url_start - url_root.size());
+        const std::string fingerprinted_path(file_handler.fingerprinted_path(tracked_url.path));
+        
+        if (!fingerprinted_path.empty()) {
+            tracked_url.fingerprinted_url = url_root + fingerprinted_path;
+        }
+        
+        tracked_urls.push_back(tracked_url);
+    }
+    
+    boost::mutex::scoped_lock lock(mutex_);
+    this->update_tracked_urls(tracked_urls);
+}
+
+/**
+ * Publish the recorded URLs that have changed.  The recorded URLs are
+ * copied, so that the pages being rewritten keep the older ones.
+ */
+void AssetPipeline::update_tracked_urls(const std::vector<TrackedUrl>& changed_urls) {
+    const TrackedUrlsPtr current = boost::atomic_load(&tracked_urls_);
+    boost::shared_ptr<TrackedUrls> updated;
+    
+    for (std::vector<TrackedUrl>::const_iterator it = changed_urls.begin(); 
+         it != changed_urls.end(); 
+         ++it) {
+        const std::string url(it->handler->url_root() + it->path);
+        TrackedUrlMap::const_iterator tracked = current->urls.find(url);
+        
+        if (tracked != current->urls.end() 
+                && tracked->second.fingerprinted_url == it->fingerprinted_url) {
+            continue;
+        }
+        
+        if (!updated) {
+            updated = boost::shared_ptr<TrackedUrls>(new TrackedUrls(*current));
+            ++updated->generation;
+        }
+        
+        updated->urls[url] = *it;
+    }
+    
+    if (updated) {
+        boost::atomic_store(&tracked_urls_, TrackedUrlsPtr(updated));
+    }
+}
+
+/**
+ * Replace the URLs of the static files and the bundles with their 
+ * fingerprinted URLs.
+ */
+std::string AssetPipeline::rewrite_urls(const std::string& text) const {
+    const TrackedUrlsPtr tracked_urls = boost::atomic_load(&tracked_urls_);
+    return rewrite_urls(rewrite_urls(text, *file_handler_, tracked_urls->urls), 
+                        *bundle_handler_, 
+                        tracked_urls->urls);
+}
+
+/**
+ * Get the generation of the fingerprinted URLs.
+ */
+size_t AssetPipeline::generation() const {
+    return boost::atomic_load(&tracked_urls_)->generation;
+}
+
+/**
+ * Replace the URLs of the files served by one handler.
+ */
+std::string AssetPipeline::rewrite_urls(const std::string& text, 
+                                        const FileHandler& file_handler, 
+                                        const TrackedUrlMap& tracked_urls) {
+    const std::string url_root(file_handler.url_root());
+    std::string rewritten;
+    size_t copied = 0;
+    size_t url_end = 0;
+    
+    for (size_t url_start = find_url(text, url_root, 0, url_end); 
+         url_start != std::string::npos; 
+         url_start = find_url(text, url_root, url_end, url_end)) {
+        TrackedUrlMap::const_iterator it = 
+            tracked_urls.find(text.substr(url_start, url_end - url_start));
+        
+        if (it == tracked_urls.end() || it->second.fingerprinted_url.empty()) {
+            continue;
+        }
+        
+        rewritten.append(text, copied, url_start - copied);
+        rewritten += it->second.fingerprinted_url;
+        copied = url_end;
+    }
+    
+    rewritten.append(text, copied, std::string::npos);
+    return rewritten;
+}
+
+/**
+ * Rebuild the bundles, then record the fingerprinted URLs anew, the 
+ * bundles' included.
+ */
+bool AssetPipeline::refresh() {
+    std::vector<Bundle> bundles;
+    std::vector<TrackedUrl> tracked_urls;
+    bool is_refreshed = true;
+    
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        is_refresh_pending_ = false;
+        bundles = bundles_;
+    }
+    
+    for (std::vector<Bundle>::const_iterator it = bundles.begin(); it != bundles.end(); ++it) {
+        if (!this->build_bundle(it->path, it->source_paths)) {
+            std::cout << "Could not rebuild the bundle " << it->path << std::endl;
+            is_refreshed = false;
+        }
+    }
+    
+    const TrackedUrlsPtr current = boost::atomic_load(&tracked_urls_);
+    
+    for (TrackedUrlMap::const_iterator it = current->urls.begin(); 
+         it != current->urls.end(); 
+         ++it) {
+        TrackedUrl tracked_url(it->second);
+        const std::string fingerprinted_path(
+            tracked_url.handler->fingerprinted_path(tracked_url.path));
+        tracked_url.fingerprinted_url = fingerprinted_path.empty() 
+            ? std::string() 
+            : tracked_url.handler->url_root() + fingerprinted_path;
+        tracked_urls.push_back(tracked_url);
+    }
+    
+    boost::mutex::scoped_lock lock(mutex_);
+    this->update_tracked_urls(tracked_urls);
+    return is_refreshed;
+}
+
+/**
+ * Refresh the bundles and the fingerprinted URLs as the files change.
+ */
+void AssetPipeline::watch_files() {
+    if (refresh_pool_) {
+        return;
+    }
+    
+    refresh_pool_ = boost::shared_ptr<WorkerPool>(new WorkerPool(1));
+    file_handler_->set_change_callback(&AssetPipeline::file_changed_callback, (void*) this);
+    bundle_handler_->set_change_callback(&AssetPipeline::file_changed_callback, (void*) this);
+}
+
+/**
+ * Schedule a refresh if a file the pages depend on has changed.  The
+ * changes that come in before the refresh starts are all covered by it.
+ */
+void AssetPipeline::handle_file_change(const std::string& url) {
+    const TrackedUrlsPtr tracked_urls = boost::atomic_load(&tracked_urls_);
+    boost::mutex::scoped_lock lock(mutex_);
+    bool is_affected = 
+        url == file_handler_->url_root() 
+        || url == bundle_handler_->url_root()
+        || tracked_urls->urls.find(url) != tracked_urls->urls.end();
+    
+    for (std::vector<Bundle>::const_iterator bundle = bundles_.begin(); 
+         bundle != bundles_.end() && !is_affected; 
+         ++bundle) {
+        for (std::vector<std::string>::const_iterator it = bundle->source_paths.begin(); 
+             it != bundle->source_paths.end() && !is_affected; 
+             ++it) {
+            is_affected = (url == file_handler_->url_root() + *it);
+        }
+    }
+    
+    if (!is_affected || is_refresh_pending_ || !refresh_pool_) {
+        return;
+    }
+    
+    is_refresh_pending_ = true;
+    refresh_pool_->post(boost::bind(&AssetPipeline::refresh, this));
+}
+
+/**
+ * Minify a script.  String and regular expression literals are copied
+ * as they are; runs of white space within a line become a single space.
+ */
+std::string AssetPipeline::minify_js(const std::string& source) {
+    std::string minified;
+    bool has_space = false;
+    bool has_line_break = false;
+    size_t i = 0;
+    minified.reserve(source.size());
+    
+    while (i < source.size()) {
+        const char c = source[i];
+        const char next = (i + 1 < source.size()) ? source[i + 1] : '\0';
+        
+        if (c == ' ' || c == '\t' || c == '\r') {
+            has_space = true;
+            ++i;
+            continue;
+        
+        } else if (c == '\n') {
+            has_line_break = true;
+            ++i;
+            continue;
+        
+        } else if (c == '/' && next == '/') {
+            i = source.find('\n', i);
+            
+            if (i == std::string::npos) {
+                i = source.size();
+            }
+            
+            continue;
+        
+        } else if (c == '/' && next == '*') {
+            size_t comment_end = source.find("*/", i + 2);
+            comment_end = (comment_end == std::string::npos) ? source.size() : comment_end + 2;
+            
+            if (i + 2 < source.size() && source[i + 2] == '!') {
+                if (!minified.empty()) {
+                    minified += '\n';
+                }
+                
+                minified.append(source, i, comment_end - i);
+                has_line_break = true;
+            
+            } else if (source.find('\n', i) < comment_end) {
+                has_line_break = true;
+            
+            } else {
+                has_space = true;
+            }
+            
+            i = comment_end;
+            continue;
+        }
+        
+        //Keep a single separator before the next token.
+        if (!minified.empty() && has_line_break) {
+            minified += '\n';
+        
+        } else if (!minified.empty() && has_space) {
+            minified += ' ';
+        }
+        
+        has_space = false;
+        has_line_break = false;
+        
+        if (c == '"' || c == '\'' || c == '`') {
+            i = copy_string_literal(source, i, minified);
+        
+        } else if (c == '/' && starts_regex(minified)) {
+            i = copy_regex_literal(source, i, minified);
+        
+        } else {
+            minified += c;
+            ++i;
+        }
+    }
+    
+    return minified;
+}
+
+/**
+ * Minify a style sheet.  The white space around braces, semicolons and
+ * commas goes, along with the white space after colons and the last 
+ * semicolon of a block; other runs of white space become a single space.
+ * The white space before a colon is kept, as it matters in selectors.
+ */
+std::string AssetPipeline::minify_css(const std::string& source) {
+    const char* separators = "{};,";
+    const char* no_space_after = "{};,:";
+    std::string minified;
+    bool has_space = false;
+    size_t i = 0;
+    minified.reserve(source.size());
+    
+    while (i < source.size()) {
+        const char c = source[i];
+        
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            has_space = true;
+            ++i;
+            continue;
+        
+        } else if (c == '/' && i + 1 < source.size() && source[i + 1] == '*') {
+            const size_t comment_end = source.find("*/", i + 2);
+            i = (comment_end == std::string::npos) ? source.size() : comment_end + 2;
+            has_space = true;
+            continue;
+        }
+        
+        const bool is_separator = strchr(separators, c) != NULL;
+        
+        if (has_space && !is_separator && !minified.empty() 
+                && strchr(no_space_after, minified[minified.size() - 1]) == NULL) {
+            minified += ' ';
+        }
+        
+        has_space = false;
+        
+        if (c == '}' && !minified.empty() && minified[minified.size() - 1] == ';') {
+            minified[minified.size() - 1] = c;
+            ++i;
+        
+        } else if (c == '"' || c == '\'') {
+            i = copy_string_literal(source, i, minified);
+        
+        } else {
+            minified += c;
+            ++i;
+        }
+    }
+    
+    return minified;
+}
+
+} /* namespace isaword */
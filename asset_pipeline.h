@@ -0,0 +1,220 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Bundling the scripts and styles of the pages, and referring to the
+// static files by URLs that change with their contents, so that 
+// browsers can keep them for good.
+
+#ifndef ISAWORD_ASSET_PIPELINE_H
+#define ISAWORD_ASSET_PIPELINE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace isaword {
+
+class FileHandler;
+class WorkerPool;
+
+/*---------------------------------------------------------
+                    AssetPipeline class.
+----------------------------------------------------------*/
+/**
+ * Prepares the static files served by a FileHandler for the pages: 
+ * concatenates and minifies scripts and styles into bundles, written
+ * to the file root of a second FileHandler so that the served files
+ * are never touched, and rewrites the URLs of the static files and the
+ * bundles in a page to their fingerprinted URLs (see 
+ * FileHandler::fingerprinted_path()).  The fingerprints are recorded
+ * while the pages are built, and kept up to date as the files change
+ * once watch_files() is called.
+ */
+class AssetPipeline {
+public:
+    AssetPipeline(const boost::shared_ptr<FileHandler>& file_handler,
+                  const boost::shared_ptr<FileHandler>& bundle_handler)
+    : file_handler_(file_handler),
+      bundle_handler_(bundle_handler),
+      tracked_urls_(new TrackedUrls()),
+      is_refresh_pending_(false) {
+    }
+    
+    /// Stop watching the files.
+    ~AssetPipeline();
+    
+    /**
+     * Concatenate and minify a number of files, given relative to the
+     * file root, into a bundle under the root of the bundle handler.  
+     * Scripts (".js") and styles (".css") are minified; other files are
+     * only concatenated.  The URLs of the static files in a style bundle
+     * are fingerprinted, so they should be absolute.  The bundle is only
+     * written if it has changed, and is rebuilt by refresh().  Should be
+     * called before watch_files().
+     *
+     * @return true on success; false if a file could not be read or the
+     * bundle could not be written.
+     */
+    bool build_bundle(const std::string& bundle_path, 
+                      const std::vector<std::string>& source_paths);
+    
+    /**
+     * Record the fingerprinted URLs of the static files and bundles in
+     * a page, or a style sheet, for rewrite_urls().  Only the URLs under
+     * the URL roots of the handlers, following a quote, '(', '=' or 
+     * whitespace, are recorded.  Loads the files that are not cached
+     * yet, so it's meant for building pages rather than for the event
+     * loop.
+     */
+    void track_urls(const std::string& text);
+    
+    /**
+     * Replace the URLs of the static files and bundles in a page, or a
+     * style sheet, with the fingerprinted URLs recorded by track_urls().
+     * The URLs that were not recorded, or don't lead to a file, are left
+     * as is.  Never touches the disk, nor waits for track_urls() or 
+     * refresh().
+     */
+    std::string rewrite_urls(const std::string& text) const;
+    
+    /**
+     * Get the generation of the fingerprinted URLs, which changes 
+     * whenever rewrite_urls() could rewrite a text differently.  A text
+     * rewritten after getting the generation is at least that recent, 
+     * so it can be kept until the generation changes.
+     */
+    size_t generation() const;
+    
+    /**
+     * Rebuild the bundles and record the fingerprinted URLs anew.  
+     * Loads and writes files, like build_bundle() and track_urls().
+     *
+     * @return false if a bundle could not be rebuilt; the older one is
+     * kept.
+     */
+    bool refresh();
+    
+    /**
+     * Refresh the bundles and the fingerprinted URLs whenever the files
+     * they depend on change, on a thread of their own.  Relies on the 
+     * handlers watching their files (see FileHandler::is_watching_files()).
+     */
+    void watch_files();
+    
+    /**
+     * Minify a script: drop the comments, other than the block comments
+     * opening with '!' that are kept for the licenses, and the 
+     * indentation and blank lines.  The line breaks are kept, as they
+     * may end statements.
+     */
+    static std::string minify_js(const std::string& source);
+    
+    /**
+     * Minify a style sheet: drop the comments, and the white space 
+     * that's not needed between the selectors and declarations.
+     */
+    static std::string minify_css(const std::string& source);
+    
+private:
+    /// A bundle and the files it's made of.
+    class Bundle {
+    public:
+        std::string path;
+        std::vector<std::string> source_paths;
+    };
+    
+    /// A recorded URL: the handler serving it, the path of the file 
+    /// relative to the handler's root, and the fingerprinted URL; empty 
+    /// if the file is not there.
+    class TrackedUrl {
+    public:
+        FileHandler* handler;
+        std::string path;
+        std::string fingerprinted_url;
+    };
+    
+    typedef std::map<std::string, TrackedUrl> TrackedUrlMap;
+    
+    /// The recorded URLs, by URL, and their generation.  Never changed
+    /// once published, so that the pages can be rewritten without a 
+    /// lock.
+    class TrackedUrls {
+    public:
+        TrackedUrls() : generation(0) {}
+        
+        TrackedUrlMap urls;
+        size_t generation;
+    };
+    
+    typedef boost::shared_ptr<const TrackedUrls> TrackedUrlsPtr;
+    
+    /**
+     * Callback function for FileHandler::set_change_callback().
+     */
+    static void file_changed_callback(const std::string& url, void* asset_pipeline) {
+        ((AssetPipeline*) asset_pipeline)->handle_file_change(url);
+    }
+    
+    /**
+     * Schedule a refresh if a changed file, given by its URL, is one of
+     * the recorded URLs or the source of a bundle.  An URL root stands
+     * for any file of its handler.
+     */
+    void handle_file_change(const std::string& url);
+    
+    /// Record the fingerprinted URLs of the files served by one handler.
+    void track_urls(const std::string& text, FileHandler& file_handler);
+    
+    /// Replace the URLs of the files served by one handler.
+    static std::string rewrite_urls(const std::string& text, 
+                                    const FileHandler& file_handler, 
+                                    const TrackedUrlMap& tracked_urls);
+    
+    /// Publish the recorded URLs that have changed as a new generation.
+    /// Called with the mutex held, so that no change is lost.
+    void update_tracked_urls(const std::vector<TrackedUrl>& changed_urls);
+    
+    /// The handler serving the static files.
+    boost::shared_ptr<FileHandler> file_handler_;
+    
+    /// The handler serving the bundles, from a directory of their own.
+    boost::shared_ptr<FileHandler> bundle_handler_;
+    
+    /// The URLs recorded by track_urls().  Only accessed with the 
+    /// atomic shared_ptr operations.
+    TrackedUrlsPtr tracked_urls_;
+    
+    /// Guards the fields below, and the updates of the recorded URLs.
+    mutable boost::mutex mutex_;
+    
+    /// The bundles built so far.
+    std::vector<Bundle> bundles_;
+    
+    /// Whether a refresh has been scheduled, but hasn't started yet.
+    bool is_refresh_pending_;
+    
+    /// Runs the refreshes, once the files are watched.  Stopped first
+    /// on destruction, so that a running refresh finishes before the
+    /// change callbacks and the rest of the pipeline go.
+    boost::shared_ptr<WorkerPool> refresh_pool_;
+};
+
+} /* namespace isaword */
+#endif
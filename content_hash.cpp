@@ -0,0 +1,133 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A fast, non-cryptographic hash of file contents, used to tag
+// the versions of cached files.
+
+#include <string.h>
+#include <boost/cstdint.hpp>
+
+#include "content_hash.h"
+
+using boost::uint64_t;
+using boost::uint32_t;
+
+namespace isaword {
+
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotate_left(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+/// Read 8 bytes that may not be aligned.
+static inline uint64_t read64(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/// Read 4 bytes that may not be aligned.
+static inline uint32_t read32(const char* p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/// Mix 8 bytes of input into one of the four accumulators.
+static inline uint64_t mix_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * kPrime2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * kPrime1;
+}
+
+/// Fold one of the four accumulators into the hash.
+static inline uint64_t merge_round(uint64_t hash, uint64_t accumulator) {
+    hash ^= mix_round(0, accumulator);
+    return hash * kPrime1 + kPrime4;
+}
+
+/**
+ * Compute the XXH64 hash of a block of data.  The data is consumed
+ * 32 bytes at a time by four independent accumulators, then the tail
+ * is mixed in and the result is avalanched.
+ */
+uint64_t content_hash(const char* data, size_t size, uint64_t seed) {
+    const char* p = data;
+    const char* const end = data + size;
+    uint64_t hash;
+    
+    if (size >= 32) {
+        const char* const limit = end - 32;
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        
+        do {
+            v1 = mix_round(v1, read64(p));
+            v2 = mix_round(v2, read64(p + 8));
+            v3 = mix_round(v3, read64(p + 16));
+            v4 = mix_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) 
+             + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    
+    } else {
+        hash = seed + kPrime5;
+    }
+    
+    hash += static_cast<uint64_t>(size);
+    
+    //Mix in the remaining bytes.
+    for (; p + 8 <= end; p += 8) {
+        hash ^= mix_round(0, read64(p));
+        hash = rotate_left(hash, 27) * kPrime1 + kPrime4;
+    }
+    
+    if (p + 4 <= end) {
+        hash ^= static_cast<uint64_t>(read32(p)) * kPrime1;
+        hash = rotate_left(hash, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    
+    for (; p < end; ++p) {
+        hash ^= static_cast<uint64_t>(static_cast<unsigned char>(*p)) * kPrime5;
+        hash = rotate_left(hash, 11) * kPrime1;
+    }
+    
+    //Avalanche.
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+} /* namespace isaword */
@@ -0,0 +1,38 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A fast, non-cryptographic hash of file contents, used to tag
+// the versions of cached files.
+
+#ifndef ISAWORD_CONTENT_HASH_H
+#define ISAWORD_CONTENT_HASH_H
+
+#include <stddef.h>
+#include <boost/cstdint.hpp>
+
+namespace isaword {
+
+/**
+ * Compute the XXH64 hash of a block of data.  The result is the same
+ * as that of the reference xxHash implementation on little-endian
+ * machines.
+ */
+boost::uint64_t content_hash(const char* data, size_t size, boost::uint64_t seed = 0);
+
+} /* namespace isaword */
+#endif
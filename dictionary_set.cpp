@@ -0,0 +1,253 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The set of dictionaries the site serves words from.
+
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "dictionary_set.h"
+#include "word_picker.h"
+#include "word_store.h"
+
+using boost::shared_ptr;
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    DictionarySet class.
+----------------------------------------------------------*/
+DictionarySet::DictionarySet(const IndexDescriptionList& index_descriptions, size_t generation)
+: index_descriptions_(index_descriptions),
+  word_store_(new WordStore()),
+  generation_(generation) {
+}
+
+/**
+ * Load the dictionaries.
+ * @return true if all dictionaries were loaded, false otherwise.
+ */
+bool DictionarySet::load(const std::string& dictionary_root, 
+                         const std::vector<std::string>& dictionary_names) {
+    bool has_loaded_all = true;
+    
+    for (size_t i = 0; i < dictionary_names.size(); i++) {
+        shared_ptr<WordPicker> word_picker(new WordPicker(index_descriptions_, word_store_));
+        
+        if (word_picker->initialize(dictionary_root + dictionary_names[i] + ".txt", 
+                                    dictionary_names[i])) {
+            word_pickers_.push_back(word_picker);
+            
+        } else {
+            has_loaded_all = false;
+        }
+    }
+    
+    return has_loaded_all && !word_pickers_.empty();
+}
+
+/**
+ * Find the word picker for a dictionary, or the default one.
+ */
+shared_ptr<WordPicker> DictionarySet::find_word_picker(const std::string& dictionary_name) const {
+    for (size_t i = 0; i < word_pickers_.size(); i++) {
+        if (word_store_->dictionary_name(word_pickers_[i]->dictionary_num()) == dictionary_name) {
+            return word_pickers_[i];
+        }
+    }
+    
+    return word_pickers_.empty() ? shared_ptr<WordPicker>() : word_pickers_[0];
+}
+
+/*---------------------------------------------------------
+                DictionaryReloader class.
+----------------------------------------------------------*/
+const int DictionaryReloader::kReloadNiceness;
+
+/// Wait for the reload in progress, if any.
+DictionaryReloader::~DictionaryReloader() {
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+    
+    //From now on the snapshots are freed by whoever releases them,
+    //starting with the ones released already.
+    std::vector<DictionarySet*> released_snapshots;
+    
+    {
+        boost::mutex::scoped_lock lock(reclaimer_->mutex);
+        reclaimer_->is_closed = true;
+        released_snapshots.swap(reclaimer_->snapshots);
+    }
+    
+    for (size_t i = 0; i < released_snapshots.size(); i++) {
+        delete released_snapshots[i];
+    }
+}
+
+/**
+ * Load the dictionaries on the calling thread.
+ */
+bool DictionaryReloader::load() {
+    bool has_loaded_all = false;
+    boost::atomic_store(&current_, this->build_snapshot(has_loaded_all));
+    return has_loaded_all;
+}
+
+/**
+ * Start reloading the dictionaries on a background thread.
+ */
+bool DictionaryReloader::start_reload() {
+    boost::mutex::scoped_lock lock(mutex_);
+    
+    if (is_reloading_) {
+        return false;
+    }
+    
+    //The previous reload thread, if any, is done by now.
+    if (reload_thread_.joinable()) {
+        reload_thread_.join();
+    }
+    
+    is_reloading_ = true;
+    reload_thread_ = boost::thread(boost::bind(&DictionaryReloader::reload, this));
+    return true;
+}
+
+/// Get the current snapshot.
+DictionarySetPtr DictionaryReloader::current() const {
+    return boost::atomic_load(&current_);
+}
+
+/// Check whether a reload is in progress.
+bool DictionaryReloader::is_reloading() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return is_reloading_;
+}
+
+/// Get the number of snapshots swapped in by reloads.
+size_t DictionaryReloader::num_reloads() const {
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_reloads_;
+}
+
+/**
+ * Build a new snapshot and swap it in.
+ */
+void DictionaryReloader::reload() {
+    //Loading is not urgent; leave the CPU to the requests.
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), kReloadNiceness);
+    
+    bool has_loaded_all = false;
+    DictionarySetPtr snapshot = this->build_snapshot(has_loaded_all);
+    
+    //A failed snapshot is thrown away, the old one once the last
+    //request using it lets go of it.
+    if (has_loaded_all) {
+        snapshot = boost::atomic_exchange(&current_, snapshot);
+        
+        boost::mutex::scoped_lock lock(mutex_);
+        num_reloads_++;
+    }
+    
+    const DictionarySet* unused_snapshot = snapshot.get();
+    snapshot.reset();
+    this->reclaim(unused_snapshot);
+    
+    //The snapshots were allocated from this thread's heap; give the
+    //memory back to the system rather than keep it around until
+    //the next reload.
+    malloc_trim(0);
+    
+    boost::mutex::scoped_lock lock(mutex_);
+    is_reloading_ = false;
+}
+
+/**
+ * Build a new snapshot.
+ */
+DictionarySetPtr DictionaryReloader::build_snapshot(bool& has_loaded_all) {
+    size_t generation = 0;
+    
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        generation = ++num_snapshots_;
+    }
+    
+    DictionarySet* snapshot = new DictionarySet(index_descriptions_, generation);
+    DictionarySetPtr shared_snapshot(snapshot, 
+                                     boost::bind(&DictionaryReloader::release_snapshot, 
+                                                 reclaimer_, 
+                                                 _1));
+    has_loaded_all = snapshot->load(dictionary_root_, dictionary_names_);
+    return shared_snapshot;
+}
+
+/**
+ * Pass a snapshot no longer in use to the background thread to be 
+ * freed.  Runs on whichever thread lets go of the snapshot last.
+ */
+void DictionaryReloader::release_snapshot(shared_ptr<Reclaimer> reclaimer, 
+                                          DictionarySet* snapshot) {
+    boost::mutex::scoped_lock lock(reclaimer->mutex);
+    
+    if (reclaimer->is_closed) {
+        lock.unlock();
+        delete snapshot;
+        return;
+    }
+    
+    reclaimer->snapshots.push_back(snapshot);
+    reclaimer->released.notify_all();
+}
+
+/**
+ * Wait until the snapshot is released, and free it together with
+ * any other released snapshots.
+ */
+void DictionaryReloader::reclaim(const DictionarySet* snapshot) {
+    std::vector<DictionarySet*> released_snapshots;
+    
+    {
+        boost::mutex::scoped_lock lock(reclaimer_->mutex);
+        
+        while (snapshot != NULL && 
+                std::find(reclaimer_->snapshots.begin(), 
+                          reclaimer_->snapshots.end(), 
+                          snapshot) == reclaimer_->snapshots.end()) {
+            reclaimer_->released.wait(lock);
+        }
+        
+        released_snapshots.swap(reclaimer_->snapshots);
+    }
+    
+    for (size_t i = 0; i < released_snapshots.size(); i++) {
+        delete released_snapshots[i];
+    }
+}
+
+} /* namespace isaword */
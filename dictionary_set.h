@@ -0,0 +1,232 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The set of dictionaries the site serves words from, and the
+// machinery to reload it without stopping the server.
+
+#ifndef ISAWORD_DICTIONARY_SET_H
+#define ISAWORD_DICTIONARY_SET_H
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace isaword {
+
+class WordIndexDescription;
+class WordPicker;
+class WordStore;
+
+/*---------------------------------------------------------
+                    DictionarySet class.
+----------------------------------------------------------*/
+/**
+ * A snapshot of all loaded dictionaries: a word picker per dictionary,
+ * and the word store they share.  Once loaded, a snapshot is never
+ * changed; reloading the dictionaries creates a new one.
+ */
+class DictionarySet {
+public:
+    typedef std::vector<boost::shared_ptr<WordIndexDescription> > IndexDescriptionList;
+    
+    /// Create a snapshot; the generation tells it apart from the other
+    /// snapshots loaded by the same process.
+    DictionarySet(const IndexDescriptionList& index_descriptions, size_t generation = 0);
+    
+    /**
+     * Load the dictionaries <dictionary_root><name>.txt.  The first
+     * dictionary becomes the default one.
+     *
+     * @return true if all dictionaries were loaded, false otherwise.
+     */
+    bool load(const std::string& dictionary_root, 
+              const std::vector<std::string>& dictionary_names);
+    
+    /**
+     * Find the word picker for a dictionary.
+     * @return the word picker, or the default word picker if there is
+     * no dictionary with this name.
+     */
+    boost::shared_ptr<WordPicker> find_word_picker(const std::string& dictionary_name) const;
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the word pickers, one per dictionary.
+    const std::vector<boost::shared_ptr<WordPicker> >& word_pickers() const {
+        return word_pickers_;
+    }
+    
+    /// Get the store shared by the dictionaries.
+    boost::shared_ptr<WordStore> word_store() const     {return word_store_;}
+    
+    /// Get the number of the snapshot, counting from 1 for the first
+    /// one loaded.
+    size_t generation() const                           {return generation_;}
+    
+private:
+    /// Descriptions of the indexes to build for each dictionary.
+    IndexDescriptionList index_descriptions_;
+    
+    /// Storage for the words of all dictionaries.
+    boost::shared_ptr<WordStore> word_store_;
+    
+    /// Word pickers, one per dictionary; the first one is the default.
+    std::vector<boost::shared_ptr<WordPicker> > word_pickers_;
+    
+    /// The number of the snapshot.
+    size_t generation_;
+};
+
+typedef boost::shared_ptr<DictionarySet> DictionarySetPtr;
+
+/*---------------------------------------------------------
+                DictionaryReloader class.
+----------------------------------------------------------*/
+/**
+ * Keeps the current DictionarySet, and replaces it with a freshly
+ * loaded one on request.
+ *
+ * This works like read-copy-update: readers take a reference to the
+ * current snapshot with current() and use it for as long as they need.
+ * The current snapshot is read and replaced with atomic shared_ptr
+ * operations, so readers never wait on a lock held by each other or
+ * by a reload.  A reload builds a new snapshot on a background thread
+ * and swaps it in; readers that started before the swap keep the old
+ * snapshot until they're done.  When the last of them lets go, the
+ * snapshot's deleter hands it back to the background thread, which
+ * frees it, so that the request threads never pay for tearing it down.
+ */
+class DictionaryReloader {
+public:
+    /// Scheduling priority of the background thread, as for nice(1).
+    static const int kReloadNiceness = 10;
+    
+    DictionaryReloader(const DictionarySet::IndexDescriptionList& index_descriptions,
+                       const std::string& dictionary_root,
+                       const std::vector<std::string>& dictionary_names)
+    : index_descriptions_(index_descriptions),
+      dictionary_root_(dictionary_root),
+      dictionary_names_(dictionary_names),
+      reclaimer_(new Reclaimer()),
+      is_reloading_(false),
+      num_reloads_(0),
+      num_snapshots_(0) {
+    }
+    
+    /// Wait for the reload in progress, if any.  Snapshots still in
+    /// use are freed by whoever lets go of them last.
+    ~DictionaryReloader();
+    
+    /**
+     * Load the dictionaries on the calling thread.  Use this to load
+     * the initial snapshot.
+     *
+     * @return true if all dictionaries were loaded, false otherwise.
+     */
+    bool load();
+    
+    /**
+     * Start reloading the dictionaries on a background thread.
+     * If loading fails, the current snapshot is kept.
+     *
+     * @return true if a reload was started, false if another reload is
+     * still in progress.
+     */
+    bool start_reload();
+    
+    /// Get the current snapshot.
+    DictionarySetPtr current() const;
+    
+    /*=============== Getters/Setters ====================*/
+    /// Check whether a reload is in progress.
+    bool is_reloading() const;
+    
+    /// Get the number of snapshots swapped in by reloads.
+    size_t num_reloads() const;
+    
+private:
+    /**
+     * Collects the snapshots nobody uses any more, for the background
+     * thread to free.  The deleters of the snapshots share it, since 
+     * a snapshot may outlive the reloader.
+     */
+    class Reclaimer {
+    public:
+        Reclaimer() : is_closed(false) {}
+        
+        /// Guards the fields below.
+        boost::mutex mutex;
+        
+        /// Signalled when a snapshot is released.
+        boost::condition_variable released;
+        
+        /// The released snapshots, not freed yet.
+        std::vector<DictionarySet*> snapshots;
+        
+        /// Whether the reloader is gone, in which case the snapshots
+        /// are freed as soon as they're released.
+        bool is_closed;
+    };
+    
+    /// Build a new snapshot and swap it in.  Runs on the background thread.
+    void reload();
+    
+    /// Build a new snapshot, which is handed to the reclaimer once it's
+    /// no longer in use.
+    DictionarySetPtr build_snapshot(bool& has_loaded_all);
+    
+    /// Deleter of the snapshots: pass the snapshot to the background 
+    /// thread to be freed.
+    static void release_snapshot(boost::shared_ptr<Reclaimer> reclaimer, 
+                                 DictionarySet* snapshot);
+    
+    /// Wait until the snapshot is released, and free it together with
+    /// any other released snapshots.
+    void reclaim(const DictionarySet* snapshot);
+    
+    DictionarySet::IndexDescriptionList index_descriptions_;
+    std::string dictionary_root_;
+    std::vector<std::string> dictionary_names_;
+    
+    /// The current snapshot.  Only accessed with the atomic shared_ptr
+    /// operations.
+    DictionarySetPtr current_;
+    
+    /// Where the snapshots go once they're no longer in use.
+    boost::shared_ptr<Reclaimer> reclaimer_;
+    
+    /// Guards the fields below.
+    mutable boost::mutex mutex_;
+    
+    /// Whether a reload is in progress.
+    bool is_reloading_;
+    
+    /// Number of successful reloads.
+    size_t num_reloads_;
+    
+    /// Number of snapshots built, including the ones that failed.
+    size_t num_snapshots_;
+    
+    /// The background thread.
+    boost::thread reload_thread_;
+};
+
+} /* namespace isaword */
+#endif
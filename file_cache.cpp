@@ -20,35 +20,102 @@
 // cache and storing them there.
 
 #include <errno.h>
-#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <algorithm>
+#include <list>
 #include <string>
+#include <utility>
+#include <vector>
 #include <sys/stat.h>
+#include <zlib.h>
+#ifdef ISAWORD_USE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include <boost/bind.hpp>
 #include <boost/shared_array.hpp>
 #include <google/dense_hash_map>
 
+#include "content_hash.h"
 #include "file_cache.h"
+#include "http_utils.h"
+#include "worker_pool.h"
 
 using boost::shared_array;
 using boost::shared_ptr;
 
 namespace isaword {
 
+/*---------------------------------------------------------
+                    OpenFile class.
+----------------------------------------------------------*/
+OpenFile::~OpenFile() {
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
 /*---------------------------------------------------------
                     FileCache class.
 ----------------------------------------------------------*/
+const time_t FileCache::kDefaultExpirationPeriod;
+const size_t FileCache::kDefaultMmapThreshold;
+const size_t FileCache::kDefaultMemoryBudget;
+const size_t FileCache::kMaxMissingFiles;
+const size_t FileCache::kDefaultNumShards;
+
+FileCache::FileCache(const std::string& file_root,
+                     time_t expiration_period,
+                     size_t memory_budget,
+                     size_t num_shards)
+: expiration_period_(expiration_period),
+  is_watched_(false),
+  mmap_threshold_(kDefaultMmapThreshold),
+  keeps_files_open_(false),
+  buffer_pool_(new BufferPool()),
+  missing_file_(new CachedFile("")),
+  file_root_(file_root) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(shared_ptr<Shard>(new Shard(0)));
+    }
+    
+    max_missing_files_ = std::max(kMaxMissingFiles / num_shards, (size_t) 1);
+    this->set_memory_budget(memory_budget);
+}
+
+FileCache::Shard::Shard(size_t memory_budget)
+: is_watched(false),
+  eviction_policy(memory_budget) {
+    cached_files.set_empty_key("");
+    cached_files.set_deleted_key("\x01");
+    missing_files.set_empty_key("");
+    missing_files.set_deleted_key("\x01");
+    pending_loads.set_empty_key("");
+    pending_loads.set_deleted_key("\x01");
+}
+
 /**
  * Get the contents of the file.
  *
  * The data will be returned in the first argument, and will be always 
- * zero terminated.  The second optional argument can be used to return
- * the number of bytes of data returned.
+ * zero terminated.  The optional arguments can be used to return the
+ * number of bytes of data returned and the time the file was last
+ * modified.
  *
  * @return will return true on success, false on failure.
  */
 bool FileCache::get(const std::string& file_path,
                     boost::shared_array<char>& data, 
-                    size_t* data_size) {
+                    size_t* data_size,
+                    time_t* last_modified) {
     CachedFilePtr cached_file;
     const bool found_file = this->get_cached_object(file_path, cached_file);
     data = cached_file->data();
@@ -57,9 +124,217 @@ bool FileCache::get(const std::string& file_path,
         *data_size = cached_file->data_size();
     }
     
+    if (last_modified != NULL) {
+        *last_modified = cached_file->last_modified();
+    }
+    
+    return found_file;
+}
+
+/**
+ * Get the prepared response for the file in the best of the accepted 
+ * encodings.  Brotli is preferred to gzip, and gzip to sending the 
+ * file as is.
+ *
+ * @return true if the file exists at the time of latest refresh; 
+ * false otherwise.
+ */
+bool FileCache::get_response(const std::string& file_path, 
+                             int accepted_encodings,
+                             PreparedResponsePtr& response) {
+    CachedFilePtr cached_file;
+    const bool found_file = this->get_cached_object(file_path, cached_file);
+    response = select_response(*cached_file, accepted_encodings);
     return found_file;
 }
 
+/**
+ * Look up the prepared response for the file, without touching the disk.
+ * The requests that need a load are counted by load_async().
+ */
+FileCache::LookupStatus FileCache::find_response(const std::string& file_path, 
+                                                 int accepted_encodings,
+                                                 PreparedResponsePtr& response) {
+    const time_t now = time(NULL);
+    Shard& shard = this->shard(file_path);
+    CachedFilePtr cached_file;
+    
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        
+        if (shard.pending_loads.find(file_path) != shard.pending_loads.end()) {
+            return RESPONSE_NEEDS_LOAD;
+        }
+        
+        CachedFilesMap::const_iterator it = shard.cached_files.find(file_path);
+        
+        if (it == shard.cached_files.end()) {
+            if (this->is_missing(shard, file_path, now)) {
+                ++shard.stats.negative_hits;
+                return RESPONSE_MISSING;
+            }
+            
+            return RESPONSE_NEEDS_LOAD;
+        }
+        
+        if (it->second->needs_refresh(now)) {
+            return RESPONSE_NEEDS_LOAD;
+        }
+        
+        ++shard.stats.hits;
+        shard.eviction_policy.touch(file_path);
+        cached_file = it->second;
+    }
+    
+    response = select_response(*cached_file, accepted_encodings);
+    return RESPONSE_FOUND;
+}
+
+/**
+ * Load or refresh a file on one of the I/O threads.  A cached file is
+ * refreshed in a copy, which replaces it once loaded.
+ */
+void FileCache::load_async(const std::string& file_path, 
+                           int accepted_encodings,
+                           LoadCallback callback, 
+                           void* callback_data) {
+    Shard& shard = this->shard(file_path);
+    
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        const LoadWaiter waiter(accepted_encodings, callback, callback_data);
+        PendingLoadsMap::iterator pending = shard.pending_loads.find(file_path);
+        CachedFilesMap::const_iterator it = shard.cached_files.find(file_path);
+        
+        if (it == shard.cached_files.end()) {
+            ++shard.stats.misses;
+        
+        } else {
+            ++shard.stats.hits;
+        }
+        
+        if (pending != shard.pending_loads.end()) {
+            pending->second.waiters.push_back(waiter);
+            return;
+        }
+        
+        PendingLoad& load = shard.pending_loads[file_path];
+        load.waiters.push_back(waiter);
+        load.cached_file = (it == shard.cached_files.end()) 
+                           ? this->new_cached_file(shard, file_path)
+                           : CachedFilePtr(new CachedFile(*it->second));
+        
+        if (io_threads_) {
+            io_threads_->post(boost::bind(&FileCache::run_load, this, file_path));
+            return;
+        }
+    }
+    
+    this->run_load(file_path);
+}
+
+/**
+ * Start the threads for load_async().
+ */
+void FileCache::start_io_threads(size_t num_threads) {
+    if (num_threads > 0) {
+        io_threads_ = shared_ptr<WorkerPool>(new WorkerPool(num_threads));
+    }
+}
+
+/**
+ * Load a file handed to load_async(), and call back the requests 
+ * waiting for it.  The file is loaded without holding the lock, as 
+ * it's not shared until it replaces the cached one.
+ */
+void FileCache::run_load(const std::string& file_path) {
+    Shard& shard = this->shard(file_path);
+    CachedFilePtr cached_file;
+    
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        cached_file = shard.pending_loads[file_path].cached_file;
+    }
+    
+    const bool found_file = cached_file->refresh_if_expired();
+    std::vector<LoadWaiter> waiters;
+    std::vector<PreparedResponsePtr> responses;
+    
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        PendingLoadsMap::iterator pending = shard.pending_loads.find(file_path);
+        waiters.swap(pending->second.waiters);
+        const bool is_invalidated = pending->second.is_invalidated;
+        shard.pending_loads.erase(pending);
+        
+        if (found_file) {
+            //Pick up the changes made while the file was being loaded.
+            cached_file->set_is_watched(shard.is_watched);
+            
+            if (is_invalidated) {
+                cached_file->mark_dirty();
+            }
+            
+            CachedFilesMap::iterator it = shard.cached_files.find(file_path);
+            
+            if (it == shard.cached_files.end()) {
+                this->forget_missing(shard, file_path);
+                this->add_cached_file(shard, file_path, cached_file);
+            
+            } else {
+                std::vector<std::string> evicted;
+                it->second = cached_file;
+                shard.eviction_policy.touch(file_path);
+                shard.eviction_policy.resize(file_path, cached_file->memory_bytes(), evicted);
+                this->drop_evicted(shard, evicted);
+            }
+        
+        } else {
+            shard.cached_files.erase(file_path);
+            shard.eviction_policy.erase(file_path);
+            
+            if (!is_invalidated) {
+                this->add_missing(shard, file_path, time(NULL));
+            }
+        }
+    }
+    
+    //The loaded file is no longer changed, even if it's replaced as 
+    //soon as the lock is released.
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        responses.push_back(found_file ? select_response(*cached_file, 
+                                                         waiters[i].accepted_encodings)
+                                       : PreparedResponsePtr());
+    }
+    
+    for (size_t i = 0; i < waiters.size(); ++i) {
+        waiters[i].callback(responses[i], waiters[i].callback_data);
+    }
+}
+
+/**
+ * Pick the prepared response in the best of the accepted encodings.
+ * Brotli is preferred to gzip, and gzip to sending the file as is.
+ */
+PreparedResponsePtr FileCache::select_response(const CachedFile& cached_file, 
+                                               int accepted_encodings) {
+    const ContentEncoding preferred_encodings[] = {BROTLI_ENCODING, GZIP_ENCODING};
+    const size_t num_preferred_encodings = 
+        sizeof(preferred_encodings) / sizeof(preferred_encodings[0]);
+    
+    for (size_t i = 0; i < num_preferred_encodings; ++i) {
+        if ((accepted_encodings & preferred_encodings[i]) != 0) {
+            PreparedResponsePtr response(cached_file.response(preferred_encodings[i]));
+            
+            if (response) {
+                return response;
+            }
+        }
+    }
+    
+    return cached_file.response(IDENTITY_ENCODING);
+}
+
 /**
  * Get the cached file as well as metadata associated with it.
  *
@@ -70,23 +345,362 @@ bool FileCache::get(const std::string& file_path,
  */
 bool FileCache::get_cached_object(const std::string& file_path, 
                                   CachedFilePtr& cached_file) {
+    Shard& shard = this->shard(file_path);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    return this->find_cached_object(shard, file_path, cached_file);
+}
+
+/**
+ * Find the cached file, loading or refreshing it if needed.  Only the
+ * files that exist are kept, within the memory budget; the paths that
+ * don't lead to a file are remembered as missing.  A cached file is 
+ * refreshed in a copy, which replaces it, as other threads may be 
+ * reading it.  The caller must hold the shard's mutex.
+ */
+bool FileCache::find_cached_object(Shard& shard, 
+                                   const std::string& file_path, 
+                                   CachedFilePtr& cached_file) {
+    const time_t now = time(NULL);
+    std::vector<std::string> evicted;
+    
     //Check if the file is already being cached.
-    CachedFilesMap::const_iterator it = cached_files_.find(file_path);
+    CachedFilesMap::iterator it = shard.cached_files.find(file_path);
     
-    if (it == cached_files_.end()) {
+    if (it == shard.cached_files.end()) {
+        if (this->is_missing(shard, file_path, now)) {
+            ++shard.stats.negative_hits;
+            cached_file = missing_file_;
+            return false;
+        }
+        
         //Start caching the file.
-        std::string full_path(file_root_ + file_path);
-        cached_file = CachedFilePtr(new CachedFile(full_path, expiration_period_));
-        cached_files_[file_path] = cached_file;
+        ++shard.stats.misses;
+        cached_file = this->new_cached_file(shard, file_path);
+        
+        if (!cached_file->refresh_if_expired()) {
+            this->add_missing(shard, file_path, now);
+            return false;
+        }
+        
+        this->add_cached_file(shard, file_path, cached_file);
+        return true;
+    }
     
-    } else {
+    ++shard.stats.hits;
+    shard.eviction_policy.touch(file_path);
+    
+    if (!it->second->needs_refresh(now)) {
         cached_file = it->second;
+        return true;
     }
     
     //Get the file contents.
-    const bool found_file = cached_file->refresh_if_expired();
+    cached_file = CachedFilePtr(new CachedFile(*it->second));
     
-    return found_file;
+    if (!cached_file->refresh_if_expired()) {
+        //Don't hold on to the files that are gone.
+        shard.cached_files.erase(it);
+        shard.eviction_policy.erase(file_path);
+        this->add_missing(shard, file_path, now);
+        return false;
+    }
+    
+    const size_t memory_bytes = it->second->memory_bytes();
+    it->second = cached_file;
+    
+    if (cached_file->memory_bytes() != memory_bytes) {
+        shard.eviction_policy.resize(file_path, cached_file->memory_bytes(), evicted);
+        this->drop_evicted(shard, evicted);
+    }
+    
+    return true;
+}
+
+/**
+ * Get the shard of a path.  The hash is mixed again before picking 
+ * the shard, as the maps within the shard bucket the paths by the low
+ * bits of the same hash.
+ */
+FileCache::Shard& FileCache::shard(const std::string& file_path) const {
+    const boost::uint64_t hash = boost::hash<std::string>()(file_path);
+    const boost::uint64_t mixed_hash = (hash * 0x9E3779B97F4A7C15ULL) >> 32;
+    return *shards_[mixed_hash % shards_.size()];
+}
+
+/// Create a cached file, not loaded yet, for a path relative to the
+/// file root.
+CachedFilePtr FileCache::new_cached_file(const Shard& shard, 
+                                         const std::string& file_path) const {
+    CachedFilePtr cached_file(new CachedFile(file_root_ + file_path, expiration_period_));
+    cached_file->set_cache_control(cache_control_);
+    cached_file->set_is_watched(shard.is_watched);
+    cached_file->set_mmap_threshold(mmap_threshold_);
+    cached_file->set_keeps_file_open(keeps_files_open_);
+    cached_file->set_buffer_pool(buffer_pool_);
+    return cached_file;
+}
+
+/// Start caching a loaded file, evicting other files as needed.
+void FileCache::add_cached_file(Shard& shard, 
+                                const std::string& file_path, 
+                                const CachedFilePtr& cached_file) {
+    std::vector<std::string> evicted;
+    shard.cached_files[file_path] = cached_file;
+    shard.eviction_policy.insert(file_path, cached_file->memory_bytes(), evicted);
+    this->drop_evicted(shard, evicted);
+}
+
+/**
+ * Load files into the cache ahead of the requests.  The files are 
+ * loaded without holding the locks, as they're not shared yet, and
+ * added to the cache once they're all loaded.
+ */
+size_t FileCache::preload(const std::vector<std::string>& file_paths, 
+                          size_t num_threads,
+                          size_t& bytes_loaded) {
+    std::vector<std::string> preloaded_paths;
+    std::vector<CachedFilePtr> preloaded_files;
+    
+    for (std::vector<std::string>::const_iterator it = file_paths.begin();
+         it != file_paths.end();
+         ++it) {
+        Shard& shard = this->shard(*it);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        
+        if (shard.cached_files.find(*it) == shard.cached_files.end()) {
+            preloaded_paths.push_back(*it);
+            preloaded_files.push_back(this->new_cached_file(shard, *it));
+        }
+    }
+    
+    //Not a vector<bool>: the threads write to the flags side by side.
+    std::vector<char> has_loaded(preloaded_files.size(), 0);
+    std::vector<WorkerPool::Task> tasks;
+    
+    for (size_t i = 0; i < preloaded_files.size(); ++i) {
+        tasks.push_back(boost::bind(&FileCache::preload_file, 
+                                    preloaded_files[i].get(), 
+                                    &has_loaded[i]));
+    }
+    
+    //The calling thread works on the files too.
+    WorkerPool workers(num_threads > 1 ? num_threads - 1 : 0);
+    workers.run(tasks);
+    
+    size_t num_loaded = 0;
+    bytes_loaded = 0;
+    
+    for (size_t i = 0; i < preloaded_files.size(); ++i) {
+        if (!has_loaded[i]) {
+            continue;
+        }
+        
+        Shard& shard = this->shard(preloaded_paths[i]);
+        boost::mutex::scoped_lock lock(shard.mutex);
+        
+        //The file may have been requested in the meantime.
+        if (shard.cached_files.find(preloaded_paths[i]) != shard.cached_files.end()) {
+            continue;
+        }
+        
+        this->forget_missing(shard, preloaded_paths[i]);
+        this->add_cached_file(shard, preloaded_paths[i], preloaded_files[i]);
+        bytes_loaded += preloaded_files[i]->memory_bytes();
+        ++num_loaded;
+    }
+    
+    return num_loaded;
+}
+
+/// Load a file for preload(), and record whether it exists.
+void FileCache::preload_file(CachedFile* cached_file, char* has_loaded) {
+    *has_loaded = cached_file->refresh_if_expired() ? 1 : 0;
+}
+
+/**
+ * Check whether a path is known to be missing.  Unless the files are
+ * watched, a missing path is checked on disk again once the expiration
+ * period has passed.
+ */
+bool FileCache::is_missing(Shard& shard, const std::string& file_path, time_t now) {
+    MissingFilesMap::iterator it = shard.missing_files.find(file_path);
+    
+    if (it == shard.missing_files.end()) {
+        return false;
+    }
+    
+    if (!shard.is_watched && now >= it->second.expiration_time) {
+        shard.missing_file_order.erase(it->second.position);
+        shard.missing_files.erase(it);
+        return false;
+    }
+    
+    return true;
+}
+
+/// Remember a path as missing, forgetting the oldest missing path 
+/// of the shard if there are too many.
+void FileCache::add_missing(Shard& shard, const std::string& file_path, time_t now) {
+    this->forget_missing(shard, file_path);
+    
+    shard.missing_file_order.push_front(file_path);
+    MissingFile& missing_file = shard.missing_files[file_path];
+    missing_file.expiration_time = now + expiration_period_;
+    missing_file.position = shard.missing_file_order.begin();
+    
+    if (shard.missing_files.size() > max_missing_files_) {
+        shard.missing_files.erase(shard.missing_file_order.back());
+        shard.missing_file_order.pop_back();
+    }
+}
+
+/// Stop considering a path as missing.
+void FileCache::forget_missing(Shard& shard, const std::string& file_path) {
+    MissingFilesMap::iterator missing = shard.missing_files.find(file_path);
+    
+    if (missing != shard.missing_files.end()) {
+        shard.missing_file_order.erase(missing->second.position);
+        shard.missing_files.erase(missing);
+    }
+}
+
+/// Drop the files evicted by the eviction policy.
+void FileCache::drop_evicted(Shard& shard, const std::vector<std::string>& evicted) {
+    for (std::vector<std::string>::const_iterator it = evicted.begin(); 
+         it != evicted.end(); 
+         ++it) {
+        shard.cached_files.erase(*it);
+        ++shard.stats.evictions;
+    }
+}
+
+/**
+ * Mark a cached file as changed on disk, so that it's reloaded the
+ * next time it's requested.  An empty path marks all the files.  The
+ * path is no longer considered missing, as it may have just been 
+ * created.
+ */
+void FileCache::invalidate(const std::string& file_path) {
+    if (file_path.empty()) {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            Shard& shard = *shards_[i];
+            boost::mutex::scoped_lock lock(shard.mutex);
+            
+            for (CachedFilesMap::iterator it = shard.cached_files.begin(); 
+                 it != shard.cached_files.end(); 
+                 ++it) {
+                it->second->mark_dirty();
+            }
+            
+            for (PendingLoadsMap::iterator pending = shard.pending_loads.begin(); 
+                 pending != shard.pending_loads.end(); 
+                 ++pending) {
+                pending->second.is_invalidated = true;
+            }
+            
+            shard.missing_files.clear();
+            shard.missing_file_order.clear();
+        }
+        
+        return;
+    }
+    
+    Shard& shard = this->shard(file_path);
+    boost::mutex::scoped_lock lock(shard.mutex);
+    CachedFilesMap::iterator it = shard.cached_files.find(file_path);
+    
+    if (it != shard.cached_files.end()) {
+        it->second->mark_dirty();
+    }
+    
+    PendingLoadsMap::iterator pending = shard.pending_loads.find(file_path);
+    
+    if (pending != shard.pending_loads.end()) {
+        pending->second.is_invalidated = true;
+    }
+    
+    this->forget_missing(shard, file_path);
+}
+
+/**
+ * Get the counters of hits, misses and evictions, along with the 
+ * memory in use, summed over the shards.
+ */
+FileCacheStats FileCache::stats() {
+    FileCacheStats stats;
+    
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        stats.hits += shard.stats.hits;
+        stats.misses += shard.stats.misses;
+        stats.negative_hits += shard.stats.negative_hits;
+        stats.evictions += shard.stats.evictions;
+        stats.resident_bytes += shard.eviction_policy.resident_bytes();
+        stats.memory_budget += shard.eviction_policy.capacity();
+        stats.num_files += shard.cached_files.size();
+        stats.num_missing_files += shard.missing_files.size();
+    }
+    
+    return stats;
+}
+
+/// Get the limit on the bytes of file data held by the cache.
+size_t FileCache::memory_budget() const {
+    size_t memory_budget = 0;
+    
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        boost::mutex::scoped_lock lock(shards_[i]->mutex);
+        memory_budget += shards_[i]->eviction_policy.capacity();
+    }
+    
+    return memory_budget;
+}
+
+/// Set the limit on the bytes of file data held by the cache, 
+/// dropping files as needed.  The bytes that don't divide evenly go
+/// to the first shards.
+void FileCache::set_memory_budget(size_t memory_budget) {
+    const size_t shard_budget = memory_budget / shards_.size();
+    const size_t remainder = memory_budget % shards_.size();
+    
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        std::vector<std::string> evicted;
+        shard.eviction_policy.set_capacity(shard_budget + (i < remainder ? 1 : 0), evicted);
+        this->drop_evicted(shard, evicted);
+    }
+}
+
+/// Set whether the files are watched for changes, in which case
+/// the cache relies on invalidate() to learn about them.
+void FileCache::set_is_watched(bool is_watched) {
+    is_watched_ = is_watched;
+    
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        boost::mutex::scoped_lock lock(shard.mutex);
+        shard.is_watched = is_watched;
+        
+        for (CachedFilesMap::iterator it = shard.cached_files.begin(); 
+             it != shard.cached_files.end(); 
+             ++it) {
+            it->second->set_is_watched(is_watched);
+            
+            //Changes may have been missed while the files were not watched.
+            it->second->mark_dirty();
+        }
+        
+        for (PendingLoadsMap::iterator pending = shard.pending_loads.begin(); 
+             pending != shard.pending_loads.end(); 
+             ++pending) {
+            pending->second.is_invalidated = true;
+        }
+        
+        shard.missing_files.clear();
+        shard.missing_file_order.clear();
+    }
 }
 
 /// Set the directory relative to which all file paths will 
@@ -101,10 +715,99 @@ void FileCache::set_file_root(const std::string& root) {
     }
 }
     
+/*---------------------------------------------------------
+                    BufferPool class.
+----------------------------------------------------------*/
+const size_t BufferPool::kMinBufferSize;
+const size_t BufferPool::kMaxBufferSize;
+const size_t BufferPool::kMaxFreeBuffers;
+
+BufferPool::BufferPool()
+: free_buffers_(size_class(kMaxBufferSize) + 1) {
+}
+
+BufferPool::~BufferPool() {
+    for (size_t i = 0; i < free_buffers_.size(); ++i) {
+        for (size_t j = 0; j < free_buffers_[i].size(); ++j) {
+            delete [] free_buffers_[i][j];
+        }
+    }
+}
+
+/**
+ * Get a buffer of at least size bytes.  Buffers over the largest size
+ * class are allocated, and freed, as usual.
+ */
+boost::shared_array<char> BufferPool::allocate(size_t size) {
+    if (size > kMaxBufferSize) {
+        return shared_array<char>(new char[size]);
+    }
+    
+    const size_t buffer_class = size_class(size);
+    char* buffer = NULL;
+    
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        std::vector<char*>& free_buffers = free_buffers_[buffer_class];
+        
+        if (!free_buffers.empty()) {
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+    
+    if (buffer == NULL) {
+        buffer = new char[kMinBufferSize << buffer_class];
+    }
+    
+    return shared_array<char>(buffer, Releaser(shared_from_this(), buffer_class));
+}
+
+/// Get the number of free buffers in the pool.
+size_t BufferPool::num_free_buffers() {
+    boost::mutex::scoped_lock lock(mutex_);
+    size_t num_buffers = 0;
+    
+    for (size_t i = 0; i < free_buffers_.size(); ++i) {
+        num_buffers += free_buffers_[i].size();
+    }
+    
+    return num_buffers;
+}
+
+/// Find the smallest size class that fits size bytes.
+size_t BufferPool::size_class(size_t size) {
+    size_t buffer_class = 0;
+    
+    while ((kMinBufferSize << buffer_class) < size) {
+        ++buffer_class;
+    }
+    
+    return buffer_class;
+}
+
+/// Put a buffer back into the pool, or free it if the pool is full.
+void BufferPool::release(char* buffer, size_t size_class) {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        std::vector<char*>& free_buffers = free_buffers_[size_class];
+        
+        if (free_buffers.size() < kMaxFreeBuffers) {
+            free_buffers.push_back(buffer);
+            return;
+        }
+    }
+    
+    delete [] buffer;
+}
+
 /*---------------------------------------------------------
                     CachedFile class.
 ----------------------------------------------------------*/
 const time_t CachedFile::kDefaultExpirationPeriod;
+const size_t CachedFile::kDefaultMmapThreshold;
+const size_t CachedFile::kMaxCompressedPercent;
+const size_t CachedFile::kMaxETagLength;
 
 /**
  * Get the data.
@@ -122,6 +825,18 @@ bool CachedFile::get(boost::shared_array<char>& data, size_t& size) {
     return has_found;
 }
 
+/**
+ * Check whether refresh_if_expired() would look at the file on disk:
+ * if it has changed, its cache period has expired, or it has no data.
+ */
+bool CachedFile::needs_refresh(time_t now) const {
+    if (is_watched_ && !is_dirty_ && data_size_ != 0) {
+        return false;
+    }
+    
+    return is_dirty_ || now >= expiration_time_ || data_size_ == 0;
+}
+
 /**
  * Refresh the cached data if it has expired or empty.
  * @return true on success, false on failure (e.g. if the file is gone
@@ -129,9 +844,18 @@ bool CachedFile::get(boost::shared_array<char>& data, size_t& size) {
  * cache.
  */
 bool CachedFile::refresh_if_expired() {
+    //A watched file is only checked once it's known to have changed.
+    if (is_watched_ && !is_dirty_ && data_size_ != 0) {
+        return true;
+    }
+    
     const time_t now = time(NULL);
     
-    if (now >= expiration_time_ || data_size_ == 0) {
+    if (this->needs_refresh(now)) {
+        //A file marked as changed may have the same modification time,
+        //as those only have a one second resolution.
+        const bool was_dirty = is_dirty_;
+        is_dirty_ = false;
         expiration_time_ = now + expiration_period_;
         
         //Reload the cache.
@@ -146,46 +870,406 @@ bool CachedFile::refresh_if_expired() {
         
         //Check whether the file has changed since the last time we
         //read it.
-        if (stat_buffer.st_mtime == last_modified_) {
+        if (stat_buffer.st_mtime == last_modified_ && !was_dirty) {
             return true;
         
         } else {
             last_modified_ = stat_buffer.st_mtime;
         }
 
-        //Attempt to open the file.
-        std::ifstream file(file_path_.c_str());
-        if (!file.good()) {
-            file.close();
+        //Attempt to open the file.  The file may have changed since
+        //stat(), so take its size from the open file.
+        const int fd = open(file_path_.c_str(), O_RDONLY | O_CLOEXEC);
+        
+        if (fd < 0 || fstat(fd, &stat_buffer) != 0 
+                || !this->load_data(fd, static_cast<size_t>(stat_buffer.st_size))) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            
             this->empty_data();
             return false;
         }
         
-        size_t file_size = stat_buffer.st_size;
-        //shared_array<char> data(new char[file_size]);
-        //data_ = data;
-        data_ = shared_array<char>(new char[file_size + 1]);
-        data_capacity_ = file_size;
+        //Keep the file open if the responses are to be sent from it, so
+        //that they're sent from this very version of the file.
+        if (keeps_file_open_) {
+            file_ = OpenFilePtr(new OpenFile(fd));
+        } else {
+            file_.reset();
+            close(fd);
+        }
         
-        //Read the file.
-        data_size_ = static_cast<size_t>(file.readsome(data_.get(), data_capacity_));
-        file.close();
+        last_modified_ = stat_buffer.st_mtime;
         
-        //Terminate the data string with a zero.
-        data_[data_size_] = '\0';
+        //Compress the new data and prepare the responses once, rather 
+        //than on every request.
+        this->compress_data();
+        this->prepare_responses();
     }
     
     return true;
 }
 
+/**
+ * Load the contents of an open file into data_.  Files from the mmap
+ * threshold up are mapped into memory; smaller ones, and the ones that
+ * fail to map, are read into a buffer from the pool.
+ * @return false if the file could not be read.
+ */
+bool CachedFile::load_data(int fd, size_t file_size) {
+    if (file_size > 0 && file_size >= mmap_threshold_) {
+        shared_array<char> mapping(map_file(fd, file_size));
+        
+        if (mapping) {
+            data_ = mapping;
+            data_size_ = file_size;
+            data_capacity_ = file_size;
+            is_mapped_ = true;
+            return true;
+        }
+    }
+    
+    //Read the file, with room for the terminating zero.
+    shared_array<char> buffer(buffer_pool_ ? buffer_pool_->allocate(file_size + 1)
+                                           : shared_array<char>(new char[file_size + 1]));
+    size_t bytes_read = 0;
+    
+    if (!read_file(fd, buffer.get(), file_size, bytes_read)) {
+        return false;
+    }
+    
+    data_ = buffer;
+    data_size_ = bytes_read;
+    data_capacity_ = file_size;
+    is_mapped_ = false;
+    
+    //Terminate the data string with a zero.
+    data_[data_size_] = '\0';
+    return true;
+}
+
+/// Unmaps a file once it's no longer referenced.
+class MappingReleaser {
+public:
+    MappingReleaser(size_t length)
+    : length_(length) {
+    }
+    
+    void operator()(char* mapping) const {
+        munmap(mapping, length_);
+    }
+    
+private:
+    size_t length_;
+};
+
+/**
+ * Map a file into memory, followed by a zero byte.  The file is mapped
+ * over an anonymous mapping one byte longer than the file, so that the
+ * zero byte exists even when the file ends on a page boundary.
+ * @return the mapping; empty on failure.
+ */
+boost::shared_array<char> CachedFile::map_file(int fd, size_t file_size) {
+    const size_t length = file_size + 1;
+    void* region = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    
+    if (region == MAP_FAILED) {
+        return shared_array<char>();
+    }
+    
+    if (mmap(region, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(region, length);
+        return shared_array<char>();
+    }
+    
+    return shared_array<char>(static_cast<char*>(region), MappingReleaser(length));
+}
+
+/**
+ * Read a file into a buffer until the end of file or size bytes, 
+ * whichever comes first.  Unlike istream::readsome, this doesn't stop
+ * short when the data is not yet buffered.
+ * @return false on a read error.
+ */
+bool CachedFile::read_file(int fd, char* buffer, size_t size, size_t& bytes_read) {
+    bytes_read = 0;
+    
+    while (bytes_read < size) {
+        const ssize_t result = read(fd, buffer + bytes_read, size - bytes_read);
+        
+        if (result < 0 && errno == EINTR) {
+            continue;
+        
+        } else if (result < 0) {
+            return false;
+        
+        } else if (result == 0) {
+            break;
+        }
+        
+        bytes_read += static_cast<size_t>(result);
+    }
+    
+    return true;
+}
+
+/**
+ * Get the currently cached data in the given encoding; do not 
+ * refresh the contents even if it has expired.
+ *
+ * @return true if there is a variant of the data in that encoding,
+ * false otherwise.
+ */
+bool CachedFile::encoded_data(ContentEncoding encoding, 
+                              boost::shared_array<char>& data, 
+                              size_t& size) const {
+    switch (encoding) {
+    case IDENTITY_ENCODING:
+        data = data_;
+        size = data_size_;
+        return data_.get() != NULL;
+        
+    case GZIP_ENCODING:
+        data = gzip_data_;
+        size = gzip_data_size_;
+        return gzip_data_.get() != NULL;
+        
+    case BROTLI_ENCODING:
+        data = brotli_data_;
+        size = brotli_data_size_;
+        return brotli_data_.get() != NULL;
+    }
+    
+    return false;
+}
+
+/**
+ * Get the prepared response for the currently cached data in the 
+ * given encoding; empty if there is no variant in that encoding.
+ */
+PreparedResponsePtr CachedFile::response(ContentEncoding encoding) const {
+    switch (encoding) {
+    case IDENTITY_ENCODING:     return response_;
+    case GZIP_ENCODING:         return gzip_response_;
+    case BROTLI_ENCODING:       return brotli_response_;
+    }
+    
+    return PreparedResponsePtr();
+}
+
+/**
+ * Compress the data with a given encoding.  Returns false if the 
+ * encoding is not supported (e.g. brotli, when built without it) 
+ * or the compression fails.
+ */
+bool CachedFile::compress(ContentEncoding encoding,
+                          const char* data,
+                          size_t size,
+                          boost::shared_array<char>& compressed_data,
+                          size_t& compressed_size) {
+    if (encoding == GZIP_ENCODING) {
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        
+        //15 bits of window, plus 16 to get the gzip header and trailer.
+        if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 
+                         15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        
+        const size_t capacity = deflateBound(&stream, size);
+        compressed_data = shared_array<char>(new char[capacity]);
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = size;
+        stream.next_out = reinterpret_cast<Bytef*>(compressed_data.get());
+        stream.avail_out = capacity;
+        
+        const int status = deflate(&stream, Z_FINISH);
+        compressed_size = stream.total_out;
+        deflateEnd(&stream);
+        return status == Z_STREAM_END;
+    }
+    
+#ifdef ISAWORD_USE_BROTLI
+    if (encoding == BROTLI_ENCODING) {
+        compressed_size = BrotliEncoderMaxCompressedSize(size);
+        
+        if (compressed_size == 0) {
+            return false;
+        }
+        
+        compressed_data = shared_array<char>(new char[compressed_size]);
+        return BrotliEncoderCompress(BROTLI_MAX_QUALITY, 
+                                     BROTLI_DEFAULT_WINDOW, 
+                                     BROTLI_DEFAULT_MODE,
+                                     size, 
+                                     reinterpret_cast<const uint8_t*>(data),
+                                     &compressed_size,
+                                     reinterpret_cast<uint8_t*>(compressed_data.get()));
+    }
+#endif
+    
+    return false;
+}
+
+/**
+ * Build the compressed variants of the data, skipping the ones
+ * that don't save enough.
+ */
+void CachedFile::compress_data() {
+    this->compress_variant(GZIP_ENCODING, gzip_data_, gzip_data_size_);
+    this->compress_variant(BROTLI_ENCODING, brotli_data_, brotli_data_size_);
+}
+
+/**
+ * Compress the data with a given encoding, and keep the result
+ * if it's small enough.
+ */
+void CachedFile::compress_variant(ContentEncoding encoding,
+                                  boost::shared_array<char>& variant_data,
+                                  size_t& variant_size) const {
+    shared_array<char> compressed_data;
+    size_t compressed_size = 0;
+    
+    if (data_size_ > 0
+            && compress(encoding, data_.get(), data_size_, compressed_data, compressed_size)
+            && compressed_size * 100 <= data_size_ * kMaxCompressedPercent) {
+        variant_data = compressed_data;
+        variant_size = compressed_size;
+    
+    } else {
+        variant_data.reset();
+        variant_size = 0;
+    }
+}
+
+/**
+ * Get the Content-Type of a file from its extension; text/html 
+ * for unknown extensions.
+ */
+const char* CachedFile::content_type(const std::string& file_path) {
+    static const char* const content_types[][2] = {
+        {"css",     "text/css"},
+        {"js",      "text/javascript"},
+        {"png",     "image/png"},
+        {"jpeg",    "image/jpeg"},
+        {"jpg",     "image/jpeg"},
+        {"gif",     "image/gif"},
+        {"ico",     "image/vnd.microsoft.icon"},
+        {"txt",     "text/plain"},
+        {"h",       "text/plain"},
+        {"cpp",     "text/plain"},
+        {"hpp",     "text/plain"},
+        {"html",    "text/html"},
+    };
+    const size_t num_content_types = sizeof(content_types) / sizeof(content_types[0]);
+    const size_t extension_start = file_path.find_last_of(".");
+    
+    if (extension_start != std::string::npos) {
+        const char* extension = file_path.c_str() + extension_start + 1;
+        
+        for (size_t i = 0; i < num_content_types; ++i) {
+            if (strcmp(extension, content_types[i][0]) == 0) {
+                return content_types[i][1];
+            }
+        }
+    }
+    
+    return "text/html";
+}
+
+/**
+ * Hash the data, and prepare the responses for all its variants.
+ */
+void CachedFile::prepare_responses() {
+    content_hash_ = isaword::content_hash(data_.get(), data_size_);
+    const std::string last_modified_string(time_to_string(last_modified_).get());
+    
+    response_ = this->prepare_response(IDENTITY_ENCODING, last_modified_string);
+    gzip_response_ = this->prepare_response(GZIP_ENCODING, last_modified_string);
+    brotli_response_ = this->prepare_response(BROTLI_ENCODING, last_modified_string);
+}
+
+/**
+ * Prepare the response for one variant of the data.  The compressed 
+ * variants are different representations of the file, so each gets 
+ * an ETag of its own.
+ */
+PreparedResponsePtr 
+CachedFile::prepare_response(ContentEncoding encoding,
+                             const std::string& last_modified_string) const {
+    shared_ptr<PreparedResponse> response(new PreparedResponse());
+    
+    if (!this->encoded_data(encoding, response->body, response->body_size)) {
+        return PreparedResponsePtr();
+    }
+    
+    const char* etag_suffix = "";
+    const char* content_encoding = NULL;
+    
+    if (encoding == GZIP_ENCODING) {
+        etag_suffix = "-gzip";
+        content_encoding = "gzip";
+    
+    } else if (encoding == BROTLI_ENCODING) {
+        etag_suffix = "-br";
+        content_encoding = "br";
+    }
+    
+    char etag[kMaxETagLength];
+    snprintf(etag, sizeof(etag), "\"%016llx%s\"", 
+             static_cast<unsigned long long>(content_hash_), etag_suffix);
+    
+    response->encoding = encoding;
+    
+    if (encoding == IDENTITY_ENCODING) {
+        response->file = file_;
+    }
+    
+    response->last_modified = last_modified_;
+    response->last_modified_string = last_modified_string;
+    response->etag = etag;
+    
+    PreparedResponse::Headers& headers = response->headers;
+    headers.push_back(PreparedResponse::Header("Last-Modified", last_modified_string));
+    headers.push_back(PreparedResponse::Header("ETag", response->etag));
+    
+    if (!cache_control_.empty()) {
+        headers.push_back(PreparedResponse::Header("Cache-Control", cache_control_));
+    }
+    
+    headers.push_back(PreparedResponse::Header("Content-Type", content_type(file_path_)));
+    
+    // The response depends on the encodings the user agent accepts.
+    headers.push_back(PreparedResponse::Header("Vary", "Accept-Encoding"));
+    
+    if (content_encoding != NULL) {
+        headers.push_back(PreparedResponse::Header("Content-Encoding", content_encoding));
+    }
+    
+    return response;
+}
+
 /**
  * A helper function for blanking out the data.
  */
 void CachedFile::empty_data() {
     shared_array<char> empty_array;
     data_ = empty_array;
+    is_mapped_ = false;
     data_capacity_ = 0;
     data_size_ = 0;
+    gzip_data_ = empty_array;
+    gzip_data_size_ = 0;
+    brotli_data_ = empty_array;
+    brotli_data_size_ = 0;
+    content_hash_ = 0;
+    file_.reset();
+    response_.reset();
+    gzip_response_.reset();
+    brotli_response_.reset();
+    last_modified_ = 0;
 }
 
 } /* namespace isaword */
@@ -21,18 +21,103 @@
 #ifndef ISAWORD_FILE_CACHE_H
 #define ISAWORD_FILE_CACHE_H
 
+#include <list>
 #include <string>
+#include <utility>
+#include <vector>
 #include <time.h>
 
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
 #include <google/dense_hash_map>
 
+#include "arc_policy.h"
+
 namespace isaword {
 
 class CachedFile;
 typedef boost::shared_ptr<CachedFile> CachedFilePtr;
+class WorkerPool;
+
+/**
+ * Content encodings a cached file can be sent in.  The values are
+ * bit flags, so that a set of accepted encodings fits into an int;
+ * the identity encoding is always accepted.
+ */
+enum ContentEncoding {
+    IDENTITY_ENCODING = 0,
+    GZIP_ENCODING = 1,
+    BROTLI_ENCODING = 2,
+};
+
+/**
+ * A file kept open, so that a response can be sent from it with 
+ * sendfile: the version of the file that was loaded stays reachable 
+ * through the descriptor even once the file has been replaced on disk.
+ * The descriptor is closed with the last reference.
+ */
+class OpenFile {
+public:
+    explicit OpenFile(int fd) : fd_(fd) {}
+    ~OpenFile();
+    
+    /// Get the file descriptor.
+    int fd() const                                  {return fd_;}
+    
+private:
+    OpenFile(const OpenFile&);
+    OpenFile& operator=(const OpenFile&);
+    
+    int fd_;
+};
+
+typedef boost::shared_ptr<const OpenFile> OpenFilePtr;
+
+/**
+ * A response for one version of a cached file, in one encoding, 
+ * prepared when the file is loaded: the body and the complete list
+ * of response headers.  Prepared responses are never modified; when
+ * the file changes, new ones replace them, so a handler may keep
+ * using a response after the file has been refreshed.
+ */
+class PreparedResponse {
+public:
+    typedef std::pair<std::string, std::string> Header;
+    typedef std::vector<Header> Headers;
+    
+    PreparedResponse()
+    : body_size(0),
+      encoding(IDENTITY_ENCODING),
+      last_modified(0) {
+    }
+    
+    /// The response headers, in the order they should be sent.
+    Headers headers;
+    
+    /// The body: the file data in the given encoding, zero terminated
+    /// for the identity encoding.
+    boost::shared_array<char> body;
+    size_t body_size;
+    ContentEncoding encoding;
+    
+    /// The file the body was read from, for the identity encoding, if
+    /// the cache keeps the files open (see FileCache::set_keeps_files_open());
+    /// empty otherwise.
+    OpenFilePtr file;
+    
+    /// The validators, for answering conditional requests: the time
+    /// the file was last modified, the same time formatted for the
+    /// Last-Modified header, and the quoted ETag of the body.
+    time_t last_modified;
+    std::string last_modified_string;
+    std::string etag;
+};
+
+typedef boost::shared_ptr<const PreparedResponse> PreparedResponsePtr;
 
 /**
  * A functor used to compare the strings in the hash set.
@@ -43,36 +128,235 @@ struct eqstr {
     }
 };
 
+/*---------------------------------------------------------
+                    BufferPool class.
+----------------------------------------------------------*/
+/**
+ * A pool of buffers for the contents of small files.  The buffers come
+ * in power-of-two size classes, and go back to the pool once the last
+ * shared_array referencing them is gone, so that reloading a file 
+ * reuses the memory of older versions instead of allocating more.
+ */
+class BufferPool : public boost::enable_shared_from_this<BufferPool> {
+public:
+    /// The smallest size class.
+    static const size_t kMinBufferSize = 4096;
+    
+    /// The largest size class; larger buffers are not pooled.
+    static const size_t kMaxBufferSize = 65536;
+    
+    /// Number of free buffers kept for each size class.
+    static const size_t kMaxFreeBuffers = 16;
+    
+    BufferPool();
+    ~BufferPool();
+    
+    /**
+     * Get a buffer of at least size bytes.  The pool must be held by
+     * a shared_ptr: the buffer keeps the pool alive until it's released.
+     */
+    boost::shared_array<char> allocate(size_t size);
+    
+    /// Get the number of free buffers in the pool.
+    size_t num_free_buffers();
+    
+private:
+    /// Returns a buffer to the pool once it's no longer referenced.
+    class Releaser {
+    public:
+        Releaser(const boost::shared_ptr<BufferPool>& pool, size_t size_class)
+        : pool_(pool), size_class_(size_class) {
+        }
+        
+        void operator()(char* buffer) const {
+            pool_->release(buffer, size_class_);
+        }
+        
+    private:
+        boost::shared_ptr<BufferPool> pool_;
+        size_t size_class_;
+    };
+    
+    /// Find the smallest size class that fits size bytes.
+    static size_t size_class(size_t size);
+    
+    /// Put a buffer back into the pool, or free it if the pool is full.
+    void release(char* buffer, size_t size_class);
+    
+    /// Guards the free buffers.
+    boost::mutex mutex_;
+    
+    /// Free buffers by size class.
+    std::vector<std::vector<char*> > free_buffers_;
+};
+
+/*---------------------------------------------------------
+                    FileCacheStats class.
+----------------------------------------------------------*/
+/**
+ * Counters for sizing the file cache.  Every request is counted as
+ * exactly one of a hit, a miss (the file had to be loaded, or was found
+ * to be missing) or a negative hit (the file was recently found to be
+ * missing).
+ */
+class FileCacheStats {
+public:
+    FileCacheStats()
+    : hits(0),
+      misses(0),
+      negative_hits(0),
+      evictions(0),
+      resident_bytes(0),
+      memory_budget(0),
+      num_files(0),
+      num_missing_files(0) {
+    }
+    
+    size_t hits;
+    size_t misses;
+    size_t negative_hits;
+    
+    /// Number of files dropped to stay within the memory budget.
+    size_t evictions;
+    
+    /// Bytes of file data (all variants) held by the cache.
+    size_t resident_bytes;
+    size_t memory_budget;
+    
+    /// Number of files cached, and of paths known to be missing.
+    size_t num_files;
+    size_t num_missing_files;
+};
+
 /*---------------------------------------------------------
                     FileCache class.
 ----------------------------------------------------------*/
+/**
+ * A cache of files loaded from disk, limited to a memory budget.  The 
+ * files to keep are chosen by an ArcPolicy, so that a burst of requests
+ * for files seen only once doesn't push out the popular ones.  Paths 
+ * that don't lead to a file are remembered in a separate, bounded list,
+ * so that repeated requests for them don't reach the disk, and arbitrary
+ * URLs can't grow the cache.
+ *
+ * The paths are spread over a number of shards, each with its own lock,
+ * eviction policy and share of the memory budget, so that threads 
+ * looking up different files rarely wait for each other.  The lock of a 
+ * shard is only held for map lookups, never while a file is read by 
+ * load_async() or preload().  A cached file is never changed once 
+ * cached: refreshing it builds a new CachedFile, which replaces the old
+ * one, so the files and responses handed out can be read without a lock.
+ */
 class FileCache {
 public:
+    /**
+     * The outcomes of looking up a response without touching the disk.
+     */
+    enum LookupStatus {
+        RESPONSE_FOUND = 0,
+        RESPONSE_MISSING = 1,
+        RESPONSE_NEEDS_LOAD = 2,
+    };
+    
+    /**
+     * Called once a file handed to load_async() has been loaded, with
+     * the response in the encoding asked for; empty if the file is 
+     * missing.
+     */
+    typedef void (*LoadCallback)(const PreparedResponsePtr& response, void* data);
+    
     /**
      * The default cache expiration period, in sec.
      */
     static const time_t kDefaultExpirationPeriod = 60;
     
+    /**
+     * The default size from which files are mapped into memory: none
+     * are (see CachedFile::kDefaultMmapThreshold).
+     */
+    static const size_t kDefaultMmapThreshold = static_cast<size_t>(-1);
+    
+    /**
+     * The default limit on the bytes of file data held by the cache.
+     */
+    static const size_t kDefaultMemoryBudget = 64 << 20;
+    
+    /**
+     * Number of missing paths remembered.
+     */
+    static const size_t kMaxMissingFiles = 4096;
+    
+    /**
+     * The default number of shards.
+     */
+    static const size_t kDefaultNumShards = 16;
+    
     FileCache(const std::string& file_root,
-              time_t expiration_period = kDefaultExpirationPeriod)
-    : expiration_period_(expiration_period),
-      file_root_(file_root) {
-        cached_files_.set_empty_key("");
-    }
+              time_t expiration_period = kDefaultExpirationPeriod,
+              size_t memory_budget = kDefaultMemoryBudget,
+              size_t num_shards = kDefaultNumShards);
     
     /**
      * Get the contents of the file.
      *
      * The data will be returned in the first argument, and will be always 
-     * zero terminated.  The second optional argument can be used to return
-     * the number of bytes of data returned.
+     * zero terminated.  The optional arguments can be used to return
+     * the number of bytes of data returned and the time the file was
+     * last modified.  Safe to call from several threads at once.
      *
      * @return true if the file exists at the time of latest refresh; 
      * false otherwise.
      */
     bool get(const std::string& file_path, 
              boost::shared_array<char>& data, 
-             size_t* data_size = NULL);
+             size_t* data_size = NULL,
+             time_t* last_modified = NULL);
+    
+    /**
+     * Get the prepared response for the file in the best of the 
+     * accepted encodings (a combination of ContentEncoding flags) the 
+     * file has been compressed with.  Nothing is computed here: the 
+     * responses are built when the file is loaded.  Safe to call from 
+     * several threads at once.
+     *
+     * @return true if the file exists at the time of latest refresh; 
+     * false otherwise, in which case response is left empty.
+     */
+    bool get_response(const std::string& file_path, 
+                      int accepted_encodings,
+                      PreparedResponsePtr& response);
+    
+    /**
+     * Look up the prepared response for the file, like get_response(),
+     * but never touch the disk: a file that is not cached yet, or needs
+     * to be refreshed, must be loaded with load_async() first.  Safe to
+     * call from several threads at once.
+     *
+     * @return RESPONSE_FOUND with the response, RESPONSE_MISSING if the 
+     * file is known not to exist, or RESPONSE_NEEDS_LOAD.
+     */
+    LookupStatus find_response(const std::string& file_path, 
+                               int accepted_encodings,
+                               PreparedResponsePtr& response);
+    
+    /**
+     * Load or refresh a file on one of the I/O threads, and call back
+     * from that thread with the response in the best of the accepted
+     * encodings once it's done.  The requests for a file that is already
+     * being loaded wait for the same load.  Without I/O threads, the 
+     * file is loaded, and the callback called, right away.  Safe to call
+     * from several threads at once.
+     */
+    void load_async(const std::string& file_path, 
+                    int accepted_encodings,
+                    LoadCallback callback, 
+                    void* callback_data);
+    
+    /**
+     * Start the threads for load_async().  Should be called at most
+     * once, before the first call to load_async().
+     */
+    void start_io_threads(size_t num_threads);
     
     /**
      * Get the cached file as well as metadata associated with it.
@@ -82,11 +366,42 @@ public:
      * the second argument.  On failure, cached_file will contain an 
      * object with no data.
      *
+     * The CachedFile must not be modified: it's shared with the other
+     * threads, and a refresh replaces it rather than changing it.
+     *
      * @return true if the file exists at the time of latest refresh; 
      * false otherwise.
      */
     bool get_cached_object(const std::string& file_path, CachedFilePtr& cached_file);
     
+    /**
+     * Mark a cached file as changed on disk, so that it's reloaded the
+     * next time it's requested.  An empty path marks all the files.
+     * Safe to call from several threads at once.
+     */
+    void invalidate(const std::string& file_path);
+    
+    /**
+     * Load files into the cache ahead of the requests, on a number of 
+     * threads at once (including the calling one).  The files are 
+     * compressed and hashed, same as when they're requested.  Files
+     * already cached, and the ones that can't be loaded, are skipped.
+     * Safe to call from several threads at once; the cache is not held
+     * up while the files are being loaded.
+     *
+     * @return the number of files loaded; the bytes taken by them are
+     * returned in bytes_loaded.
+     */
+    size_t preload(const std::vector<std::string>& file_paths, 
+                   size_t num_threads,
+                   size_t& bytes_loaded);
+    
+    /**
+     * Get the counters of hits, misses and evictions, along with the 
+     * memory in use.  Safe to call from several threads at once.
+     */
+    FileCacheStats stats();
+    
     /*=============== Getters/Setters ====================*/
     /// Get the cache expiration period.
     time_t expiration_period() const                {return expiration_period_;}
@@ -94,9 +409,58 @@ public:
     /// Set the cache expiration period.
     void set_expiration_period(time_t period)       {expiration_period_ = period;}
     
+    /// Get the size from which files are mapped into memory.
+    size_t mmap_threshold() const                   {return mmap_threshold_;}
+    
+    /// Set the size from which files are mapped into memory rather 
+    /// than read; only for files that are never rewritten in place (see
+    /// CachedFile::kDefaultMmapThreshold).  This should not be used 
+    /// after the first call to get().
+    void set_mmap_threshold(size_t threshold)       {mmap_threshold_ = threshold;}
+    
+    /// Check whether the files are kept open once loaded.
+    bool keeps_files_open() const                   {return keeps_files_open_;}
+    
+    /// Set whether the files are kept open once loaded, so that their
+    /// responses can be sent with sendfile (see PreparedResponse::file).
+    /// Takes a file descriptor for every cached file.  This should not
+    /// be used after the first call to get().
+    void set_keeps_files_open(bool keeps_files_open) {keeps_files_open_ = keeps_files_open;}
+    
+    /// Get the limit on the bytes of file data held by the cache.
+    size_t memory_budget() const;
+    
+    /// Set the limit on the bytes of file data held by the cache, 
+    /// dropping files as needed.  Each shard gets an equal share of it,
+    /// which is also the largest file the cache can keep.
+    void set_memory_budget(size_t memory_budget);
+    
+    /// Get the number of shards.
+    size_t num_shards() const                       {return shards_.size();}
+    
+    /// Get the pool of buffers for the smaller files.
+    boost::shared_ptr<BufferPool> buffer_pool() const {return buffer_pool_;}
+    
+    /// Check whether the files are watched for changes, rather than
+    /// checked on disk when the expiration period has passed.
+    bool is_watched() const                         {return is_watched_;}
+    
+    /// Set whether the files are watched for changes, in which case
+    /// the cache relies on invalidate() to learn about them.
+    void set_is_watched(bool is_watched);
+    
     /// Get the base path for all files.
     std::string file_root() const                   {return file_root_;}
     
+    /// Get the Cache-Control header of the prepared responses.
+    std::string cache_control() const               {return cache_control_;}
+    
+    /// Set the Cache-Control header of the prepared responses; empty
+    /// for none.  This should not be used after the first call to get().
+    void set_cache_control(const std::string& cache_control) {
+        cache_control_ = cache_control;
+    }
+    
     /// Set the directory relative to which all file paths will 
     /// be resolved.  This should not be used after the first call 
     /// to get().  If the provided directory name does not have a 
@@ -110,14 +474,165 @@ private:
                                    eqstr>
             CachedFilesMap;
     
-    /// Cached files.
-    CachedFilesMap cached_files_;
+    /// A path known to be missing, and when to check it again.
+    class MissingFile {
+    public:
+        time_t expiration_time;
+        std::list<std::string>::iterator position;
+    };
+    
+    typedef google::dense_hash_map<std::string, 
+                                   MissingFile, 
+                                   boost::hash<std::string>, 
+                                   eqstr>
+            MissingFilesMap;
+    
+    /// A request waiting for a file to be loaded.
+    class LoadWaiter {
+    public:
+        LoadWaiter(int waiter_encodings, LoadCallback waiter_callback, void* waiter_data)
+        : accepted_encodings(waiter_encodings), 
+          callback(waiter_callback), 
+          callback_data(waiter_data) {
+        }
+        
+        int accepted_encodings;
+        LoadCallback callback;
+        void* callback_data;
+    };
+    
+    /// A file being loaded by load_async(), into a new CachedFile or a
+    /// copy of the cached one, so that the cached one can still be read 
+    /// in the meantime.
+    class PendingLoad {
+    public:
+        PendingLoad() : is_invalidated(false) {}
+        
+        CachedFilePtr cached_file;
+        std::vector<LoadWaiter> waiters;
+        
+        /// Whether the file has changed since the load started.
+        bool is_invalidated;
+    };
+    
+    typedef google::dense_hash_map<std::string, 
+                                   PendingLoad, 
+                                   boost::hash<std::string>, 
+                                   eqstr>
+            PendingLoadsMap;
+    
+    /**
+     * The part of the cache holding the paths that hash to it.  Everything
+     * in a shard, including the flags of its cached files, is guarded by
+     * the shard's mutex.
+     */
+    class Shard {
+    public:
+        explicit Shard(size_t memory_budget);
+        
+        boost::mutex mutex;
+        
+        /// Cached files.
+        CachedFilesMap cached_files;
+        
+        /// Whether the files are watched for changes.
+        bool is_watched;
+        
+        /// Decides which files to keep within the shard's memory budget.
+        ArcPolicy eviction_policy;
+        
+        /// Paths known to be missing, and the same paths from the most
+        /// recently added.
+        MissingFilesMap missing_files;
+        std::list<std::string> missing_file_order;
+        
+        /// Files being loaded by load_async().
+        PendingLoadsMap pending_loads;
+        
+        /// Counters for stats().
+        FileCacheStats stats;
+    };
+    
+    /// Get the shard of a path.
+    Shard& shard(const std::string& file_path) const;
+    
+    /// Create a cached file, not loaded yet, for a path relative to the
+    /// file root.  The caller must hold the shard's mutex.
+    CachedFilePtr new_cached_file(const Shard& shard, const std::string& file_path) const;
+    
+    /// Load a file for preload(), and record whether it exists.
+    static void preload_file(CachedFile* cached_file, char* has_loaded);
+    
+    /// Start caching a loaded file, evicting other files as needed.
+    /// The caller must hold the shard's mutex.
+    void add_cached_file(Shard& shard, 
+                         const std::string& file_path, 
+                         const CachedFilePtr& cached_file);
+    
+    /// Pick the prepared response in the best of the accepted encodings.
+    static PreparedResponsePtr select_response(const CachedFile& cached_file, 
+                                               int accepted_encodings);
+    
+    /// Load a file handed to load_async(), and call back the requests
+    /// waiting for it.
+    void run_load(const std::string& file_path);
+    
+    /// Find the cached file, loading or refreshing it if needed.
+    /// The caller must hold the shard's mutex.
+    bool find_cached_object(Shard& shard, 
+                            const std::string& file_path, 
+                            CachedFilePtr& cached_file);
+    
+    /// Check whether a path is known to be missing.  The caller must 
+    /// hold the shard's mutex.
+    bool is_missing(Shard& shard, const std::string& file_path, time_t now);
+    
+    /// Remember a path as missing, forgetting the oldest missing path 
+    /// of the shard if there are too many.  The caller must hold the 
+    /// shard's mutex.
+    void add_missing(Shard& shard, const std::string& file_path, time_t now);
+    
+    /// Stop considering a path as missing.  The caller must hold the 
+    /// shard's mutex.
+    void forget_missing(Shard& shard, const std::string& file_path);
+    
+    /// Drop the files evicted by the eviction policy.  The caller must 
+    /// hold the shard's mutex.
+    void drop_evicted(Shard& shard, const std::vector<std::string>& evicted);
+    
+    /// The shards, each held by a shared_ptr as it can't be copied.
+    std::vector<boost::shared_ptr<Shard> > shards_;
+    
+    /// Number of missing paths remembered by each shard.
+    size_t max_missing_files_;
     
     /// Cache expiration period.
     time_t expiration_period_;
     
+    /// Whether the files are watched for changes.
+    bool is_watched_;
+    
+    /// Size from which files are mapped into memory.
+    size_t mmap_threshold_;
+    
+    /// Whether the files are kept open once loaded.
+    bool keeps_files_open_;
+    
+    /// Pool of buffers for the smaller files, shared by all the files.
+    boost::shared_ptr<BufferPool> buffer_pool_;
+    
+    /// The empty file returned for the missing paths.
+    CachedFilePtr missing_file_;
+    
     /// Root directory for the files to be cached.
     std::string file_root_;
+    
+    /// Cache-Control header of the prepared responses.
+    std::string cache_control_;
+    
+    /// The threads loading the files for load_async().  Declared last,
+    /// so that it's stopped before the rest of the cache is destroyed.
+    boost::shared_ptr<WorkerPool> io_threads_;
 };
 
 
@@ -131,11 +646,43 @@ public:
      */
     static const time_t kDefaultExpirationPeriod = 60;
     
+    /**
+     * A compressed variant is only kept if it takes at most this
+     * percentage of the original size; the files that compress 
+     * poorly (e.g. images) are always sent as is.
+     */
+    static const size_t kMaxCompressedPercent = 90;
+    
+    /**
+     * Room for a quoted ETag: 16 hex digits of the content hash, plus
+     * an encoding suffix.
+     */
+    static const size_t kMaxETagLength = 32;
+    
+    /**
+     * Files of at least the mmap threshold are mapped into memory rather
+     * than read, so that they share pages with the page cache.  Such 
+     * files must be replaced (e.g. renamed over) rather than rewritten 
+     * in place: reading a mapping past the end of a truncated file 
+     * raises SIGBUS, and a file changed in place changes under its ETag.
+     * So by default no file is mapped; the threshold has to be lowered
+     * where the files are known to be replaced.
+     */
+    static const size_t kDefaultMmapThreshold = static_cast<size_t>(-1);
+    
     CachedFile(const std::string& file_path, 
                time_t expiration_period = kDefaultExpirationPeriod)
     : data_(NULL), 
       data_size_(0), 
       data_capacity_(0), 
+      gzip_data_size_(0),
+      brotli_data_size_(0),
+      content_hash_(0),
+      is_watched_(false),
+      is_dirty_(false),
+      is_mapped_(false),
+      mmap_threshold_(kDefaultMmapThreshold),
+      keeps_file_open_(false),
       expiration_time_(0),
       expiration_period_(expiration_period),
       last_modified_(0),
@@ -157,7 +704,10 @@ public:
     bool get(boost::shared_array<char>& data, size_t& size);
     
     /**
-     * Refresh the cached data if it has expired.
+     * Refresh the cached data if it has expired, or has been marked as
+     * changed.  A watched file that hasn't been marked is never checked
+     * on disk.  When the file has changed, its compressed variants and 
+     * prepared responses are rebuilt.
      *
      * @return true if the data has not yet expired or has been refreshed
      * successfully; false if the file is gone or not accessible.  In case 
@@ -165,6 +715,46 @@ public:
      */
     bool refresh_if_expired();
     
+    /**
+     * Check whether refresh_if_expired() would look at the file on disk.
+     */
+    bool needs_refresh(time_t now) const;
+    
+    /**
+     * Get the currently cached data in the given encoding; do not 
+     * refresh the contents even if it has expired.
+     *
+     * @return true if there is a variant of the data in that encoding,
+     * false otherwise.
+     */
+    bool encoded_data(ContentEncoding encoding, 
+                      boost::shared_array<char>& data, 
+                      size_t& size) const;
+    
+    /**
+     * Get the prepared response for the currently cached data in the 
+     * given encoding; do not refresh the contents even if it has expired.
+     * Empty if there is no variant of the data in that encoding.
+     */
+    PreparedResponsePtr response(ContentEncoding encoding) const;
+    
+    /**
+     * Compress the data with a given encoding.  Returns false if the 
+     * encoding is not supported (e.g. brotli, when built without it) 
+     * or the compression fails.
+     */
+    static bool compress(ContentEncoding encoding,
+                         const char* data,
+                         size_t size,
+                         boost::shared_array<char>& compressed_data,
+                         size_t& compressed_size);
+    
+    /**
+     * Get the Content-Type of a file from its extension; text/html 
+     * for unknown extensions.
+     */
+    static const char* content_type(const std::string& file_path);
+    
     /*=============== Getters/Setters ====================*/
     /// Get the cache expiration time.
     time_t expiration_time() const                  {return expiration_time_;}
@@ -175,12 +765,66 @@ public:
     /// Set the cache expiration period.
     void set_expiration_period(time_t period)       {expiration_period_ = period;}
     
+    /// Get the Cache-Control header of the prepared responses.
+    std::string cache_control() const               {return cache_control_;}
+    
+    /// Set the Cache-Control header of the prepared responses; empty
+    /// for none.  Takes effect the next time the file is loaded.
+    void set_cache_control(const std::string& cache_control) {
+        cache_control_ = cache_control;
+    }
+    
+    /// Check whether the file is watched for changes, rather than
+    /// checked on disk when the expiration period has passed.
+    bool is_watched() const                         {return is_watched_;}
+    
+    /// Set whether the file is watched for changes.
+    void set_is_watched(bool is_watched)            {is_watched_ = is_watched;}
+    
+    /// Check whether the file has been marked as changed.
+    bool is_dirty() const                           {return is_dirty_;}
+    
+    /// Mark the file as changed, so that it's reloaded on next refresh.
+    void mark_dirty()                               {is_dirty_ = true;}
+    
+    /// Get the size from which the file is mapped into memory.
+    size_t mmap_threshold() const                   {return mmap_threshold_;}
+    
+    /// Set the size from which the file is mapped into memory rather
+    /// than read.  Takes effect the next time the file is loaded.
+    void set_mmap_threshold(size_t threshold)       {mmap_threshold_ = threshold;}
+    
+    /// Check whether the file is kept open once loaded.
+    bool keeps_file_open() const                    {return keeps_file_open_;}
+    
+    /// Set whether the file is kept open once loaded, for the identity
+    /// response to be sent from.  Takes effect the next time the file
+    /// is loaded.
+    void set_keeps_file_open(bool keeps_file_open)  {keeps_file_open_ = keeps_file_open;}
+    
+    /// Get the file the currently cached data was read from, if it's 
+    /// kept open; empty otherwise.
+    OpenFilePtr file() const                        {return file_;}
+    
+    /// Set the pool of buffers to read the file into, if it's not
+    /// mapped into memory.  Without a pool, the buffers are allocated
+    /// with new[].
+    void set_buffer_pool(const boost::shared_ptr<BufferPool>& pool) {
+        buffer_pool_ = pool;
+    }
+    
+    /// Check whether the currently cached data is mapped into memory.
+    bool is_mapped() const                          {return is_mapped_;}
+    
     /// Get the name of the cached file.
     std::string file_path() const                   {return file_path_;}
     
     /// Get the last modified date of the file.
     time_t last_modified() const                    {return last_modified_;}
     
+    /// Get the hash of the currently cached data.
+    boost::uint64_t content_hash() const            {return content_hash_;}
+    
     /// Get the currently cached data; do not refresh the contents
     /// even if it has expired.
     boost::shared_array<char> data()                {return data_;}
@@ -189,12 +833,64 @@ public:
     /// Do not refresh the content even if it has expired.
     size_t data_size() const                        {return data_size_;}
     
+    /// Get the number of bytes taken by the currently cached data and
+    /// its compressed variants.
+    size_t memory_bytes() const {
+        return data_size_ + gzip_data_size_ + brotli_data_size_;
+    }
+    
 private:
     /**
      * A helper function for blanking out the data.
      */
     void empty_data();
     
+    /**
+     * Load the contents of an open file of a given size into data_, 
+     * mapping it into memory or reading it into a buffer.  
+     * @return false if the file could not be read.
+     */
+    bool load_data(int fd, size_t file_size);
+    
+    /**
+     * Map a file into memory, followed by a zero byte.
+     * @return the mapping, unmapped once no longer referenced; empty
+     * on failure.
+     */
+    static boost::shared_array<char> map_file(int fd, size_t file_size);
+    
+    /**
+     * Read a file into a buffer until the end of file or size bytes.
+     * @return false on a read error.
+     */
+    static bool read_file(int fd, char* buffer, size_t size, size_t& bytes_read);
+    
+    /**
+     * Build the compressed variants of the data, skipping the ones
+     * that don't save enough.
+     */
+    void compress_data();
+    
+    /**
+     * Compress the data with a given encoding, and keep the result
+     * if it's small enough.
+     */
+    void compress_variant(ContentEncoding encoding,
+                          boost::shared_array<char>& variant_data,
+                          size_t& variant_size) const;
+    
+    /**
+     * Hash the data, and prepare the responses for all its variants.
+     */
+    void prepare_responses();
+    
+    /**
+     * Prepare the response for one variant of the data; empty if 
+     * there is no such variant.
+     */
+    PreparedResponsePtr prepare_response(ContentEncoding encoding,
+                                         const std::string& last_modified_string) const;
+    
     /**
      * The data stored here.
      */
@@ -210,6 +906,56 @@ private:
      */
     size_t data_capacity_;
     
+    /**
+     * The gzip-compressed data, if it's worth keeping.
+     */
+    boost::shared_array<char> gzip_data_;
+    size_t gzip_data_size_;
+    
+    /**
+     * The brotli-compressed data, if it's worth keeping.
+     */
+    boost::shared_array<char> brotli_data_;
+    size_t brotli_data_size_;
+    
+    /**
+     * The hash of the data.
+     */
+    boost::uint64_t content_hash_;
+    
+    /**
+     * The prepared responses for each variant of the data.
+     */
+    PreparedResponsePtr response_;
+    PreparedResponsePtr gzip_response_;
+    PreparedResponsePtr brotli_response_;
+    
+    /**
+     * Whether the file is watched for changes, and whether it has 
+     * changed since it was loaded.
+     */
+    bool is_watched_;
+    bool is_dirty_;
+    
+    /**
+     * Whether the data is mapped into memory, and the size from which
+     * files are.
+     */
+    bool is_mapped_;
+    size_t mmap_threshold_;
+    
+    /**
+     * Whether the file is kept open once loaded, and the open file the
+     * currently cached data was read from.
+     */
+    bool keeps_file_open_;
+    OpenFilePtr file_;
+    
+    /**
+     * Pool of buffers for the data of files that are not mapped.
+     */
+    boost::shared_ptr<BufferPool> buffer_pool_;
+    
     /**
      * Time when the cached file expires.
      */
@@ -225,6 +971,11 @@ private:
      */
     time_t last_modified_;
     
+    /**
+     * Cache-Control header of the prepared responses.
+     */
+    std::string cache_control_;
+    
     /**
      * File name.
      */
@@ -17,11 +17,18 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <sys/stat.h>
 
 #include <fstream>
+#include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
@@ -47,6 +54,14 @@ using boost::shared_array;
 
 namespace isaword {
 
+/// Cache-Control of the files requested by their current fingerprint:
+/// a new version of the file gets a new URL, so there's nothing to 
+/// revalidate.
+static const char* kImmutableCacheControl = "public, max-age=31536000, immutable";
+
+const size_t FileHandler::kNumIoThreads;
+const size_t FileHandler::kFingerprintLength;
+
 /**
  * Set the directory to serve the files from.
  */
@@ -75,11 +90,12 @@ FileHandler::FileRootStatusCode FileHandler::initialize(const std::string& file_
         boost::regex("^[a-zA-Z0-9_-]+(\\.[a-zA-Z0-9_-]*)*(/[a-zA-Z0-9_-]+(\\.[a-zA-Z0-9_-]*)*)*$");
     
     // Initialize the file cache.
-    file_cache_ = shared_ptr<FileCache>(new FileCache(file_root));
+    file_cache_ = shared_ptr<FileCache>(new FileCache(file_root_));
     file_cache_->set_expiration_period(cache_period_sec_);
+    file_cache_->set_keeps_files_open(use_sendfile_);
     std::stringstream cache_control;
     cache_control << "public, max-age=" << cache_period_sec_;
-    cache_control_ = cache_control.str();
+    this->set_cache_control(cache_control.str());
     
     return FileHandler::FILE_ROOT_OK;
 }
@@ -101,12 +117,7 @@ FileHandler::attach_to_server(boost::shared_ptr<HttpServer> server,
     }
     
     
-    url_root_ = url_root;
-    
-    //Make sure that the URL root ends with "/".
-    if (url_root_[url_root_.size() - 1] != '/') {
-        url_root_ += '/';
-    }
+    this->set_url_root(url_root);
     
     //Attach the handler to the server.
     std::string url_pattern = url_root_ + ".*";
@@ -114,9 +125,174 @@ FileHandler::attach_to_server(boost::shared_ptr<HttpServer> server,
     
     is_attached_ = true;
     server_ = server;
+    file_cache_->start_io_threads(kNumIoThreads);
+    
+    //Watch the files for changes rather than checking them on disk.  If 
+    //inotify is not available, the cache period is used instead.
+    if (file_watcher_.initialize(file_root_)
+            && file_watcher_.attach(server->ev_base(), &FileHandler::file_changed_callback, 
+                                    (void*) this)) {
+        file_cache_->set_is_watched(true);
+    }
+    
     return FileHandler::ATTACHED_OK;
 }
 
+/**
+ * Load the files into the cache ahead of the requests, from a manifest
+ * or from the whole file root.
+ */
+size_t FileHandler::warm_up(const std::string& manifest_path, 
+                            size_t num_threads, 
+                            size_t& bytes_loaded) {
+    bytes_loaded = 0;
+    
+    if (!file_cache_) {
+        return 0;
+    }
+    
+    std::vector<std::string> file_paths;
+    
+    if (manifest_path.empty()) {
+        this->list_files("", file_paths);
+    
+    } else if (!this->read_manifest(manifest_path, file_paths)) {
+        std::cout << "Could not read the warm-up manifest at " << manifest_path 
+                  << "; loading all the static files." << std::endl;
+        this->list_files("", file_paths);
+    }
+    
+    return file_cache_->preload(file_paths, num_threads, bytes_loaded);
+}
+
+/**
+ * Append the paths, relative to the file root, of the files to be
+ * served from a directory and its subdirectories.
+ */
+void FileHandler::list_files(const std::string& relative_dir, 
+                             std::vector<std::string>& file_paths) const {
+    const std::string full_dir(file_root_ + relative_dir);
+    DIR* dir = opendir(full_dir.c_str());
+    
+    if (dir == NULL) {
+        return;
+    }
+    
+    for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        const std::string relative_path(relative_dir + entry->d_name);
+        struct stat stat_buffer;
+        
+        //Skips ".", ".." and the hidden files as well.
+        if (!this->is_permitted_file_path(relative_path)
+                || lstat((file_root_ + relative_path).c_str(), &stat_buffer) != 0) {
+            continue;
+        }
+        
+        if (S_ISDIR(stat_buffer.st_mode)) {
+            this->list_files(relative_path + "/", file_paths);
+        
+        } else if (S_ISREG(stat_buffer.st_mode)) {
+            file_paths.push_back(relative_path);
+        }
+    }
+    
+    closedir(dir);
+}
+
+/**
+ * Append the paths to be served listed in a manifest.
+ * @return false if the manifest could not be read.
+ */
+bool FileHandler::read_manifest(const std::string& manifest_path, 
+                                std::vector<std::string>& file_paths) const {
+    std::ifstream manifest(manifest_path.c_str());
+    
+    if (!manifest.is_open()) {
+        return false;
+    }
+    
+    std::string line;
+    
+    while (std::getline(manifest, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        
+        if (!line.empty() && line[0] != '#' && this->is_permitted_file_path(line)) {
+            file_paths.push_back(line);
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Get the path of a file with the fingerprint of its current contents
+ * inserted before the extension.  The fingerprint is taken from the 
+ * ETag of the file, which starts with the hash of its contents.
+ */
+std::string FileHandler::fingerprinted_path(const std::string& relative_path) {
+    const size_t extension_start = relative_path.rfind('.');
+    const size_t name_start = relative_path.rfind('/');
+    PreparedResponsePtr response;
+    
+    if (!file_cache_
+            || extension_start == std::string::npos
+            || (name_start != std::string::npos && extension_start < name_start)
+            || !this->is_permitted_file_path(relative_path)
+            || !file_cache_->get_response(relative_path, IDENTITY_ENCODING, response)
+            || response->etag.size() < kFingerprintLength + 1) {
+        return std::string();
+    }
+    
+    return relative_path.substr(0, extension_start) + '.' 
+           + response->etag.substr(1, kFingerprintLength) 
+           + relative_path.substr(extension_start);
+}
+
+/**
+ * Split a fingerprinted path, "name.<fingerprint>.extension", into 
+ * the path of the file and the fingerprint: lowercase hex digits, as 
+ * in the ETags.
+ */
+bool FileHandler::split_fingerprint(const std::string& path, 
+                                    std::string& file_path, 
+                                    std::string& fingerprint) {
+    const size_t extension_start = path.rfind('.');
+    
+    if (extension_start == std::string::npos 
+            || extension_start < kFingerprintLength + 2
+            || path.find('/', extension_start) != std::string::npos) {
+        return false;
+    }
+    
+    const size_t fingerprint_start = extension_start - kFingerprintLength;
+    
+    //The name before the fingerprint must not be empty.
+    if (path[fingerprint_start - 1] != '.' 
+            || path[fingerprint_start - 2] == '/' 
+            || path[fingerprint_start - 2] == '.') {
+        return false;
+    }
+    
+    for (size_t i = fingerprint_start; i < extension_start; ++i) {
+        if (!isdigit(path[i]) && (path[i] < 'a' || path[i] > 'f')) {
+            return false;
+        }
+    }
+    
+    file_path = path.substr(0, fingerprint_start - 1) + path.substr(extension_start);
+    fingerprint = path.substr(fingerprint_start, kFingerprintLength);
+    return true;
+}
+
+/**
+ * Add a page with the file cache statistics to the HTTP server.
+ */
+void FileHandler::attach_stats(boost::shared_ptr<HttpServer> server, 
+                               const std::string& url_pattern) {
+    server->add_url_handler(url_pattern, &FileHandler::stats_callback, (void*) this);
+}
+
 /**
  * Handle a file request.
  */
@@ -125,76 +301,286 @@ void FileHandler::handle_request(struct evhttp_request* request) {
     std::string uri(request_uri_path(request));
     std::string relative_file_path(uri.substr(url_root_.size()));
     
+    //A fingerprinted path stands for the file without the fingerprint,
+    //unless a file has that very name.
+    std::string unfingerprinted_path;
+    std::string fingerprint;
+    split_fingerprint(relative_file_path, unfingerprinted_path, fingerprint);
+    this->serve_file(request, relative_file_path, unfingerprinted_path, fingerprint);
+}
+
+/**
+ * Look a file up in the cache and send it, leaving the disk to the
+ * I/O threads.  If there's no such file, the fallback is looked up
+ * the same way.
+ */
+void FileHandler::serve_file(struct evhttp_request* request, 
+                             const std::string& relative_file_path,
+                             const std::string& fallback_path,
+                             const std::string& fallback_fingerprint) {
     //Check whether the user entered a valid file path.
     if (!this->is_permitted_file_path(relative_file_path)) {
+        if (!fallback_path.empty()) {
+            this->serve_file(request, fallback_path, "", fallback_fingerprint);
+            return;
+        }
+        
         // Invalid request.  Cannot find the file.
         server_->send_response(request, std::string(""), HTTP_NOTFOUND);
         return;
     }
     
-    //Attempt to load the file.
-    //std::string full_path = file_root_ + relative_file_path;
-    CachedFilePtr cached_file;
-    const bool has_loaded = file_cache_->get_cached_object(relative_file_path, cached_file);
+    //The fingerprint only applies to the fallback; it's passed on with
+    //an empty fallback path once the fallback is the file looked up.
+    const std::string fingerprint(fallback_path.empty() ? fallback_fingerprint : "");
+    struct evkeyvalq* request_headers = evhttp_request_get_input_headers(request);
+    const int encodings = 
+        accepted_encodings(evhttp_find_header(request_headers, "Accept-Encoding"));
+    PreparedResponsePtr response;
+    const FileCache::LookupStatus status = 
+        file_cache_->find_response(relative_file_path, encodings, response);
+    
+    if (status == FileCache::RESPONSE_NEEDS_LOAD) {
+        PendingRequest* pending_request = new PendingRequest();
+        pending_request->handler = this;
+        pending_request->request = request;
+        pending_request->base = 
+            evhttp_connection_get_base(evhttp_request_get_connection(request));
+        pending_request->relative_path = relative_file_path;
+        pending_request->fingerprint = fingerprint;
+        pending_request->fallback_path = fallback_path;
+        pending_request->fallback_fingerprint = fallback_fingerprint;
+        file_cache_->load_async(relative_file_path, encodings, 
+                                &FileHandler::file_loaded_callback, 
+                                (void*) pending_request);
+        return;
+    
+    } else if (status == FileCache::RESPONSE_MISSING && !fallback_path.empty()) {
+        this->serve_file(request, fallback_path, "", fallback_fingerprint);
+        return;
+    }
+    
+    this->send_file(request, fingerprint, response);
+}
+
+/**
+ * Hand a loaded file over to the event loop of the request waiting
+ * for it.  The request can't be completed from the I/O thread.
+ */
+void FileHandler::file_loaded_callback(const PreparedResponsePtr& response, 
+                                       void* pending_request_ptr) {
+    PendingRequest* pending_request = (PendingRequest*) pending_request_ptr;
+    pending_request->response = response;
+    
+    if (event_base_once(pending_request->base, -1, EV_TIMEOUT, 
+                        &FileHandler::finish_request_callback, 
+                        pending_request_ptr, NULL) != 0) {
+        // Nothing more can be done; the connection will time out.
+        delete pending_request;
+    }
+}
+
+/**
+ * Complete a request once its file has been loaded, or look up the
+ * fallback if there's no such file.
+ */
+void FileHandler::finish_request_callback(evutil_socket_t, short, void* pending_request_ptr) {
+    PendingRequest* pending_request = (PendingRequest*) pending_request_ptr;
+    
+    if (!pending_request->response && !pending_request->fallback_path.empty()) {
+        pending_request->handler->serve_file(pending_request->request, 
+                                             pending_request->fallback_path, 
+                                             "",
+                                             pending_request->fallback_fingerprint);
+    } else {
+        pending_request->handler->send_file(pending_request->request, 
+                                            pending_request->fingerprint,
+                                            pending_request->response);
+    }
     
-    if (!has_loaded) {
+    delete pending_request;
+}
+
+/**
+ * Send a prepared response for a file, or 304 Not Modified if the
+ * user agent already has it.  An empty response means there's no 
+ * such file.  The file may be cached for good if it was requested by
+ * the fingerprint of this very version.
+ */
+void FileHandler::send_file(struct evhttp_request* request, 
+                            const std::string& fingerprint,
+                            const PreparedResponsePtr& response) {
+    if (!response) {
         // No such file.
         server_->send_response(request, std::string(""), HTTP_NOTFOUND);
         return;
     }
     
-    // Start writing the response.
-    // Add Last-Modified response header.
-    const time_t last_modified = cached_file->last_modified();
+    // Start writing the response.  All the headers were prepared when
+    // the file was loaded.  The ETag starts with the same content hash
+    // as the fingerprint.
+    struct evkeyvalq* request_headers = evhttp_request_get_input_headers(request);
     struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
-    shared_array<char> sz_last_modified(time_to_string(last_modified));
-    evhttp_add_header(response_headers, "Last-Modified", sz_last_modified.get());
+    const bool is_immutable = 
+        !fingerprint.empty() 
+        && response->etag.size() > fingerprint.size()
+        && response->etag.compare(1, fingerprint.size(), fingerprint) == 0;
     
-    // Add Cache Control response header.
-    if (!cache_control_.empty()) {
-        evhttp_add_header(response_headers, "Cache-Control", cache_control_.c_str());
+    for (PreparedResponse::Headers::const_iterator header = response->headers.begin();
+         header != response->headers.end();
+         ++header) {
+        if (is_immutable && header->first == "Cache-Control") {
+            continue;
+        }
+        
+        evhttp_add_header(response_headers, header->first.c_str(), header->second.c_str());
     }
     
-    // Set the Content-Type header.
-    std::string extension;
-    size_t extension_start = relative_file_path.find_last_of(".");
-    const char* content_type = NULL;
-    
-    if (extension_start != std::string::npos) {
-        extension = relative_file_path.substr(extension_start + 1);
+    if (is_immutable) {
+        evhttp_add_header(response_headers, "Cache-Control", kImmutableCacheControl);
     }
     
-    if      (extension == "css")    { content_type = "text/css";} 
-    else if (extension == "js")     { content_type = "text/javascript"; }
-    else if (extension == "png")    { content_type = "image/png"; }
-    else if (extension == "jpeg")   { content_type = "image/jpeg"; }
-    else if (extension == "jpg")    { content_type = "image/jpeg"; }
-    else if (extension == "gif")    { content_type = "image/gif"; }
-    else if (extension == "ico")    { content_type = "image/vnd.microsoft.icon"; }
-    else if (extension == "txt")    { content_type = "text/plain"; }
-    else if (extension == "h")      { content_type = "text/plain"; }
-    else if (extension == "cpp")    { content_type = "text/plain"; }
-    else if (extension == "hpp")    { content_type = "text/plain"; }
-    else if (extension == "html")   { content_type = "text/html"; }
-    else                            { content_type = "text/html"; }
+    // Check whether the user agent already has the right version of the file.
+    // If-None-Match takes precedence over If-Modified-Since.
+    const char* if_none_match = evhttp_find_header(request_headers, "If-None-Match");
+    bool is_not_modified = false;
     
-    evhttp_add_header(response_headers, "Content-Type", content_type);
+    if (if_none_match != NULL) {
+        is_not_modified = etag_matches(if_none_match, response->etag.c_str());
     
-    // Check whether the user agent already has the right version of the file.
-    // TODO: need to implement handling "If-None-Match" header.
-    struct evkeyvalq* request_headers = evhttp_request_get_input_headers(request);
-    const char* if_modified_since = evhttp_find_header(request_headers, "If-Modified-Since");
-    const time_t t_if_modified_since = string_to_time(if_modified_since);
+    } else {
+        // User agents echo Last-Modified back, so an exact match 
+        // saves parsing the date.
+        const char* if_modified_since = evhttp_find_header(request_headers, "If-Modified-Since");
+        is_not_modified = 
+            (if_modified_since != NULL 
+             && response->last_modified_string == if_modified_since)
+            || string_to_time(if_modified_since) >= response->last_modified;
+    }
     
-    if (t_if_modified_since >= cached_file->last_modified()) {
+    if (is_not_modified) {
         server_->send_response(request, std::string(""), HTTP_NOTMODIFIED);
         return;
     }
     
-    // Respond with the file data..
-    shared_array<char> file_data = cached_file->data();
-    size_t data_size = cached_file->data_size();
-    server_->send_response_data(request, file_data.get(), data_size, HTTP_OK);
+    // Respond with the file itself, or with the cached data.  Neither
+    // is copied into the response.  The file is the one the cached data
+    // was read from, kept open, so that it matches the headers even if
+    // the file has since been replaced.  Compressed variants only exist
+    // in the cache.
+    if (use_sendfile_ && response->file) {
+        server_->send_response_file(request, 
+                                    response->file->fd(), 
+                                    response->body_size, 
+                                    response->file, 
+                                    HTTP_OK);
+        return;
+    }
+    
+    server_->send_response_reference(request, response->body, response->body_size, HTTP_OK);
+}
+
+/**
+ * Set the URL root, making sure that it ends with "/".
+ */
+void FileHandler::set_url_root(const std::string& url_root) {
+    url_root_ = url_root;
+    
+    if (url_root_.empty() || url_root_[url_root_.size() - 1] != '/') {
+        url_root_ += '/';
+    }
+}
+
+/**
+ * Drop a file from the cache.
+ */
+void FileHandler::invalidate_file(const std::string& relative_path) {
+    file_cache_->invalidate(relative_path);
+}
+
+/**
+ * Handle a change to a file under the file root, reported by the
+ * file watcher.
+ */
+void FileHandler::handle_file_change(const std::string& relative_path) {
+    file_cache_->invalidate(relative_path);
+    
+    //Fall back to the cache period if the file root is no longer watched.
+    if (!file_watcher_.is_watching()) {
+        file_cache_->set_is_watched(false);
+    }
+    
+    if (change_callback_ != NULL) {
+        change_callback_(url_root_ + relative_path, change_callback_data_);
+    }
+}
+
+/**
+ * Show the file cache statistics, one "name value" pair per line.  
+ * Pretend that the page doesn't exist for the rest of the world.
+ */
+void FileHandler::handle_stats_request(struct evhttp_request* request) {
+    if (!server_->is_admin_request(request) || !file_cache_) {
+        server_->send_response(request, std::string(""), HTTP_NOTFOUND);
+        return;
+    }
+    
+    const FileCacheStats stats(file_cache_->stats());
+    std::stringstream page;
+    page << "hits " << stats.hits << "\n"
+         << "misses " << stats.misses << "\n"
+         << "negative_hits " << stats.negative_hits << "\n"
+         << "evictions " << stats.evictions << "\n"
+         << "resident_bytes " << stats.resident_bytes << "\n"
+         << "memory_budget " << stats.memory_budget << "\n"
+         << "files " << stats.num_files << "\n"
+         << "missing_files " << stats.num_missing_files << "\n";
+    
+    response_set_never_cache(request);
+    evhttp_add_header(evhttp_request_get_output_headers(request), "Content-Type", "text/plain");
+    server_->send_response(request, page.str(), HTTP_OK);
+}
+
+/**
+ * Set whether the files are sent straight from disk.  The cache then
+ * keeps the files open.
+ */
+void FileHandler::set_use_sendfile(bool use_sendfile) {
+    use_sendfile_ = use_sendfile;
+    
+    if (file_cache_) {
+        file_cache_->set_keeps_files_open(use_sendfile);
+    }
+}
+
+/**
+ * Set the limit on the memory taken by the cached files, in bytes.
+ */
+void FileHandler::set_memory_budget(size_t memory_budget) {
+    if (file_cache_) {
+        file_cache_->set_memory_budget(memory_budget);
+    }
+}
+
+/**
+ * Set the size from which files are mapped into memory rather than read.
+ */
+void FileHandler::set_mmap_threshold(size_t mmap_threshold) {
+    if (file_cache_) {
+        file_cache_->set_mmap_threshold(mmap_threshold);
+    }
+}
+
+/**
+ * Set cache control response header.  The header is part of the
+ * responses prepared by the file cache.
+ */
+void FileHandler::set_cache_control(const std::string& cache_control) {
+    cache_control_ = cache_control;
+    
+    if (file_cache_) {
+        file_cache_->set_cache_control(cache_control_);
+    }
 }
     
 /**
@@ -206,4 +592,131 @@ bool FileHandler::is_permitted_file_path(const std::string& file_path) const {
     return regex_match(file_path, allowed_path_pattern_);
 }
 
+/**
+ * Check whether an If-None-Match request header lists the given ETag,
+ * or is "*".  Weak tags match their strong counterparts, as the
+ * comparison for If-None-Match is a weak one.  The tags are compared
+ * in constant time.
+ */
+bool FileHandler::etag_matches(const char* if_none_match, const char* etag) {
+    const size_t etag_length = strlen(etag);
+    const char* p = if_none_match;
+    
+    while (*p != '\0') {
+        // Skip the separators between the tags.
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            ++p;
+        }
+        
+        const char* tag_start = p;
+        
+        while (*p != '\0' && *p != ',') {
+            ++p;
+        }
+        
+        const char* tag_end = p;
+        
+        while (tag_end > tag_start && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+            --tag_end;
+        }
+        
+        if (tag_end - tag_start == 1 && *tag_start == '*') {
+            return true;
+        }
+        
+        if (tag_end - tag_start > 2 && tag_start[0] == 'W' && tag_start[1] == '/') {
+            tag_start += 2;
+        }
+        
+        if (static_cast<size_t>(tag_end - tag_start) == etag_length) {
+            unsigned char difference = 0;
+            
+            for (size_t i = 0; i < etag_length; ++i) {
+                difference |= static_cast<unsigned char>(tag_start[i] ^ etag[i]);
+            }
+            
+            if (difference == 0) {
+                return true;
+            }
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * Parse the value of an Accept-Encoding request header into a 
+ * combination of ContentEncoding flags.  Codings with a zero
+ * quality value are left out; "*" stands for all the codings
+ * not listed explicitly.
+ */
+int FileHandler::accepted_encodings(const char* accept_encoding) {
+    if (accept_encoding == NULL) {
+        return IDENTITY_ENCODING;
+    }
+    
+    const int all_encodings = GZIP_ENCODING | BROTLI_ENCODING;
+    int accepted = IDENTITY_ENCODING;
+    int listed = IDENTITY_ENCODING;
+    bool accepts_any = false;
+    std::string header(accept_encoding);
+    size_t start = 0;
+    
+    while (start < header.size()) {
+        size_t end = header.find(',', start);
+        
+        if (end == std::string::npos) {
+            end = header.size();
+        }
+        
+        // Split the element into the coding and its parameters.
+        const std::string element(header.substr(start, end - start));
+        const size_t params_start = element.find(';');
+        std::string coding(element.substr(0, params_start));
+        coding.erase(0, coding.find_first_not_of(" \t"));
+        coding.erase(coding.find_last_not_of(" \t") + 1);
+        
+        for (size_t i = 0; i < coding.size(); ++i) {
+            coding[i] = tolower(coding[i]);
+        }
+        
+        // Only an explicit zero quality value refuses the coding.
+        bool is_accepted = true;
+        
+        if (params_start != std::string::npos) {
+            const size_t q_start = element.find("q=", params_start);
+            
+            if (q_start != std::string::npos) {
+                is_accepted = atof(element.c_str() + q_start + 2) > 0.0;
+            }
+        }
+        
+        int flag = IDENTITY_ENCODING;
+        
+        if (coding == "gzip" || coding == "x-gzip") {
+            flag = GZIP_ENCODING;
+        
+        } else if (coding == "br") {
+            flag = BROTLI_ENCODING;
+        
+        } else if (coding == "*") {
+            accepts_any = is_accepted;
+        }
+        
+        listed |= flag;
+        
+        if (is_accepted) {
+            accepted |= flag;
+        }
+        
+        start = end + 1;
+    }
+    
+    if (accepts_any) {
+        accepted |= all_encodings & ~listed;
+    }
+    
+    return accepted;
+}
+
 }
\ No newline at end of file
@@ -33,17 +33,26 @@
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
+#include "file_cache.h"
+#include "file_watcher.h"
+
 /// Predeclared request struct.
 struct evhttp_request;
 
 namespace isaword {
 
 class HttpServer;
-class FileCache;
 
 class FileHandler {
 public:
     static const size_t kDefaultCachePeriodSec = 3600;
+    
+    /// Number of threads loading the files missing from the cache, so 
+    /// that the event loop never waits for the disk.
+    static const size_t kNumIoThreads = 2;
+    
+    /// Number of hex digits of the content hash in fingerprinted paths.
+    static const size_t kFingerprintLength = 16;
 
     enum FileRootStatusCode {
         FILE_ROOT_OK = 0,
@@ -64,7 +73,10 @@ public:
      */
     FileHandler(size_t cache_period_sec = kDefaultCachePeriodSec)
     : is_attached_(false),
-    cache_period_sec_(cache_period_sec) {
+    cache_period_sec_(cache_period_sec),
+    use_sendfile_(false),
+    change_callback_(NULL),
+    change_callback_data_(NULL) {
     }
     
     /**
@@ -80,6 +92,61 @@ public:
     ServerAttachStatusCode attach_to_server(boost::shared_ptr<HttpServer> server, 
                          const std::string& url_root);
     
+    /**
+     * Load the files into the cache ahead of the requests, on a number
+     * of threads at once.  The files are taken from a manifest listing
+     * one path relative to the file root per line, or found by walking
+     * the file root if there is no manifest (an empty path) or it can't
+     * be read, which is logged.  Paths that would not be served are skipped.  Should be
+     * called after attach_to_server(), before the server starts serving.
+     *
+     * @return the number of files loaded; the bytes taken by them are 
+     * returned in bytes_loaded.
+     */
+    size_t warm_up(const std::string& manifest_path, size_t num_threads, size_t& bytes_loaded);
+    
+    /**
+     * Get the path of a file with the fingerprint of its current contents
+     * inserted before the extension, e.g. "js/isaword.0123456789abcdef.js".
+     * A request for that path gets the file with a Cache-Control that 
+     * lets it be kept for good, as long as the fingerprint is still the
+     * current one; otherwise it gets the current file, cached as usual.
+     * Loads the file if it's not cached yet, so it's meant for building
+     * pages rather than for the event loop.
+     *
+     * @return the fingerprinted path; empty if the file is not there, 
+     * would not be served, or has no extension.
+     */
+    std::string fingerprinted_path(const std::string& relative_path);
+    
+    /**
+     * Drop a file from the cache, so that it's loaded anew the next 
+     * time it's requested or fingerprinted.  Unlike a change reported
+     * by the file watcher, this doesn't call the change callback, so it
+     * can be used from any thread.
+     */
+    void invalidate_file(const std::string& relative_path);
+    
+    /**
+     * Split a fingerprinted path into the path of the file and the 
+     * fingerprint.  A file whose own name looks fingerprinted is still
+     * served under that name, as the requests look it up first.
+     *
+     * @return false if the path has no fingerprint, in which case 
+     * file_path and fingerprint are left as they are.
+     */
+    static bool split_fingerprint(const std::string& path, 
+                                  std::string& file_path, 
+                                  std::string& fingerprint);
+    
+    /**
+     * Add a page with the file cache statistics to the HTTP server, 
+     * at a given URL pattern.  The page is only shown to requests 
+     * with the administrator token (see HttpServer::is_admin_request()).
+     * Must be called after attach_to_server().
+     */
+    void attach_stats(boost::shared_ptr<HttpServer> server, const std::string& url_pattern);
+    
     /**
      * Callback function for HttpServer.
      */
@@ -88,10 +155,61 @@ public:
     }
     
     /**
-     * Handle a file request.
+     * Handle a file request.  A file that is not cached yet, or needs 
+     * to be refreshed, is loaded on an I/O thread, and the request 
+     * completed from the event loop once it's loaded.
      */
     void handle_request(struct evhttp_request* request);
     
+    /**
+     * Look a file up in the cache and send it, loading it on an I/O 
+     * thread if needed.  If there's no such file and a fallback path is
+     * given, the fallback is served instead, as requested by the given
+     * fingerprint; this is how a fingerprinted path is served, unless a
+     * file has that very name.
+     */
+    void serve_file(struct evhttp_request* request, 
+                    const std::string& relative_file_path,
+                    const std::string& fallback_path,
+                    const std::string& fallback_fingerprint);
+    
+    /**
+     * Callback function for FileCache::load_async(); called from an 
+     * I/O thread.
+     */
+    static void file_loaded_callback(const PreparedResponsePtr& response, void* pending_request);
+    
+    /**
+     * Callback function for the event loop, completing a request once
+     * its file has been loaded.
+     */
+    static void finish_request_callback(evutil_socket_t, short, void* pending_request);
+    
+    /**
+     * Callback function for the file cache statistics page.
+     */
+    static void stats_callback(struct evhttp_request* request, void* file_handler) {
+        ((FileHandler*) file_handler)->handle_stats_request(request);
+    }
+    
+    /**
+     * Show the file cache statistics, one "name value" pair per line.
+     */
+    void handle_stats_request(struct evhttp_request* request);
+    
+    /**
+     * Callback function for FileWatcher.
+     */
+    static void file_changed_callback(const std::string& relative_path, void* file_handler) {
+        ((FileHandler*) file_handler)->handle_file_change(relative_path);
+    }
+    
+    /**
+     * Handle a change to a file under the file root, reported by the
+     * file watcher.  An empty path means any file may have changed.
+     */
+    void handle_file_change(const std::string& relative_path);
+    
     /**
      * Check whether the file path is a permitted path (e.g. not
      * an absolute path, not a path leading up in the directory tree, 
@@ -99,25 +217,120 @@ public:
      */
     bool is_permitted_file_path(const std::string& file_path) const;
     
+    /**
+     * Check whether an If-None-Match request header lists the given
+     * quoted ETag (weak tags included), or is "*".  The tags are 
+     * compared in constant time.
+     */
+    static bool etag_matches(const char* if_none_match, const char* etag);
+    
+    /**
+     * Parse the value of an Accept-Encoding request header into a 
+     * combination of ContentEncoding flags.  Codings with a zero
+     * quality value are left out; "*" stands for all the codings
+     * not listed explicitly.
+     */
+    static int accepted_encodings(const char* accept_encoding);
+    
     /*=============== Getters/setters ==============*/
-    /// Set cache control response header.
-    void set_cache_control(const std::string& cache_control) {
-        cache_control_ = cache_control;
-    }
+    /// Set cache control response header.  The header is part of the
+    /// responses prepared by the file cache, so this should not be 
+    /// used once files have been served.
+    void set_cache_control(const std::string& cache_control);
     
     /// Get the cache control response header.
     std::string cache_control() const       {return cache_control_;}
     
+    /// Set the limit on the memory taken by the cached files, in bytes.
+    /// Should be called after initialize().
+    void set_memory_budget(size_t memory_budget);
+    
+    /// Set the size from which files are mapped into memory rather than
+    /// read.  Only for files that are replaced, never rewritten in place
+    /// (see CachedFile::kDefaultMmapThreshold).  Should be called after
+    /// initialize().
+    void set_mmap_threshold(size_t mmap_threshold);
+    
     /// Check whether the handler is attached to a server.
     bool is_attached() const                {return is_attached_;}
     
+    /// Set the URL root, ahead of attach_to_server(), so that the URLs
+    /// of the files are known before there's a server, e.g. to build the
+    /// bundles (see AssetPipeline) before the daemon is launched.
+    void set_url_root(const std::string& url_root);
+    
     /// Get the URL root
     std::string url_root() const            {return url_root_;}
     
     /// Get the directory to serve the files from.
     std::string file_root() const           {return file_root_;}
     
+    /// Check whether the files are watched for changes, rather than
+    /// checked on disk when the cache period has passed.
+    bool is_watching_files() const          {return file_watcher_.is_watching();}
+    
+    /// Set a function to call once a changed file has been dropped from
+    /// the cache, with the URL of the file; the URL root if any file may
+    /// have changed.  Called from the thread reporting the change, 
+    /// normally the server's event loop.
+    void set_change_callback(FileWatcher::ChangeCallback callback, void* callback_data) {
+        change_callback_ = callback;
+        change_callback_data_ = callback_data;
+    }
+    
+    /// Check whether the files are sent straight from disk (sendfile)
+    /// rather than from the cache.
+    bool use_sendfile() const               {return use_sendfile_;}
+    
+    /// Set whether the files are sent straight from disk.  Either way,
+    /// the file data is never copied into the response.  Sending from 
+    /// disk keeps a file descriptor open for each cached file.  Should
+    /// not be used once files have been served.
+    void set_use_sendfile(bool use_sendfile);
+    
 private:
+    /**
+     * A request waiting for its file to be loaded, and the event loop 
+     * it's to be completed on.
+     */
+    class PendingRequest {
+    public:
+        FileHandler* handler;
+        struct evhttp_request* request;
+        struct event_base* base;
+        std::string relative_path;
+        std::string fingerprint;
+        PreparedResponsePtr response;
+        
+        /// The file to look up if there's no file at relative_path, and
+        /// the fingerprint it was requested by.
+        std::string fallback_path;
+        std::string fallback_fingerprint;
+    };
+    
+    /**
+     * Send a prepared response for a file, or 304 Not Modified if the
+     * user agent already has it.  The fingerprint the file was requested
+     * with, if any, decides whether the response may be cached for good.
+     */
+    void send_file(struct evhttp_request* request, 
+                   const std::string& fingerprint,
+                   const PreparedResponsePtr& response);
+    
+    /**
+     * Append the paths, relative to the file root, of the files to be
+     * served from a directory and its subdirectories.
+     */
+    void list_files(const std::string& relative_dir, std::vector<std::string>& file_paths) const;
+    
+    /**
+     * Append the paths to be served listed in a manifest, skipping the
+     * blank lines and the lines starting with '#'.
+     * @return false if the manifest could not be read.
+     */
+    bool read_manifest(const std::string& manifest_path, 
+                       std::vector<std::string>& file_paths) const;
+    
     std::string file_root_;
     bool is_attached_;
     std::string url_root_;
@@ -126,6 +339,10 @@ private:
     /// The HttpServer to which this is attached.
     boost::shared_ptr<HttpServer> server_;
     
+    /// Watches the file root for changes, from the server's event loop.
+    /// Must be destroyed before the server.
+    FileWatcher file_watcher_;
+    
     /// The regex expression for permitted file paths.
     boost::regex allowed_path_pattern_;
     
@@ -134,6 +351,14 @@ private:
     
     /// Seconds to cache the files for.
     size_t cache_period_sec_;
+    
+    /// Whether the files are sent straight from disk.
+    bool use_sendfile_;
+    
+    /// Called once a changed file has been dropped from the cache; 
+    /// none if NULL.
+    FileWatcher::ChangeCallback change_callback_;
+    void* change_callback_data_;
 };
 
 
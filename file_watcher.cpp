@@ -0,0 +1,235 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Watching a directory tree for changed files, so that cached copies
+// of the files can be refreshed without checking the disk on every
+// request.
+
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+
+#include <event2/event.h>
+#include <event2/util.h>
+
+#include "file_watcher.h"
+
+namespace isaword {
+
+/// The changes worth reporting: anything that changes a file's contents
+/// or its presence, or the directory tree itself.
+static const uint32_t kWatchMask = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB 
+                                 | IN_CREATE | IN_DELETE | IN_MOVED_FROM 
+                                 | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+/*---------------------------------------------------------
+                    FileWatcher class.
+----------------------------------------------------------*/
+const size_t FileWatcher::kEventBufferSize;
+
+FileWatcher::~FileWatcher() {
+    if (event_ != NULL) {
+        event_free(event_);
+    }
+    
+    if (inotify_fd_ >= 0) {
+        close(inotify_fd_);
+    }
+}
+
+/**
+ * Start watching a directory tree.
+ * @return true on success; false if inotify is not available, or 
+ * the root directory could not be watched.
+ */
+bool FileWatcher::initialize(const std::string& root) {
+    if (inotify_fd_ >= 0) {
+        return false;
+    }
+    
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    
+    if (inotify_fd_ < 0) {
+        return false;
+    }
+    
+    root_ = root;
+    
+    if (root_.empty() || root_[root_.size() - 1] != '/') {
+        root_ += '/';
+    }
+    
+    if (!this->add_watch("")) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+        return false;
+    }
+    
+    return true;
+}
+
+/**
+ * Report the changes through the callback, from the given event loop.
+ * @return true on success, false if the watcher is not initialized
+ * or the event could not be added.
+ */
+bool FileWatcher::attach(struct event_base* base, ChangeCallback callback, void* callback_data) {
+    if (inotify_fd_ < 0 || event_ != NULL || base == NULL) {
+        return false;
+    }
+    
+    callback_ = callback;
+    callback_data_ = callback_data;
+    event_ = event_new(base, inotify_fd_, EV_READ | EV_PERSIST, 
+                       &FileWatcher::event_callback, this);
+    
+    if (event_ == NULL || event_add(event_, NULL) != 0) {
+        return false;
+    }
+    
+    return true;
+}
+
+/// Callback for libevent.
+void FileWatcher::event_callback(evutil_socket_t, short, void* watcher) {
+    static_cast<FileWatcher*>(watcher)->handle_events();
+}
+
+/**
+ * Read the pending inotify events, and report the changed files.
+ */
+void FileWatcher::handle_events() {
+    char buffer[kEventBufferSize] 
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    
+    while (true) {
+        const ssize_t length = read(inotify_fd_, buffer, sizeof(buffer));
+        
+        if (length <= 0) {
+            // EAGAIN: no more events for now.
+            return;
+        }
+        
+        for (const char* p = buffer; p < buffer + length; ) {
+            const struct inotify_event* event = 
+                reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            
+            if ((event->mask & IN_Q_OVERFLOW) != 0) {
+                // Events were lost.
+                this->report("");
+                continue;
+            }
+            
+            std::map<int, std::string>::iterator dir = watched_dirs_.find(event->wd);
+            
+            if (dir == watched_dirs_.end()) {
+                continue;
+            }
+            
+            if ((event->mask & IN_IGNORED) != 0) {
+                // The directory is gone, or no longer watched.
+                watched_dirs_.erase(dir);
+                this->report("");
+                continue;
+            }
+            
+            if ((event->mask & IN_ISDIR) != 0) {
+                // Directories coming and going may bring any number of
+                // files with them.
+                if ((event->mask & (IN_CREATE | IN_MOVED_TO)) != 0) {
+                    this->add_watch(dir->second + event->name + "/");
+                }
+                
+                if ((event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) != 0) {
+                    this->report("");
+                }
+                
+                continue;
+            }
+            
+            if (event->len > 0) {
+                this->report(dir->second + event->name);
+            }
+        }
+    }
+}
+
+/// Check whether the root directory is still being watched.
+bool FileWatcher::is_watching() const {
+    for (std::map<int, std::string>::const_iterator dir = watched_dirs_.begin();
+         dir != watched_dirs_.end();
+         ++dir) {
+        if (dir->second.empty()) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/// Watch a directory, given relative to the root, and all its
+/// subdirectories.
+bool FileWatcher::add_watch(const std::string& relative_dir) {
+    const std::string full_dir(root_ + relative_dir);
+    const int wd = inotify_add_watch(inotify_fd_, full_dir.c_str(), kWatchMask | IN_ONLYDIR);
+    
+    if (wd < 0) {
+        return false;
+    }
+    
+    watched_dirs_[wd] = relative_dir;
+    
+    DIR* dir = opendir(full_dir.c_str());
+    
+    if (dir == NULL) {
+        return true;
+    }
+    
+    for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        const std::string name(entry->d_name);
+        
+        if (name == "." || name == "..") {
+            continue;
+        }
+        
+        struct stat stat_buffer;
+        
+        if (lstat((full_dir + name).c_str(), &stat_buffer) == 0 
+                && S_ISDIR(stat_buffer.st_mode)) {
+            this->add_watch(relative_dir + name + "/");
+        }
+    }
+    
+    closedir(dir);
+    return true;
+}
+
+/// Report a changed file.
+void FileWatcher::report(const std::string& relative_path) const {
+    if (callback_ != NULL) {
+        callback_(relative_path, callback_data_);
+    }
+}
+
+} /* namespace isaword */
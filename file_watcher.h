@@ -0,0 +1,114 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Watching a directory tree for changed files, so that cached copies
+// of the files can be refreshed without checking the disk on every
+// request.
+
+#ifndef ISAWORD_FILE_WATCHER_H
+#define ISAWORD_FILE_WATCHER_H
+
+#include <map>
+#include <string>
+#include <event2/event.h>
+#include <event2/util.h>
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    FileWatcher class.
+----------------------------------------------------------*/
+/**
+ * Watches a directory and all its subdirectories with inotify, and 
+ * reports the files that change through a callback run by a libevent
+ * loop.  The paths reported are relative to the watched root.  An 
+ * empty path means that any file may have changed, e.g. when inotify
+ * dropped events, or a directory was moved.
+ */
+class FileWatcher {
+public:
+    /// The callback invoked for each changed file.
+    typedef void (*ChangeCallback)(const std::string& relative_path, void* data);
+    
+    /// Buffer size for reading the inotify events.
+    static const size_t kEventBufferSize = 16384;
+    
+    FileWatcher()
+    : inotify_fd_(-1),
+      event_(NULL),
+      callback_(NULL),
+      callback_data_(NULL) {
+    }
+    
+    ~FileWatcher();
+    
+    /**
+     * Start watching a directory tree.
+     * @return true on success; false if inotify is not available, or 
+     * the root directory could not be watched.
+     */
+    bool initialize(const std::string& root);
+    
+    /**
+     * Report the changes through the callback, from the given event loop.
+     * @return true on success, false if the watcher is not initialized
+     * or the event could not be added.
+     */
+    bool attach(struct event_base* base, ChangeCallback callback, void* callback_data);
+    
+    /**
+     * Read the pending inotify events, and report the changed files.
+     * Called by the event loop when the inotify descriptor is readable.
+     */
+    void handle_events();
+    
+    /*=============== Getters/Setters ====================*/
+    /// Check whether the root directory is still being watched.
+    bool is_watching() const;
+    
+    /// Get the number of directories being watched.
+    size_t num_watched_dirs() const             {return watched_dirs_.size();}
+    
+    /// Get the watched directory, with a trailing slash.
+    std::string root() const                    {return root_;}
+    
+private:
+    /// Callback for libevent.
+    static void event_callback(evutil_socket_t fd, short what, void* watcher);
+    
+    /// Watch a directory, given relative to the root, and all its
+    /// subdirectories.
+    bool add_watch(const std::string& relative_dir);
+    
+    /// Report a changed file.
+    void report(const std::string& relative_path) const;
+    
+    int inotify_fd_;
+    struct event* event_;
+    std::string root_;
+    
+    /// Relative paths of the watched directories (with a trailing 
+    /// slash, or empty for the root), by watch descriptor.
+    std::map<int, std::string> watched_dirs_;
+    
+    ChangeCallback callback_;
+    void* callback_data_;
+};
+
+} /* namespace isaword */
+#endif
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+//Measures how fast pseudowords are generated at each difficulty, and
+//how likely they are under the model.  Each letter costs the same at
+//every difficulty; the words per second differ only as much as the
+//average word length does.
+//Usage: 
+// $ ./benchmark_makewords <num_words> <dictionary_file>
+// e.g
+// $ ./benchmark_makewords 100000 owl2.txt
+
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <sys/time.h>
+#include <boost/lexical_cast.hpp>
+#include "pseudoword_generator.h"
+
+using makewords::Difficulty;
+using makewords::PseudowordGenerator;
+
+const size_t kReadBufferSize = 30;
+
+/// Get the current time in seconds.
+double now() {
+    struct timeval time;
+    gettimeofday(&time, NULL);
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_usec) / 1e6;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage:" << std::endl;
+        std::cerr << "    benchmark_makewords <num_words> <dictionary_file>" << std::endl;
+        return 1;
+    }
+    
+    int num_words = 0;
+    try {
+        num_words = boost::lexical_cast<int>(argv[1]);
+    
+    } catch (boost::bad_lexical_cast &) {
+        std::cerr << "Error: first argument should be an integer; "
+                  << "received \"" << argv[1] << "\" instead." << std::endl;
+        return 1;
+    }
+    
+    std::ifstream dictionary_file(argv[2], std::ifstream::in);
+    if (dictionary_file.fail()) {
+        std::cerr << "Error: cannot open file " << argv[2] << std::endl;
+        return 1;
+    }
+    
+    //Train the generator.
+    PseudowordGenerator generator("ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    generator.initialize();
+    char buffer[kReadBufferSize];
+    
+    while (!dictionary_file.eof()) {
+        dictionary_file.getline(buffer, kReadBufferSize);
+        std::string word(buffer);
+        
+        if (word.length() > 0) {
+            generator.add_dictionary_word(word);
+        }
+    }
+    
+    dictionary_file.close();
+    generator.prepare_for_generation();
+    
+    //Generate the words at each difficulty.
+    const char* difficulty_names[] = {"easy", "normal", "tricky"};
+    std::cout << std::setw(10) << "difficulty" 
+              << std::setw(14) << "words/sec" 
+              << std::setw(14) << "letters/sec" 
+              << std::setw(14) << "log p/word" 
+              << std::setw(14) << "log p/letter" << std::endl;
+    
+    for (size_t i = 0; i < PseudowordGenerator::kNumDifficulties; ++i) {
+        const Difficulty difficulty = static_cast<Difficulty>(i);
+        double total_log_probability = 0;
+        size_t total_length = 0;
+        const double start_time = now();
+        
+        for (int j = 0; j < num_words; ++j) {
+            double log_probability = 0;
+            total_length += generator.make_word(0, difficulty, &log_probability).length();
+            total_log_probability += log_probability;
+        }
+        
+        const double elapsed_time = now() - start_time;
+        std::cout << std::setw(10) << difficulty_names[i]
+                  << std::setw(14) << static_cast<int>(num_words / elapsed_time)
+                  << std::setw(14) << static_cast<int>(total_length / elapsed_time)
+                  << std::setw(14) << std::setprecision(4) << total_log_probability / num_words
+                  << std::setw(14) << std::setprecision(4) << total_log_probability / total_length
+                  << std::endl;
+    }
+    
+    return 0;
+}
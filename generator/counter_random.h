@@ -0,0 +1,81 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef MAKEWORDS_COUNTER_RANDOM_H
+#define MAKEWORDS_COUNTER_RANDOM_H
+
+// A counter-based random number generator, used where the same
+// seed must always give the same words.
+
+#include <boost/cstdint.hpp>
+
+namespace makewords {
+
+/**
+ * A counter-based random number generator in the style of SplitMix64:
+ * the n-th number of a stream is a hash of the stream's key and n.  Any
+ * number can be computed without the ones before it, and streams with
+ * different keys are independent, so a stream can be split into
+ * several that are used in any order, or in parallel.
+ */
+class CounterRandom {
+public:
+    explicit CounterRandom(boost::uint64_t key)
+    : key_(key), 
+      counter_(0) {
+    }
+    
+    /// Get the next number in [0, 1).
+    double operator()() {
+        return static_cast<double>(this->next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    
+    /// Get the next 64 random bits.
+    boost::uint64_t next() {
+        counter_++;
+        return mix(key_ + counter_ * 0x9E3779B97F4A7C15ULL);
+    }
+    
+    /// Make an independent stream keyed on this stream's key and a value.
+    CounterRandom fork(boost::uint64_t value) const {
+        return CounterRandom(combine(key_, value));
+    }
+    
+    /// Combine a key with a value into a new key.
+    static boost::uint64_t combine(boost::uint64_t key, boost::uint64_t value) {
+        return mix(key ^ mix(value + 0x9E3779B97F4A7C15ULL));
+    }
+    
+    /// Scramble the bits of a number; this is SplitMix64's finalizer.
+    static boost::uint64_t mix(boost::uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    
+    /// Get the key of the stream.
+    boost::uint64_t key() const         {return key_;}
+    
+private:
+    boost::uint64_t key_;
+    boost::uint64_t counter_;
+};
+
+}; /* namespace makewords */
+
+#endif
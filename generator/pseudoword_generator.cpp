@@ -34,20 +34,22 @@ namespace makewords {
 ----------------------------------------------------------*/
 
 const int PseudowordGenerator::kDefaultNumCondidiontingCharacters;
+const size_t PseudowordGenerator::kNumDifficulties;
+const double PseudowordGenerator::kDifficultyTemperatures[kNumDifficulties] = {2.0, 1.0, 0.6};
 
 PseudowordGenerator::PseudowordGenerator(const std::string& alphabet)
 :alphabet_(alphabet), 
 num_conditioning_characters_(kDefaultNumCondidiontingCharacters),
 preceding_chars_(kDefaultNumCondidiontingCharacters, alphabet),
-random_numbers_generator_(time(0)),
-uniform_01_(),
-random_01_(random_numbers_generator_, uniform_01_) {
+random_(CounterRandom::mix(static_cast<boost::uint64_t>(time(0)))) {
     const int alphabet_size = static_cast<int>(alphabet.size());
     num_matrix_rows_ = (alphabet_size + 1) * (alphabet_size + 1);
     num_matrix_columns_ = (alphabet_size + 1);
     const size_t matrix_size = static_cast<size_t>(num_matrix_rows_ * num_matrix_columns_);
     sampling_matrix_ = std::vector<int>(matrix_size, 0);
     transition_matrix_ = std::vector<double>(matrix_size, 0);
+    tempered_matrices_ = std::vector<double>(matrix_size * kNumDifficulties, 0);
+    log_probabilities_ = std::vector<double>(matrix_size, 0);
     
     //Initialize the column indexes of letters.
     column_indexes_.resize(kAlphabetSpaceSize, kNoColumnIndex);
@@ -55,11 +57,37 @@ random_01_(random_numbers_generator_, uniform_01_) {
     for (size_t i = 0; i < alphabet.size(); ++i) {
         column_indexes_[alphabet[i]] = i;
     }
+    
+    //Tabulate the row that follows each row and column, so that making
+    //a word doesn't touch preceding_chars_, and several threads can
+    //make words at once.  Column -1 stands for the start of the word.
+    const int end_column = num_matrix_columns_ - 1;
+    next_row_indexes_ = std::vector<int>(matrix_size, -1);
+    preceding_chars_.set_word_start();
+    start_row_index_ = preceding_chars_.row_index();
+    
+    for (int first = -1; first < end_column; ++first) {
+        for (int second = (first < 0) ? -1 : 0; second <= end_column; ++second) {
+            this->set_preceding_columns(first, second);
+            const int row_index = preceding_chars_.row_index();
+            
+            if (row_index < 0) {
+                continue;
+            }
+            
+            for (int column = 0; column <= end_column; ++column) {
+                this->set_preceding_columns(first, second);
+                this->add_preceding_column(column);
+                next_row_indexes_[row_index * num_matrix_columns_ + column] = 
+                    preceding_chars_.row_index();
+            }
+        }
+    }
 }
 
 bool PseudowordGenerator::initialize(size_t expected_dictionary_size) {
     //Initialize the hash set.
-    dictionary_ = sparse_hash_set<std::string, boost::hash<std::string>, eqstr>(expected_dictionary_size);
+    dictionary_ = Dictionary(expected_dictionary_size);
     return true;
 }
 
@@ -77,7 +105,7 @@ bool PseudowordGenerator::add_dictionary_word(const std::string& word) {
     }
     
     //Add the word to the dictionary.
-    dictionary_.insert(word);
+    dictionary_.insert(boost::hash<std::string>()(word));
     
     //Add the word to the matrix.
     preceding_chars_.set_word_start();
@@ -151,49 +179,130 @@ bool PseudowordGenerator::prepare_for_generation() {
             }
         }
     }
+    
+    //Precompute the rows at each temperature, so that generating a
+    //word of any difficulty costs the same, and the log probability
+    //of each transition, so that a word's probability is a sum.  Only
+    //the letters are tempered; the chance of ending the word is kept,
+    //so that the words are as long at every difficulty.
+    const int end_column = num_matrix_columns_ - 1;
+    const size_t matrix_size = transition_matrix_.size();
+    tempered_matrices_.assign(matrix_size * kNumDifficulties, 0);
+    log_probabilities_.assign(matrix_size, 0);
+    
+    for (int row = 0; row < num_matrix_rows_; ++row) {
+        const int row_offset = row * num_matrix_columns_;
+        double total_transitions = 0;
+        int last_column = -1;
+        
+        for (int column = 0; column < num_matrix_columns_; ++column) {
+            const int num_transitions = sampling_matrix_[row_offset + column];
+            total_transitions += static_cast<double>(num_transitions);
+            
+            if (num_transitions > 0) {
+                last_column = column;
+            }
+        }
+        
+        if (last_column < 0) {
+            continue;
+        }
+        
+        for (int column = 0; column <= last_column; ++column) {
+            const double num_transitions = static_cast<double>(sampling_matrix_[row_offset + column]);
+            
+            if (num_transitions > 0) {
+                log_probabilities_[row_offset + column] = log(num_transitions / total_transitions);
+            }
+        }
+        
+        for (size_t difficulty = 0; difficulty < kNumDifficulties; ++difficulty) {
+            const double exponent = 1.0 / kDifficultyTemperatures[difficulty];
+            double* tempered_row = &tempered_matrices_[difficulty * matrix_size + row_offset];
+            double total_letter_weight = 0;
+            
+            for (int column = 0; column < end_column; ++column) {
+                const double num_transitions = static_cast<double>(sampling_matrix_[row_offset + column]);
+                tempered_row[column] = (num_transitions > 0) ? pow(num_transitions, exponent) : 0;
+                total_letter_weight += tempered_row[column];
+            }
+            
+            const double end_probability = 
+                static_cast<double>(sampling_matrix_[row_offset + end_column]) / total_transitions;
+            const double letter_scale = (total_letter_weight > 0) ? 
+                (1 - end_probability) / total_letter_weight : 0;
+            double cumulative_probability = 0;
+            
+            for (int column = 0; column < last_column; ++column) {
+                cumulative_probability += tempered_row[column] * letter_scale;
+                tempered_row[column] = cumulative_probability;
+            }
+            
+            //Make sure that rounding never lets the walk fall off the row.
+            for (int column = last_column; column < num_matrix_columns_; ++column) {
+                tempered_row[column] = 1;
+            }
+        }
+    }
 
     return true;
 }
 
 std::string PseudowordGenerator::make_word(size_t max_length) const {
+    return this->make_word(max_length, NORMAL_DIFFICULTY);
+}
+
+std::string PseudowordGenerator::make_word(size_t max_length, 
+                                           Difficulty difficulty, 
+                                           double* log_probability) const {
+    return this->make_word(random_, max_length, difficulty, log_probability);
+}
+
+std::string PseudowordGenerator::make_word(CounterRandom& random,
+                                           size_t max_length, 
+                                           Difficulty difficulty, 
+                                           double* log_probability) const {
     //Use the transition matrix to generate the word.
     //If the produced word is actually a dictionary word, try again.
+    const double* transition_matrix = &tempered_matrices_[difficulty * transition_matrix_.size()];
     std::string word;
+    double word_log_probability = 0;
     
     do {
         word = "";
+        word_log_probability = 0;
         bool is_at_last_character = false;
         bool has_word_ended = false;
-        preceding_chars_.set_word_start();
+        int row_index = start_row_index_;
         size_t num_chars = 0;
         bool completed_a_word = true;
         
         do {
-            const int row_offset = preceding_chars_.row_index() * num_matrix_columns_;
-            const double p = random_01_();
+            const int row_offset = row_index * num_matrix_columns_;
+            const double p = random();
             
             //Find which letter this corresponds to.
             int column = 0;
-            while (p > transition_matrix_[row_offset + column]) {
+            while (p > transition_matrix[row_offset + column]) {
                 column++;
             }
             
+            word_log_probability += log_probabilities_[row_offset + column];
+            
             if (column != (num_matrix_columns_ - 1)) {
                 const char ch = alphabet_[column];
                 word += ch;
                 
                 if (is_at_last_character) {
                     has_word_ended = true;
-                
-                } else {
-                    preceding_chars_.set_next_char(ch);
                 }
             
             } else {
                 is_at_last_character = true;
-                preceding_chars_.set_next_char_end_of_word();
             }
             
+            row_index = next_row_indexes_[row_offset + column];
+            
             //Make sure that the word is not too long.
             num_chars++;
             
@@ -210,21 +319,46 @@ std::string PseudowordGenerator::make_word(size_t max_length) const {
         
     } while (this->is_dictionary_word(word));
     
+    if (log_probability != NULL) {
+        *log_probability = word_log_probability;
+    }
+    
     return word;
 }
 
 std::string PseudowordGenerator::make_word(const boost::regex& criteria, 
                                            size_t max_length) const {
+    return this->make_word(criteria, max_length, NORMAL_DIFFICULTY);
+}
+
+std::string PseudowordGenerator::make_word(const boost::regex& criteria, 
+                                           size_t max_length,
+                                           Difficulty difficulty, 
+                                           double* log_probability) const {
+    return this->make_word(random_, criteria, max_length, difficulty, log_probability);
+}
+
+std::string PseudowordGenerator::make_word(CounterRandom& random,
+                                           const boost::regex& criteria, 
+                                           size_t max_length,
+                                           Difficulty difficulty, 
+                                           double* log_probability) const {
     //Use the transition matrix to generate the word.
     //If the produced word is actually a dictionary word, try again.
     std::string word;
     do {
-        word = this->make_word(max_length);
+        word = this->make_word(random, max_length, difficulty, log_probability);
     } while (!boost::regex_match(word, criteria));
     
     return word;
 }
 
+std::vector<double> PseudowordGenerator::tempered_matrix(Difficulty difficulty) const {
+    const size_t matrix_size = transition_matrix_.size();
+    return std::vector<double>(tempered_matrices_.begin() + difficulty * matrix_size,
+                               tempered_matrices_.begin() + (difficulty + 1) * matrix_size);
+}
+
 
 
 bool PseudowordGenerator::set_sampling_matrix(const std::vector<int>& matrix) {
@@ -237,8 +371,26 @@ bool PseudowordGenerator::set_sampling_matrix(const std::vector<int>& matrix) {
 //    return false;
 //}
 
+void PseudowordGenerator::set_preceding_columns(int first, int second) {
+    preceding_chars_.set_word_start();
+    this->add_preceding_column(first);
+    this->add_preceding_column(second);
+}
+
+void PseudowordGenerator::add_preceding_column(int column) {
+    if (column < 0) {
+        return;
+    
+    } else if (column == num_matrix_columns_ - 1) {
+        preceding_chars_.set_next_char_end_of_word();
+    
+    } else {
+        preceding_chars_.set_next_char(alphabet_[column]);
+    }
+}
+
 bool PseudowordGenerator::is_dictionary_word(const std::string& word) const {
-    Dictionary::const_iterator it = dictionary_.find(word);
+    Dictionary::const_iterator it = dictionary_.find(boost::hash<std::string>()(word));
     return (it != dictionary_.end());
 }
 
@@ -22,16 +22,14 @@
 // Definition of the Markov Chain pseudoword generator.
 // 
 #include <bitset>
+#include <functional>
 #include <string>
 #include <vector>
 #include <boost/functional/hash.hpp>
-#include <boost/random.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_01.hpp>
-#include <boost/random/variate_generator.hpp>
 #include <boost/regex.hpp>
 #include <google/sparse_hash_set>
 #include <google/dense_hash_map>
+#include "counter_random.h"
 #include "utils.h"
 
 namespace makewords {
@@ -111,12 +109,26 @@ private:
     RowIndexMap row_index_map_;
 };
 
+/**
+ * How word-like the generated pseudowords should be.  Easy pseudowords
+ * are less likely under the model than the dictionary words, tricky
+ * ones more likely.
+ */
+enum Difficulty {
+    EASY_DIFFICULTY = 0,
+    NORMAL_DIFFICULTY = 1,
+    TRICKY_DIFFICULTY = 2
+};
+
 /**
  * This class is responsible for generating the pseudowords.
  */
 class PseudowordGenerator {
 private:
-    typedef google::sparse_hash_set<std::string, boost::hash<std::string>, eqstr> Dictionary;
+    /// Dictionary words are remembered only by their hashes; the words
+    /// themselves are usually kept elsewhere.  A hash collision can only
+    /// make the generator discard a good pseudoword.
+    typedef google::sparse_hash_set<size_t, boost::hash<size_t>, std::equal_to<size_t> > Dictionary;
 
 public:
     static const int kDefaultNumCondidiontingCharacters = 2;
@@ -124,6 +136,14 @@ public:
     static const size_t kAlphabetSpaceSize = 256;
     static const int kNoColumnIndex = -1;
     
+    /// Number of difficulty levels.
+    static const size_t kNumDifficulties = 3;
+    
+    /// Temperature of the transition probabilities for each difficulty:
+    /// each probability is raised to the power of 1 / temperature, and
+    /// the row rescaled to add up to 1.
+    static const double kDifficultyTemperatures[kNumDifficulties];
+    
     /*========= Main logic =======*/
     /** 
      * Create the generator.  The generator will attempt to create the
@@ -159,7 +179,8 @@ public:
     /**
      * Prepare the generator for pseudoword generation.  Invoke this when
      * you're done adding dictionary words, and want to start generating
-     * pseudowords.  Invoking this updates the transition_matrix_.
+     * pseudowords.  Invoking this updates the transition_matrix_, and
+     * the tempered transition matrices for all difficulties.
      * Will return true if succeeded, false if no dictionary words have been
      * provided.
      */
@@ -174,6 +195,26 @@ public:
      */
     std::string make_word(size_t max_length = 0) const;
     
+    /**
+     * Generate a pseudoword of a given difficulty.  If log_probability
+     * is not NULL, it will receive the natural log of the probability of
+     * the word under the (untempered) model.
+     */
+    std::string make_word(size_t max_length, 
+                          Difficulty difficulty, 
+                          double* log_probability = NULL) const;
+    
+    /**
+     * Generate a pseudoword of a given difficulty, drawing the random
+     * numbers from the given stream; the same stream always gives the
+     * same word.  Unlike the overloads using the generator's own stream,
+     * this may be called from several threads at once.
+     */
+    std::string make_word(CounterRandom& random,
+                          size_t max_length, 
+                          Difficulty difficulty, 
+                          double* log_probability = NULL) const;
+    
     /**
      * Generate a pseudoword satisfying specific criteria.  The pseudoword 
      * will be checked against existing dictionary words to ensure that it 
@@ -183,6 +224,25 @@ public:
      */
     std::string make_word(const boost::regex& criteria, size_t max_length = 0) const;
     
+    /**
+     * Generate a pseudoword of a given difficulty satisfying specific
+     * criteria.  See make_word(size_t, Difficulty, double*).
+     */
+    std::string make_word(const boost::regex& criteria, 
+                          size_t max_length,
+                          Difficulty difficulty, 
+                          double* log_probability = NULL) const;
+    
+    /**
+     * Generate a pseudoword of a given difficulty satisfying specific
+     * criteria, drawing the random numbers from the given stream.
+     */
+    std::string make_word(CounterRandom& random,
+                          const boost::regex& criteria, 
+                          size_t max_length,
+                          Difficulty difficulty, 
+                          double* log_probability = NULL) const;
+    
     /*========= Getters/setters =======*/
     
     ///Get the alphabet.
@@ -213,6 +273,20 @@ public:
     ///Get the cumulative transition matrix.
     std::vector<double> transition_matrix() const   {return transition_matrix_;}
     
+    ///Get the cumulative transition matrix for a difficulty.
+    std::vector<double> tempered_matrix(Difficulty difficulty) const;
+    
+    ///Get the log of each transition's probability; 0 for transitions
+    ///that never occur.
+    std::vector<double> log_probabilities() const   {return log_probabilities_;}
+    
+    ///Get the row that follows each row and column of the transition
+    ///matrix, laid out like the matrix; -1 where there is none.
+    std::vector<int> next_row_indexes() const       {return next_row_indexes_;}
+    
+    ///Get the row for the start of a word.
+    int start_row_index() const                     {return start_row_index_;}
+    
     ///Get the column indexes of the letters.
     ///Letters with no column index should have index of kNoColumnIndex.
     std::vector<int> column_indexes() const         {return column_indexes_;}
@@ -223,6 +297,14 @@ public:
     bool is_dictionary_word(const std::string& word) const;
     
 private:
+    /// Set preceding_chars_ to the start of a word followed by the
+    /// characters of two columns; column -1 adds nothing.
+    void set_preceding_columns(int first, int second);
+    
+    /// Add the character of a column to preceding_chars_; column -1
+    /// adds nothing.
+    void add_preceding_column(int column);
+    
     /// The error message.
     std::string error_message_;
     
@@ -246,23 +328,31 @@ private:
     /// Can be updated by invoking prepare_for_generation().
     std::vector<double> transition_matrix_;
     
-    /// Storage place for all valid dictionary words.
+    /// Cumulative transition matrices at each difficulty's temperature,
+    /// one after another.  Can be updated by invoking prepare_for_generation().
+    std::vector<double> tempered_matrices_;
+    
+    /// Natural log of each transition's probability.
+    std::vector<double> log_probabilities_;
+    
+    /// Hashes of all valid dictionary words.
     Dictionary dictionary_; 
     
-    /// An internal helper to keep track of preceding characters.
-    mutable PrecedingChars preceding_chars_;
+    /// An internal helper to keep track of preceding characters while
+    /// adding dictionary words.
+    PrecedingChars preceding_chars_;
     
-    /// Column index of each letter.
-    std::vector<int> column_indexes_;
+    /// The row that follows each row and column of the transition matrix.
+    std::vector<int> next_row_indexes_;
     
-    /// Random numbers generator.
-    mutable boost::mt19937 random_numbers_generator_;
+    /// The row for the start of a word.
+    int start_row_index_;
     
-    /// Uniform [0, 1] distribution.
-    mutable boost::uniform_01<> uniform_01_;
+    /// Column index of each letter.
+    std::vector<int> column_indexes_;
     
-    /// The main generator.
-    mutable boost::variate_generator<boost::mt19937&, boost::uniform_01<> > random_01_;
+    /// Random numbers for the words made without a stream of their own.
+    mutable CounterRandom random_;
 };
 
 }; /* namespace makewords */
@@ -20,6 +20,7 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE PseudowordGenerator
 
+#include <math.h>
 #include <sstream>
 #include <vector>
 #include <string>
@@ -212,6 +213,42 @@ BOOST_AUTO_TEST_CASE(index_calculations) {
 
 BOOST_AUTO_TEST_SUITE_END()
 
+/*---------------------------------------------------------
+                    CounterRandom tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(CounterRandom_tests)
+
+BOOST_AUTO_TEST_CASE(same_key_same_numbers) {
+    CounterRandom first(42);
+    CounterRandom second(42);
+    CounterRandom other(43);
+    size_t num_same_numbers = 0;
+    
+    for (int i = 0; i < 100; ++i) {
+        const double number = first();
+        BOOST_CHECK(number >= 0 && number < 1);
+        BOOST_CHECK_EQUAL(number, second());
+        num_same_numbers += (number == other());
+    }
+    
+    BOOST_CHECK_EQUAL(num_same_numbers, 0);
+}
+
+BOOST_AUTO_TEST_CASE(fork) {
+    CounterRandom random(42);
+    CounterRandom first_fork(random.fork(1));
+    random.next();
+    CounterRandom second_fork(random.fork(1));
+    CounterRandom other_fork(random.fork(2));
+    
+    //Forks depend on the key and the value, not on the numbers drawn.
+    BOOST_CHECK_EQUAL(first_fork.key(), second_fork.key());
+    BOOST_CHECK(first_fork.key() != other_fork.key());
+    BOOST_CHECK(first_fork.key() != random.key());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 /*---------------------------------------------------------
                 PseudowordGenerator tests.
 ----------------------------------------------------------*/
@@ -356,6 +393,20 @@ BOOST_AUTO_TEST_CASE(constructor_small_alphabet) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(next_row_indexes) {
+    //The rows are numbered as in the PrecedingChars index calculation
+    //tests: ^^, ^A, ..., ^E, AA, AB, AD, AE, A$, BA, ...
+    PseudowordGenerator generator(make_small_alphabet());
+    const std::vector<int> next_rows(generator.next_row_indexes());
+    const int num_columns = generator.num_matrix_columns();
+    
+    BOOST_CHECK_EQUAL(generator.start_row_index(), 0);
+    BOOST_CHECK_EQUAL(next_rows[0 * num_columns + 0], 1);   // ^^ + A -> ^A
+    BOOST_CHECK_EQUAL(next_rows[1 * num_columns + 1], 6);   // ^A + B -> AB
+    BOOST_CHECK_EQUAL(next_rows[6 * num_columns + 4], 14);  // AB + $ -> B$
+    BOOST_CHECK_EQUAL(next_rows[9 * num_columns + 2], -1);  // A$ + D
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /*========= Initialization tests. ===================*/
@@ -685,6 +736,37 @@ BOOST_AUTO_TEST_CASE(prepare_for_generation) {
     }
 }
 
+BOOST_AUTO_TEST_CASE(tempered_matrices) {
+    generator.set_sampling_matrix(sampling_matrix);
+    generator.prepare_for_generation();
+    const std::vector<double> normal_matrix(generator.tempered_matrix(NORMAL_DIFFICULTY));
+    const std::vector<double> easy_matrix(generator.tempered_matrix(EASY_DIFFICULTY));
+    const std::vector<double> tricky_matrix(generator.tempered_matrix(TRICKY_DIFFICULTY));
+    const int num_columns = generator.num_matrix_columns();
+    
+    for (size_t i = 0; i < normal_matrix.size(); ++i) {
+        BOOST_CHECK_CLOSE(normal_matrix[i] + 1, expected_transition_matrix[i] + 1, 1e-5);
+    }
+    
+    //The chance of ending the word is the same at every difficulty; the
+    //most likely letter gets likelier as the words get trickier.
+    for (int row = 0; row < generator.num_matrix_rows(); ++row) {
+        const int end_index = (row + 1) * num_columns - 1;
+        
+        if (expected_transition_matrix[end_index] == 0) {
+            continue;
+        }
+        
+        const double end_probability = 1 - expected_transition_matrix[end_index - 1];
+        BOOST_CHECK_CLOSE(1 - easy_matrix[end_index - 1], end_probability, 1e-5);
+        BOOST_CHECK_CLOSE(1 - tricky_matrix[end_index - 1], end_probability, 1e-5);
+    }
+    
+    //Row 0: 0.39, 0.28, 0.19, 0.05, 0.1.
+    BOOST_CHECK_LT(easy_matrix[0], normal_matrix[0]);
+    BOOST_CHECK_GT(tricky_matrix[0], normal_matrix[0]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /*========= Check the word generation process. ===================*/
@@ -747,4 +829,22 @@ BOOST_AUTO_TEST_CASE(make_word) {
     }
 }
 
+
+BOOST_AUTO_TEST_CASE(make_word_log_probability) {
+    //The only choice is after "EA", where the word either ends with
+    //a D or goes on with an E, with equal probability.
+    std::string base_word("BEAEAD");
+    generator.add_dictionary_word(base_word);
+    generator.prepare_for_generation();
+    
+    for (size_t i = 0; i < PseudowordGenerator::kNumDifficulties; ++i) {
+        for (int j = 0; j < 5; ++j) {
+            double log_probability = 1;
+            std::string pseudoword(generator.make_word(0, static_cast<Difficulty>(i), &log_probability));
+            const double num_choices = static_cast<double>(pseudoword.length() - 2) / 2;
+            BOOST_CHECK_CLOSE(log_probability, num_choices * log(0.5), 1e-6);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
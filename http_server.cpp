@@ -16,15 +16,23 @@
  * under the License.
  */
 
+#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <iostream>
 #include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 #include <event2/event.h>
 #include <event2/http.h>
+#include <event2/thread.h>
 #include <event2/buffer.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
@@ -38,10 +46,16 @@ using boost::shared_ptr;
 /*---------------------------------------------------------
                     HttpServer class.
 ----------------------------------------------------------*/
+const int HttpServer::kListenBacklog;
+const size_t HttpServer::kMaxBodySize;
+
 void HttpServer::initialize() {
+    // Let the workers' event loops be stopped from another thread.
+    evthread_use_pthreads();
     event_base_ = event_base_new();
     server_ = evhttp_new(event_base_);
     evhttp_set_gencb(server_, &HttpServer::event_handler, (void*)this);
+    evhttp_set_max_body_size(server_, kMaxBodySize);
     not_found_handler_ = boost::shared_ptr<UriHandler>(new UriHandler());
 }
 
@@ -61,6 +75,21 @@ bool HttpServer::add_url_handler(const std::string& pattern,
     shared_ptr<UriHandler> handler(new UriHandler());
     handler->initialize(pattern, callback, data);
     uri_handlers_.push_back(handler);
+    router_.add(handler);
+    return false;
+}
+
+/**
+ * Add a url handler that receives the path parameters captured by
+ * the groups of the URI regular expression.
+ */
+bool HttpServer::add_url_handler(const std::string& pattern,
+                     void(*callback)(struct evhttp_request*, const PathParams&, void*),
+                     void* data) {
+    shared_ptr<UriHandler> handler(new UriHandler());
+    handler->initialize(pattern, callback, data);
+    uri_handlers_.push_back(handler);
+    router_.add(handler);
     return false;
 }
 
@@ -76,31 +105,156 @@ void HttpServer::set_not_found_handler(void(*callback)(struct evhttp_request*, v
     not_found_handler_->set_handler_data(data);
 }
 
+/**
+ * Handle a signal on the server's event loop.
+ * @return true if succeeded, false if not.
+ */
+bool HttpServer::add_signal_handler(int signal_number,
+                                    void(*callback)(evutil_socket_t, short, void*),
+                                    void* data) {
+    struct event* signal_event = evsignal_new(event_base_, signal_number, callback, data);
+    
+    if (signal_event == NULL || evsignal_add(signal_event, NULL) != 0) {
+        if (signal_event != NULL) {
+            event_free(signal_event);
+        }
+        
+        return false;
+    }
+    
+    signal_events_.push_back(signal_event);
+    return true;
+}
+
 /** 
  * Start serving on a specified IP address and port.
  * @param address a string with IP address to listen on
  * @param port the port number to listen on
+ * @param num_workers the number of threads serving requests
  * @return true if succeeded, false if not.
  */
-bool HttpServer::serve(const std::string& address, u_short port) {
-    if (!evhttp_bind_socket(server_, address.c_str(), port)) {
-        // Set the process to ignore SIGPIPE, which can be produced
-        // if libevent will write to a closed socket.  Ideally
-        // we'd do this per socket, but libevent doesn't
-        // provide a way to get the socket assosiated with a 
-        // connection.
-        struct sigaction ingore_sigpipe_action;
-        ingore_sigpipe_action.sa_handler = SIG_IGN;
-        sigemptyset(&ingore_sigpipe_action.sa_mask);
-        ingore_sigpipe_action.sa_flags = 0;
-        sigaction(SIGPIPE, &ingore_sigpipe_action, NULL);
+bool HttpServer::serve(const std::string& address, u_short port, size_t num_workers) {
+    if (num_workers <= 1) {
+        // A single worker keeps the port to itself, so that a second
+        // server started by mistake fails to bind instead of quietly
+        // taking half of the connections.
+        struct evhttp_bound_socket* bound_socket = 
+            evhttp_bind_socket_with_handle(server_, address.c_str(), port);
         
-        // Start the main event loop.
-        event_base_dispatch(event_base_);
-        return true;
+        if (bound_socket == NULL) {
+            return false;
+        }
+        
+        disable_nagle(evhttp_bound_socket_get_fd(bound_socket));
+    
+    } else {
+        for (size_t i = 1; i < num_workers; i++) {
+            struct event_base* worker_base = event_base_new();
+            struct evhttp* worker_server = evhttp_new(worker_base);
+            evhttp_set_gencb(worker_server, &HttpServer::event_handler, (void*)this);
+            evhttp_set_max_body_size(worker_server, kMaxBodySize);
+            worker_bases_.push_back(worker_base);
+            worker_servers_.push_back(worker_server);
+        }
+        
+        for (size_t i = 0; i < num_workers; i++) {
+            struct evhttp* worker_server = (i == 0) ? server_ : worker_servers_[i - 1];
+            const evutil_socket_t listener = listen_on_shared_port(address, port);
+            
+            if (listener < 0) {
+                return false;
+            }
+            
+            if (evhttp_accept_socket(worker_server, listener) != 0) {
+                evutil_closesocket(listener);
+                return false;
+            }
+        }
     }
     
-    return false;
+    // Set the process to ignore SIGPIPE, which can be produced
+    // if libevent will write to a closed socket.  Ideally
+    // we'd do this per socket, but libevent doesn't
+    // provide a way to get the socket assosiated with a 
+    // connection.
+    struct sigaction ingore_sigpipe_action;
+    ingore_sigpipe_action.sa_handler = SIG_IGN;
+    sigemptyset(&ingore_sigpipe_action.sa_mask);
+    ingore_sigpipe_action.sa_flags = 0;
+    sigaction(SIGPIPE, &ingore_sigpipe_action, NULL);
+    
+    // Start the other workers' event loops, then the main one.
+    boost::thread_group workers;
+    
+    for (size_t i = 0; i < worker_bases_.size(); i++) {
+        workers.create_thread(boost::bind(&event_base_dispatch, worker_bases_[i]));
+    }
+    
+    event_base_dispatch(event_base_);
+    
+    for (size_t i = 0; i < worker_bases_.size(); i++) {
+        event_base_loopbreak(worker_bases_[i]);
+    }
+    
+    workers.join_all();
+    return true;
+}
+
+/**
+ * Send small writes on the connections accepted by a listening socket
+ * right away.  Otherwise the tail of a response that doesn't fill a
+ * packet waits for the client's delayed ACK, which takes up to 40 ms.
+ */
+void HttpServer::disable_nagle(evutil_socket_t listener) {
+    const int on = 1;
+    setsockopt(listener, IPPROTO_TCP, TCP_NODELAY, (const void*) &on, sizeof(on));
+}
+
+/**
+ * Open a listening socket on the address and port which other
+ * sockets may be bound to as well.
+ * @return the socket, or -1 on failure.
+ */
+evutil_socket_t HttpServer::listen_on_shared_port(const std::string& address, u_short port) {
+    struct evutil_addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_flags = EVUTIL_AI_PASSIVE | EVUTIL_AI_ADDRCONFIG;
+    
+    std::stringstream port_string;
+    port_string << port;
+    struct evutil_addrinfo* addresses = NULL;
+    
+    if (evutil_getaddrinfo(address.c_str(), port_string.str().c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+    
+    evutil_socket_t listener = socket(addresses->ai_family, 
+                                      addresses->ai_socktype, 
+                                      addresses->ai_protocol);
+    
+    if (listener < 0) {
+        evutil_freeaddrinfo(addresses);
+        return -1;
+    }
+    
+    const int on = 1;
+    evutil_make_socket_nonblocking(listener);
+    evutil_make_socket_closeonexec(listener);
+    evutil_make_listen_socket_reuseable(listener);
+    disable_nagle(listener);
+    
+    if (setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, (const void*) &on, sizeof(on)) != 0
+            || bind(listener, addresses->ai_addr, addresses->ai_addrlen) != 0
+            || listen(listener, kListenBacklog) != 0) {
+        evutil_closesocket(listener);
+        listener = -1;
+    }
+    
+    evutil_freeaddrinfo(addresses);
+    return listener;
 }
 
 /// Handle the request event.
@@ -109,12 +263,13 @@ void HttpServer::handle_request(struct evhttp_request* request) {
     std::string uri(request_uri_path(request));
     bool has_handled_request = false;
     
-    // Check the request URI and invoke the correct handler.
-    for (size_t i = 0; i < uri_handlers_.size(); ++i) {
-        if (uri_handlers_[i]->handle_if_matched(uri, request)) {
-            has_handled_request = true;
-            break;
-        }
+    // Find the route for the request URI and invoke its handler.
+    PathParams params;
+    UriHandler* handler = router_.find(uri, params);
+    
+    if (handler != NULL) {
+        handler->handle(request, params);
+        has_handled_request = true;
     }
     
     // No handler is registered for the current URI; return 404.
@@ -173,6 +328,116 @@ void HttpServer::send_response_data(struct evhttp_request* request,
     evbuffer_free(buffer);
 }
 
+/**
+ * Send a response from shared memory without copying it.  The
+ * response holds a reference to the data until it has been sent.
+ */
+void HttpServer::send_response_reference(struct evhttp_request* request, 
+                                         const boost::shared_array<char>& response,
+                                         size_t response_size,
+                                         int response_code) {
+    struct evbuffer* buffer = evbuffer_new();
+    
+    if (response_size > 0) {
+        evbuffer_add_reference(buffer, response.get(), response_size, 
+                               &HttpServer::release_response_data, 
+                               new boost::shared_array<char>(response));
+    }
+    
+    const char* status_string = this->response_string(response_code);
+    evhttp_send_reply(request, response_code, status_string, buffer);
+    evbuffer_free(buffer);
+}
+
+/**
+ * Send the first file_size bytes of an open file as the response.
+ * The file segment holds the owner of the descriptor until the last
+ * evbuffer using it is done with it.  The response buffer is marked as
+ * draining to a socket, like the connection's, so that the segment is 
+ * sent with sendfile rather than read into memory.
+ */
+bool HttpServer::send_response_file(struct evhttp_request* request, 
+                                    int fd,
+                                    size_t file_size,
+                                    const boost::shared_ptr<const void>& file_owner,
+                                    int response_code) {
+    struct evbuffer* buffer = evbuffer_new();
+    evbuffer_set_flags(buffer, EVBUFFER_FLAG_DRAINS_TO_FD);
+    
+    if (file_size > 0) {
+        struct evbuffer_file_segment* segment = 
+            evbuffer_file_segment_new(fd, 0, static_cast<ev_off_t>(file_size), 0);
+        
+        if (segment == NULL) {
+            evbuffer_free(buffer);
+            this->send_response(request, std::string(""), HTTP_SERVUNAVAIL);
+            return false;
+        }
+        
+        evbuffer_file_segment_add_cleanup_cb(segment, 
+                                             &HttpServer::release_response_file, 
+                                             new boost::shared_ptr<const void>(file_owner));
+        const int status = 
+            evbuffer_add_file_segment(buffer, segment, 0, static_cast<ev_off_t>(file_size));
+        evbuffer_file_segment_free(segment);
+        
+        if (status != 0) {
+            evbuffer_free(buffer);
+            this->send_response(request, std::string(""), HTTP_SERVUNAVAIL);
+            return false;
+        }
+    }
+    
+    const char* status_string = this->response_string(response_code);
+    evhttp_send_reply(request, response_code, status_string, buffer);
+    evbuffer_free(buffer);
+    return true;
+}
+
+/**
+ * Check whether the request carries the administrator token.  The
+ * comparison takes as long whatever the token sent, so that it can't
+ * be guessed a character at a time from the response times.
+ */
+bool HttpServer::is_admin_request(struct evhttp_request* request) const {
+    static const std::string kAuthorizationScheme("Bearer ");
+    
+    if (admin_token_.empty()) {
+        return false;
+    }
+    
+    const char* authorization = 
+        evhttp_find_header(evhttp_request_get_input_headers(request), "Authorization");
+    
+    if (authorization == NULL || 
+            strncmp(authorization, kAuthorizationScheme.c_str(), kAuthorizationScheme.length()) != 0) {
+        return false;
+    }
+    
+    const std::string token(authorization + kAuthorizationScheme.length());
+    unsigned char difference = (token.length() == admin_token_.length()) ? 0 : 1;
+    
+    for (size_t i = 0; i < admin_token_.length(); i++) {
+        const char sent = (i < token.length()) ? token[i] : '\0';
+        difference |= static_cast<unsigned char>(sent ^ admin_token_[i]);
+    }
+    
+    return difference == 0;
+}
+
+/// Release the data held by a response sent with
+/// send_response_reference().
+void HttpServer::release_response_data(const void*, size_t, void* shared_data) {
+    delete (boost::shared_array<char>*) shared_data;
+}
+
+/// Release the owner of a file sent with send_response_file().
+void HttpServer::release_response_file(struct evbuffer_file_segment const*, 
+                                       int, 
+                                       void* file_owner) {
+    delete (boost::shared_ptr<const void>*) file_owner;
+}
+
 /**
  * Create a response string from a response code.
  */
@@ -180,6 +445,7 @@ const char* HttpServer::response_string(int response_code) const {
     const char* status_string = NULL;
     
     switch (response_code) {
+        case HTTP_BADMETHOD:    status_string = "Method Not Allowed";   break;
         case HTTP_BADREQUEST:   status_string = "Bad Request";          break;
         case HTTP_MOVEPERM:     status_string = "Moved Permanently";    break;
         case HTTP_MOVETEMP:     status_string = "Moved Temporarily";    break;
@@ -207,6 +473,18 @@ void UriHandler::initialize(const std::string& uri_pattern,
     //TODO: Implement
     pattern_ = boost::regex(uri_pattern);
     request_handler_ = request_handler;
+    params_handler_ = NULL;
+    handler_data_ = handler_data;
+}
+
+///Initialize the URI handler with a callback that receives the
+///path parameters captured by the URI pattern.
+void UriHandler::initialize(const std::string& uri_pattern,
+           void(*params_handler)(struct evhttp_request*, const PathParams&, void*),
+           void* handler_data) {
+    pattern_ = boost::regex(uri_pattern);
+    request_handler_ = NULL;
+    params_handler_ = params_handler;
     handler_data_ = handler_data;
 }
 
@@ -214,8 +492,16 @@ void UriHandler::initialize(const std::string& uri_pattern,
 /// Returns true if the pattern matches and the callback was called;
 /// false otherwise.
 bool UriHandler::handle_if_matched(const std::string& uri, struct evhttp_request* request) {
-    if (regex_match(uri, pattern_)) {
-        (*request_handler_)(request, handler_data_);
+    boost::smatch groups;
+    
+    if (regex_match(uri, groups, pattern_)) {
+        PathParams params;
+        
+        for (size_t i = 1; i < groups.size(); i++) {
+            params.push_back(groups[i].str());
+        }
+        
+        this->handle(request, params);
         return true;
     }
     
@@ -224,7 +510,18 @@ bool UriHandler::handle_if_matched(const std::string& uri, struct evhttp_request
 
 /// Handle the request.
 void UriHandler::handle(struct evhttp_request* request) {
-    (*request_handler_)(request, handler_data_);
+    this->handle(request, PathParams());
+}
+
+/// Handle the request, with the path parameters captured by the
+/// URI pattern.
+void UriHandler::handle(struct evhttp_request* request, const PathParams& params) {
+    if (params_handler_ != NULL) {
+        (*params_handler_)(request, params, handler_data_);
+    
+    } else {
+        (*request_handler_)(request, handler_data_);
+    }
 }
 } /* namespace isaword */
 
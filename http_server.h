@@ -22,6 +22,7 @@
 // A generic HTTP server based on libevent http server.
 #include <string>
 #include <vector>
+#include <boost/shared_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/regex.hpp>
 #include <event2/event.h>
@@ -30,6 +31,7 @@
 #include <event2/buffer.h>
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
+#include "router.h"
 
 namespace isaword {
 
@@ -41,11 +43,19 @@ class UriHandler;
 /// The main server class.
 class HttpServer {
 public:
+    /// Maximum number of connections waiting on a worker's socket.
+    static const int kListenBacklog = 128;
+    
+    /// Maximum size of a request body, in bytes.  Larger requests are
+    /// turned away with 413 before their body is read in full.
+    static const size_t kMaxBodySize = 64 * 1024;
+    
     /// Create an HTTP server.
     HttpServer()
     : event_base_(NULL), 
       server_(NULL), 
-      not_found_handler_() {
+      not_found_handler_(),
+      admin_token_() {
     }
     
     ///Initialize the server.
@@ -65,6 +75,15 @@ public:
                          void(*callback)(struct evhttp_request*, void*),
                          void* data = NULL);
     
+    /**
+     * Add a url handler that receives the path parameters captured by
+     * the groups of the URI regular expression, e.g. the dictionary and
+     * the letters for "/anagrams/([a-z0-9]+)/([A-Za-z]+)".
+     */
+    bool add_url_handler(const std::string& pattern,
+                         void(*callback)(struct evhttp_request*, const PathParams&, void*),
+                         void* data = NULL);
+    
     /** 
      * Set handler for requests that do not match any URL pattern.
      * @param callback a function that will handle the requests
@@ -73,13 +92,32 @@ public:
     void set_not_found_handler(void(*callback)(struct evhttp_request*, void*),
                          void* data = NULL);
     
+    /**
+     * Handle a signal on the server's event loop.  Unlike a plain signal
+     * handler, the callback may do anything a request handler may do.
+     * @param signal_number the signal to handle, e.g. SIGHUP.
+     * @param callback a function that will handle the signal.
+     * @param data additional data to pass to the callback.
+     * @return true if succeeded, false if not.
+     */
+    bool add_signal_handler(int signal_number,
+                            void(*callback)(evutil_socket_t, short, void*),
+                            void* data = NULL);
+    
     /** 
-     * Start serving on a specified IP address and port.
+     * Start serving on a specified IP address and port.  With more than
+     * one worker, each worker runs its own event loop on its own thread,
+     * with a socket of its own bound to the port with SO_REUSEPORT, and
+     * the kernel spreads the connections between them.  The workers
+     * share the URL handlers, which must then be safe to call from
+     * several threads at once; signals are handled on the first worker.
+     *
      * @param address a string with IP address to listen on
      * @param port the port number to listen on
+     * @param num_workers the number of threads serving requests
      * @return true if succeeded, false if not.
      */
-    bool serve(const std::string& address, u_short port);
+    bool serve(const std::string& address, u_short port, size_t num_workers = 1);
     
     /**
      * Send a string response.  This is appropriate for text-type responses.
@@ -97,6 +135,43 @@ public:
                             size_t response_size,
                             int response_code = HTTP_OK);
     
+    /**
+     * Send a response from shared memory without copying it.  The
+     * response holds a reference to the data until it has been sent,
+     * so the data may be replaced in the meantime, e.g. in a cache.
+     */
+    void send_response_reference(struct evhttp_request* request, 
+                                 const boost::shared_array<char>& response,
+                                 size_t response_size,
+                                 int response_code = HTTP_OK);
+    
+    /**
+     * Send the first file_size bytes of an open file as the response.
+     * Where it can, the kernel copies the file straight to the socket
+     * (sendfile), reading at an offset, so the descriptor may be shared
+     * by several responses at once.  The response holds a reference to
+     * the owner of the descriptor, which must keep it open, until it has
+     * been sent.
+     * @return true if succeeded; false if the file could not be
+     * attached, in which case a 503 response is sent instead.
+     */
+    bool send_response_file(struct evhttp_request* request, 
+                            int fd,
+                            size_t file_size,
+                            const boost::shared_ptr<const void>& file_owner,
+                            int response_code = HTTP_OK);
+    
+    /**
+     * Check whether the request carries the administrator token, as
+     * "Authorization: Bearer <token>".  Use this for the pages only
+     * meant for the administrators.  Behind a reverse proxy every
+     * request comes from the proxy, so the peer address can't tell
+     * who sent it.
+     * @return true if the token matches; false if it doesn't, or if
+     * no token has been set.
+     */
+    bool is_admin_request(struct evhttp_request* request) const;
+    
     /// Callback for the evhttp event handler to be provided to the 
     /// evhttp object.  Not for external use.
     static void event_handler(struct evhttp_request* request, void* server) {
@@ -111,6 +186,10 @@ public:
     
     boost::shared_ptr<UriHandler> not_found_handler() {return not_found_handler_;}
     
+    /// Set the token the administrator pages require.  With no token,
+    /// the administrator pages are closed to everyone.
+    void set_admin_token(const std::string& admin_token) {admin_token_ = admin_token;}
+    
 private:
     /**
      * Create a response string from a response code.
@@ -120,17 +199,55 @@ private:
     /// Handle the request event.
     void handle_request(struct evhttp_request* request);
     
+    /// Release the data held by a response sent with
+    /// send_response_reference().
+    static void release_response_data(const void* data, size_t data_size, void* shared_data);
+    
+    /// Release the owner of a file sent with send_response_file().
+    static void release_response_file(struct evbuffer_file_segment const* segment, 
+                                      int flags, 
+                                      void* file_owner);
+    
+    /**
+     * Open a listening socket on the address and port which other
+     * sockets may be bound to as well.
+     * @return the socket, or -1 on failure.
+     */
+    static evutil_socket_t listen_on_shared_port(const std::string& address, u_short port);
+    
+    /**
+     * Send small writes on the connections accepted by a listening socket
+     * right away, instead of waiting for the client to acknowledge the
+     * data already sent.
+     */
+    static void disable_nagle(evutil_socket_t listener);
+    
     /// Libevent event base.
     struct event_base* event_base_;
     
     /// Libevent HTTP server instance.
     struct evhttp* server_;
     
+    /// Event bases of the workers other than the first one.
+    std::vector<struct event_base*> worker_bases_;
+    
+    /// HTTP servers of the workers other than the first one.
+    std::vector<struct evhttp*> worker_servers_;
+    
     /// Routing patterns.
     std::vector<boost::shared_ptr<UriHandler> > uri_handlers_;
     
+    /// The routing patterns, compiled for lookup.
+    Router router_;
+    
+    /// Signal events added with add_signal_handler().
+    std::vector<struct event*> signal_events_;
+    
     /// Handler for requests that have not matched any pattern.
     boost::shared_ptr<UriHandler> not_found_handler_;
+    
+    /// Token the administrator pages require; empty if they're closed.
+    std::string admin_token_;
 };
 
 /*---------------------------------------------------------
@@ -142,7 +259,7 @@ private:
 class UriHandler {
 public:
     UriHandler() 
-    : pattern_(), request_handler_(NULL), handler_data_(NULL) {
+    : pattern_(), request_handler_(NULL), params_handler_(NULL), handler_data_(NULL) {
     }
     
     ///Initialize the URI handler.  Throws an exception if the
@@ -151,6 +268,12 @@ public:
                void(*request_handler)(struct evhttp_request*, void*),
                void* handler_data = NULL);
     
+    ///Initialize the URI handler with a callback that receives the
+    ///path parameters captured by the URI pattern.
+    void initialize(const std::string& uri_pattern,
+               void(*params_handler)(struct evhttp_request*, const PathParams&, void*),
+               void* handler_data = NULL);
+    
     /// Handle the request if the URI matches the pattern.
     /// Returns true if the pattern matches and the callback was called;
     /// false otherwise.
@@ -159,17 +282,24 @@ public:
     /// Handle the request.
     void handle(struct evhttp_request* request);
     
+    /// Handle the request, with the path parameters captured by the
+    /// URI pattern.
+    void handle(struct evhttp_request* request, const PathParams& params);
+    
     /*============ Getters/setters ==================*/
     /// Get the regex pattern which this handler is responsible for.
-    boost::regex pattern() const        {return pattern_;}
+    const boost::regex& pattern() const {return pattern_;}
     
     /// Get the pointer to the function that will handle requests to this
     /// URI.
-    void* handler() const       {return (void*) request_handler_;}
+    void* handler() const {
+        return (request_handler_ != NULL) ? (void*) request_handler_ : (void*) params_handler_;
+    }
     
     /// Set the request handler.
     void set_handler (void(*request_handler)(struct evhttp_request*, void*)) {
         request_handler_ = request_handler;
+        params_handler_ = NULL;
     }
     
     /// Get the data to be passed to the handler.
@@ -185,6 +315,9 @@ private:
     /// The callback to call if the pattern is matched.
     void(*request_handler_)(struct evhttp_request*, void*);
     
+    /// The callback taking path parameters, if it was given instead.
+    void(*params_handler_)(struct evhttp_request*, const PathParams&, void*);
+    
     /// An additional argument to provide with the callback.
     void* handler_data_;
 };
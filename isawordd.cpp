@@ -16,12 +16,18 @@
  * under the License.
  */
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/program_options.hpp>
+#include <boost/thread/thread.hpp>
+#include "asset_pipeline.h"
 #include "daemonize.h"
+#include "file_cache.h"
 #include "file_handler.h"
 #include "http_server.h"
 #include "views.h"
@@ -31,22 +37,51 @@ using boost::shared_array;
 using namespace isaword;
 namespace po = boost::program_options;
 
+/// The scripts and styles of the pages, in the order they're bundled,
+/// relative to resources/.
+static const char* kScriptBundleSources[] = {"js/jquery-1.4.4.min.js", "js/isaword.js"};
+static const char* kStyleBundleSources[] = {"css/isaword.css"};
+
 int main(int argc, char* argv[]) {
     //Process options.
     po::options_description options("Usage:\n    isawordd [options]\n\nOptions");
     options.add_options()
         ("help,h", "produce help message")
+        ("admin_token_file,a", 
+         po::value<std::vector<std::string> >(), 
+         "file with the token the admin pages require, sent as "
+         "\"Authorization: Bearer <token>\" (default: admin pages disabled)")
+        ("bundle_dir,b", 
+         po::value<std::vector<std::string> >(), 
+         "directory to write the script and style bundles to, served under "
+         "/bundles/ (default: bundles/ under the resource root)")
+        ("file_cache_mb,c", 
+         po::value<int>(), 
+         "memory for caching static files, in MB (default: 64)")
         ("ip,i", 
          po::value<std::vector<std::string> >(), 
          "IP address to listen on (default: 0.0.0.0)")
         ("log_file,l", 
          po::value<std::vector<std::string> >(), 
          "log file")
+        ("mmap_kb,M", 
+         po::value<int>(), 
+         "map static files of at least this many KB into memory instead of "
+         "reading them; only safe if the files are replaced by renaming, "
+         "never rewritten in place (default: never map)")
         ("no_daemon,d", "do not run as a daemon")
         ("port,p", po::value<int>(), "port to listen on (default: 80)")
         ("res_root,r", 
          po::value<std::vector<std::string> >(), 
-         "root directory for server resources (default: current dir)");
+         "root directory for server resources (default: current dir)")
+        ("sendfile,s", "send static files straight from disk with sendfile")
+        ("warmup_manifest,m", 
+         po::value<std::vector<std::string> >(), 
+         "list of static files to load on startup, relative to resources/ "
+         "(default: all the files)")
+        ("workers,w", 
+         po::value<int>(), 
+         "number of threads serving requests (default: 1)");
     
     po::variables_map args;
     po::store(po::parse_command_line(argc, argv, options), args);
@@ -71,6 +106,27 @@ int main(int argc, char* argv[]) {
         listen_port = static_cast<u_short>(args["port"].as<int>());
     }
     
+    // Get the number of threads serving requests.
+    size_t num_workers = 1;
+    
+    if (args.count("workers") && args["workers"].as<int>() > 1) {
+        num_workers = static_cast<size_t>(args["workers"].as<int>());
+    }
+    
+    // Get the memory budget for the static files.
+    size_t file_cache_bytes = FileCache::kDefaultMemoryBudget;
+    
+    if (args.count("file_cache_mb") && args["file_cache_mb"].as<int>() > 0) {
+        file_cache_bytes = static_cast<size_t>(args["file_cache_mb"].as<int>()) << 20;
+    }
+    
+    // Get the size from which the static files are mapped into memory.
+    size_t mmap_threshold = FileCache::kDefaultMmapThreshold;
+    
+    if (args.count("mmap_kb") && args["mmap_kb"].as<int>() >= 0) {
+        mmap_threshold = static_cast<size_t>(args["mmap_kb"].as<int>()) << 10;
+    }
+    
     // Get the root for the resource files.
     std::string resource_dir;
     
@@ -94,6 +150,56 @@ int main(int argc, char* argv[]) {
                   << " current directory (" << resource_dir << ")." << std::endl;
     }
     
+    // Get the directory for the bundles, as an absolute path, since the
+    // daemon leaves the current directory.
+    std::string bundle_dir(resource_dir + "bundles/");
+    
+    if (args.count("bundle_dir")) {
+        bundle_dir = args["bundle_dir"].as<std::vector<std::string> >()[0];
+        
+        if (bundle_dir[0] != '/') {
+            bundle_dir = 
+                boost::filesystem::current_path<boost::filesystem::path>().string() + 
+                    '/' + 
+                    bundle_dir;
+        }
+    }
+    
+    // Get the list of static files to load on startup, as an absolute
+    // path, like the bundle directory.
+    std::string warmup_manifest;
+    
+    if (args.count("warmup_manifest")) {
+        warmup_manifest = args["warmup_manifest"].as<std::vector<std::string> >()[0];
+        
+        if (warmup_manifest[0] != '/') {
+            warmup_manifest = 
+                boost::filesystem::current_path<boost::filesystem::path>().string() + 
+                    '/' + 
+                    warmup_manifest;
+        }
+    }
+    
+    // Get the token for the admin pages.  It's read from a file rather
+    // than given on the command line, where any user could see it.
+    std::string admin_token;
+    
+    if (args.count("admin_token_file")) {
+        const std::string admin_token_file = 
+            args["admin_token_file"].as<std::vector<std::string> >()[0];
+        std::ifstream admin_token_stream(admin_token_file.c_str());
+        std::getline(admin_token_stream, admin_token);
+        
+        //Ignore the line break and any other trailing whitespace.
+        admin_token.erase(admin_token.find_last_not_of(" \t\r\n") + 1);
+        
+        if (admin_token.empty()) {
+            std::cerr << "Could not read the admin token from " 
+                      << admin_token_file << "." << std::endl;
+            return 1;
+        }
+    }
+    
     // Get logging file name, if such exists.
     //shared_array<char> log_file_name;
     shared_array<char> log_file_name;
@@ -124,8 +230,52 @@ int main(int argc, char* argv[]) {
         std::cout << "No log file specified; sending logs to /dev/null." << std::endl;
     }
         
+    // This part of the server is responsible for loading files.
+    shared_ptr<FileHandler> file_handler(new FileHandler(3600 /* cache period */));
+    file_handler->initialize(resource_dir + "resources/");
+    file_handler->set_use_sendfile(args.count("sendfile") > 0);
+    file_handler->set_memory_budget(file_cache_bytes);
+    file_handler->set_mmap_threshold(mmap_threshold);
+    file_handler->set_url_root("/resources/");
+    
+    // Bundle the scripts and styles of the pages.  The pages refer to 
+    // the bundles, like the rest of the static files, by fingerprinted 
+    // URLs that browsers can cache for good.  The bundles have their 
+    // own directory, so that the files under resources/ are only ever
+    // written by the people maintaining them.  They're built 
+    // before the daemon is launched, so that a failure is reported here.
+    boost::system::error_code bundle_dir_error;
+    boost::filesystem::create_directories(bundle_dir, bundle_dir_error);
+    
+    shared_ptr<FileHandler> bundle_handler(new FileHandler(3600 /* cache period */));
+    
+    if (bundle_handler->initialize(bundle_dir) != FileHandler::FILE_ROOT_OK) {
+        std::cerr << "Could not use " << bundle_dir << " for the bundles." << std::endl;
+        return 1;
+    }
+    
+    bundle_handler->set_use_sendfile(args.count("sendfile") > 0);
+    bundle_handler->set_url_root("/bundles/");
+    
+    shared_ptr<AssetPipeline> asset_pipeline(new AssetPipeline(file_handler, bundle_handler));
+    const std::vector<std::string> script_sources(
+        kScriptBundleSources, 
+        kScriptBundleSources + sizeof(kScriptBundleSources) / sizeof(kScriptBundleSources[0]));
+    const std::vector<std::string> style_sources(
+        kStyleBundleSources, 
+        kStyleBundleSources + sizeof(kStyleBundleSources) / sizeof(kStyleBundleSources[0]));
+    
+    // The pages have no other way to get their scripts and styles.
+    if (!asset_pipeline->build_bundle("isaword.js", script_sources)
+            || !asset_pipeline->build_bundle("isaword.css", style_sources)) {
+        std::cerr << "Could not build the script and style bundles in " 
+                  << bundle_dir << "." << std::endl;
+        return 1;
+    }
+    
     std::cout << "Preparing to serve on " << listen_ip 
-              << ":" << listen_port << std::endl;
+              << ":" << listen_port << " with " << num_workers 
+              << " worker(s)" << std::endl;
     
     if (!args.count("no_daemon")) {
         pid_t pid = daemonize(log_file_name.get());
@@ -147,17 +297,39 @@ int main(int argc, char* argv[]) {
     // Set up the server.
     shared_ptr<HttpServer> server(new HttpServer());
     server->initialize();
+    server->set_admin_token(admin_token);
     
-    // This part of the server is responsible for loading files.
-    shared_ptr<FileHandler> file_handler(new FileHandler(3600 /* cache period */));
-    file_handler->initialize(resource_dir + "resources/");
-    file_handler->attach_to_server(server, "/resources/");
+    // Serve the static files and the bundles.
+    file_handler->attach_to_server(server, file_handler->url_root());
+    file_handler->attach_stats(server, "/admin/file_cache/?");
+    bundle_handler->attach_to_server(server, bundle_handler->url_root());
+    
+    // Load the static files before serving, so that the first requests
+    // after a restart don't wait for the disk.
+    const boost::posix_time::ptime warmup_start = 
+        boost::posix_time::microsec_clock::universal_time();
+    size_t warmup_bytes = 0;
+    const size_t num_warmup_files = 
+        file_handler->warm_up(warmup_manifest, 
+                              std::max(boost::thread::hardware_concurrency(), 1u), 
+                              warmup_bytes);
+    const boost::posix_time::time_duration warmup_time = 
+        boost::posix_time::microsec_clock::universal_time() - warmup_start;
+    
+    std::cout << "Loaded " << num_warmup_files << " static files (" 
+              << warmup_bytes << " bytes) in " 
+              << warmup_time.total_milliseconds() << " ms" << std::endl;
     
     //Add some pages to the server.
     shared_ptr<PageHandler> page_handler(new PageHandler(server));
+    page_handler->set_asset_pipeline(asset_pipeline);
     page_handler->initialize(resource_dir);
     
-    server->serve(listen_ip, listen_port);
+    // Keep the bundles and the fingerprints in the pages up to date as
+    // the static files change.
+    asset_pipeline->watch_files();
+    
+    server->serve(listen_ip, listen_port, num_workers);
     return 0;
 }
 
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The letters and length of every word, packed for quickly ruling
+// out words before running a regular expression on them.
+
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "letter_mask_index.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  LetterMaskIndex class.
+----------------------------------------------------------*/
+const size_t LetterMaskIndex::kLengthShift;
+const size_t LetterMaskIndex::kMaxLength;
+const boost::uint32_t LetterMaskIndex::kLetterBits;
+
+/**
+ * Add the next word.
+ */
+void LetterMaskIndex::add(const std::string& word) {
+    masks_.push_back(summarize(word));
+}
+
+/**
+ * Summarize a word: a bit for each letter it has, and its length.
+ */
+boost::uint32_t LetterMaskIndex::summarize(const std::string& word) {
+    boost::uint32_t mask = 0;
+    
+    for (size_t i = 0; i < word.length(); i++) {
+        if (word[i] >= 'A' && word[i] <= 'Z') {
+            mask |= 1u << (word[i] - 'A');
+        }
+    }
+    
+    const size_t length = std::min(word.length(), kMaxLength);
+    return mask | static_cast<boost::uint32_t>(length << kLengthShift);
+}
+
+/**
+ * Work out what any match of a regular expression must have.  Every
+ * top-level atom that isn't made optional by a quantifier adds a
+ * character to the length, and a letter atom adds its letter.  Groups
+ * and escapes are skipped, since they could match anything or nothing.
+ */
+boost::uint32_t LetterMaskIndex::find_requirements(const std::string& pattern) {
+    boost::uint32_t letters = 0;
+    size_t min_length = 0;
+    size_t depth = 0;
+    
+    //The atom before the current position: whether it's a character
+    //that must be there, and its letter bit, if any.
+    bool is_atom_required = false;
+    boost::uint32_t atom_letter = 0;
+    bool is_after_quantifier = false;
+    
+    for (size_t i = 0; i <= pattern.length(); i++) {
+        const char c = (i < pattern.length()) ? pattern[i] : '\0';
+        
+        //Quantifiers apply to the atom before them; a '?' or '+' right
+        //after a quantifier only makes it lazy or possessive.
+        if (c == '*' || c == '?' || c == '+' || c == '{') {
+            if (is_after_quantifier && (c == '?' || c == '+')) {
+                is_after_quantifier = false;
+                continue;
+            }
+            
+            is_after_quantifier = true;
+            
+            if (c == '{') {
+                //Only a repeat count starting with 0 allows no atom.
+                size_t end = i + 1;
+                size_t min_count = 0;
+                
+                while (end < pattern.length() && isdigit(static_cast<unsigned char>(pattern[end]))) {
+                    min_count = 10 * min_count + static_cast<size_t>(pattern[end] - '0');
+                    end++;
+                }
+                
+                if (end > i + 1 && min_count == 0) {
+                    is_atom_required = false;
+                }
+                
+                end = pattern.find_first_of('}', i);
+                i = (end == std::string::npos) ? pattern.length() : end;
+            
+            } else if (c != '+') {
+                is_atom_required = false;
+            }
+            
+            continue;
+        }
+        
+        //Anything else ends the atom before it.
+        is_after_quantifier = false;
+        
+        if (depth == 0 && is_atom_required) {
+            min_length++;
+            letters |= atom_letter;
+        }
+        
+        is_atom_required = false;
+        atom_letter = 0;
+        
+        if (c == '\0') {
+            break;
+        
+        } else if (c == '(') {
+            depth++;
+        
+        } else if (c == ')') {
+            depth = (depth > 0) ? depth - 1 : 0;
+        
+        } else if (c == '|') {
+            if (depth == 0) {
+                return 0;
+            }
+        
+        } else if (c == '\\') {
+            i++;
+        
+        } else if (c == '[') {
+            //Skip to the end of the bracket expression; a ']' right 
+            //after the opening '[' or '[^' is a literal.
+            size_t end = i + 1;
+            
+            if (end < pattern.length() && pattern[end] == '^') {
+                end++;
+            }
+            
+            if (end < pattern.length() && pattern[end] == ']') {
+                end++;
+            }
+            
+            while (end < pattern.length() && pattern[end] != ']') {
+                if (pattern[end] == '[' && end + 1 < pattern.length() && 
+                    (pattern[end + 1] == ':' || pattern[end + 1] == '=' || pattern[end + 1] == '.')) {
+                    const size_t class_end = pattern.find(std::string(1, pattern[end + 1]) + "]", end + 2);
+                    end = (class_end == std::string::npos) ? pattern.length() : class_end + 2;
+                } else {
+                    end++;
+                }
+            }
+            
+            is_atom_required = true;
+            i = end;
+        
+        } else if (c != '^' && c != '$') {
+            is_atom_required = true;
+            
+            if (isalpha(static_cast<unsigned char>(c))) {
+                atom_letter = 1u << (toupper(static_cast<unsigned char>(c)) - 'A');
+            }
+        }
+    }
+    
+    min_length = std::min(min_length, kMaxLength);
+    return letters | static_cast<boost::uint32_t>(min_length << kLengthShift);
+}
+
+/**
+ * Find the ids of the words that meet the requirements.  The loop has
+ * no branches other than its own, so that it runs at the speed of
+ * reading the summaries.
+ */
+void LetterMaskIndex::find_candidates(boost::uint32_t requirements, WordIdList& ids) const {
+    const boost::uint32_t letters = requirements & kLetterBits;
+    const boost::uint32_t min_length = requirements >> kLengthShift;
+    const size_t first_id = ids.size();
+    
+    if (masks_.empty()) {
+        return;
+    }
+    
+    ids.resize(first_id + masks_.size());
+    
+    WordId* next_id = &ids[0] + first_id;
+    
+    for (size_t i = 0; i < masks_.size(); i++) {
+        const boost::uint32_t mask = masks_[i];
+        *next_id = static_cast<WordId>(i);
+        next_id += ((mask & letters) == letters) & ((mask >> kLengthShift) >= min_length);
+    }
+    
+    ids.resize(static_cast<size_t>(next_id - &ids[0]));
+}
+
+} /* namespace isaword */
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The letters and length of every word, packed for quickly ruling
+// out words before running a regular expression on them.
+
+#ifndef ISAWORD_LETTER_MASK_INDEX_H
+#define ISAWORD_LETTER_MASK_INDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  LetterMaskIndex class.
+----------------------------------------------------------*/
+/**
+ * A 32-bit summary of every word: the low 26 bits tell which of the
+ * letters 'A' to 'Z' the word has, and the upper 6 bits hold its
+ * length.  Scanning the summaries finds the words that have all the
+ * letters a regular expression requires, and are long enough for it,
+ * at a fraction of the cost of running the expression itself.
+ */
+class LetterMaskIndex {
+public:
+    /// Position of the length in a summary.
+    static const size_t kLengthShift = 26;
+    
+    /// Longest length that can be stored; longer words are stored
+    /// with this length.
+    static const size_t kMaxLength = 63;
+    
+    /// Bits for the letters.
+    static const boost::uint32_t kLetterBits = (1u << kLengthShift) - 1;
+    
+    /**
+     * Add the next word.  Words must be added in order of their ids,
+     * starting with 0.  Characters other than 'A' to 'Z' are ignored.
+     */
+    void add(const std::string& word);
+    
+    /// Summarize a word the same way add() does.
+    static boost::uint32_t summarize(const std::string& word);
+    
+    /**
+     * Work out what any match of a regular expression must have, looking
+     * only at the top level of the expression: the letters that are
+     * always there, and the least number of characters.  Letters are
+     * taken regardless of case.  This errs on the side of requiring
+     * less; an expression with a '|' at the top level requires nothing.
+     *
+     * @return the summary a word needs to contain to possibly match.
+     */
+    static boost::uint32_t find_requirements(const std::string& pattern);
+    
+    /**
+     * Find the ids of the words that have all the letters of the
+     * requirements and are at least as long, in increasing order.
+     */
+    void find_candidates(boost::uint32_t requirements, WordIdList& ids) const;
+    
+    /// Get the summary of a word by its id.
+    boost::uint32_t summary(WordId id) const    {return masks_[id];}
+    
+    /// Get the number of bytes used by the index.
+    size_t memory_bytes() const     {return masks_.capacity() * sizeof(boost::uint32_t);}
+    
+private:
+    /// The summaries by word id.
+    std::vector<boost::uint32_t> masks_;
+};
+
+} /* namespace isaword */
+#endif
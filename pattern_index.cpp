@@ -0,0 +1,127 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the letters at each position.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "pattern_index.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    PatternIndex class.
+----------------------------------------------------------*/
+const char PatternIndex::kAnyLetter;
+const size_t PatternIndex::kNumLetters;
+
+/// Order bitmaps from the smallest to the largest.
+static bool has_fewer_ids(const WordBitmap* first, const WordBitmap* second) {
+    return first->cardinality() < second->cardinality();
+}
+
+/**
+ * Add a word to the index.
+ */
+void PatternIndex::add(WordId id, const std::string& word) {
+    const size_t num_positions = std::min(word.length(), max_word_length_);
+    
+    for (size_t position = 0; position < num_positions; position++) {
+        const char letter = word[position];
+        
+        if (letter >= 'A' && letter <= 'Z') {
+            bitmaps_[position * kNumLetters + static_cast<size_t>(letter - 'A')].add(id);
+        }
+    }
+}
+
+/**
+ * Check whether a pattern can be looked up.
+ */
+bool PatternIndex::is_valid_pattern(const std::string& pattern) const {
+    if (pattern.empty() || pattern.length() > max_word_length_) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < pattern.length(); i++) {
+        if (pattern[i] != kAnyLetter && (pattern[i] < 'A' || pattern[i] > 'Z')) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/**
+ * Find the ids of the words matching a pattern.
+ * @return the total number of matching ids.
+ */
+size_t PatternIndex::find(const std::string& pattern,
+                          WordId range_begin,
+                          WordId range_end,
+                          size_t first_rank,
+                          size_t max_ids,
+                          WordIdList& ids) const {
+    if (range_begin >= range_end) {
+        return 0;
+    }
+    
+    std::vector<const WordBitmap*> bitmaps;
+    
+    for (size_t position = 0; position < pattern.length(); position++) {
+        if (pattern[position] != kAnyLetter) {
+            bitmaps.push_back(&this->bitmap(position, pattern[position]));
+        }
+    }
+    
+    //With no letters fixed, every word in the range matches.
+    if (bitmaps.empty()) {
+        const size_t num_words = range_end - range_begin;
+        
+        const size_t end_rank = std::min(num_words, first_rank + std::min(max_ids, num_words));
+        
+        for (size_t rank = first_rank; rank < end_rank; rank++) {
+            ids.push_back(static_cast<WordId>(range_begin + rank));
+        }
+        
+        return num_words;
+    }
+    
+    //Intersect the sparsest bitmaps first; it's cheaper to walk them.
+    std::sort(bitmaps.begin(), bitmaps.end(), has_fewer_ids);
+    WordBitmapIntersection intersection(bitmaps, range_begin, range_end);
+    intersection.to_ids(first_rank, max_ids, ids);
+    return intersection.cardinality();
+}
+
+/**
+ * Get the number of bytes used by the bitmaps.
+ */
+size_t PatternIndex::memory_bytes() const {
+    size_t num_bytes = 0;
+    
+    for (size_t i = 0; i < bitmaps_.size(); i++) {
+        num_bytes += bitmaps_[i].memory_bytes();
+    }
+    
+    return num_bytes;
+}
+
+} /* namespace isaword */
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the letters at each position, used
+// to look up crossword-style patterns such as "?A??E".
+
+#ifndef ISAWORD_PATTERN_INDEX_H
+#define ISAWORD_PATTERN_INDEX_H
+
+#include <string>
+#include <vector>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    PatternIndex class.
+----------------------------------------------------------*/
+/**
+ * An inverted index of words by letter and position: for every position
+ * in a word and every letter, a bitmap of the ids of the words that have
+ * the letter at the position.  A pattern is looked up by intersecting the
+ * bitmaps of its fixed letters within the range of ids of the words of
+ * the pattern's length.
+ */
+class PatternIndex {
+public:
+    /// Placeholder for an unknown letter in a pattern.
+    static const char kAnyLetter = '?';
+    
+    /// Number of letters in the alphabet; words may only use 'A' to 'Z'.
+    static const size_t kNumLetters = 26;
+    
+    /// Create an index for words of up to max_word_length letters.
+    PatternIndex(size_t max_word_length)
+    : max_word_length_(max_word_length),
+      bitmaps_(max_word_length * kNumLetters) {
+    }
+    
+    /// Add a word to the index.  Letters outside of the alphabet and
+    /// beyond the maximum word length are not indexed.
+    void add(WordId id, const std::string& word);
+    
+    /**
+     * Check whether a pattern can be looked up: it must consist of
+     * letters 'A' to 'Z' and kAnyLetter, and be no longer than the
+     * maximum word length.
+     */
+    bool is_valid_pattern(const std::string& pattern) const;
+    
+    /**
+     * Find the ids of the words matching a valid pattern among the ids
+     * in [range_begin, range_end), which should be the ids of the words
+     * of the pattern's length.  Up to max_ids ids are written to ids,
+     * starting with the match of rank first_rank.
+     *
+     * @return the total number of matching ids.
+     */
+    size_t find(const std::string& pattern,
+                WordId range_begin,
+                WordId range_end,
+                size_t first_rank,
+                size_t max_ids,
+                WordIdList& ids) const;
+    
+    /// Get the number of bytes used by the bitmaps.
+    size_t memory_bytes() const;
+    
+private:
+    /// Get the bitmap of words with the letter at the position.
+    const WordBitmap& bitmap(size_t position, char letter) const {
+        return bitmaps_[position * kNumLetters + static_cast<size_t>(letter - 'A')];
+    }
+    
+    /// Maximum length of the indexed words.
+    size_t max_word_length_;
+    
+    /// The bitmaps, by position and then by letter.
+    std::vector<WordBitmap> bitmaps_;
+};
+
+} /* namespace isaword */
+#endif
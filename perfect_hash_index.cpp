@@ -0,0 +1,307 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A read-only perfect hash of the words of a dictionary.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "perfect_hash_index.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  PerfectHashIndex class.
+----------------------------------------------------------*/
+const WordId PerfectHashIndex::kNotFound;
+const size_t PerfectHashIndex::kWordsPerBucket;
+const size_t PerfectHashIndex::kWordsPerSpareSlot;
+const boost::uint32_t PerfectHashIndex::kMaxDisplacement;
+const size_t PerfectHashIndex::kMaxSeeds;
+const size_t PerfectHashIndex::kMaxWordLength;
+const size_t PerfectHashIndex::kBatchSize;
+
+/// Ask the CPU to start loading the memory at the address.
+static inline void prefetch(const void* address) {
+#ifdef __GNUC__
+    __builtin_prefetch(address);
+#endif
+}
+
+/// Scramble the bits of a 64-bit number.
+static inline boost::uint64_t mix(boost::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/// Orders buckets from the largest to the smallest.
+class LargerBucket {
+public:
+    LargerBucket(const std::vector<std::vector<size_t> >& buckets) : buckets_(buckets) {}
+    
+    bool operator()(size_t first, size_t second) const {
+        return buckets_[first].size() > buckets_[second].size();
+    }
+    
+private:
+    const std::vector<std::vector<size_t> >& buckets_;
+};
+
+/**
+ * Add the next word.
+ */
+void PerfectHashIndex::add(const std::string& word) {
+    pending_words_.push_back(word);
+}
+
+/**
+ * Build the hash once all words have been added.
+ */
+bool PerfectHashIndex::finish() {
+    for (size_t seed = 0; seed < kMaxSeeds; seed++) {
+        if (this->build(seed)) {
+            std::vector<std::string>().swap(pending_words_);
+            return true;
+        }
+    }
+    
+    slots_.clear();
+    return false;
+}
+
+/**
+ * Find the id of a word.
+ */
+WordId PerfectHashIndex::find(const std::string& word) const {
+    if (slots_.empty() || word.length() > kMaxWordLength) {
+        return kNotFound;
+    }
+    
+    const Hash word_hash = this->hash(word.data(), word.length(), seed_);
+    const Slot& word_slot = slots_[this->slot(word_hash, displacements_[word_hash.bucket])];
+    return this->is_in_slot(word_slot, word.data(), word.length()) ? word_slot.id : kNotFound;
+}
+
+/**
+ * Find the ids of many words.  Each batch goes through the lookup a
+ * step at a time, prefetching what the next step will read: first the
+ * displacements, then the slots, then the stored words.
+ */
+void PerfectHashIndex::find(const std::vector<std::string>& words, WordIdList& ids) const {
+    ids.assign(words.size(), kNotFound);
+    
+    if (slots_.empty()) {
+        return;
+    }
+    
+    Hash hashes[kBatchSize];
+    size_t slot_nums[kBatchSize];
+    
+    for (size_t batch_start = 0; batch_start < words.size(); batch_start += kBatchSize) {
+        const size_t batch_size = std::min(kBatchSize, words.size() - batch_start);
+        const std::string* batch = &words[batch_start];
+        
+        for (size_t i = 0; i < batch_size; i++) {
+            const size_t length = std::min(batch[i].length(), kMaxWordLength);
+            hashes[i] = this->hash(batch[i].data(), length, seed_);
+            prefetch(&displacements_[hashes[i].bucket]);
+        }
+        
+        for (size_t i = 0; i < batch_size; i++) {
+            slot_nums[i] = this->slot(hashes[i], displacements_[hashes[i].bucket]);
+            prefetch(&slots_[slot_nums[i]]);
+        }
+        
+        for (size_t i = 0; i < batch_size; i++) {
+            prefetch(&arena_[slots_[slot_nums[i]].offset]);
+        }
+        
+        for (size_t i = 0; i < batch_size; i++) {
+            const Slot& word_slot = slots_[slot_nums[i]];
+            const bool is_found = batch[i].length() <= kMaxWordLength &&
+                this->is_in_slot(word_slot, batch[i].data(), batch[i].length());
+            ids[batch_start + i] = is_found ? word_slot.id : kNotFound;
+        }
+    }
+}
+
+/**
+ * Get the number of bytes used by the index.
+ */
+size_t PerfectHashIndex::memory_bytes() const {
+    return displacements_.capacity() * sizeof(boost::uint32_t) +
+           slots_.capacity() * sizeof(Slot) +
+           arena_.capacity();
+}
+
+/**
+ * Hash a word: FNV-1a, with its bits scrambled to make the parts of
+ * the hash independent.
+ */
+PerfectHashIndex::Hash PerfectHashIndex::hash(const char* word, 
+                                              size_t length, 
+                                              boost::uint64_t seed) const {
+    boost::uint64_t fnv = 0xCBF29CE484222325ULL;
+    
+    for (size_t i = 0; i < length; i++) {
+        fnv ^= static_cast<unsigned char>(word[i]);
+        fnv *= 0x100000001B3ULL;
+    }
+    
+    const boost::uint64_t first = mix(fnv ^ mix(seed + 1));
+    const boost::uint64_t second = mix(first ^ 0x9E3779B97F4A7C15ULL);
+    
+    Hash result;
+    result.bucket = static_cast<size_t>(first % displacements_.size());
+    result.base = static_cast<boost::uint32_t>(second);
+    result.step = static_cast<boost::uint32_t>(second >> 32) | 1;
+    return result;
+}
+
+/**
+ * Check whether a slot holds the word.
+ */
+bool PerfectHashIndex::is_in_slot(const Slot& slot, const char* word, size_t length) const {
+    if (slot.id == kNotFound) {
+        return false;
+    }
+    
+    const char* stored_word = &arena_[slot.offset];
+    return static_cast<unsigned char>(stored_word[0]) == length &&
+           std::equal(word, word + length, stored_word + 1);
+}
+
+/**
+ * Try to build the table with a given seed.  Buckets are placed from
+ * the largest to the smallest, while there's still plenty of room.
+ * @return true on success, false if some bucket couldn't be placed.
+ */
+bool PerfectHashIndex::build(boost::uint64_t seed) {
+    const size_t num_words = pending_words_.size();
+    seed_ = seed;
+    displacements_.assign(num_words / kWordsPerBucket + 1, 0);
+    slots_.assign(num_words + num_words / kWordsPerSpareSlot + 1, Slot());
+    arena_.clear();
+    
+    //Hash the words into buckets.
+    std::vector<Hash> hashes(num_words);
+    std::vector<std::vector<size_t> > buckets(displacements_.size());
+    
+    for (size_t i = 0; i < num_words; i++) {
+        const std::string& word = pending_words_[i];
+        
+        if (word.length() <= kMaxWordLength) {
+            hashes[i] = this->hash(word.data(), word.length(), seed);
+            buckets[hashes[i].bucket].push_back(i);
+        }
+    }
+    
+    std::vector<size_t> bucket_order(buckets.size());
+    for (size_t i = 0; i < bucket_order.size(); i++) {
+        bucket_order[i] = i;
+    }
+    
+    std::stable_sort(bucket_order.begin(), bucket_order.end(), LargerBucket(buckets));
+    
+    //Find a displacement for each bucket.
+    std::vector<bool> is_taken(slots_.size(), false);
+    std::vector<size_t> bucket_slots;
+    
+    for (size_t order = 0; order < bucket_order.size(); order++) {
+        const size_t bucket_num = bucket_order[order];
+        std::vector<size_t>& bucket = buckets[bucket_num];
+        
+        if (bucket.empty()) {
+            break;
+        }
+        
+        //Repeated words keep the first id.
+        for (size_t i = 1; i < bucket.size(); i++) {
+            for (size_t j = 0; j < i; j++) {
+                if (pending_words_[bucket[i]] == pending_words_[bucket[j]]) {
+                    bucket.erase(bucket.begin() + i);
+                    i--;
+                    break;
+                }
+            }
+        }
+        
+        bool is_placed = false;
+        
+        for (boost::uint32_t displacement = 0; displacement < kMaxDisplacement; displacement++) {
+            bucket_slots.clear();
+            
+            for (size_t i = 0; i < bucket.size(); i++) {
+                const size_t slot_num = this->slot(hashes[bucket[i]], displacement);
+                
+                if (is_taken[slot_num] || 
+                    std::find(bucket_slots.begin(), bucket_slots.end(), slot_num) != bucket_slots.end()) {
+                    break;
+                }
+                
+                bucket_slots.push_back(slot_num);
+            }
+            
+            if (bucket_slots.size() == bucket.size()) {
+                displacements_[bucket_num] = displacement;
+                
+                for (size_t i = 0; i < bucket.size(); i++) {
+                    is_taken[bucket_slots[i]] = true;
+                    slots_[bucket_slots[i]].id = static_cast<WordId>(bucket[i]);
+                }
+                
+                is_placed = true;
+                break;
+            }
+        }
+        
+        if (!is_placed) {
+            return false;
+        }
+    }
+    
+    //Copy the words into the arena, in slot order.  The empty slots
+    //point to an empty word at the end.
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i].id == kNotFound) {
+            continue;
+        }
+        
+        const std::string& word = pending_words_[slots_[i].id];
+        slots_[i].offset = static_cast<boost::uint32_t>(arena_.size());
+        arena_.push_back(static_cast<char>(word.length()));
+        arena_.insert(arena_.end(), word.begin(), word.end());
+    }
+    
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i].id == kNotFound) {
+            slots_[i].offset = static_cast<boost::uint32_t>(arena_.size());
+        }
+    }
+    
+    arena_.push_back(0);
+    return true;
+}
+
+} /* namespace isaword */
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A read-only perfect hash of the words of a dictionary, used to
+// check many candidate words with one probe each.
+
+#ifndef ISAWORD_PERFECT_HASH_INDEX_H
+#define ISAWORD_PERFECT_HASH_INDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  PerfectHashIndex class.
+----------------------------------------------------------*/
+/**
+ * A perfect hash of words to their ids, built with the hash-and-displace
+ * method: words are first hashed into small buckets,
+ * and each bucket gets a displacement that sends all of its words to
+ * free slots.  A lookup reads one displacement and one slot, and
+ * compares the candidate with the word stored for the slot.
+ *
+ * The words are copied into a single arena, in slot order, each
+ * prefixed by its length, so that a probe touches little memory.  The
+ * index can't be changed once finish() has been called.
+ */
+class PerfectHashIndex {
+public:
+    /// Returned for words that aren't in the index.
+    static const WordId kNotFound = 0xFFFFFFFF;
+    
+    /// Average number of words per bucket.
+    static const size_t kWordsPerBucket = 4;
+    
+    /// The table has one spare slot for every kWordsPerSpareSlot words.
+    static const size_t kWordsPerSpareSlot = 8;
+    
+    /// Number of displacements to try for a bucket before giving up
+    /// and starting over with a different seed.
+    static const boost::uint32_t kMaxDisplacement = 1 << 16;
+    
+    /// Number of seeds to try before giving up.
+    static const size_t kMaxSeeds = 16;
+    
+    /// Longest word that can be stored.
+    static const size_t kMaxWordLength = 255;
+    
+    /// Number of words looked up together by find(), with the memory
+    /// they need prefetched ahead.
+    static const size_t kBatchSize = 16;
+    
+    PerfectHashIndex()
+    : seed_(0) {
+    }
+    
+    /**
+     * Add the next word.  Words must be added in order of their ids,
+     * starting with 0.  Repeated words keep the first id; words longer 
+     * than kMaxWordLength are never found.
+     */
+    void add(const std::string& word);
+    
+    /**
+     * Build the hash once all words have been added.
+     * @return true on success, false if no perfect hash could be found.
+     */
+    bool finish();
+    
+    /// Find the id of a word; kNotFound if there is none.
+    WordId find(const std::string& word) const;
+    
+    /**
+     * Find the ids of many words, writing kNotFound for the words that
+     * aren't in the index.  The words are looked up in batches, which
+     * lets the lookups of a batch wait for memory at the same time.
+     */
+    void find(const std::vector<std::string>& words, WordIdList& ids) const;
+    
+    /// Get the number of bytes used by the index.
+    size_t memory_bytes() const;
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the number of slots in the table.
+    size_t num_slots() const            {return slots_.size();}
+    
+private:
+    /// A slot of the table: a word's id, and where it's stored in the arena.
+    class Slot {
+    public:
+        Slot() : offset(0), id(kNotFound) {}
+        
+        boost::uint32_t offset;
+        WordId id;
+    };
+    
+    /// The hash of a word, split into the parts used for the lookup.
+    class Hash {
+    public:
+        size_t bucket;
+        boost::uint32_t base;
+        boost::uint32_t step;
+    };
+    
+    /// Hash a word.
+    Hash hash(const char* word, size_t length, boost::uint64_t seed) const;
+    
+    /// Find the slot of a hash with a given displacement.
+    size_t slot(const Hash& hash, boost::uint32_t displacement) const {
+        return (hash.base + static_cast<boost::uint64_t>(displacement) * hash.step) % slots_.size();
+    }
+    
+    /// Check whether a slot holds the word.
+    bool is_in_slot(const Slot& slot, const char* word, size_t length) const;
+    
+    /// Try to build the table with a given seed.
+    bool build(boost::uint64_t seed);
+    
+    /// The words added so far, before the table is built.
+    std::vector<std::string> pending_words_;
+    
+    /// The displacement of each bucket.
+    std::vector<boost::uint32_t> displacements_;
+    
+    /// The table.
+    std::vector<Slot> slots_;
+    
+    /// The words, each prefixed by its length.
+    std::vector<char> arena_;
+    
+    /// The seed the table was built with.
+    boost::uint64_t seed_;
+};
+
+} /* namespace isaword */
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Dispatching request URIs to their handlers without trying every
+// handler's regular expression in turn.
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/regex.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "http_server.h"
+#include "router.h"
+
+using boost::shared_ptr;
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    Router class.
+----------------------------------------------------------*/
+/// Add a route.  Routes are matched in the order they were added.
+void Router::add(const shared_ptr<UriHandler>& handler) {
+    const size_t route = routes_.size();
+    routes_.push_back(handler);
+    
+    bool is_literal = false;
+    const std::string prefix = literal_prefix(handler->pattern().str(), is_literal);
+    
+    if (prefix.empty()) {
+        regex_routes_.push_back(route);
+        return;
+    }
+    
+    if (is_literal) {
+        //An earlier route for the same text would always win.
+        if (exact_routes_.find(prefix) == exact_routes_.end()) {
+            exact_routes_[prefix] = route;
+        }
+        
+        return;
+    }
+    
+    //Walk down the trie, adding the missing nodes.
+    size_t node = 0;
+    
+    for (size_t i = 0; i < prefix.length(); i++) {
+        size_t next_node = 0;
+        const std::vector<std::pair<char, size_t> >& children = nodes_[node].children;
+        
+        for (size_t j = 0; j < children.size(); j++) {
+            if (children[j].first == prefix[i]) {
+                next_node = children[j].second;
+                break;
+            }
+        }
+        
+        if (next_node == 0) {
+            next_node = nodes_.size();
+            nodes_.push_back(TrieNode());
+            nodes_[node].children.push_back(std::make_pair(prefix[i], next_node));
+        }
+        
+        node = next_node;
+    }
+    
+    nodes_[node].routes.push_back(route);
+}
+
+/**
+ * Find the first route matching the URI.  The groups captured by
+ * the route's regular expression are written to params.
+ * @return the route's handler, or NULL if no route matches.
+ */
+UriHandler* Router::find(const std::string& uri, PathParams& params) const {
+    params.clear();
+    
+    //A literal route matches without running a regular expression, but
+    //an earlier route could match the URI too.
+    size_t best_route = routes_.size();
+    ExactRouteMap::const_iterator exact_route = exact_routes_.find(uri);
+    
+    if (exact_route != exact_routes_.end()) {
+        best_route = exact_route->second;
+    }
+    
+    //Gather the earlier routes whose prefix starts the URI.
+    std::vector<size_t> candidates;
+    size_t node = 0;
+    
+    for (size_t i = 0; ; i++) {
+        const std::vector<size_t>& routes = nodes_[node].routes;
+        
+        for (size_t j = 0; j < routes.size() && routes[j] < best_route; j++) {
+            candidates.push_back(routes[j]);
+        }
+        
+        if (i == uri.length()) {
+            break;
+        }
+        
+        const std::vector<std::pair<char, size_t> >& children = nodes_[node].children;
+        size_t next_node = 0;
+        
+        for (size_t j = 0; j < children.size(); j++) {
+            if (children[j].first == uri[i]) {
+                next_node = children[j].second;
+                break;
+            }
+        }
+        
+        if (next_node == 0) {
+            break;
+        }
+        
+        node = next_node;
+    }
+    
+    for (size_t i = 0; i < regex_routes_.size() && regex_routes_[i] < best_route; i++) {
+        candidates.push_back(regex_routes_[i]);
+    }
+    
+    std::sort(candidates.begin(), candidates.end());
+    
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (this->matches(candidates[i], uri, params)) {
+            return routes_[candidates[i]].get();
+        }
+    }
+    
+    return (best_route < routes_.size()) ? routes_[best_route].get() : NULL;
+}
+
+/**
+ * Get the longest literal prefix of a regular expression, i.e. the
+ * text any matching string has to start with.  is_literal is set to
+ * true if the whole pattern is literal text.
+ */
+std::string Router::literal_prefix(const std::string& pattern, bool& is_literal) {
+    is_literal = false;
+    
+    //Either side of an alternation may start with anything.
+    if (pattern.find('|') != std::string::npos) {
+        return std::string();
+    }
+    
+    const size_t special_char = pattern.find_first_of("\\^$.?*+()[]{}");
+    
+    if (special_char == std::string::npos) {
+        is_literal = true;
+        return pattern;
+    }
+    
+    //A character that may be repeated zero times is not required.
+    const char quantifier = pattern[special_char];
+    
+    if (special_char > 0 && (quantifier == '?' || quantifier == '*' || quantifier == '{')) {
+        return pattern.substr(0, special_char - 1);
+    }
+    
+    return pattern.substr(0, special_char);
+}
+
+/// Check whether a route's regular expression matches the URI, and
+/// capture its groups if it does.
+bool Router::matches(size_t route, const std::string& uri, PathParams& params) const {
+    boost::smatch groups;
+    
+    if (!boost::regex_match(uri, groups, routes_[route]->pattern())) {
+        return false;
+    }
+    
+    params.clear();
+    
+    for (size_t i = 1; i < groups.size(); i++) {
+        params.push_back(groups[i].str());
+    }
+    
+    return true;
+}
+
+} /* namespace isaword */
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Dispatching request URIs to their handlers without trying every
+// handler's regular expression in turn.
+
+#ifndef ISAWORD_ROUTER_H
+#define ISAWORD_ROUTER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <google/dense_hash_map>
+
+namespace isaword {
+
+class UriHandler;
+
+/// Path parameters captured by a route's regular expression, in the
+/// order of their groups.
+typedef std::vector<std::string> PathParams;
+
+/*---------------------------------------------------------
+                    Router class.
+----------------------------------------------------------*/
+/**
+ * Finds the handler for a request URI.  A route's pattern is split into
+ * a literal prefix and the rest:
+ * - routes that are entirely literal go into a hash table, and are
+ *   found with one lookup;
+ * - routes with a literal prefix go into a trie of the prefixes, so
+ *   that only the routes whose prefix starts the URI have their regular
+ *   expression run;
+ * - routes with no literal prefix are kept in a list and always tried.
+ * The cost of a lookup depends on the URI, not on the number of
+ * routes.  As with a linear scan, the first matching route in the
+ * order they were added wins.
+ */
+class Router {
+public:
+    Router() {
+        exact_routes_.set_empty_key("");
+        nodes_.push_back(TrieNode());
+    }
+    
+    /// Add a route.  Routes are matched in the order they were added.
+    void add(const boost::shared_ptr<UriHandler>& handler);
+    
+    /**
+     * Find the first route matching the URI.  The groups captured by
+     * the route's regular expression are written to params.
+     * @return the route's handler, or NULL if no route matches.
+     */
+    UriHandler* find(const std::string& uri, PathParams& params) const;
+    
+    /**
+     * Get the longest literal prefix of a regular expression, i.e. the
+     * text any matching string has to start with.  is_literal is set to
+     * true if the whole pattern is literal text.
+     */
+    static std::string literal_prefix(const std::string& pattern, bool& is_literal);
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the number of routes.
+    size_t num_routes() const                   {return routes_.size();}
+    
+    /// Get the number of routes found by their full text.
+    size_t num_exact_routes() const             {return exact_routes_.size();}
+    
+    /// Get the number of routes with no literal prefix.
+    size_t num_regex_routes() const             {return regex_routes_.size();}
+    
+private:
+    /// A node of the prefix trie: its children by the next character,
+    /// and the routes whose prefix ends here.
+    class TrieNode {
+    public:
+        std::vector<std::pair<char, size_t> > children;
+        std::vector<size_t> routes;
+    };
+    
+    /**
+     * A functor used to compare the strings in the hash map.
+     */
+    struct eqstr {
+        bool operator()(const std::string& first, const std::string& second) const {
+            return (first == second);
+        }
+    };
+    
+    typedef google::dense_hash_map<std::string,
+                                   size_t,
+                                   boost::hash<std::string>,
+                                   eqstr>
+            ExactRouteMap;
+    
+    /// Check whether a route's regular expression matches the URI, and
+    /// capture its groups if it does.
+    bool matches(size_t route, const std::string& uri, PathParams& params) const;
+    
+    /// All routes, in the order they were added.
+    std::vector<boost::shared_ptr<UriHandler> > routes_;
+    
+    /// Positions of the literal routes in routes_, by their text.
+    ExactRouteMap exact_routes_;
+    
+    /// Trie of the literal prefixes; the root is nodes_[0].
+    std::vector<TrieNode> nodes_;
+    
+    /// Positions of the routes with no literal prefix in routes_.
+    std::vector<size_t> regex_routes_;
+};
+
+} /* namespace isaword */
+#endif
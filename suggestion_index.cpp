@@ -0,0 +1,334 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the strings left after deleting a few of
+// their letters.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "suggestion_index.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  SuggestionIndex class.
+----------------------------------------------------------*/
+const size_t SuggestionIndex::kDefaultMaxDistance;
+const size_t SuggestionIndex::kDefaultPrefixLength;
+const size_t SuggestionIndex::kDefaultMaxBytes;
+const size_t SuggestionIndex::kIdsPerBucket;
+
+/// Longest prefix that can be indexed, limited by the bits of the
+/// mask of deleted positions.
+static const size_t kMaxPrefixLength = 32;
+
+/**
+ * Add the next word.
+ */
+void SuggestionIndex::add(const std::string& word) {
+    pending_prefixes_.push_back(word.substr(0, std::min(prefix_length_, kMaxPrefixLength)));
+}
+
+/**
+ * Build the index once all words have been added.  The ids are laid
+ * out in two passes: the first counts the ids in each bucket, the
+ * second puts them in place.
+ */
+void SuggestionIndex::finish() {
+    prefix_length_ = std::min(prefix_length_, kMaxPrefixLength);
+    
+    //Use a shorter prefix if the index would take too much memory.
+    size_t num_ids = this->count_ids();
+    size_t num_buckets = 1;
+    
+    while (true) {
+        num_buckets = 1;
+        while (num_buckets * kIdsPerBucket < num_ids) {
+            num_buckets *= 2;
+        }
+        
+        const size_t num_bytes = (num_buckets + 1 + num_ids) * sizeof(boost::uint32_t);
+        if (num_bytes <= max_bytes_ || prefix_length_ <= max_distance_ + 1) {
+            break;
+        }
+        
+        prefix_length_--;
+        num_ids = this->count_ids();
+    }
+    
+    bucket_mask_ = static_cast<boost::uint32_t>(num_buckets - 1);
+    
+    //Count the ids in each bucket.
+    std::vector<boost::uint32_t> buckets;
+    bucket_starts_.assign(num_buckets + 1, 0);
+    
+    for (size_t i = 0; i < pending_prefixes_.size(); i++) {
+        this->find_buckets(pending_prefixes_[i], max_distance_, bucket_mask_, buckets);
+        
+        for (size_t j = 0; j < buckets.size(); j++) {
+            bucket_starts_[buckets[j] + 1]++;
+        }
+    }
+    
+    for (size_t i = 1; i < bucket_starts_.size(); i++) {
+        bucket_starts_[i] += bucket_starts_[i - 1];
+    }
+    
+    //Put the ids in place.
+    std::vector<boost::uint32_t> bucket_ends(bucket_starts_.begin(), bucket_starts_.end() - 1);
+    ids_.resize(bucket_starts_.back());
+    
+    for (size_t i = 0; i < pending_prefixes_.size(); i++) {
+        this->find_buckets(pending_prefixes_[i], max_distance_, bucket_mask_, buckets);
+        
+        for (size_t j = 0; j < buckets.size(); j++) {
+            ids_[bucket_ends[buckets[j]]++] = static_cast<WordId>(i);
+        }
+    }
+    
+    std::vector<std::string>().swap(pending_prefixes_);
+}
+
+/**
+ * Find the ids of the words that may be within max_distance edits
+ * of a word.
+ */
+void SuggestionIndex::find_candidates(const std::string& word, WordIdList& ids) const {
+    const size_t first_new_id = ids.size();
+    this->find_candidates(word, max_distance_, 0, 0xFFFFFFFF, ids);
+    
+    std::sort(ids.begin() + first_new_id, ids.end());
+    ids.erase(std::unique(ids.begin() + first_new_id, ids.end()), ids.end());
+}
+
+/**
+ * Find the ids of the words that may be within max_distance edits of
+ * a word.  Any such word shares a string with this one after deleting
+ * up to max_distance letters from each, so deleting fewer letters
+ * from this word is enough when asking for fewer edits.  Sorting the
+ * ids costs more than finding them, so they're left as they are.
+ */
+void SuggestionIndex::find_candidates(const std::string& word, 
+                                      size_t max_distance, 
+                                      WordId range_begin,
+                                      WordId range_end,
+                                      WordIdList& ids) const {
+    if (bucket_starts_.empty()) {
+        return;
+    }
+    
+    std::vector<boost::uint32_t> buckets;
+    this->find_buckets(word, std::min(max_distance, max_distance_), bucket_mask_, buckets);
+    
+    size_t max_new_ids = 0;
+    
+    for (size_t i = 0; i < buckets.size(); i++) {
+        max_new_ids += bucket_starts_[buckets[i] + 1] - bucket_starts_[buckets[i]];
+    }
+    
+    ids.reserve(ids.size() + max_new_ids);
+    
+    for (size_t i = 0; i < buckets.size(); i++) {
+        const WordId* bucket_end = &ids_[0] + bucket_starts_[buckets[i] + 1];
+        
+        for (const WordId* id = &ids_[0] + bucket_starts_[buckets[i]]; id != bucket_end; ++id) {
+            if (*id >= range_begin && *id < range_end) {
+                ids.push_back(*id);
+            }
+        }
+    }
+}
+
+/**
+ * Count the edits needed to turn one word into another, using the
+ * optimal string alignment distance.  Rows of the table that can't
+ * stay within max_distance end the count early.
+ */
+size_t SuggestionIndex::edit_distance(const std::string& first, 
+                                      const std::string& second,
+                                      size_t max_distance) {
+    const size_t length_difference = first.length() > second.length() ? 
+                                     first.length() - second.length() :
+                                     second.length() - first.length();
+    
+    if (length_difference > max_distance) {
+        return max_distance + 1;
+    }
+    
+    //Keep the last three rows of the table.  Short words, which are
+    //most of them, don't need to allocate the rows.
+    const size_t kShortRowLength = 32;
+    size_t short_rows[3][kShortRowLength];
+    std::vector<size_t> long_rows;
+    size_t* before_previous_row = short_rows[0];
+    size_t* previous_row = short_rows[1];
+    size_t* row = short_rows[2];
+    
+    if (second.length() + 1 > kShortRowLength) {
+        long_rows.resize(3 * (second.length() + 1));
+        before_previous_row = &long_rows[0];
+        previous_row = &long_rows[second.length() + 1];
+        row = &long_rows[2 * (second.length() + 1)];
+    }
+    
+    for (size_t j = 0; j <= second.length(); j++) {
+        previous_row[j] = j;
+    }
+    
+    for (size_t i = 1; i <= first.length(); i++) {
+        row[0] = i;
+        size_t row_minimum = row[0];
+        
+        for (size_t j = 1; j <= second.length(); j++) {
+            const size_t substitution_cost = (first[i - 1] == second[j - 1]) ? 0 : 1;
+            row[j] = std::min(std::min(previous_row[j] + 1, row[j - 1] + 1),
+                              previous_row[j - 1] + substitution_cost);
+            
+            if (i > 1 && j > 1 && 
+                first[i - 1] == second[j - 2] && first[i - 2] == second[j - 1]) {
+                row[j] = std::min(row[j], before_previous_row[j - 2] + 1);
+            }
+            
+            row_minimum = std::min(row_minimum, row[j]);
+        }
+        
+        if (row_minimum > max_distance) {
+            return max_distance + 1;
+        }
+        
+        size_t* oldest_row = before_previous_row;
+        before_previous_row = previous_row;
+        previous_row = row;
+        row = oldest_row;
+    }
+    
+    return std::min(previous_row[second.length()], max_distance + 1);
+}
+
+/**
+ * Check whether two words are exactly one edit apart: skip the common
+ * beginning, then the rest must be the same after the one edit.
+ */
+bool SuggestionIndex::is_one_edit_apart(const std::string& first, const std::string& second) {
+    const std::string& longer = (first.length() >= second.length()) ? first : second;
+    const std::string& shorter = (first.length() >= second.length()) ? second : first;
+    
+    if (longer.length() > shorter.length() + 1) {
+        return false;
+    }
+    
+    size_t i = 0;
+    while (i < shorter.length() && longer[i] == shorter[i]) {
+        i++;
+    }
+    
+    if (longer.length() > shorter.length()) {
+        //A deletion.
+        return longer.compare(i + 1, std::string::npos, shorter, i, std::string::npos) == 0;
+    }
+    
+    if (i == longer.length()) {
+        return false;
+    }
+    
+    //A substitution, or a swap of neighbouring letters.
+    if (longer.compare(i + 1, std::string::npos, shorter, i + 1, std::string::npos) == 0) {
+        return true;
+    }
+    
+    return i + 1 < longer.length() && 
+           longer[i] == shorter[i + 1] && longer[i + 1] == shorter[i] &&
+           longer.compare(i + 2, std::string::npos, shorter, i + 2, std::string::npos) == 0;
+}
+
+/**
+ * Get the number of bytes used by the index.
+ */
+size_t SuggestionIndex::memory_bytes() const {
+    return bucket_starts_.capacity() * sizeof(boost::uint32_t) + 
+           ids_.capacity() * sizeof(WordId);
+}
+
+/**
+ * Find the buckets of all strings made by deleting letters from the
+ * prefix of a word.
+ */
+void SuggestionIndex::find_buckets(const std::string& word, 
+                                   size_t max_deletes,
+                                   boost::uint32_t bucket_mask, 
+                                   std::vector<boost::uint32_t>& buckets) const {
+    buckets.clear();
+    const std::string prefix(word, 0, std::min(word.length(), prefix_length_));
+    this->add_deletes(prefix, 0, 0, max_deletes, bucket_mask, buckets);
+    
+    std::sort(buckets.begin(), buckets.end());
+    buckets.erase(std::unique(buckets.begin(), buckets.end()), buckets.end());
+}
+
+/**
+ * Hash the prefix without the letters at deleted positions (FNV-1a),
+ * then recurse into the deletes of the letters after first_position.
+ */
+void SuggestionIndex::add_deletes(const std::string& prefix,
+                                  size_t first_position,
+                                  boost::uint32_t deleted_positions,
+                                  size_t deletes_left,
+                                  boost::uint32_t bucket_mask,
+                                  std::vector<boost::uint32_t>& buckets) const {
+    boost::uint32_t hash = 2166136261u;
+    
+    for (size_t i = 0; i < prefix.length(); i++) {
+        if ((deleted_positions & (1u << i)) == 0) {
+            hash ^= static_cast<unsigned char>(prefix[i]);
+            hash *= 16777619u;
+        }
+    }
+    
+    buckets.push_back(hash & bucket_mask);
+    
+    if (deletes_left == 0) {
+        return;
+    }
+    
+    for (size_t i = first_position; i < prefix.length(); i++) {
+        this->add_deletes(prefix, i + 1, deleted_positions | (1u << i), 
+                          deletes_left - 1, bucket_mask, buckets);
+    }
+}
+
+/**
+ * Count the ids the index would have with the current prefix length.
+ * Deletes that are the same string are only counted once for a word,
+ * so this is the size of ids_ if there are enough buckets.
+ */
+size_t SuggestionIndex::count_ids() const {
+    size_t num_ids = 0;
+    std::vector<boost::uint32_t> buckets;
+    
+    for (size_t i = 0; i < pending_prefixes_.size(); i++) {
+        this->find_buckets(pending_prefixes_[i], max_distance_, 0xFFFFFFFF, buckets);
+        num_ids += buckets.size();
+    }
+    
+    return num_ids;
+}
+
+} /* namespace isaword */
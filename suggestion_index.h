@@ -0,0 +1,175 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// An index of words by the strings left after deleting a few of
+// their letters, used to suggest real words close to a misspelling.
+
+#ifndef ISAWORD_SUGGESTION_INDEX_H
+#define ISAWORD_SUGGESTION_INDEX_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                  SuggestionIndex class.
+----------------------------------------------------------*/
+/**
+ * A symmetric delete index: every word is filed under each string that
+ * can be made by deleting up to max_distance letters from its prefix.
+ * Two words within max_distance edits of each other share at least one
+ * of these strings, so the candidates for a misspelling are found by
+ * looking up its own deletes.
+ *
+ * The deletes themselves aren't stored.  Each one is hashed to a
+ * bucket, and a bucket is just a run of word ids in one flat array;
+ * hash collisions only add a few candidates, which the caller has to
+ * check with edit_distance() anyway.  If the index would take more than
+ * max_bytes, a shorter prefix is used.
+ */
+class SuggestionIndex {
+public:
+    /// Default maximum number of edits between a word and a suggestion.
+    static const size_t kDefaultMaxDistance = 2;
+    
+    /// Default number of letters of each word that get indexed.
+    static const size_t kDefaultPrefixLength = 7;
+    
+    /// Default limit on the memory used by the index.
+    static const size_t kDefaultMaxBytes = 24 << 20;
+    
+    /// Average number of ids per bucket.
+    static const size_t kIdsPerBucket = 4;
+    
+    SuggestionIndex(size_t max_distance = kDefaultMaxDistance,
+                    size_t prefix_length = kDefaultPrefixLength,
+                    size_t max_bytes = kDefaultMaxBytes)
+    : max_distance_(max_distance),
+      prefix_length_(prefix_length),
+      max_bytes_(max_bytes),
+      bucket_mask_(0) {
+    }
+    
+    /**
+     * Add the next word.  Words must be added in order of their ids,
+     * starting with 0.
+     */
+    void add(const std::string& word);
+    
+    /// Build the index once all words have been added.
+    void finish();
+    
+    /**
+     * Find the ids of the words that may be within max_distance edits
+     * of a word, in increasing order.  Some of them may be further away.
+     */
+    void find_candidates(const std::string& word, WordIdList& ids) const;
+    
+    /**
+     * Find the ids of the words that may be within max_distance edits
+     * of a word, for a max_distance no greater than the index's, among
+     * the ids in [range_begin, range_end).  Asking for fewer edits looks
+     * at fewer candidates.  The ids are in no particular order, and may
+     * repeat.
+     */
+    void find_candidates(const std::string& word, 
+                         size_t max_distance, 
+                         WordId range_begin,
+                         WordId range_end,
+                         WordIdList& ids) const;
+    
+    /**
+     * Count the edits (insertions, deletions, substitutions and swaps of
+     * neighbouring letters) needed to turn one word into another.
+     * @return the number of edits, or max_distance + 1 if there are more.
+     */
+    static size_t edit_distance(const std::string& first, 
+                                const std::string& second,
+                                size_t max_distance);
+    
+    /**
+     * Check whether two words are exactly one edit apart, as counted
+     * by edit_distance().  This takes a single pass over the words.
+     */
+    static bool is_one_edit_apart(const std::string& first, const std::string& second);
+    
+    /// Get the number of bytes used by the index.
+    size_t memory_bytes() const;
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the maximum number of edits between a word and a suggestion.
+    size_t max_distance() const         {return max_distance_;}
+    
+    /// Get the number of letters of each word that got indexed.
+    size_t prefix_length() const        {return prefix_length_;}
+    
+private:
+    /**
+     * Find the buckets of all strings made by deleting up to
+     * max_deletes letters from the prefix of a word, given the mask
+     * that turns a hash into a bucket.  The buckets are sorted, without
+     * repeats.
+     */
+    void find_buckets(const std::string& word, 
+                      size_t max_deletes,
+                      boost::uint32_t bucket_mask, 
+                      std::vector<boost::uint32_t>& buckets) const;
+    
+    /**
+     * Hash the prefix of a word without the letters at deleted positions,
+     * then do the same for every way of deleting up to deletes_left more
+     * letters at first_position or after.
+     */
+    void add_deletes(const std::string& prefix,
+                     size_t first_position,
+                     boost::uint32_t deleted_positions,
+                     size_t deletes_left,
+                     boost::uint32_t bucket_mask,
+                     std::vector<boost::uint32_t>& buckets) const;
+    
+    /// Count the ids the index would have with the current prefix length.
+    size_t count_ids() const;
+    
+    /// Maximum number of edits between a word and a suggestion.
+    size_t max_distance_;
+    
+    /// Number of letters of each word to index.
+    size_t prefix_length_;
+    
+    /// Limit on the memory used by the index.
+    size_t max_bytes_;
+    
+    /// The prefixes of the words added so far, before the index is built.
+    std::vector<std::string> pending_prefixes_;
+    
+    /// The mask that turns a hash into a bucket.
+    boost::uint32_t bucket_mask_;
+    
+    /// Where each bucket starts in ids_; one extra entry marks the end.
+    std::vector<boost::uint32_t> bucket_starts_;
+    
+    /// The word ids, grouped by bucket.
+    std::vector<WordId> ids_;
+};
+
+} /* namespace isaword */
+#endif
@@ -20,22 +20,35 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE isaword_server
 
+#include <algorithm>
 #include <fstream>
+#include <set>
 #include <sstream>
 #include <vector>
 #include <string>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
 #include <boost/regex/pattern_except.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include "arc_policy.h"
+#include "asset_pipeline.h"
+#include "content_hash.h"
 #include "http_utils.h"
 #include "http_server.h"
 #include "file_handler.h"
 #include "file_cache.h"
+#include "file_watcher.h"
+#include "dictionary_set.h"
 #include "word_picker.h"
+#include "worker_pool.h"
 
 using namespace isaword;
 using boost::shared_ptr;
@@ -172,6 +185,72 @@ BOOST_AUTO_TEST_CASE(inoke_callback_no_match) {
 }
 BOOST_AUTO_TEST_SUITE_END()
 
+/*---------------------------------------------------------
+                    Router tests.
+----------------------------------------------------------*/
+/// Make a route handing its own number to change_test_value.
+shared_ptr<UriHandler> make_route(const std::string& pattern, int* route_number) {
+    shared_ptr<UriHandler> handler(new UriHandler());
+    handler->initialize(pattern, &change_test_value, route_number);
+    return handler;
+}
+
+BOOST_AUTO_TEST_SUITE(Router_tests)
+
+BOOST_AUTO_TEST_CASE(literal_prefix) {
+    bool is_literal = false;
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/about", is_literal), "/about");
+    BOOST_CHECK(is_literal);
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/about/?", is_literal), "/about");
+    BOOST_CHECK(!is_literal);
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/words/[a-z]+", is_literal), "/words/");
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/wordss*", is_literal), "/words");
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/a+", is_literal), "/a");
+    BOOST_CHECK_EQUAL(Router::literal_prefix("/a|/b", is_literal), "");
+    BOOST_CHECK_EQUAL(Router::literal_prefix(".*", is_literal), "");
+}
+
+BOOST_AUTO_TEST_CASE(find_routes) {
+    int numbers[] = {0, 1, 2, 3, 4};
+    Router router;
+    router.add(make_route("/", &numbers[0]));
+    router.add(make_route("/about/?", &numbers[1]));
+    router.add(make_route("/anagrams/([a-z0-9]+)/([A-Za-z]+)/?", &numbers[2]));
+    router.add(make_route("/about", &numbers[3]));
+    router.add(make_route(".*\\.txt", &numbers[4]));
+    
+    BOOST_CHECK_EQUAL(router.num_routes(), 5);
+    BOOST_CHECK_EQUAL(router.num_exact_routes(), 2);
+    BOOST_CHECK_EQUAL(router.num_regex_routes(), 1);
+    
+    PathParams params;
+    UriHandler* handler = router.find("/", params);
+    BOOST_REQUIRE(handler != NULL);
+    BOOST_CHECK_EQUAL(handler->handler_data(), &numbers[0]);
+    BOOST_CHECK(params.empty());
+    
+    // The earlier pattern wins over the exact route added after it.
+    handler = router.find("/about", params);
+    BOOST_REQUIRE(handler != NULL);
+    BOOST_CHECK_EQUAL(handler->handler_data(), &numbers[1]);
+    
+    handler = router.find("/anagrams/owl2/RETAINS/", params);
+    BOOST_REQUIRE(handler != NULL);
+    BOOST_CHECK_EQUAL(handler->handler_data(), &numbers[2]);
+    BOOST_REQUIRE_EQUAL(params.size(), 2);
+    BOOST_CHECK_EQUAL(params[0], "owl2");
+    BOOST_CHECK_EQUAL(params[1], "RETAINS");
+    
+    handler = router.find("/anagrams/robots.txt", params);
+    BOOST_REQUIRE(handler != NULL);
+    BOOST_CHECK_EQUAL(handler->handler_data(), &numbers[4]);
+    
+    BOOST_CHECK(router.find("/anagrams/owl2", params) == NULL);
+    BOOST_CHECK(router.find("/abo", params) == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 /*---------------------------------------------------------
                     HttpServer tests.
 ----------------------------------------------------------*/
@@ -193,6 +272,37 @@ BOOST_AUTO_TEST_CASE(initialize) {
 
 }
 
+BOOST_AUTO_TEST_CASE(is_admin_request) {
+    HttpServer http_server;
+    struct evhttp_request* request = evhttp_request_new(NULL, NULL);
+    struct evkeyvalq* headers = evhttp_request_get_input_headers(request);
+    
+    //Without a token the admin pages are closed.
+    evhttp_add_header(headers, "Authorization", "Bearer ");
+    BOOST_CHECK(!http_server.is_admin_request(request));
+    
+    http_server.set_admin_token("s3cret");
+    BOOST_CHECK(!http_server.is_admin_request(request));
+    
+    evhttp_remove_header(headers, "Authorization");
+    evhttp_add_header(headers, "Authorization", "Bearer s3cre");
+    BOOST_CHECK(!http_server.is_admin_request(request));
+    
+    evhttp_remove_header(headers, "Authorization");
+    evhttp_add_header(headers, "Authorization", "Bearer s3cret!");
+    BOOST_CHECK(!http_server.is_admin_request(request));
+    
+    evhttp_remove_header(headers, "Authorization");
+    evhttp_add_header(headers, "Authorization", "s3cret");
+    BOOST_CHECK(!http_server.is_admin_request(request));
+    
+    evhttp_remove_header(headers, "Authorization");
+    evhttp_add_header(headers, "Authorization", "Bearer s3cret");
+    BOOST_CHECK(http_server.is_admin_request(request));
+    
+    evhttp_request_free(request);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /*---------------------------------------------------------
@@ -334,6 +444,320 @@ BOOST_AUTO_TEST_CASE(attach_twice) {
 
 BOOST_AUTO_TEST_SUITE_END()
 
+/* ============ accepted_encodings tests ==============*/
+BOOST_AUTO_TEST_SUITE(FileHandler_accepted_encodings_tests)
+
+BOOST_AUTO_TEST_CASE(no_header) {
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings(NULL), IDENTITY_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings(""), IDENTITY_ENCODING);
+}
+
+BOOST_AUTO_TEST_CASE(listed_encodings) {
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("gzip"), GZIP_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("gzip, deflate, br"), 
+                      GZIP_ENCODING | BROTLI_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings(" BR ;q=0.5,identity"), 
+                      BROTLI_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("deflate"), IDENTITY_ENCODING);
+}
+
+BOOST_AUTO_TEST_CASE(refused_encodings) {
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("gzip;q=0, br"), BROTLI_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("gzip; q=0.000"), IDENTITY_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("gzip;q=0.001"), GZIP_ENCODING);
+}
+
+BOOST_AUTO_TEST_CASE(any_encoding) {
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("*"), 
+                      GZIP_ENCODING | BROTLI_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("br;q=0, *"), GZIP_ENCODING);
+    BOOST_CHECK_EQUAL(FileHandler::accepted_encodings("*;q=0"), IDENTITY_ENCODING);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/* ============ etag_matches tests ==============*/
+BOOST_AUTO_TEST_SUITE(FileHandler_etag_matches_tests)
+
+BOOST_AUTO_TEST_CASE(single_tag) {
+    BOOST_CHECK(FileHandler::etag_matches("\"0123456789abcdef\"", "\"0123456789abcdef\""));
+    BOOST_CHECK(!FileHandler::etag_matches("\"0123456789abcdee\"", "\"0123456789abcdef\""));
+    BOOST_CHECK(!FileHandler::etag_matches("\"0123456789abcdef-gzip\"", "\"0123456789abcdef\""));
+    BOOST_CHECK(!FileHandler::etag_matches("", "\"0123456789abcdef\""));
+}
+
+BOOST_AUTO_TEST_CASE(several_tags) {
+    BOOST_CHECK(FileHandler::etag_matches("\"a\", \"0123456789abcdef\" ,\"b\"", 
+                                          "\"0123456789abcdef\""));
+    BOOST_CHECK(!FileHandler::etag_matches("\"a\", \"b\"", "\"0123456789abcdef\""));
+}
+
+BOOST_AUTO_TEST_CASE(weak_and_any_tags) {
+    BOOST_CHECK(FileHandler::etag_matches("W/\"0123456789abcdef\"", "\"0123456789abcdef\""));
+    BOOST_CHECK(FileHandler::etag_matches("*", "\"0123456789abcdef\""));
+    BOOST_CHECK(FileHandler::etag_matches(" * ", "\"0123456789abcdef\""));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/* ============ split_fingerprint tests ==============*/
+BOOST_AUTO_TEST_SUITE(FileHandler_split_fingerprint_tests)
+
+BOOST_AUTO_TEST_CASE(fingerprinted_path) {
+    std::string file_path;
+    std::string fingerprint;
+    BOOST_CHECK(FileHandler::split_fingerprint("js/isaword.0123456789abcdef.js", 
+                                               file_path, 
+                                               fingerprint));
+    BOOST_CHECK_EQUAL(file_path, "js/isaword.js");
+    BOOST_CHECK_EQUAL(fingerprint, "0123456789abcdef");
+    
+    BOOST_CHECK(FileHandler::split_fingerprint("a.b.0123456789abcdef.css", file_path, fingerprint));
+    BOOST_CHECK_EQUAL(file_path, "a.b.css");
+}
+
+BOOST_AUTO_TEST_CASE(plain_path) {
+    std::string file_path("unchanged");
+    std::string fingerprint("unchanged");
+    BOOST_CHECK(!FileHandler::split_fingerprint("js/isaword.js", file_path, fingerprint));
+    BOOST_CHECK(!FileHandler::split_fingerprint("js/isaword.0123456789ABCDEF.js", 
+                                                file_path, 
+                                                fingerprint));
+    BOOST_CHECK(!FileHandler::split_fingerprint("js/isaword.0123456789abcde.js", 
+                                                file_path, 
+                                                fingerprint));
+    BOOST_CHECK(!FileHandler::split_fingerprint("js/.0123456789abcdef.js", file_path, fingerprint));
+    BOOST_CHECK(!FileHandler::split_fingerprint("0123456789abcdef.js", file_path, fingerprint));
+    BOOST_CHECK_EQUAL(file_path, "unchanged");
+    BOOST_CHECK_EQUAL(fingerprint, "unchanged");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/* ============ warm_up tests ==============*/
+class FileHandlerWarmUpFixture {
+public:
+    FileHandlerWarmUpFixture()
+    : root("warmup_test") {
+        remove_all(root);
+        create_directories(root + "/css");
+        write_file("index.html", "<html></html>");
+        write_file("css/isaword.css", "body {}");
+        write_file(".hidden", "secret");
+        file_handler.initialize(root);
+    }
+    
+    ~FileHandlerWarmUpFixture() {
+        remove_all(root);
+    }
+    
+    /// Write a file under the root.
+    void write_file(const std::string& relative_path, const std::string& contents) {
+        std::ofstream file((root + "/" + relative_path).c_str());
+        file << contents;
+    }
+    
+    std::string root;
+    FileHandler file_handler;
+};
+
+BOOST_FIXTURE_TEST_SUITE(FileHandler_warm_up_tests, FileHandlerWarmUpFixture)
+
+BOOST_AUTO_TEST_CASE(warm_up_all_files) {
+    size_t bytes_loaded = 0;
+    BOOST_CHECK_EQUAL(file_handler.warm_up("", 2, bytes_loaded), 2);
+    BOOST_CHECK_EQUAL(bytes_loaded, strlen("<html></html>") + strlen("body {}"));
+}
+
+BOOST_AUTO_TEST_CASE(warm_up_from_manifest) {
+    write_file("manifest", "# Preloaded files.\n\ncss/isaword.css\r\n../secret\nno_such_file\n");
+    size_t bytes_loaded = 0;
+    BOOST_CHECK_EQUAL(file_handler.warm_up(root + "/manifest", 2, bytes_loaded), 1);
+    BOOST_CHECK_EQUAL(bytes_loaded, strlen("body {}"));
+}
+
+BOOST_AUTO_TEST_CASE(warm_up_without_manifest) {
+    size_t bytes_loaded = 0;
+    BOOST_CHECK_EQUAL(file_handler.warm_up(root + "/no_such_manifest", 1, bytes_loaded), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    AssetPipeline tests.
+----------------------------------------------------------*/
+class AssetPipelineFixture {
+public:
+    AssetPipelineFixture()
+    : root("asset_test"),
+      bundle_root("asset_test_bundles") {
+        remove_all(root);
+        remove_all(bundle_root);
+        create_directories(root + "/js");
+        create_directories(root + "/css");
+        create_directories(bundle_root);
+        write_file("js/a.js", "// A.\nvar a = 1;\n");
+        write_file("js/b.js", "/*! B. */\nvar b = 2;\n");
+        write_file("css/site.css", "body {\n    background: url(/resources/css/dot.png);\n}\n");
+        write_file("css/dot.png", "dot");
+        
+        file_handler = shared_ptr<FileHandler>(new FileHandler());
+        file_handler->initialize(root);
+        server = shared_ptr<HttpServer>(new HttpServer());
+        server->initialize();
+        file_handler->attach_to_server(server, "/resources/");
+        bundle_handler = shared_ptr<FileHandler>(new FileHandler());
+        bundle_handler->initialize(bundle_root);
+        bundle_handler->attach_to_server(server, "/bundles/");
+        asset_pipeline = 
+            shared_ptr<AssetPipeline>(new AssetPipeline(file_handler, bundle_handler));
+    }
+    
+    ~AssetPipelineFixture() {
+        remove_all(root);
+        remove_all(bundle_root);
+    }
+    
+    /// Write a file under the root.
+    void write_file(const std::string& relative_path, const std::string& contents) {
+        std::ofstream file((root + "/" + relative_path).c_str());
+        file << contents;
+    }
+    
+    /// Read a bundle.
+    std::string read_bundle(const std::string& relative_path) {
+        std::ifstream file((bundle_root + "/" + relative_path).c_str());
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+    
+    std::string root;
+    std::string bundle_root;
+    shared_ptr<FileHandler> file_handler;
+    shared_ptr<FileHandler> bundle_handler;
+    shared_ptr<HttpServer> server;
+    shared_ptr<AssetPipeline> asset_pipeline;
+};
+
+BOOST_FIXTURE_TEST_SUITE(AssetPipeline_tests, AssetPipelineFixture)
+
+BOOST_AUTO_TEST_CASE(minify_js) {
+    BOOST_CHECK_EQUAL(AssetPipeline::minify_js("/* Comment. */\nvar a = 1;  // One.\n\n"
+                                               "    var b  =  a;\n"),
+                      "var a = 1;\nvar b = a;");
+    
+    //Literals are kept as they are.
+    BOOST_CHECK_EQUAL(AssetPipeline::minify_js("var url = \"http://a/*b*/\";  "
+                                               "var re = /\\/\\*[/]*/g;"),
+                      "var url = \"http://a/*b*/\"; var re = /\\/\\*[/]*/g;");
+    
+    //So are the licenses.
+    BOOST_CHECK_EQUAL(AssetPipeline::minify_js("/*! License. */\n(function() {\n"
+                                               "    return 1 / 2;\n})();"),
+                      "/*! License. */\n(function() {\nreturn 1 / 2;\n})();");
+}
+
+BOOST_AUTO_TEST_CASE(minify_css) {
+    BOOST_CHECK_EQUAL(AssetPipeline::minify_css("/* Style. */\nbody {\n    color: red;\n"
+                                                "    margin: 0  auto;\n}\n"
+                                                "a:hover, a > b {\n}\n"),
+                      "body{color:red;margin:0 auto}a:hover,a > b{}");
+    BOOST_CHECK_EQUAL(AssetPipeline::minify_css("p:before { content: \"a ; b\"; }"),
+                      "p:before{content:\"a ; b\"}");
+}
+
+BOOST_AUTO_TEST_CASE(fingerprinted_path) {
+    const std::string path(file_handler->fingerprinted_path("js/a.js"));
+    std::string file_path;
+    std::string fingerprint;
+    BOOST_REQUIRE(FileHandler::split_fingerprint(path, file_path, fingerprint));
+    BOOST_CHECK_EQUAL(file_path, "js/a.js");
+    
+    //The fingerprint changes with the contents.
+    write_file("js/a.js", "var a = 2;");
+    file_handler->handle_file_change("js/a.js");
+    BOOST_CHECK_NE(file_handler->fingerprinted_path("js/a.js"), path);
+    
+    BOOST_CHECK_EQUAL(file_handler->fingerprinted_path("js/no_such_file.js"), "");
+    BOOST_CHECK_EQUAL(file_handler->fingerprinted_path("../asset_test/js/a.js"), "");
+}
+
+BOOST_AUTO_TEST_CASE(rewrite_urls) {
+    const std::string fingerprinted_path(file_handler->fingerprinted_path("js/a.js"));
+    const std::string page("<script src=\"/resources/js/a.js\"></script>"
+                           "<script src=\"/resources/js/no_such_file.js\"></script>"
+                           "<a href=\"http://example.com/resources/js/a.js\">");
+    
+    //Only the recorded URLs are rewritten.
+    BOOST_CHECK_EQUAL(asset_pipeline->rewrite_urls(page), page);
+    
+    asset_pipeline->track_urls(page);
+    BOOST_CHECK_EQUAL(asset_pipeline->rewrite_urls(page), 
+                      "<script src=\"/resources/" + fingerprinted_path + "\"></script>"
+                      "<script src=\"/resources/js/no_such_file.js\"></script>"
+                      "<a href=\"http://example.com/resources/js/a.js\">");
+}
+
+BOOST_AUTO_TEST_CASE(build_script_bundle) {
+    std::vector<std::string> source_paths;
+    source_paths.push_back("js/a.js");
+    source_paths.push_back("js/b.js");
+    BOOST_REQUIRE(asset_pipeline->build_bundle("all.js", source_paths));
+    BOOST_CHECK_EQUAL(read_bundle("all.js"), "var a = 1;;\n/*! B. */\nvar b = 2;;\n");
+    
+    //The bundle is served from its own directory, never from the 
+    //static files.
+    BOOST_CHECK(!exists(root + "/all.js"));
+    asset_pipeline->track_urls("src=\"/bundles/all.js\"");
+    BOOST_CHECK_EQUAL(asset_pipeline->rewrite_urls("src=\"/bundles/all.js\""), 
+                      "src=\"/bundles/" + bundle_handler->fingerprinted_path("all.js") + "\"");
+    
+    source_paths.push_back("js/no_such_file.js");
+    BOOST_CHECK(!asset_pipeline->build_bundle("all.js", source_paths));
+}
+
+BOOST_AUTO_TEST_CASE(build_style_bundle) {
+    //The URLs in the style sheets are fingerprinted too.
+    std::vector<std::string> source_paths;
+    source_paths.push_back("css/site.css");
+    BOOST_REQUIRE(asset_pipeline->build_bundle("all.css", source_paths));
+    BOOST_CHECK_EQUAL(read_bundle("all.css"), 
+                      "body{background:url(/resources/" 
+                      + file_handler->fingerprinted_path("css/dot.png") + ")}\n");
+}
+
+BOOST_AUTO_TEST_CASE(refresh) {
+    std::vector<std::string> source_paths;
+    source_paths.push_back("js/a.js");
+    BOOST_REQUIRE(asset_pipeline->build_bundle("all.js", source_paths));
+    const std::string page("<script src=\"/bundles/all.js\"></script>"
+                           "<script src=\"/resources/js/b.js\"></script>");
+    asset_pipeline->track_urls(page);
+    const std::string old_page(asset_pipeline->rewrite_urls(page));
+    const size_t old_generation = asset_pipeline->generation();
+    
+    //The generation only moves on when a fingerprint changes.
+    asset_pipeline->track_urls(page);
+    BOOST_REQUIRE(asset_pipeline->refresh());
+    BOOST_CHECK_EQUAL(asset_pipeline->generation(), old_generation);
+    
+    //The bundles and the fingerprints follow the files.
+    write_file("js/a.js", "var a = 3;");
+    write_file("js/b.js", "var b = 4;");
+    file_handler->handle_file_change("");
+    BOOST_REQUIRE(asset_pipeline->refresh());
+    BOOST_CHECK_NE(asset_pipeline->generation(), old_generation);
+    BOOST_CHECK_EQUAL(read_bundle("all.js"), "var a = 3;;\n");
+    BOOST_CHECK_EQUAL(asset_pipeline->rewrite_urls(page), 
+                      "<script src=\"/bundles/" + bundle_handler->fingerprinted_path("all.js") 
+                      + "\"></script><script src=\"/resources/" 
+                      + file_handler->fingerprinted_path("js/b.js") + "\"></script>");
+    BOOST_CHECK_NE(asset_pipeline->rewrite_urls(page), old_page);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 /* ============ read_file tests ==============*/
 BOOST_FIXTURE_TEST_SUITE(FileHandler_read_file_tests, FileHandlerWithRootFixture)
 
@@ -516,6 +940,137 @@ BOOST_AUTO_TEST_CASE(bad_path13) {
 }
 
 
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    content_hash tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(content_hash_tests)
+
+BOOST_AUTO_TEST_CASE(reference_values) {
+    //Values from the reference XXH64 implementation.
+    BOOST_CHECK_EQUAL(content_hash("", 0), 0xEF46DB3751D8E999ULL);
+    BOOST_CHECK_EQUAL(content_hash("a", 1), 0xD24EC4F1A98C6E5BULL);
+    BOOST_CHECK_EQUAL(content_hash("abc", 3), 0x44BC2CF5AD770999ULL);
+    
+    std::string digits;
+    
+    for (size_t i = 0; i < 5; ++i) {
+        digits += "0123456789";
+    }
+    
+    BOOST_CHECK_EQUAL(content_hash(digits.c_str(), digits.size()), 0x4F7CA65914623935ULL);
+    
+    std::string bytes;
+    
+    for (size_t i = 0; i < 3 * 256; ++i) {
+        bytes += static_cast<char>(i % 256);
+    }
+    
+    BOOST_CHECK_EQUAL(content_hash(bytes.c_str(), bytes.size()), 0x8E03C838C596036FULL);
+}
+
+BOOST_AUTO_TEST_CASE(unaligned_data) {
+    const std::string text("xThe quick brown fox jumps over the lazy dog, twice.");
+    BOOST_CHECK_EQUAL(content_hash(text.c_str() + 1, text.size() - 1),
+                      content_hash(std::string(text, 1).c_str(), text.size() - 1));
+    BOOST_CHECK(content_hash(text.c_str(), text.size()) != 
+                content_hash(text.c_str(), text.size(), 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    FileWatcher tests.
+----------------------------------------------------------*/
+class FileWatcherFixture {
+public:
+    FileWatcherFixture()
+    : root("watcher_test") {
+        remove_all(root);
+        create_directories(root + "/css");
+        base = event_base_new();
+    }
+    
+    ~FileWatcherFixture() {
+        remove_all(root);
+        event_base_free(base);
+    }
+    
+    static void record_change(const std::string& relative_path, void* fixture) {
+        ((FileWatcherFixture*) fixture)->changes.push_back(relative_path);
+    }
+    
+    /// Write a file under the root.
+    void write_file(const std::string& relative_path) {
+        std::ofstream file((root + "/" + relative_path).c_str());
+        file << "body {}";
+    }
+    
+    /// Let the watcher pick up the pending changes.
+    void run_loop() {
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    
+    std::string root;
+    struct event_base* base;
+    std::vector<std::string> changes;
+};
+
+BOOST_FIXTURE_TEST_SUITE(FileWatcher_tests, FileWatcherFixture)
+
+BOOST_AUTO_TEST_CASE(watch_subdirectories) {
+    FileWatcher watcher;
+    BOOST_REQUIRE(watcher.initialize(root));
+    BOOST_REQUIRE(watcher.attach(base, &FileWatcherFixture::record_change, this));
+    BOOST_CHECK_EQUAL(watcher.root(), root + "/");
+    BOOST_CHECK_EQUAL(watcher.num_watched_dirs(), 2);
+    BOOST_CHECK(watcher.is_watching());
+    
+    write_file("css/style.css");
+    run_loop();
+    
+    BOOST_REQUIRE(!changes.empty());
+    BOOST_CHECK_EQUAL(changes.back(), "css/style.css");
+}
+
+BOOST_AUTO_TEST_CASE(watch_new_directory) {
+    FileWatcher watcher;
+    BOOST_REQUIRE(watcher.initialize(root));
+    BOOST_REQUIRE(watcher.attach(base, &FileWatcherFixture::record_change, this));
+    
+    //A new directory may change any file.
+    create_directories(root + "/js");
+    run_loop();
+    BOOST_REQUIRE_EQUAL(changes.size(), 1);
+    BOOST_CHECK_EQUAL(changes[0], "");
+    BOOST_CHECK_EQUAL(watcher.num_watched_dirs(), 3);
+    
+    changes.clear();
+    write_file("js/app.js");
+    run_loop();
+    BOOST_REQUIRE(!changes.empty());
+    BOOST_CHECK_EQUAL(changes.back(), "js/app.js");
+}
+
+BOOST_AUTO_TEST_CASE(stop_watching_removed_root) {
+    FileWatcher watcher;
+    BOOST_REQUIRE(watcher.initialize(root));
+    BOOST_REQUIRE(watcher.attach(base, &FileWatcherFixture::record_change, this));
+    
+    remove_all(root);
+    run_loop();
+    BOOST_CHECK(!watcher.is_watching());
+    BOOST_REQUIRE(!changes.empty());
+    BOOST_CHECK_EQUAL(changes.back(), "");
+}
+
+BOOST_AUTO_TEST_CASE(initialize_nonexistent_root) {
+    FileWatcher watcher;
+    BOOST_CHECK(!watcher.initialize("no_such_dir"));
+    BOOST_CHECK(!watcher.attach(base, &FileWatcherFixture::record_change, this));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /*---------------------------------------------------------
@@ -667,130 +1222,981 @@ BOOST_AUTO_TEST_CASE(get_deleted_file) {
     BOOST_CHECK_EQUAL(data_size, 0);
 }
 
-//TODO: test refresh()
-
-BOOST_AUTO_TEST_SUITE_END()
-
-/*---------------------------------------------------------
-                    FileCache tests.
-----------------------------------------------------------*/
-BOOST_FIXTURE_TEST_SUITE(FileCache_tests, FileCacheFixture)
-
-BOOST_AUTO_TEST_CASE(get_nonexistent_file) {
-    BOOST_CHECK(!file_cache.get("no_such_file", data, &data_size));
-    BOOST_CHECK_EQUAL(data, empty_ptr);
-    BOOST_CHECK_EQUAL(data_size, 0);
+BOOST_AUTO_TEST_CASE(compress_gzip) {
+    const std::string text(2000, 'a');
+    shared_array<char> compressed_data;
+    size_t compressed_size = 0;
+    BOOST_REQUIRE(CachedFile::compress(GZIP_ENCODING, text.c_str(), text.size(),
+                                       compressed_data, compressed_size));
+    BOOST_CHECK_LT(compressed_size, text.size());
+    
+    //Check that it's a gzip stream that inflates back to the text.
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    BOOST_REQUIRE_EQUAL(inflateInit2(&stream, 15 + 16), Z_OK);
+    std::vector<char> inflated(text.size() + 1);
+    stream.next_in = reinterpret_cast<Bytef*>(compressed_data.get());
+    stream.avail_in = compressed_size;
+    stream.next_out = reinterpret_cast<Bytef*>(&inflated[0]);
+    stream.avail_out = inflated.size();
+    BOOST_CHECK_EQUAL(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    BOOST_CHECK_EQUAL(stream.total_out, text.size());
+    inflateEnd(&stream);
+    BOOST_CHECK_EQUAL(std::string(&inflated[0], text.size()), text);
+}
+
+BOOST_AUTO_TEST_CASE(get_compressed_variants) {
+    //Repetitive text compresses well.
+    remove(file_name);
+    file.open(file_name.c_str());
+    
+    for (size_t i = 0; i < 100; ++i) {
+        file << starting_data;
+    }
+    
+    file.close();
+    
+    CachedFile cached_file(file_name);
+    BOOST_REQUIRE(cached_file.get(data, data_size));
+    
+    shared_array<char> gzip_data;
+    size_t gzip_size = 0;
+    BOOST_REQUIRE(cached_file.encoded_data(GZIP_ENCODING, gzip_data, gzip_size));
+    BOOST_CHECK_LE(gzip_size * 100, data_size * CachedFile::kMaxCompressedPercent);
+    
+    shared_array<char> identity_data;
+    size_t identity_size = 0;
+    BOOST_CHECK(cached_file.encoded_data(IDENTITY_ENCODING, identity_data, identity_size));
+    BOOST_CHECK_EQUAL(identity_data, data);
+    BOOST_CHECK_EQUAL(identity_size, data_size);
 }
 
-BOOST_AUTO_TEST_CASE(get_nonexistent_file_no_data_size) {
-    BOOST_CHECK(!file_cache.get("no_such_file", data));
-    BOOST_CHECK_EQUAL(data, empty_ptr);
+BOOST_AUTO_TEST_CASE(skip_poorly_compressed_variants) {
+    //The test data is too short and random to be worth compressing.
+    CachedFile cached_file(file_name);
+    BOOST_REQUIRE(cached_file.get(data, data_size));
+    
+    BOOST_CHECK(!cached_file.encoded_data(GZIP_ENCODING, data, data_size));
+    BOOST_CHECK(!cached_file.encoded_data(BROTLI_ENCODING, data, data_size));
 }
 
-BOOST_AUTO_TEST_CASE(get_file) {
-    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
-    BOOST_REQUIRE_NE(data, empty_ptr);
+BOOST_AUTO_TEST_CASE(get_mapped_file) {
+    CachedFile cached_file(file_name);
+    cached_file.set_mmap_threshold(1);
+    
+    BOOST_CHECK(cached_file.get(data, data_size));
+    BOOST_CHECK(cached_file.is_mapped());
     BOOST_REQUIRE_EQUAL(data_size, starting_data_size);
     BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
-    
     BOOST_CHECK_EQUAL(data[data_size], '\0');
 }
 
-BOOST_AUTO_TEST_CASE(get_file_no_data_size) {
-    BOOST_CHECK(file_cache.get(file_name, data));
-    BOOST_REQUIRE_NE(data, empty_ptr);
-    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+BOOST_AUTO_TEST_CASE(get_mapped_file_ending_on_page_boundary) {
+    //The terminating zero lies past the end of the file's last page.
+    const size_t file_size = 2 * sysconf(_SC_PAGESIZE);
+    remove(file_name);
+    file.open(file_name.c_str());
+    file << std::string(file_size, 'x');
+    file.close();
     
-    BOOST_CHECK_EQUAL(data[starting_data_size], '\0');
-}
-
-BOOST_AUTO_TEST_CASE(set_file_root) {
-    file_cache.set_file_root("test");
-    BOOST_CHECK_EQUAL(file_cache.file_root(), "test/");
+    CachedFile cached_file(file_name);
+    cached_file.set_mmap_threshold(1);
     
-    file_cache.set_file_root("toast/");
-    BOOST_CHECK_EQUAL(file_cache.file_root(), "toast/");
+    BOOST_CHECK(cached_file.get(data, data_size));
+    BOOST_CHECK(cached_file.is_mapped());
+    BOOST_REQUIRE_EQUAL(data_size, file_size);
+    BOOST_CHECK_EQUAL(data[file_size - 1], 'x');
+    BOOST_CHECK_EQUAL(data[file_size], '\0');
 }
 
-BOOST_AUTO_TEST_CASE(set_file_root_get_file) {
-    file_cache.set_file_root(one_up_path);
-    BOOST_CHECK(file_cache.get(one_up_file_name, data));
-    BOOST_REQUIRE_NE(data, empty_ptr);
-    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+BOOST_AUTO_TEST_CASE(get_large_file_read) {
+    //Files under the mmap threshold are read in full, whatever their size.
+    const size_t file_size = 300000;
+    std::string contents;
     
-    BOOST_CHECK_EQUAL(data[starting_data_size], '\0');
-}
-
-BOOST_AUTO_TEST_CASE(get_file_from_cache) {
-    //Load the file to cache
-    file_cache.get(file_name, data, &data_size);
+    for (size_t i = 0; i < file_size; ++i) {
+        contents += static_cast<char>('a' + i % 26);
+    }
     
-    //Rewrite the file.
     remove(file_name);
     file.open(file_name.c_str());
-    file << new_data;
+    file << contents;
     file.close();
     
-    //Load the data again.  Sould still be old data.
-    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
-    BOOST_REQUIRE_NE(data, empty_ptr);
-    BOOST_REQUIRE_EQUAL(data_size, starting_data_size);
-    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+    CachedFile cached_file(file_name);
+    cached_file.set_mmap_threshold(file_size + 1);
+    
+    BOOST_CHECK(cached_file.get(data, data_size));
+    BOOST_CHECK(!cached_file.is_mapped());
+    BOOST_REQUIRE_EQUAL(data_size, file_size);
+    BOOST_CHECK_EQUAL(memcmp(contents.c_str(), data.get(), file_size), 0);
+    BOOST_CHECK_EQUAL(data[data_size], '\0');
 }
 
-BOOST_AUTO_TEST_CASE(get_expired_file) {
-    //File is modified after loading, and the cache has expired.
-    //Load the file to cache
-    file_cache.set_expiration_period(0);
-    file_cache.get(file_name, data, &data_size);
-    sleep(2);
-    
-    //Rewrite the file.
+BOOST_AUTO_TEST_CASE(get_large_file_not_mapped_by_default) {
+    //A file rewritten in place would break a mapping of it, so files
+    //are only mapped when asked to.
     remove(file_name);
     file.open(file_name.c_str());
-    file << new_data;
+    file << std::string(4 * BufferPool::kMaxBufferSize, 'x');
     file.close();
     
-    //Load the data again.  Sould still be old data.
-    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
-    BOOST_REQUIRE_NE(data, empty_ptr);
-    BOOST_REQUIRE_EQUAL(data_size, new_data_size);
-    BOOST_CHECK_EQUAL(memcmp(new_data.c_str(), data.get(), new_data_size), 0);
+    CachedFile cached_file(file_name);
+    
+    BOOST_CHECK(cached_file.get(data, data_size));
+    BOOST_CHECK(!cached_file.is_mapped());
+    BOOST_CHECK_EQUAL(data_size, 4 * BufferPool::kMaxBufferSize);
 }
 
-BOOST_AUTO_TEST_CASE(get_deleted_file) {
-    //Cache has expired and the file was deleted.
-    //Load the file to cache
-    file_cache.set_expiration_period(0);
-    file_cache.get(file_name, data, &data_size);
-    
-    //Rewrite the file.
-    sleep(2);
-    remove(file_name);
-    
-    //Load the data again.  Sould still be old data.
-    BOOST_CHECK(!file_cache.get(file_name, data, &data_size));
-    BOOST_CHECK_EQUAL(data, empty_ptr);
-    BOOST_CHECK_EQUAL(data_size, 0);
+BOOST_AUTO_TEST_CASE(content_type) {
+    BOOST_CHECK_EQUAL(CachedFile::content_type("css/isaword.css"), std::string("text/css"));
+    BOOST_CHECK_EQUAL(CachedFile::content_type("js/isaword.js"), std::string("text/javascript"));
+    BOOST_CHECK_EQUAL(CachedFile::content_type("x.mark.png"), std::string("image/png"));
+    BOOST_CHECK_EQUAL(CachedFile::content_type("readme.txt"), std::string("text/plain"));
+    BOOST_CHECK_EQUAL(CachedFile::content_type("index"), std::string("text/html"));
+    BOOST_CHECK_EQUAL(CachedFile::content_type("page.jsx"), std::string("text/html"));
 }
 
+//TODO: test refresh()
+
 BOOST_AUTO_TEST_SUITE_END()
 
 /*---------------------------------------------------------
-                    WordIndexDescription class.
+                    BufferPool tests.
 ----------------------------------------------------------*/
-class WordIndexDescriptionFixture {
-public:
-    WordIndexDescriptionFixture() {
-        index_description = 
-            shared_ptr<WordIndexDescription>(new WordIndexDescription("index", 
-                                                                      "Some Index",
-                                                                      "^.*Z.*$"));
-    }
+BOOST_AUTO_TEST_SUITE(BufferPool_tests)
+
+BOOST_AUTO_TEST_CASE(reuse_released_buffers) {
+    shared_ptr<BufferPool> pool(new BufferPool());
+    shared_array<char> buffer(pool->allocate(100));
+    char* first_buffer = buffer.get();
+    BOOST_CHECK_EQUAL(pool->num_free_buffers(), 0);
     
-    shared_ptr<WordIndexDescription> index_description;
+    buffer.reset();
+    BOOST_CHECK_EQUAL(pool->num_free_buffers(), 1);
+    
+    //A buffer of the same size class is reused.
+    buffer = pool->allocate(BufferPool::kMinBufferSize);
+    BOOST_CHECK_EQUAL(buffer.get(), first_buffer);
+    BOOST_CHECK_EQUAL(pool->num_free_buffers(), 0);
+    
+    //A larger one is not.
+    shared_array<char> larger_buffer(pool->allocate(BufferPool::kMinBufferSize + 1));
+    BOOST_CHECK(larger_buffer.get() != first_buffer);
+    larger_buffer[BufferPool::kMinBufferSize] = 'x';
+}
 
-};
+BOOST_AUTO_TEST_CASE(buffers_outlive_pool) {
+    shared_ptr<BufferPool> pool(new BufferPool());
+    shared_array<char> buffer(pool->allocate(10));
+    pool.reset();
+    
+    strcpy(buffer.get(), "still here");
+    BOOST_CHECK_EQUAL(std::string(buffer.get()), "still here");
+}
+
+BOOST_AUTO_TEST_CASE(limit_free_buffers) {
+    shared_ptr<BufferPool> pool(new BufferPool());
+    std::vector<shared_array<char> > buffers;
+    
+    for (size_t i = 0; i < 2 * BufferPool::kMaxFreeBuffers; ++i) {
+        buffers.push_back(pool->allocate(10));
+    }
+    
+    buffers.clear();
+    BOOST_CHECK_EQUAL(pool->num_free_buffers(), BufferPool::kMaxFreeBuffers);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    ArcPolicy tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(ArcPolicy_tests)
+
+BOOST_AUTO_TEST_CASE(evict_least_recently_used) {
+    ArcPolicy policy(30);
+    std::vector<std::string> evicted;
+    policy.insert("a", 10, evicted);
+    policy.insert("b", 10, evicted);
+    policy.insert("c", 10, evicted);
+    BOOST_CHECK(evicted.empty());
+    
+    policy.insert("d", 10, evicted);
+    BOOST_REQUIRE_EQUAL(evicted.size(), 1);
+    BOOST_CHECK_EQUAL(evicted[0], "a");
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 30);
+    BOOST_CHECK_EQUAL(policy.num_resident(), 3);
+    BOOST_CHECK(!policy.is_resident("a"));
+}
+
+BOOST_AUTO_TEST_CASE(keep_frequent_keys_through_scan) {
+    ArcPolicy policy(30);
+    std::vector<std::string> evicted;
+    policy.insert("a", 10, evicted);
+    BOOST_CHECK(policy.touch("a"));
+    
+    //Keys seen only once never push out a key seen twice.
+    for (char key = 'b'; key <= 'z'; ++key) {
+        policy.insert(std::string(1, key), 10, evicted);
+    }
+    
+    BOOST_CHECK(policy.is_resident("a"));
+    BOOST_CHECK(std::find(evicted.begin(), evicted.end(), "a") == evicted.end());
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 30);
+}
+
+BOOST_AUTO_TEST_CASE(readmit_ghost_as_frequent) {
+    ArcPolicy policy(30);
+    std::vector<std::string> evicted;
+    policy.insert("a", 10, evicted);
+    policy.touch("a");
+    policy.insert("b", 10, evicted);
+    policy.insert("c", 10, evicted);
+    policy.insert("d", 10, evicted);
+    BOOST_REQUIRE_EQUAL(evicted.size(), 1);
+    BOOST_CHECK_EQUAL(evicted[0], "b");
+    BOOST_CHECK_EQUAL(policy.num_ghosts(), 1);
+    BOOST_CHECK(!policy.touch("b"));
+    
+    //Loading an evicted key again means the keys seen once deserve more room.
+    policy.insert("b", 10, evicted);
+    BOOST_CHECK(policy.is_resident("b"));
+    BOOST_CHECK(!policy.is_resident("c"));
+    BOOST_CHECK_EQUAL(policy.target_recent_bytes(), 10);
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 30);
+}
+
+BOOST_AUTO_TEST_CASE(evict_oversized_key) {
+    ArcPolicy policy(10);
+    std::vector<std::string> evicted;
+    policy.insert("a", 20, evicted);
+    
+    BOOST_REQUIRE_EQUAL(evicted.size(), 1);
+    BOOST_CHECK_EQUAL(evicted[0], "a");
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(resize_and_erase) {
+    ArcPolicy policy(30);
+    std::vector<std::string> evicted;
+    policy.insert("a", 10, evicted);
+    policy.insert("b", 10, evicted);
+    
+    policy.resize("b", 15, evicted);
+    BOOST_CHECK(evicted.empty());
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 25);
+    
+    policy.erase("a");
+    BOOST_CHECK(!policy.is_resident("a"));
+    BOOST_CHECK_EQUAL(policy.resident_bytes(), 15);
+    BOOST_CHECK_EQUAL(policy.num_ghosts(), 0);
+    
+    policy.set_capacity(10, evicted);
+    BOOST_REQUIRE_EQUAL(evicted.size(), 1);
+    BOOST_CHECK_EQUAL(evicted[0], "b");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    FileCache tests.
+----------------------------------------------------------*/
+/// Collects the responses of FileCache::load_async().
+class LoadRecorder {
+public:
+    static void record(const PreparedResponsePtr& response, void* recorder_ptr) {
+        LoadRecorder* recorder = (LoadRecorder*) recorder_ptr;
+        boost::mutex::scoped_lock lock(recorder->mutex);
+        recorder->responses.push_back(response);
+    }
+    
+    /// Wait until a number of responses are in, for up to 5 seconds.
+    bool wait_for(size_t num_responses) {
+        for (size_t i = 0; i < 500; ++i) {
+            {
+                boost::mutex::scoped_lock lock(mutex);
+                
+                if (responses.size() >= num_responses) {
+                    return true;
+                }
+            }
+            
+            usleep(10000);
+        }
+        
+        return false;
+    }
+    
+    boost::mutex mutex;
+    std::vector<PreparedResponsePtr> responses;
+};
+
+/**
+ * Reads files through a FileCache from several threads while they're
+ * being rewritten, and counts the responses that don't match any 
+ * version of a file.
+ */
+class CacheStressTest {
+public:
+    static const size_t kNumFiles = 8;
+    static const size_t kMinFileSize = 100;
+    
+    CacheStressTest(FileCache& cache) : file_cache(cache), num_errors(0) {}
+    
+    static std::string file_name(size_t i) {
+        std::stringstream name;
+        name << "cache_stress_test_" << i;
+        return name.str();
+    }
+    
+    /// Write a version of a file: kMinFileSize + version bytes, all of
+    /// them the same letter.  The file is replaced at once, so that it's
+    /// never read half written.
+    static void write_file(size_t i, size_t version) {
+        const std::string temp_name(file_name(i) + ".tmp");
+        std::ofstream file(temp_name.c_str());
+        file << std::string(kMinFileSize + version, 'a' + version % 26);
+        file.close();
+        rename(temp_name.c_str(), file_name(i).c_str());
+    }
+    
+    static void remove_files() {
+        for (size_t i = 0; i < kNumFiles; ++i) {
+            remove(file_name(i).c_str());
+        }
+    }
+    
+    /// Check that the data is one of the versions written by write_file().
+    static bool is_consistent(const char* data, size_t data_size) {
+        if (data == NULL || data_size < kMinFileSize) {
+            return false;
+        }
+        
+        const char letter = 'a' + (data_size - kMinFileSize) % 26;
+        return std::string(data, data_size) == std::string(data_size, letter);
+    }
+    
+    /// Read the files over and over, through get() and load_async().
+    void read_files(size_t num_rounds) {
+        size_t errors = 0;
+        
+        for (size_t round = 0; round < num_rounds; ++round) {
+            for (size_t i = 0; i < kNumFiles; ++i) {
+                if ((round + i) % 2 == 0) {
+                    shared_array<char> data;
+                    size_t data_size = 0;
+                    
+                    if (!file_cache.get(file_name(i), data, &data_size)
+                            || !is_consistent(data.get(), data_size)
+                            || data[data_size] != '\0') {
+                        ++errors;
+                    }
+                    
+                    continue;
+                }
+                
+                PreparedResponsePtr response;
+                
+                if (file_cache.find_response(file_name(i), IDENTITY_ENCODING, response)
+                        == FileCache::RESPONSE_NEEDS_LOAD) {
+                    //Without I/O threads, the file is loaded right away,
+                    //unless another thread is loading it already.
+                    LoadRecorder recorder;
+                    file_cache.load_async(file_name(i), IDENTITY_ENCODING, 
+                                          &LoadRecorder::record, &recorder);
+                    
+                    if (recorder.wait_for(1)) {
+                        response = recorder.responses[0];
+                    }
+                }
+                
+                if (!response || !is_consistent(response->body.get(), response->body_size)) {
+                    ++errors;
+                }
+            }
+        }
+        
+        boost::mutex::scoped_lock lock(mutex);
+        num_errors += errors;
+    }
+    
+    /// Rewrite the files, telling the cache about each change.
+    void write_files(size_t num_versions) {
+        for (size_t version = 1; version <= num_versions; ++version) {
+            for (size_t i = 0; i < kNumFiles; ++i) {
+                write_file(i, version);
+                file_cache.invalidate(version % 10 == 0 ? "" : file_name(i));
+            }
+        }
+    }
+    
+    FileCache& file_cache;
+    boost::mutex mutex;
+    size_t num_errors;
+};
+
+const size_t CacheStressTest::kNumFiles;
+const size_t CacheStressTest::kMinFileSize;
+
+/// Look up cached files for time_lookups().
+static void look_up_files(FileCache* file_cache, size_t num_lookups, size_t* num_found) {
+    std::vector<std::string> file_names;
+    PreparedResponsePtr response;
+    
+    for (size_t i = 0; i < CacheStressTest::kNumFiles; ++i) {
+        file_names.push_back(CacheStressTest::file_name(i));
+    }
+    
+    for (size_t i = 0; i < num_lookups; ++i) {
+        const std::string& file_name(file_names[i % file_names.size()]);
+        
+        if (file_cache->find_response(file_name, IDENTITY_ENCODING, response) 
+                == FileCache::RESPONSE_FOUND) {
+            ++*num_found;
+        }
+    }
+}
+
+/**
+ * Look up the files of CacheStressTest from a number of threads at once.
+ * @return the lookups per second; 0 if any of the files was not found.
+ */
+static double time_lookups(FileCache& file_cache, size_t num_threads, size_t num_lookups) {
+    std::vector<size_t> num_found(num_threads, 0);
+    boost::thread_group threads;
+    const boost::posix_time::ptime start(boost::posix_time::microsec_clock::universal_time());
+    
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.create_thread(boost::bind(&look_up_files, &file_cache, num_lookups, &num_found[i]));
+    }
+    
+    threads.join_all();
+    const boost::posix_time::time_duration elapsed(
+        boost::posix_time::microsec_clock::universal_time() - start);
+    
+    for (size_t i = 0; i < num_threads; ++i) {
+        if (num_found[i] != num_lookups) {
+            return 0;
+        }
+    }
+    
+    return num_threads * num_lookups * 1e6 / std::max(elapsed.total_microseconds(), 
+                                                      (boost::int64_t) 1);
+}
+
+BOOST_FIXTURE_TEST_SUITE(FileCache_tests, FileCacheFixture)
+
+BOOST_AUTO_TEST_CASE(find_response_after_load) {
+    PreparedResponsePtr response;
+    BOOST_CHECK_EQUAL(file_cache.find_response(file_name, IDENTITY_ENCODING, response),
+                      FileCache::RESPONSE_NEEDS_LOAD);
+    BOOST_CHECK(!response);
+    
+    //Without I/O threads, the file is loaded right away.
+    LoadRecorder recorder;
+    file_cache.load_async(file_name, IDENTITY_ENCODING, &LoadRecorder::record, &recorder);
+    BOOST_REQUIRE_EQUAL(recorder.responses.size(), 1);
+    BOOST_REQUIRE(recorder.responses[0]);
+    BOOST_CHECK_EQUAL(recorder.responses[0]->body_size, starting_data_size);
+    
+    BOOST_CHECK_EQUAL(file_cache.find_response(file_name, IDENTITY_ENCODING, response),
+                      FileCache::RESPONSE_FOUND);
+    BOOST_CHECK_EQUAL(response, recorder.responses[0]);
+}
+
+BOOST_AUTO_TEST_CASE(find_response_missing_file) {
+    LoadRecorder recorder;
+    file_cache.load_async("no_such_file", IDENTITY_ENCODING, &LoadRecorder::record, &recorder);
+    BOOST_REQUIRE_EQUAL(recorder.responses.size(), 1);
+    BOOST_CHECK(!recorder.responses[0]);
+    
+    PreparedResponsePtr response;
+    BOOST_CHECK_EQUAL(file_cache.find_response("no_such_file", IDENTITY_ENCODING, response),
+                      FileCache::RESPONSE_MISSING);
+}
+
+BOOST_AUTO_TEST_CASE(find_response_expired_file) {
+    file_cache.set_expiration_period(0);
+    LoadRecorder recorder;
+    file_cache.load_async(file_name, IDENTITY_ENCODING, &LoadRecorder::record, &recorder);
+    
+    PreparedResponsePtr response;
+    BOOST_CHECK_EQUAL(file_cache.find_response(file_name, IDENTITY_ENCODING, response),
+                      FileCache::RESPONSE_NEEDS_LOAD);
+}
+
+BOOST_AUTO_TEST_CASE(coalesce_async_loads) {
+    //Opening a FIFO blocks the I/O thread until there's a writer, so
+    //the second request comes in while the file is being loaded.
+    const std::string fifo_name("cache_test_fifo");
+    remove(fifo_name.c_str());
+    BOOST_REQUIRE_EQUAL(mkfifo(fifo_name.c_str(), 0600), 0);
+    file_cache.start_io_threads(1);
+    
+    LoadRecorder recorder;
+    file_cache.load_async(fifo_name, IDENTITY_ENCODING, &LoadRecorder::record, &recorder);
+    file_cache.load_async(fifo_name, GZIP_ENCODING, &LoadRecorder::record, &recorder);
+    
+    PreparedResponsePtr response;
+    BOOST_CHECK_EQUAL(file_cache.find_response(fifo_name, IDENTITY_ENCODING, response),
+                      FileCache::RESPONSE_NEEDS_LOAD);
+    
+    std::ofstream fifo(fifo_name.c_str());
+    fifo.close();
+    
+    BOOST_REQUIRE(recorder.wait_for(2));
+    remove(fifo_name.c_str());
+    
+    //Both requests got the response of the same load.
+    BOOST_REQUIRE(recorder.responses[0]);
+    BOOST_CHECK_EQUAL(recorder.responses[0], recorder.responses[1]);
+    BOOST_CHECK_EQUAL(file_cache.stats().misses, 2);
+}
+
+BOOST_AUTO_TEST_CASE(get_nonexistent_file) {
+    BOOST_CHECK(!file_cache.get("no_such_file", data, &data_size));
+    BOOST_CHECK_EQUAL(data, empty_ptr);
+    BOOST_CHECK_EQUAL(data_size, 0);
+}
+
+BOOST_AUTO_TEST_CASE(get_nonexistent_file_no_data_size) {
+    BOOST_CHECK(!file_cache.get("no_such_file", data));
+    BOOST_CHECK_EQUAL(data, empty_ptr);
+}
+
+BOOST_AUTO_TEST_CASE(get_file) {
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_REQUIRE_NE(data, empty_ptr);
+    BOOST_REQUIRE_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+    
+    BOOST_CHECK_EQUAL(data[data_size], '\0');
+}
+
+BOOST_AUTO_TEST_CASE(get_file_no_data_size) {
+    BOOST_CHECK(file_cache.get(file_name, data));
+    BOOST_REQUIRE_NE(data, empty_ptr);
+    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+    
+    BOOST_CHECK_EQUAL(data[starting_data_size], '\0');
+}
+
+BOOST_AUTO_TEST_CASE(get_file_last_modified) {
+    struct stat file_stat;
+    BOOST_REQUIRE_EQUAL(stat(file_name.c_str(), &file_stat), 0);
+    time_t last_modified = 0;
+    
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size, &last_modified));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(last_modified, file_stat.st_mtime);
+}
+
+BOOST_AUTO_TEST_CASE(get_file_accepted_encodings) {
+    remove(file_name);
+    file.open(file_name.c_str());
+    
+    for (size_t i = 0; i < 100; ++i) {
+        file << starting_data;
+    }
+    
+    file.close();
+    PreparedResponsePtr response;
+    
+    //Only send the data as is to the user agents that don't accept gzip.
+    BOOST_CHECK(file_cache.get_response(file_name, IDENTITY_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_CHECK_EQUAL(response->encoding, IDENTITY_ENCODING);
+    BOOST_CHECK_EQUAL(response->body_size, 100 * starting_data_size);
+    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), response->body.get(), starting_data_size), 0);
+    const std::string identity_etag(response->etag);
+    
+    BOOST_CHECK(file_cache.get_response(file_name, GZIP_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_CHECK_EQUAL(response->encoding, GZIP_ENCODING);
+    BOOST_CHECK_LT(response->body_size, 100 * starting_data_size);
+    BOOST_CHECK_EQUAL(response->etag, 
+                      identity_etag.substr(0, identity_etag.size() - 1) + "-gzip\"");
+    
+    //Brotli is preferred whenever it's available.
+    BOOST_CHECK(file_cache.get_response(file_name, GZIP_ENCODING | BROTLI_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_CHECK(response->encoding != IDENTITY_ENCODING);
+    BOOST_CHECK_LT(response->body_size, 100 * starting_data_size);
+}
+
+BOOST_AUTO_TEST_CASE(get_response_validators) {
+    struct stat file_stat;
+    BOOST_REQUIRE_EQUAL(stat(file_name.c_str(), &file_stat), 0);
+    PreparedResponsePtr response;
+    
+    BOOST_CHECK(file_cache.get_response(file_name, IDENTITY_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_CHECK_EQUAL(response->last_modified, file_stat.st_mtime);
+    BOOST_CHECK_EQUAL(response->last_modified_string, 
+                      std::string(time_to_string(file_stat.st_mtime).get()));
+    
+    char expected_etag[CachedFile::kMaxETagLength];
+    snprintf(expected_etag, sizeof(expected_etag), "\"%016llx\"", 
+             static_cast<unsigned long long>(content_hash(starting_data.c_str(), 
+                                                          starting_data_size)));
+    BOOST_CHECK_EQUAL(response->etag, expected_etag);
+}
+
+BOOST_AUTO_TEST_CASE(get_response_keeps_file_open) {
+    PreparedResponsePtr response;
+    BOOST_CHECK(file_cache.get_response(file_name, IDENTITY_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_CHECK(!response->file);
+    
+    FileCache open_file_cache("");
+    open_file_cache.set_keeps_files_open(true);
+    BOOST_CHECK(open_file_cache.get_response(file_name, IDENTITY_ENCODING, response));
+    BOOST_REQUIRE(response);
+    BOOST_REQUIRE(response->file);
+    
+    //The file stays the version the response was prepared from, even
+    //once it has been replaced.
+    const std::string replacement_name(file_name + ".new");
+    file.open(replacement_name.c_str());
+    file << new_data;
+    file.close();
+    BOOST_REQUIRE_EQUAL(rename(replacement_name.c_str(), file_name.c_str()), 0);
+    open_file_cache.invalidate(file_name);
+    
+    PreparedResponsePtr new_response;
+    BOOST_CHECK(open_file_cache.get_response(file_name, IDENTITY_ENCODING, new_response));
+    BOOST_REQUIRE(new_response);
+    BOOST_CHECK_EQUAL(new_response->body_size, new_data_size);
+    
+    char buffer[starting_data_size];
+    BOOST_REQUIRE_EQUAL(pread(response->file->fd(), buffer, starting_data_size, 0), 
+                        (ssize_t) starting_data_size);
+    BOOST_CHECK_EQUAL(std::string(buffer, starting_data_size), starting_data);
+}
+
+BOOST_AUTO_TEST_CASE(get_response_headers) {
+    file_cache.set_cache_control("public, max-age=10");
+    PreparedResponsePtr response;
+    
+    BOOST_CHECK(file_cache.get_response(file_name, GZIP_ENCODING, response));
+    BOOST_REQUIRE(response);
+    
+    //The test data is too short to be compressed.
+    const PreparedResponse::Headers& headers = response->headers;
+    BOOST_REQUIRE_EQUAL(headers.size(), 5);
+    BOOST_CHECK_EQUAL(headers[0].first, "Last-Modified");
+    BOOST_CHECK_EQUAL(headers[0].second, response->last_modified_string);
+    BOOST_CHECK_EQUAL(headers[1].first, "ETag");
+    BOOST_CHECK_EQUAL(headers[1].second, response->etag);
+    BOOST_CHECK_EQUAL(headers[2].first, "Cache-Control");
+    BOOST_CHECK_EQUAL(headers[2].second, "public, max-age=10");
+    BOOST_CHECK_EQUAL(headers[3].first, "Content-Type");
+    BOOST_CHECK_EQUAL(headers[3].second, "text/html");
+    BOOST_CHECK_EQUAL(headers[4].first, "Vary");
+    BOOST_CHECK_EQUAL(headers[4].second, "Accept-Encoding");
+}
+
+BOOST_AUTO_TEST_CASE(get_response_nonexistent_file) {
+    PreparedResponsePtr response;
+    BOOST_CHECK(!file_cache.get_response("no_such_file", GZIP_ENCODING, response));
+    BOOST_CHECK(!response);
+}
+
+BOOST_AUTO_TEST_CASE(reload_into_pooled_buffer) {
+    //Reloading a file reuses the buffer of the version no longer in use.
+    file_cache.set_expiration_period(0);
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    data.reset();
+    file_cache.invalidate(file_name);
+    
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(file_cache.buffer_pool()->num_free_buffers(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(get_watched_file) {
+    //A watched file is only reloaded once it's been invalidated.
+    file_cache.set_is_watched(true);
+    file_cache.get(file_name, data, &data_size);
+    
+    remove(file_name);
+    file.open(file_name.c_str());
+    file << new_data;
+    file.close();
+    
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    
+    //No need to wait: the file is reloaded even if its modification
+    //time is the same.
+    file_cache.invalidate(file_name);
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_REQUIRE_EQUAL(data_size, new_data_size);
+    BOOST_CHECK_EQUAL(memcmp(new_data.c_str(), data.get(), new_data_size), 0);
+}
+
+BOOST_AUTO_TEST_CASE(invalidate_all_files) {
+    file_cache.set_is_watched(true);
+    file_cache.get(file_name, data, &data_size);
+    remove(file_name);
+    
+    file_cache.invalidate("");
+    BOOST_CHECK(!file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data, empty_ptr);
+}
+
+BOOST_AUTO_TEST_CASE(count_hits_and_misses) {
+    file_cache.get(file_name, data, &data_size);
+    file_cache.get(file_name, data, &data_size);
+    
+    const FileCacheStats stats(file_cache.stats());
+    BOOST_CHECK_EQUAL(stats.hits, 1);
+    BOOST_CHECK_EQUAL(stats.misses, 1);
+    BOOST_CHECK_EQUAL(stats.evictions, 0);
+    BOOST_CHECK_EQUAL(stats.num_files, 1);
+    BOOST_CHECK_EQUAL(stats.resident_bytes, starting_data_size);
+    BOOST_CHECK_EQUAL(stats.memory_budget, FileCache::kDefaultMemoryBudget);
+}
+
+BOOST_AUTO_TEST_CASE(remember_missing_files) {
+    remove(file_name);
+    BOOST_CHECK(!file_cache.get(file_name, data, &data_size));
+    
+    //The file is not looked up again until the path is invalidated.
+    file.open(file_name.c_str());
+    file << starting_data;
+    file.close();
+    BOOST_CHECK(!file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data, empty_ptr);
+    
+    FileCacheStats stats(file_cache.stats());
+    BOOST_CHECK_EQUAL(stats.misses, 1);
+    BOOST_CHECK_EQUAL(stats.negative_hits, 1);
+    BOOST_CHECK_EQUAL(stats.num_files, 0);
+    BOOST_CHECK_EQUAL(stats.num_missing_files, 1);
+    
+    file_cache.invalidate(file_name);
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(file_cache.stats().num_missing_files, 0);
+}
+
+BOOST_AUTO_TEST_CASE(limit_missing_files) {
+    //Each shard remembers its share of the paths.
+    FileCache single_shard_cache("", FileCache::kDefaultExpirationPeriod, 
+                                 FileCache::kDefaultMemoryBudget, 1);
+    
+    for (size_t i = 0; i < FileCache::kMaxMissingFiles + 10; ++i) {
+        std::stringstream missing_file_name;
+        missing_file_name << "no_such_file_" << i;
+        BOOST_CHECK(!single_shard_cache.get(missing_file_name.str(), data));
+        BOOST_CHECK(!file_cache.get(missing_file_name.str(), data));
+    }
+    
+    const FileCacheStats stats(single_shard_cache.stats());
+    BOOST_CHECK_EQUAL(stats.num_missing_files, FileCache::kMaxMissingFiles);
+    BOOST_CHECK_EQUAL(stats.num_files, 0);
+    BOOST_CHECK_LE(file_cache.stats().num_missing_files, FileCache::kMaxMissingFiles);
+}
+
+BOOST_AUTO_TEST_CASE(preload_files) {
+    std::vector<std::string> file_paths;
+    file_paths.push_back(file_name);
+    file_paths.push_back("no_such_file");
+    size_t bytes_loaded = 0;
+    
+    BOOST_CHECK_EQUAL(file_cache.preload(file_paths, 2, bytes_loaded), 1);
+    BOOST_CHECK_EQUAL(bytes_loaded, starting_data_size);
+    
+    //The preloaded file is served from the cache.
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    
+    const FileCacheStats stats(file_cache.stats());
+    BOOST_CHECK_EQUAL(stats.hits, 1);
+    BOOST_CHECK_EQUAL(stats.misses, 0);
+    BOOST_CHECK_EQUAL(stats.num_files, 1);
+    
+    //Files already cached are not loaded again.
+    BOOST_CHECK_EQUAL(file_cache.preload(file_paths, 2, bytes_loaded), 0);
+    BOOST_CHECK_EQUAL(bytes_loaded, 0);
+}
+
+BOOST_AUTO_TEST_CASE(evict_files_over_budget) {
+    const std::string other_file_name(file_name + "_other");
+    file.open(other_file_name.c_str());
+    file << starting_data;
+    file.close();
+    
+    //With a single shard, the whole budget is available to either file.
+    FileCache single_shard_cache("", FileCache::kDefaultExpirationPeriod, 
+                                 FileCache::kDefaultMemoryBudget, 1);
+    single_shard_cache.set_memory_budget(starting_data_size);
+    BOOST_CHECK(single_shard_cache.get(file_name, data, &data_size));
+    BOOST_CHECK(single_shard_cache.get(other_file_name, data, &data_size));
+    remove(other_file_name);
+    
+    //The evicted file is still returned.
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    
+    const FileCacheStats stats(single_shard_cache.stats());
+    BOOST_CHECK_EQUAL(stats.evictions, 1);
+    BOOST_CHECK_EQUAL(stats.num_files, 1);
+    BOOST_CHECK_EQUAL(stats.resident_bytes, starting_data_size);
+}
+
+BOOST_AUTO_TEST_CASE(split_memory_budget) {
+    file_cache.set_memory_budget(1000);
+    BOOST_CHECK_EQUAL(file_cache.memory_budget(), 1000);
+    BOOST_CHECK_EQUAL(file_cache.stats().memory_budget, 1000);
+    
+    //A file larger than a shard's share of the budget is not kept.
+    file_cache.set_memory_budget(file_cache.num_shards() * (starting_data_size - 1));
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(file_cache.stats().num_files, 0);
+}
+
+BOOST_AUTO_TEST_CASE(read_files_while_rewritten) {
+    //Readers must only ever see whole versions of the files.
+    file_cache.set_is_watched(true);
+    CacheStressTest stress_test(file_cache);
+    
+    for (size_t i = 0; i < CacheStressTest::kNumFiles; ++i) {
+        CacheStressTest::write_file(i, 0);
+    }
+    
+    boost::thread_group threads;
+    
+    for (size_t i = 0; i < 4; ++i) {
+        threads.create_thread(boost::bind(&CacheStressTest::read_files, &stress_test, 2000));
+    }
+    
+    threads.create_thread(boost::bind(&CacheStressTest::write_files, &stress_test, 200));
+    threads.join_all();
+    CacheStressTest::remove_files();
+    
+    BOOST_CHECK_EQUAL(stress_test.num_errors, 0);
+    
+    const FileCacheStats stats(file_cache.stats());
+    BOOST_CHECK_EQUAL(stats.hits + stats.misses, 4 * 2000 * CacheStressTest::kNumFiles);
+    BOOST_CHECK_EQUAL(stats.negative_hits, 0);
+}
+
+BOOST_AUTO_TEST_CASE(benchmark_concurrent_lookups) {
+    const size_t num_threads = 4;
+    const size_t num_lookups = 200000;
+    FileCache single_shard_cache("", FileCache::kDefaultExpirationPeriod, 
+                                 FileCache::kDefaultMemoryBudget, 1);
+    
+    for (size_t i = 0; i < CacheStressTest::kNumFiles; ++i) {
+        CacheStressTest::write_file(i, i);
+        BOOST_CHECK(file_cache.get(CacheStressTest::file_name(i), data));
+        BOOST_CHECK(single_shard_cache.get(CacheStressTest::file_name(i), data));
+    }
+    
+    const double one_thread_rate = time_lookups(file_cache, 1, num_lookups);
+    const double sharded_rate = time_lookups(file_cache, num_threads, num_lookups);
+    const double single_shard_rate = time_lookups(single_shard_cache, num_threads, num_lookups);
+    CacheStressTest::remove_files();
+    
+    BOOST_CHECK_GT(one_thread_rate, 0);
+    BOOST_CHECK_GT(sharded_rate, 0);
+    BOOST_CHECK_GT(single_shard_rate, 0);
+    BOOST_TEST_MESSAGE("FileCache lookups per second: " << one_thread_rate 
+                       << " on 1 thread, " << sharded_rate << " on " << num_threads 
+                       << " threads, " << single_shard_rate << " on " << num_threads
+                       << " threads with a single shard");
+}
+
+BOOST_AUTO_TEST_CASE(set_file_root) {
+    file_cache.set_file_root("test");
+    BOOST_CHECK_EQUAL(file_cache.file_root(), "test/");
+    
+    file_cache.set_file_root("toast/");
+    BOOST_CHECK_EQUAL(file_cache.file_root(), "toast/");
+}
+
+BOOST_AUTO_TEST_CASE(set_file_root_get_file) {
+    file_cache.set_file_root(one_up_path);
+    BOOST_CHECK(file_cache.get(one_up_file_name, data));
+    BOOST_REQUIRE_NE(data, empty_ptr);
+    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+    
+    BOOST_CHECK_EQUAL(data[starting_data_size], '\0');
+}
+
+BOOST_AUTO_TEST_CASE(get_file_from_cache) {
+    //Load the file to cache
+    file_cache.get(file_name, data, &data_size);
+    
+    //Rewrite the file.
+    remove(file_name);
+    file.open(file_name.c_str());
+    file << new_data;
+    file.close();
+    
+    //Load the data again.  Sould still be old data.
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_REQUIRE_NE(data, empty_ptr);
+    BOOST_REQUIRE_EQUAL(data_size, starting_data_size);
+    BOOST_CHECK_EQUAL(memcmp(starting_data.c_str(), data.get(), starting_data_size), 0);
+}
+
+BOOST_AUTO_TEST_CASE(get_expired_file) {
+    //File is modified after loading, and the cache has expired.
+    //Load the file to cache
+    file_cache.set_expiration_period(0);
+    file_cache.get(file_name, data, &data_size);
+    sleep(2);
+    
+    //Rewrite the file.
+    remove(file_name);
+    file.open(file_name.c_str());
+    file << new_data;
+    file.close();
+    
+    //Load the data again.  Sould still be old data.
+    BOOST_CHECK(file_cache.get(file_name, data, &data_size));
+    BOOST_REQUIRE_NE(data, empty_ptr);
+    BOOST_REQUIRE_EQUAL(data_size, new_data_size);
+    BOOST_CHECK_EQUAL(memcmp(new_data.c_str(), data.get(), new_data_size), 0);
+}
+
+BOOST_AUTO_TEST_CASE(get_deleted_file) {
+    //Cache has expired and the file was deleted.
+    //Load the file to cache
+    file_cache.set_expiration_period(0);
+    file_cache.get(file_name, data, &data_size);
+    
+    //Rewrite the file.
+    sleep(2);
+    remove(file_name);
+    
+    //Load the data again.  Sould still be old data.
+    BOOST_CHECK(!file_cache.get(file_name, data, &data_size));
+    BOOST_CHECK_EQUAL(data, empty_ptr);
+    BOOST_CHECK_EQUAL(data_size, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    WordIndexDescription class.
+----------------------------------------------------------*/
+class WordIndexDescriptionFixture {
+public:
+    WordIndexDescriptionFixture() {
+        index_description = 
+            shared_ptr<WordIndexDescription>(new WordIndexDescription("index", 
+                                                                      "Some Index",
+                                                                      "^.*Z.*$"));
+    }
+    
+    shared_ptr<WordIndexDescription> index_description;
+
+};
 
 BOOST_FIXTURE_TEST_SUITE(WordIndexDescription_tests, WordIndexDescriptionFixture)
 
@@ -892,6 +2298,960 @@ BOOST_AUTO_TEST_CASE(initialization_test) {
     BOOST_CHECK_EQUAL(indexes[1][2]->word, "PAMS");
 }
 
+BOOST_AUTO_TEST_CASE(find_words) {
+    std::vector<WordDescriptionPtr> words;
+    BOOST_CHECK_EQUAL(word_picker->find_words("??MS", 0, 10, words), 2);
+    BOOST_REQUIRE_EQUAL(words.size(), 2);
+    BOOST_CHECK_EQUAL(words[0]->word, "FEMS");
+    BOOST_CHECK_EQUAL(words[1]->word, "PAMS");
+    
+    words.clear();
+    BOOST_CHECK_EQUAL(word_picker->find_words("???", 1, 10, words), 3);
+    BOOST_REQUIRE_EQUAL(words.size(), 2);
+    BOOST_CHECK_EQUAL(words[0]->word, "AAL");
+    BOOST_CHECK_EQUAL(words[1]->word, "AAS");
+    
+    words.clear();
+    BOOST_CHECK_EQUAL(word_picker->find_words("FE??", 1, 1, words), 2);
+    BOOST_REQUIRE_EQUAL(words.size(), 1);
+    BOOST_CHECK_EQUAL(words[0]->word, "FEND");
+    
+    words.clear();
+    BOOST_CHECK_EQUAL(word_picker->find_words("B?Z", 0, 10, words), 0);
+    BOOST_CHECK_EQUAL(word_picker->find_words("?????", 0, 10, words), 0);
+    BOOST_CHECK_EQUAL(word_picker->find_words("b?", 0, 10, words), 0);
+    BOOST_CHECK_EQUAL(word_picker->find_words("", 0, 10, words), 0);
+    BOOST_CHECK(words.empty());
+}
+
+BOOST_AUTO_TEST_CASE(check_words) {
+    std::vector<std::string> words;
+    words.push_back("FEND");
+    words.push_back("FENDS");
+    words.push_back("BI");
+    words.push_back("");
+    
+    std::vector<WordDescriptionPtr> descriptions;
+    word_picker->check_words(words, descriptions);
+    BOOST_REQUIRE_EQUAL(descriptions.size(), 4);
+    BOOST_REQUIRE(descriptions[0]);
+    BOOST_CHECK_EQUAL(descriptions[0]->description, "to ward off");
+    BOOST_CHECK(!descriptions[1]);
+    BOOST_REQUIRE(descriptions[2]);
+    BOOST_CHECK_EQUAL(descriptions[2]->word, "BI");
+    BOOST_CHECK(!descriptions[3]);
+}
+
+BOOST_AUTO_TEST_CASE(suggest_words) {
+    std::vector<WordDescriptionPtr> suggestions;
+    std::vector<size_t> distances;
+    word_picker->suggest_words("PAM", 10, suggestions, distances);
+    BOOST_REQUIRE_EQUAL(suggestions.size(), 4);
+    BOOST_CHECK_EQUAL(suggestions[0]->word, "PAMS");
+    BOOST_CHECK_EQUAL(distances[0], 1);
+    BOOST_CHECK_EQUAL(suggestions[1]->word, "AAH");
+    BOOST_CHECK_EQUAL(suggestions[2]->word, "AAL");
+    BOOST_CHECK_EQUAL(suggestions[3]->word, "AAS");
+    BOOST_CHECK_EQUAL(distances[3], 2);
+    
+    suggestions.clear();
+    distances.clear();
+    word_picker->suggest_words("FEND", 2, suggestions, distances);
+    BOOST_REQUIRE_EQUAL(suggestions.size(), 2);
+    BOOST_CHECK_EQUAL(suggestions[0]->word, "FEND");
+    BOOST_CHECK_EQUAL(distances[0], 0);
+    BOOST_CHECK_EQUAL(suggestions[1]->word, "FEMS");
+    BOOST_CHECK_EQUAL(distances[1], 2);
+    
+    suggestions.clear();
+    distances.clear();
+    word_picker->suggest_words("XYZZY", 10, suggestions, distances);
+    word_picker->suggest_words("", 10, suggestions, distances);
+    BOOST_CHECK(suggestions.empty());
+}
+
+BOOST_AUTO_TEST_CASE(is_near_real_word) {
+    BOOST_CHECK(word_picker->is_near_real_word("FENS"));
+    BOOST_CHECK(word_picker->is_near_real_word("AAHS"));
+    BOOST_CHECK(word_picker->is_near_real_word("PAM"));
+    BOOST_CHECK(word_picker->is_near_real_word("HUCI"));
+    BOOST_CHECK(!word_picker->is_near_real_word("FEND"));
+    BOOST_CHECK(!word_picker->is_near_real_word("QQQQ"));
+    BOOST_CHECK(!word_picker->is_near_real_word(""));
+}
+
+BOOST_AUTO_TEST_CASE(grep_words) {
+    WorkerPool pool(2);
+    std::vector<WordDescriptionPtr> words;
+    bool is_complete = false;
+    BOOST_CHECK(word_picker->grep_words("s$", 10, 1000, pool, words, is_complete));
+    BOOST_CHECK(is_complete);
+    BOOST_REQUIRE_EQUAL(words.size(), 3);
+    BOOST_CHECK_EQUAL(words[0]->word, "AAS");
+    BOOST_CHECK_EQUAL(words[1]->word, "FEMS");
+    BOOST_CHECK_EQUAL(words[2]->word, "PAMS");
+    
+    words.clear();
+    BOOST_CHECK(word_picker->grep_words("^[^AEIOU]*[AEIOU][^AEIOU]*$", 2, 1000, pool, words, is_complete));
+    BOOST_CHECK(!is_complete);
+    BOOST_REQUIRE_EQUAL(words.size(), 2);
+    BOOST_CHECK_EQUAL(words[0]->word, "BE");
+    BOOST_CHECK_EQUAL(words[1]->word, "BI");
+    
+    words.clear();
+    BOOST_CHECK(!word_picker->grep_words("(FE", 10, 1000, pool, words, is_complete));
+    BOOST_CHECK(words.empty());
+}
+
+BOOST_AUTO_TEST_CASE(find_anagrams) {
+    std::vector<WordDescriptionPtr> anagrams;
+    std::vector<WordDescriptionPtr> subwords;
+    BOOST_CHECK(word_picker->find_anagrams("MEFS", anagrams, subwords));
+    BOOST_REQUIRE_EQUAL(anagrams.size(), 1);
+    BOOST_CHECK_EQUAL(anagrams[0]->word, "FEMS");
+    BOOST_CHECK(subwords.empty());
+    
+    anagrams.clear();
+    BOOST_CHECK(word_picker->find_anagrams("HASLA", anagrams, subwords));
+    BOOST_CHECK(anagrams.empty());
+    BOOST_REQUIRE_EQUAL(subwords.size(), 3);
+    BOOST_CHECK_EQUAL(subwords[0]->word, "AAH");
+    BOOST_CHECK_EQUAL(subwords[1]->word, "AAL");
+    BOOST_CHECK_EQUAL(subwords[2]->word, "AAS");
+    
+    //Longer words come first.
+    subwords.clear();
+    BOOST_CHECK(word_picker->find_anagrams("SPAMEIB", anagrams, subwords));
+    BOOST_CHECK(anagrams.empty());
+    BOOST_REQUIRE_EQUAL(subwords.size(), 3);
+    BOOST_CHECK_EQUAL(subwords[0]->word, "PAMS");
+    BOOST_CHECK_EQUAL(subwords[1]->word, "BE");
+    BOOST_CHECK_EQUAL(subwords[2]->word, "BI");
+    
+    subwords.clear();
+    BOOST_CHECK(!word_picker->find_anagrams("", anagrams, subwords));
+    BOOST_CHECK(!word_picker->find_anagrams("fems", anagrams, subwords));
+    BOOST_CHECK(!word_picker->find_anagrams("AAAAAAAA", anagrams, subwords));
+    BOOST_CHECK(anagrams.empty());
+    BOOST_CHECK(subwords.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    WordStore tests.
+----------------------------------------------------------*/
+class SharedWordStoreFixture {
+public:
+    SharedWordStoreFixture() 
+    : word_store(new WordStore()) {
+        shared_ptr<WordIndexDescription> a_words(new WordIndexDescription("a", "a", ".*A.*"));
+        std::vector<shared_ptr<WordIndexDescription> > index_descriptions;
+        index_descriptions.push_back(a_words);
+        
+        simple_picker = shared_ptr<WordPicker>(new WordPicker(index_descriptions, word_store));
+        simple_picker->initialize("testing/simple_dictionary.txt", "simple");
+        unsorted_picker = shared_ptr<WordPicker>(new WordPicker(index_descriptions, word_store));
+        unsorted_picker->initialize("testing/unsorted_dictionary.txt", "unsorted");
+    }
+    
+    shared_ptr<WordStore> word_store;
+    shared_ptr<WordPicker> simple_picker;
+    shared_ptr<WordPicker> unsorted_picker;
+};
+
+BOOST_FIXTURE_TEST_SUITE(WordStore_tests, SharedWordStoreFixture)
+
+BOOST_AUTO_TEST_CASE(dictionaries_share_words) {
+    // BE has a different description in the unsorted dictionary.
+    BOOST_CHECK_EQUAL(word_store->num_dictionaries(), 2);
+    BOOST_CHECK_EQUAL(word_store->words().size(), 10);
+    BOOST_CHECK_EQUAL(word_store->members(0).cardinality(), 9);
+    BOOST_CHECK_EQUAL(word_store->members(1).cardinality(), 4);
+    
+    std::vector<WordDescriptionPtr>& simple_words = simple_picker->words_by_length();
+    std::vector<WordDescriptionPtr>& unsorted_words = unsorted_picker->words_by_length();
+    BOOST_REQUIRE_EQUAL(unsorted_words.size(), 4);
+    BOOST_CHECK_EQUAL(unsorted_words[0]->description, "to exist");
+    BOOST_CHECK_NE(unsorted_words[0], simple_words[0]);
+    BOOST_CHECK_EQUAL(unsorted_words[1], simple_words[1]);
+    BOOST_CHECK_EQUAL(unsorted_words[2], simple_words[4]);
+    BOOST_CHECK_EQUAL(unsorted_words[3], simple_words[6]);
+}
+
+BOOST_AUTO_TEST_CASE(unsorted_dictionary_is_sorted) {
+    std::vector<WordDescriptionPtr>& words = unsorted_picker->words_by_length();
+    BOOST_REQUIRE_EQUAL(words.size(), 4);
+    BOOST_CHECK_EQUAL(words[0]->word, "BE");
+    BOOST_CHECK_EQUAL(words[1]->word, "BI");
+    BOOST_CHECK_EQUAL(words[2]->word, "AAS");
+    BOOST_CHECK_EQUAL(words[3]->word, "FEND");
+    
+    std::vector<size_t> word_length_ends = unsorted_picker->word_length_ends();
+    BOOST_REQUIRE_EQUAL(word_length_ends.size(), 5);
+    BOOST_CHECK_EQUAL(word_length_ends[2], 2);
+    BOOST_CHECK_EQUAL(word_length_ends[3], 3);
+    BOOST_CHECK_EQUAL(word_length_ends[4], 4);
+    
+    BOOST_REQUIRE_EQUAL(unsorted_picker->indexes()[0].size(), 1);
+    BOOST_CHECK_EQUAL(unsorted_picker->indexes()[0][0]->word, "AAS");
+}
+
+BOOST_AUTO_TEST_CASE(find_and_contains) {
+    BOOST_CHECK_EQUAL(word_store->find_dictionary("simple"), 0);
+    BOOST_CHECK_EQUAL(word_store->find_dictionary("unsorted"), 1);
+    BOOST_CHECK_EQUAL(word_store->find_dictionary("owl2"), WordStore::kNoDictionary);
+    
+    BOOST_CHECK(word_store->contains(0, "HUIC"));
+    BOOST_CHECK(!word_store->contains(1, "HUIC"));
+    BOOST_CHECK(word_store->contains(0, "BE"));
+    BOOST_CHECK(word_store->contains(1, "BE"));
+    BOOST_CHECK(!word_store->contains(0, "ZZZ"));
+    BOOST_CHECK(!word_store->contains(2, "BE"));
+}
+
+BOOST_AUTO_TEST_CASE(missing_dictionary) {
+    WordPicker word_picker(std::vector<shared_ptr<WordIndexDescription> >(), word_store);
+    BOOST_CHECK(!word_picker.initialize("testing/no_such_dictionary.txt", "missing"));
+    BOOST_CHECK_EQUAL(word_store->num_dictionaries(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                DictionaryReloader tests.
+----------------------------------------------------------*/
+class DictionaryReloaderFixture {
+public:
+    DictionaryReloaderFixture() {
+        shared_ptr<WordIndexDescription> a_words(new WordIndexDescription("a", "a", ".*A.*"));
+        index_descriptions.push_back(a_words);
+        dictionary_names.push_back("simple_dictionary");
+    }
+    
+    /// Wait for the reload in progress to finish; false on timeout.
+    bool wait_for_reload(DictionaryReloader& reloader) {
+        for (size_t i = 0; i < 500 && reloader.is_reloading(); i++) {
+            usleep(10000);
+        }
+        
+        return !reloader.is_reloading();
+    }
+    
+    DictionarySet::IndexDescriptionList index_descriptions;
+    std::vector<std::string> dictionary_names;
+};
+
+BOOST_FIXTURE_TEST_SUITE(DictionaryReloader_tests, DictionaryReloaderFixture)
+
+BOOST_AUTO_TEST_CASE(load) {
+    DictionaryReloader reloader(index_descriptions, "testing/", dictionary_names);
+    BOOST_REQUIRE(reloader.load());
+    
+    DictionarySetPtr dictionaries = reloader.current();
+    BOOST_REQUIRE(dictionaries);
+    BOOST_CHECK_EQUAL(dictionaries->generation(), 1);
+    BOOST_CHECK_EQUAL(dictionaries->word_pickers().size(), 1);
+    BOOST_CHECK_EQUAL(dictionaries->find_word_picker("simple_dictionary"), 
+                      dictionaries->word_pickers()[0]);
+    BOOST_CHECK_EQUAL(dictionaries->find_word_picker("unknown"), 
+                      dictionaries->word_pickers()[0]);
+}
+
+BOOST_AUTO_TEST_CASE(reload_waits_for_readers) {
+    DictionaryReloader reloader(index_descriptions, "testing/", dictionary_names);
+    BOOST_REQUIRE(reloader.load());
+    DictionarySetPtr old_dictionaries = reloader.current();
+    
+    BOOST_REQUIRE(reloader.start_reload());
+    BOOST_CHECK(!reloader.start_reload());
+    
+    // The new snapshot gets swapped in while the old one is in use...
+    for (size_t i = 0; i < 500 && reloader.num_reloads() == 0; i++) {
+        usleep(10000);
+    }
+    
+    BOOST_REQUIRE_EQUAL(reloader.num_reloads(), 1);
+    BOOST_CHECK(reloader.current() != old_dictionaries);
+    BOOST_CHECK_EQUAL(reloader.current()->generation(), 2);
+    BOOST_CHECK_EQUAL(old_dictionaries->word_pickers()[0]->words_by_length().size(), 9);
+    BOOST_CHECK(reloader.is_reloading());
+    
+    // ...and the reload is finished once the old one is let go.
+    old_dictionaries.reset();
+    BOOST_CHECK(wait_for_reload(reloader));
+}
+
+BOOST_AUTO_TEST_CASE(failed_reload_keeps_dictionaries) {
+    dictionary_names.push_back("no_such_dictionary");
+    DictionaryReloader reloader(index_descriptions, "testing/", dictionary_names);
+    BOOST_CHECK(!reloader.load());
+    DictionarySetPtr old_dictionaries = reloader.current();
+    
+    BOOST_REQUIRE(reloader.start_reload());
+    BOOST_CHECK(wait_for_reload(reloader));
+    BOOST_CHECK_EQUAL(reloader.num_reloads(), 0);
+    BOOST_CHECK(reloader.current() == old_dictionaries);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_outlives_reloader) {
+    DictionarySetPtr dictionaries;
+    
+    {
+        DictionaryReloader reloader(index_descriptions, "testing/", dictionary_names);
+        BOOST_REQUIRE(reloader.load());
+        dictionaries = reloader.current();
+    }
+    
+    //The snapshot is still usable, and freed here once let go of.
+    BOOST_CHECK_EQUAL(dictionaries->word_pickers().size(), 1);
+    dictionaries.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+            WordPicker tests with the full dictionary.
+----------------------------------------------------------*/
+// The simple dictionary is too small for the pseudoword generator
+// to come up with fake words, so picking lists needs the real thing.
+class FullDictionaryWordPickerFixture {
+public:
+    FullDictionaryWordPickerFixture() {
+        shared_ptr<WordIndexDescription> ox_words(new WordIndexDescription("ox", "OX-", "^OX.*$"));
+        shared_ptr<WordIndexDescription> s_words(new WordIndexDescription("s", "-S", "^.*S$"));
+        std::vector<shared_ptr<WordIndexDescription> > index_descriptions;
+        index_descriptions.push_back(ox_words);
+        index_descriptions.push_back(s_words);
+        
+        word_picker = shared_ptr<WordPicker>(new WordPicker(index_descriptions));
+        word_picker->initialize("../dictionaries/owl2.txt");
+    }
+    
+    /// Count words that occur in the list more than once.
+    size_t count_duplicates(const std::vector<WordDescriptionPtr>& words, bool is_real) {
+        std::set<std::string> seen;
+        size_t num_duplicates = 0;
+        
+        for (size_t i = 0; i < words.size(); i++) {
+            if (words[i]->is_real == is_real && !seen.insert(words[i]->word).second) {
+                num_duplicates++;
+            }
+        }
+        
+        return num_duplicates;
+    }
+    
+    shared_ptr<WordPicker> word_picker;
+};
+
+BOOST_FIXTURE_TEST_SUITE(WordPicker_pick_tests, FullDictionaryWordPickerFixture)
+
+BOOST_AUTO_TEST_CASE(get_words_by_length_no_duplicates) {
+    // There are only about a hundred two-letter words, so a list of
+    // 40 would often repeat some if they were picked with replacement.
+    for (size_t trial = 0; trial < 20; trial++) {
+        std::vector<WordDescriptionPtr> words = word_picker->get_words_by_length(2, 2, 40);
+        BOOST_REQUIRE_EQUAL(words.size(), 40);
+        BOOST_CHECK_EQUAL(count_duplicates(words, true), 0);
+        
+        for (size_t i = 0; i < words.size(); i++) {
+            BOOST_CHECK_EQUAL(words[i]->word.length(), 2);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_by_length_unique_fake_words) {
+    for (size_t trial = 0; trial < 20; trial++) {
+        std::vector<WordDescriptionPtr> words = word_picker->get_words_by_length(3, 3, 40);
+        BOOST_CHECK_EQUAL(count_duplicates(words, true), 0);
+        BOOST_CHECK_EQUAL(count_duplicates(words, false), 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_from_index_no_duplicates) {
+    for (size_t trial = 0; trial < 20; trial++) {
+        std::vector<WordDescriptionPtr> words = word_picker->get_words_from_index(0, 40);
+        BOOST_REQUIRE_EQUAL(words.size(), 40);
+        BOOST_CHECK_EQUAL(count_duplicates(words, true), 0);
+        
+        for (size_t i = 0; i < words.size(); i++) {
+            BOOST_CHECK_EQUAL(words[i]->word.substr(0, 2), "OX");
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_limits_list_size) {
+    std::vector<WordDescriptionPtr> words =
+        word_picker->get_words_by_length(4, 6, WordPicker::kMaxWordsPerPick + 10);
+    BOOST_CHECK_EQUAL(words.size(), WordPicker::kMaxWordsPerPick);
+}
+
+BOOST_AUTO_TEST_CASE(get_words_combined_indexes) {
+    WordQuery query(4, 6);
+    query.index_nums.push_back(1);
+    query.index_nums.push_back(0);
+    
+    // Repeat the query enough times for it to get cached.
+    for (size_t trial = 0; trial < 10; trial++) {
+        std::vector<WordDescriptionPtr> words = word_picker->get_words(query, 20);
+        BOOST_REQUIRE_EQUAL(words.size(), 20);
+        BOOST_CHECK_EQUAL(count_duplicates(words, true), 0);
+        
+        for (size_t i = 0; i < words.size(); i++) {
+            const std::string& word = words[i]->word;
+            BOOST_CHECK_EQUAL(word.substr(0, 2), "OX");
+            BOOST_CHECK_EQUAL(word[word.length() - 1], 'S');
+            BOOST_CHECK(word.length() >= 4 && word.length() <= 6);
+        }
+    }
+    
+    BOOST_CHECK(word_picker->query_cache().num_cached_ids() > 0);
+}
+
+BOOST_AUTO_TEST_CASE(get_words_fake_word_modes) {
+    size_t num_fake_words = 0;
+    size_t num_easy_near_words = 0;
+    size_t num_hard_near_words = 0;
+    
+    for (size_t trial = 0; trial < 10; trial++) {
+        std::vector<WordDescriptionPtr> easy_words = 
+            word_picker->get_words_by_length(5, 7, 40, EASY_FAKE_WORDS);
+        std::vector<WordDescriptionPtr> hard_words = 
+            word_picker->get_words_by_length(5, 7, 40, HARD_FAKE_WORDS);
+        BOOST_REQUIRE_EQUAL(easy_words.size(), 40);
+        BOOST_REQUIRE_EQUAL(hard_words.size(), 40);
+        
+        for (size_t i = 0; i < easy_words.size(); i++) {
+            if (!easy_words[i]->is_real) {
+                num_fake_words++;
+                num_easy_near_words += word_picker->is_near_real_word(easy_words[i]->word);
+            }
+            
+            if (!hard_words[i]->is_real) {
+                num_hard_near_words += word_picker->is_near_real_word(hard_words[i]->word);
+            }
+        }
+    }
+    
+    // The modes are best effort, but nearly always work out.
+    BOOST_CHECK_LT(num_easy_near_words, num_fake_words / 10);
+    BOOST_CHECK_GT(num_hard_near_words, num_fake_words / 2);
+}
+
+BOOST_AUTO_TEST_CASE(get_words_fake_word_difficulties) {
+    for (size_t i = 0; i < makewords::PseudowordGenerator::kNumDifficulties; i++) {
+        std::vector<WordDescriptionPtr> words = word_picker->get_words_by_length(
+            4, 6, 40, MIXED_FAKE_WORDS, static_cast<makewords::Difficulty>(i));
+        BOOST_REQUIRE_EQUAL(words.size(), 40);
+        BOOST_CHECK_EQUAL(count_duplicates(words, false), 0);
+        
+        for (size_t j = 0; j < words.size(); j++) {
+            BOOST_CHECK(words[j]->word.length() >= 4 && words[j]->word.length() <= 6);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_seeded) {
+    WordQuery length_query(4, 6);
+    length_query.has_seed = true;
+    length_query.seed = 12345;
+    WordQuery index_query(4, 6);
+    index_query.index_nums.push_back(1);
+    index_query.index_nums.push_back(0);
+    index_query.has_seed = true;
+    index_query.seed = 12345;
+    
+    const WordQuery queries[] = {length_query, index_query};
+    
+    for (size_t i = 0; i < 2; i++) {
+        WordQuery other_seed_query(queries[i]);
+        other_seed_query.seed++;
+        
+        std::vector<WordDescriptionPtr> words = word_picker->get_words(queries[i], 20);
+        std::vector<WordDescriptionPtr> same_words = word_picker->get_words(queries[i], 20);
+        std::vector<WordDescriptionPtr> other_words = word_picker->get_words(other_seed_query, 20);
+        BOOST_REQUIRE_EQUAL(words.size(), 20);
+        BOOST_REQUIRE_EQUAL(same_words.size(), 20);
+        BOOST_REQUIRE_EQUAL(other_words.size(), 20);
+        size_t num_same_words = 0;
+        
+        for (size_t j = 0; j < words.size(); j++) {
+            BOOST_CHECK_EQUAL(words[j]->word, same_words[j]->word);
+            BOOST_CHECK_EQUAL(words[j]->is_real, same_words[j]->is_real);
+            num_same_words += (words[j]->word == other_words[j]->word);
+        }
+        
+        BOOST_CHECK_LT(num_same_words, 5);
+    }
+}
+
+/// Pick seeded lists of words over and over; keep the last list.
+static void pick_seeded_words(WordPicker* word_picker, 
+                              const WordQuery* query, 
+                              std::vector<std::string>* words) {
+    for (size_t i = 0; i < 50; i++) {
+        std::vector<WordDescriptionPtr> picked = word_picker->get_words(*query, 20);
+        words->clear();
+        
+        for (size_t j = 0; j < picked.size(); j++) {
+            words->push_back(picked[j]->word);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_from_several_threads) {
+    // Server workers share the word picker; seeded lists must come out
+    // the same as when they're picked one at a time.
+    WordQuery query(4, 6);
+    query.index_nums.push_back(0);
+    query.index_nums.push_back(1);
+    query.has_seed = true;
+    query.seed = 777;
+    
+    std::vector<std::string> expected_words;
+    pick_seeded_words(word_picker.get(), &query, &expected_words);
+    
+    const size_t num_threads = 4;
+    std::vector<std::vector<std::string> > words(num_threads);
+    boost::thread_group threads;
+    
+    for (size_t i = 0; i < num_threads; i++) {
+        threads.create_thread(boost::bind(&pick_seeded_words, word_picker.get(), &query, &words[i]));
+    }
+    
+    threads.join_all();
+    
+    for (size_t i = 0; i < num_threads; i++) {
+        BOOST_CHECK(words[i] == expected_words);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(get_words_without_matches) {
+    // No word both starts with OX and is two letters long, apart from
+    // OX itself, which doesn't end with S.
+    WordQuery query(2, 2);
+    query.index_nums.push_back(0);
+    query.index_nums.push_back(1);
+    
+    std::vector<WordDescriptionPtr> words = word_picker->get_words(query, 10);
+    BOOST_CHECK(words.empty());
+}
+
+BOOST_AUTO_TEST_CASE(small_key_set) {
+    SmallKeySet keys;
+    BOOST_CHECK(keys.insert(0));
+    BOOST_CHECK(keys.insert(1));
+    BOOST_CHECK(keys.insert(12345));
+    BOOST_CHECK(!keys.insert(0));
+    BOOST_CHECK(!keys.insert(12345));
+    BOOST_CHECK(keys.insert(12346));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    WordBitmap tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(WordBitmap_tests)
+
+BOOST_AUTO_TEST_CASE(add_and_contains) {
+    WordBitmap bitmap;
+    bitmap.add(3);
+    bitmap.add(70000);
+    bitmap.add(5);
+    bitmap.add(3);
+    
+    BOOST_CHECK_EQUAL(bitmap.cardinality(), 3);
+    BOOST_CHECK_EQUAL(bitmap.containers().size(), 2);
+    BOOST_CHECK(bitmap.contains(3));
+    BOOST_CHECK(bitmap.contains(5));
+    BOOST_CHECK(bitmap.contains(70000));
+    BOOST_CHECK(!bitmap.contains(4));
+    BOOST_CHECK(!bitmap.contains(65539));
+}
+
+BOOST_AUTO_TEST_CASE(select) {
+    WordBitmap bitmap;
+    bitmap.add(10);
+    bitmap.add(20);
+    bitmap.add(65536 + 30);
+    
+    WordId id = 0;
+    BOOST_CHECK(bitmap.select(0, id));
+    BOOST_CHECK_EQUAL(id, 10);
+    BOOST_CHECK(bitmap.select(2, id));
+    BOOST_CHECK_EQUAL(id, 65536 + 30);
+    BOOST_CHECK(!bitmap.select(3, id));
+}
+
+BOOST_AUTO_TEST_CASE(dense_container) {
+    WordBitmap bitmap;
+    
+    for (WordId id = 0; id < 3 * WordBitmap::kMaxArrayCardinality; id += 2) {
+        bitmap.add(id);
+    }
+    
+    BOOST_REQUIRE_EQUAL(bitmap.containers().size(), 1);
+    BOOST_CHECK(bitmap.containers()[0].is_bitmap());
+    BOOST_CHECK_EQUAL(bitmap.cardinality(), 3 * WordBitmap::kMaxArrayCardinality / 2);
+    BOOST_CHECK(bitmap.contains(4000));
+    BOOST_CHECK(!bitmap.contains(4001));
+    
+    WordId id = 0;
+    BOOST_CHECK(bitmap.select(5000, id));
+    BOOST_CHECK_EQUAL(id, 10000);
+}
+
+BOOST_AUTO_TEST_CASE(intersect) {
+    WordBitmap evens;
+    WordBitmap threes;
+    
+    for (WordId id = 0; id < 20000; id++) {
+        if (id % 2 == 0) evens.add(id);
+        if (id % 3 == 0) threes.add(id);
+    }
+    
+    WordBitmap sixes = evens.intersect(threes);
+    BOOST_CHECK_EQUAL(sixes.cardinality(), 3334);
+    BOOST_CHECK(sixes.contains(19998));
+    BOOST_CHECK(!sixes.contains(19996));
+}
+
+BOOST_AUTO_TEST_CASE(intersection_with_range) {
+    WordBitmap evens;
+    WordBitmap sparse;
+    
+    for (WordId id = 0; id < 20000; id++) {
+        if (id % 2 == 0) evens.add(id);
+        if (id % 100 == 0) sparse.add(id);
+    }
+    
+    std::vector<const WordBitmap*> bitmaps;
+    bitmaps.push_back(&evens);
+    bitmaps.push_back(&sparse);
+    
+    WordBitmapIntersection intersection(bitmaps, 150, 1000);
+    BOOST_CHECK_EQUAL(intersection.cardinality(), 8);
+    
+    WordId id = 0;
+    BOOST_CHECK(intersection.select(0, id));
+    BOOST_CHECK_EQUAL(id, 200);
+    BOOST_CHECK(intersection.select(7, id));
+    BOOST_CHECK_EQUAL(id, 900);
+    BOOST_CHECK(!intersection.select(8, id));
+    
+    WordIdList ids;
+    intersection.to_ids(ids);
+    BOOST_REQUIRE_EQUAL(ids.size(), 8);
+    BOOST_CHECK_EQUAL(ids[3], 500);
+}
+
+BOOST_AUTO_TEST_CASE(intersection_page) {
+    WordBitmap evens;
+    WordBitmap threes;
+    
+    for (WordId id = 0; id < 200000; id++) {
+        if (id % 2 == 0) evens.add(id);
+        if (id % 3 == 0) threes.add(id);
+    }
+    
+    std::vector<const WordBitmap*> bitmaps;
+    bitmaps.push_back(&evens);
+    bitmaps.push_back(&threes);
+    WordBitmapIntersection intersection(bitmaps, 0, 200000);
+    
+    // The page spans two chunks.
+    WordIdList ids;
+    intersection.to_ids(10920, 5, ids);
+    BOOST_REQUIRE_EQUAL(ids.size(), 5);
+    
+    for (size_t i = 0; i < ids.size(); i++) {
+        BOOST_CHECK_EQUAL(ids[i], (10920 + i) * 6);
+    }
+    
+    ids.clear();
+    intersection.to_ids(intersection.cardinality() - 2, 5, ids);
+    BOOST_CHECK_EQUAL(ids.size(), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    LetterCounts tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(LetterCounts_tests)
+
+BOOST_AUTO_TEST_CASE(count) {
+    LetterCounts counts;
+    BOOST_CHECK(counts.count("ZAZA"));
+    BOOST_CHECK_EQUAL(counts.lanes[0], 2ULL);
+    BOOST_CHECK_EQUAL(counts.lanes[1], 2ULL << 36);
+    
+    BOOST_CHECK(counts.count("SSSSSSS"));
+    BOOST_CHECK(!counts.count("SSSSSSSS"));
+    BOOST_CHECK(!counts.count("Zaza"));
+    BOOST_CHECK(!counts.count("ZA-ZA"));
+}
+
+BOOST_AUTO_TEST_CASE(contains) {
+    LetterCounts rack;
+    LetterCounts word;
+    BOOST_REQUIRE(rack.count("RETAINS"));
+    
+    BOOST_REQUIRE(word.count("STAIN"));
+    BOOST_CHECK(rack.contains(word));
+    BOOST_CHECK(!word.contains(rack));
+    
+    BOOST_REQUIRE(word.count("NASTIER"));
+    BOOST_CHECK(rack.contains(word));
+    BOOST_CHECK(word == rack);
+    
+    BOOST_REQUIRE(word.count("TEENS"));
+    BOOST_CHECK(!rack.contains(word));
+    
+    BOOST_REQUIRE(word.count("ZA"));
+    BOOST_CHECK(!rack.contains(word));
+    
+    BOOST_REQUIRE(rack.count("AAAAAAA"));
+    BOOST_REQUIRE(word.count("AAAAAA"));
+    BOOST_CHECK(rack.contains(word));
+    BOOST_CHECK(!word.contains(rack));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    PerfectHashIndex tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(PerfectHashIndex_tests)
+
+BOOST_AUTO_TEST_CASE(find) {
+    PerfectHashIndex index;
+    index.add("QI");
+    index.add("ZA");
+    index.add("QI");
+    index.add(std::string(300, 'A'));
+    index.add("QAT");
+    BOOST_REQUIRE(index.finish());
+    
+    BOOST_CHECK_EQUAL(index.find("QI"), 0);
+    BOOST_CHECK_EQUAL(index.find("ZA"), 1);
+    BOOST_CHECK_EQUAL(index.find("QAT"), 4);
+    BOOST_CHECK_EQUAL(index.find("QA"), PerfectHashIndex::kNotFound);
+    BOOST_CHECK_EQUAL(index.find(""), PerfectHashIndex::kNotFound);
+    BOOST_CHECK_EQUAL(index.find(std::string(300, 'A')), PerfectHashIndex::kNotFound);
+}
+
+BOOST_AUTO_TEST_CASE(find_batch) {
+    PerfectHashIndex index;
+    std::vector<std::string> words;
+    
+    for (size_t i = 0; i < 5000; i++) {
+        std::stringstream word_stream;
+        word_stream << "W" << i * 7;
+        const std::string word = word_stream.str();
+        index.add(word);
+        words.push_back(word);
+        words.push_back(word + "X");
+    }
+    
+    BOOST_REQUIRE(index.finish());
+    
+    WordIdList ids;
+    index.find(words, ids);
+    BOOST_REQUIRE_EQUAL(ids.size(), words.size());
+    
+    for (size_t i = 0; i < words.size(); i += 2) {
+        BOOST_CHECK_EQUAL(ids[i], i / 2);
+        BOOST_CHECK_EQUAL(ids[i + 1], PerfectHashIndex::kNotFound);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(empty_index) {
+    PerfectHashIndex index;
+    BOOST_REQUIRE(index.finish());
+    BOOST_CHECK_EQUAL(index.find("QI"), PerfectHashIndex::kNotFound);
+    
+    std::vector<std::string> words(3, "QI");
+    WordIdList ids;
+    index.find(words, ids);
+    BOOST_CHECK(ids == WordIdList(3, PerfectHashIndex::kNotFound));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    SuggestionIndex tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(SuggestionIndex_tests)
+
+BOOST_AUTO_TEST_CASE(edit_distance) {
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("RECEIVE", "RECEIVE", 2), 0);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("RECIEVE", "RECEIVE", 2), 1);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("RECEVE", "RECEIVE", 2), 1);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("RACEIVES", "RECEIVE", 2), 2);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("DECEIT", "RECEIVE", 2), 3);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("", "QI", 2), 2);
+    BOOST_CHECK_EQUAL(SuggestionIndex::edit_distance("", "QAT", 2), 3);
+}
+
+BOOST_AUTO_TEST_CASE(is_one_edit_apart) {
+    BOOST_CHECK(SuggestionIndex::is_one_edit_apart("RECIEVE", "RECEIVE"));
+    BOOST_CHECK(SuggestionIndex::is_one_edit_apart("RECEVE", "RECEIVE"));
+    BOOST_CHECK(SuggestionIndex::is_one_edit_apart("RECEIVE", "RECEIVER"));
+    BOOST_CHECK(SuggestionIndex::is_one_edit_apart("DECEIVE", "RECEIVE"));
+    BOOST_CHECK(SuggestionIndex::is_one_edit_apart("", "A"));
+    BOOST_CHECK(!SuggestionIndex::is_one_edit_apart("RECEIVE", "RECEIVE"));
+    BOOST_CHECK(!SuggestionIndex::is_one_edit_apart("RACEIVES", "RECEIVE"));
+    BOOST_CHECK(!SuggestionIndex::is_one_edit_apart("RECEIVE", "RECEIVERS"));
+    BOOST_CHECK(!SuggestionIndex::is_one_edit_apart("ERCEIVF", "RECEIVE"));
+}
+
+BOOST_AUTO_TEST_CASE(find_candidates) {
+    SuggestionIndex index;
+    index.add("QI");
+    index.add("QAT");
+    index.add("RECEIVE");
+    index.add("RECEIVER");
+    index.finish();
+    
+    WordIdList ids;
+    index.find_candidates("RECIEVE", ids);
+    BOOST_CHECK(std::find(ids.begin(), ids.end(), 2) != ids.end());
+    BOOST_CHECK(std::find(ids.begin(), ids.end(), 3) != ids.end());
+    
+    ids.clear();
+    index.find_candidates("QT", ids);
+    BOOST_CHECK(std::find(ids.begin(), ids.end(), 0) != ids.end());
+    BOOST_CHECK(std::find(ids.begin(), ids.end(), 1) != ids.end());
+}
+
+BOOST_AUTO_TEST_CASE(memory_is_bounded) {
+    SuggestionIndex index(2, 7, 16384);
+    
+    for (size_t i = 0; i < 200; i++) {
+        std::stringstream word;
+        word << "ABCDEFG" << i;
+        index.add(word.str());
+    }
+    
+    index.finish();
+    BOOST_CHECK_LT(index.prefix_length(), 7);
+    BOOST_CHECK_LE(index.memory_bytes(), 16384);
+    
+    WordIdList ids;
+    index.find_candidates("ABCDEFG7", ids);
+    BOOST_CHECK(std::find(ids.begin(), ids.end(), 7) != ids.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+/*---------------------------------------------------------
+                    LetterMaskIndex tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(LetterMaskIndex_tests)
+
+/// Make the requirements for a set of letters and a minimum length.
+static boost::uint32_t requirements(const std::string& letters, size_t min_length) {
+    boost::uint32_t mask = min_length << LetterMaskIndex::kLengthShift;
+    
+    for (size_t i = 0; i < letters.length(); i++) {
+        mask |= 1u << (letters[i] - 'A');
+    }
+    
+    return mask;
+}
+
+BOOST_AUTO_TEST_CASE(find_requirements) {
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("^[^AEIOU]*Y$"), requirements("Y", 1));
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("qu?iz"), requirements("QIZ", 3));
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("^(AB|CD)C{2}..$"), requirements("C", 3));
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("X{0,2}Z+?"), requirements("Z", 1));
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("\\wZ[]A-Z[:alpha:]]{3}Q"), requirements("ZQ", 3));
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements("QI|ZA"), 0u);
+    BOOST_CHECK_EQUAL(LetterMaskIndex::find_requirements(""), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(find_candidates) {
+    LetterMaskIndex index;
+    index.add("QI");
+    index.add("QAT");
+    index.add("ZA");
+    index.add("QUIZ");
+    
+    WordIdList ids;
+    index.find_candidates(requirements("QI", 0), ids);
+    BOOST_REQUIRE_EQUAL(ids.size(), 2);
+    BOOST_CHECK_EQUAL(ids[0], 0);
+    BOOST_CHECK_EQUAL(ids[1], 3);
+    
+    ids.clear();
+    index.find_candidates(requirements("A", 3), ids);
+    BOOST_REQUIRE_EQUAL(ids.size(), 1);
+    BOOST_CHECK_EQUAL(ids[0], 1);
+    
+    ids.clear();
+    index.find_candidates(requirements("", 0), ids);
+    BOOST_CHECK_EQUAL(ids.size(), 4);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
 
+/*---------------------------------------------------------
+                    WorkerPool tests.
+----------------------------------------------------------*/
+BOOST_AUTO_TEST_SUITE(WorkerPool_tests)
+
+/// Mark a task as done.
+static void mark_done(std::vector<int>* done, size_t task_num) {
+    (*done)[task_num]++;
+}
+
+BOOST_AUTO_TEST_CASE(run) {
+    WorkerPool pool(3);
+    BOOST_CHECK_EQUAL(pool.num_threads(), 3);
+    
+    for (size_t batch = 0; batch < 20; batch++) {
+        std::vector<int> done(50, 0);
+        std::vector<WorkerPool::Task> tasks;
+        
+        for (size_t i = 0; i < done.size(); i++) {
+            tasks.push_back(boost::bind(&mark_done, &done, i));
+        }
+        
+        pool.run(tasks);
+        BOOST_CHECK(done == std::vector<int>(50, 1));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(run_without_threads) {
+    WorkerPool pool(0);
+    std::vector<int> done(5, 0);
+    std::vector<WorkerPool::Task> tasks;
+    
+    for (size_t i = 0; i < done.size(); i++) {
+        tasks.push_back(boost::bind(&mark_done, &done, i));
+    }
+    
+    pool.run(tasks);
+    pool.run(std::vector<WorkerPool::Task>());
+    BOOST_CHECK(done == std::vector<int>(5, 1));
+}
+
+BOOST_AUTO_TEST_CASE(post) {
+    std::vector<int> done(10, 0);
+    
+    {
+        WorkerPool pool(2);
+        
+        for (size_t i = 0; i < done.size(); i++) {
+            pool.post(boost::bind(&mark_done, &done, i));
+        }
+    }
+    
+    //The posted tasks are done by the time the pool is destroyed.
+    BOOST_CHECK(done == std::vector<int>(10, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -17,19 +17,27 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
 
 #include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <event2/event.h>
 #include <event2/http.h>
@@ -39,10 +47,15 @@
 #include <event2/keyvalq_struct.h>
 
 #include "views.h"
+#include "asset_pipeline.h"
+#include "content_hash.h"
+#include "dictionary_set.h"
+#include "file_handler.h"
 #include "http_server.h"
 #include "http_utils.h"
 #include "file_cache.h"
 #include "word_picker.h"
+#include "worker_pool.h"
 
 using boost::shared_ptr;
 using boost::shared_array;
@@ -51,12 +64,103 @@ using boost::bad_lexical_cast;
 
 namespace isaword {
 
+/// Escape a string for use inside a JSON string literal.  Control
+/// characters, which JSON doesn't allow in strings, are written as
+/// escape sequences.
+static std::string json_escape(const std::string& text) {
+    static const char kHexDigits[] = "0123456789abcdef";
+    std::string escaped;
+    escaped.reserve(text.length());
+    
+    for (size_t i = 0; i < text.length(); i++) {
+        const unsigned char c = static_cast<unsigned char>(text[i]);
+        
+        switch (c) {
+            case '"':   escaped += "\\\"";  break;
+            case '\\':  escaped += "\\\\";  break;
+            case '\b':  escaped += "\\b";   break;
+            case '\f':  escaped += "\\f";   break;
+            case '\n':  escaped += "\\n";   break;
+            case '\r':  escaped += "\\r";   break;
+            case '\t':  escaped += "\\t";   break;
+            
+            default:
+                if (c < 0x20) {
+                    escaped += "\\u00";
+                    escaped += kHexDigits[c >> 4];
+                    escaped += kHexDigits[c & 0xf];
+                } else {
+                    escaped += text[i];
+                }
+        }
+    }
+    
+    return escaped;
+}
+
 /// Default minimum word length.
 const size_t PageHandler::kDefaultMinWordLength;
 
 /// Default maximum word length.
 const size_t PageHandler::kDefaultMaxWordLength;
 
+/// Number of words on a page of search results.
+const size_t PageHandler::kSearchPageSize;
+
+/// Last page of search results that can be asked for.
+const size_t PageHandler::kMaxSearchPage;
+
+/// Maximum number of words to check in one request.
+const size_t PageHandler::kMaxCheckWords;
+
+/// Maximum number of suggestions for a misspelled word.
+const size_t PageHandler::kMaxSuggestions;
+
+/// Maximum number of words found by a regular expression search.
+const size_t PageHandler::kMaxGrepWords;
+
+/// How long a regular expression search may take.
+const long PageHandler::kGrepTimeBudgetMillisec;
+
+/// Maximum number of threads working on a regular expression search.
+const size_t PageHandler::kMaxGrepThreads;
+const size_t PageHandler::kSeededWordsMaxAge;
+
+/// Split a list of words separated by spaces, commas or '+' signs,
+/// converting them to upper case, and add them to the words.  Stops
+/// as soon as there are more than max_words words.
+/// @return true if there are at most max_words words; false otherwise.
+static bool split_words(const char* text, 
+                        size_t length, 
+                        size_t max_words, 
+                        std::vector<std::string>& words) {
+    std::string word;
+    
+    for (size_t i = 0; i <= length; i++) {
+        const unsigned char letter = (i < length) ? static_cast<unsigned char>(text[i]) : ' ';
+        
+        if (letter == '+' || letter == ',' || isspace(letter)) {
+            if (!word.empty()) {
+                if (words.size() == max_words) {
+                    return false;
+                }
+                
+                words.push_back(word);
+                word.clear();
+            }
+        
+        } else {
+            word += static_cast<char>(toupper(letter));
+        }
+    }
+    
+    return true;
+}
+
+/// Names of the dictionaries to load from the dictionaries directory.
+/// The first one is used by default.
+static const char* kDictionaryNames[] = {"owl2", "ospd4"};
+
 /**
  * Initialize.
  * Returns true if there were no problems; false if the initialization
@@ -64,7 +168,6 @@ const size_t PageHandler::kDefaultMaxWordLength;
  */
 bool PageHandler::initialize(const std::string& resource_root) {
     template_cache_ = boost::shared_ptr<FileCache>(new FileCache(resource_root));
-    page_buffer_ = shared_array<char>(new char[page_buffer_size_]);
     
     // Create the descriptions of lists of words to keep track of.
     shared_ptr<WordIndexDescription> j_words(
@@ -96,23 +199,52 @@ bool PageHandler::initialize(const std::string& resource_root) {
     index_descriptions_.push_back(out_words);
     index_descriptions_.push_back(re_words);
     
-    //Create the word picker.
-    word_picker_ = shared_ptr<WordPicker>(new WordPicker(index_descriptions_));
-    bool has_initialized_word_picker = 
-        word_picker_->initialize(resource_root + "dictionaries/owl2.txt");
+    //Load the dictionaries, with a word picker for each.
+    const size_t num_dictionaries = sizeof(kDictionaryNames) / sizeof(kDictionaryNames[0]);
+    std::vector<std::string> dictionary_names(kDictionaryNames, kDictionaryNames + num_dictionaries);
+    dictionaries_ = shared_ptr<DictionaryReloader>(
+        new DictionaryReloader(index_descriptions_, resource_root + "dictionaries/", dictionary_names));
+    bool has_initialized_word_picker = dictionaries_->load();
+    
+    const std::vector<shared_ptr<WordPicker> >& word_pickers = 
+        dictionaries_->current()->word_pickers();
+    
+    for (size_t i = 0; i < word_pickers.size() && i < num_dictionaries; i++) {
+        const SuggestionIndex& suggestion_index = word_pickers[i]->suggestion_index();
+        std::cout << "Suggestion index for " << kDictionaryNames[i] << ": "
+                  << suggestion_index.memory_bytes() << " bytes, "
+                  << suggestion_index.prefix_length() << "-letter prefixes" << std::endl;
+    }
+    
+    //The thread running a search works on it too, so it needs one 
+    //helper thread less.  The searches run off the event loops, so 
+    //that a slow one doesn't hold up the other requests.
+    const size_t num_grep_threads = 
+        std::min(std::max(boost::thread::hardware_concurrency(), 1u), 
+                 static_cast<unsigned>(kMaxGrepThreads));
+    grep_pool_ = shared_ptr<WorkerPool>(new WorkerPool(num_grep_threads - 1));
+    grep_request_pool_ = shared_ptr<WorkerPool>(new WorkerPool(num_grep_threads));
     
     //Build vairous templates.
     main_page_template_ =  this->build_main_page_template();
     about_page_ = this->insert_into_main_layout("templates/about.html");
     fine_print_page_ = this->insert_into_main_layout("templates/fine-print.html");
     not_found_template_ = this->insert_into_main_layout("templates/404.html");
+    this->fingerprinted_pages();
     
     //Attach to the server.
     server_->add_url_handler("/", &main_page, (void*) this);
     server_->add_url_handler("/about/?", &about, (void*) this);
     server_->add_url_handler("/fine_print/?", &fine_print, (void*) this);
-    server_->add_url_handler("/words/[a-z0-9/_]+", &words, (void*) this);
+    server_->add_url_handler("/words(/[a-z0-9/_+]+)", &words, (void*) this);
+    server_->add_url_handler("/search/[a-z0-9]+(/.*)?", &search, (void*) this);
+    server_->add_url_handler("/anagrams/([a-z0-9]+)/([A-Za-z]+)/?", &anagrams, (void*) this);
+    server_->add_url_handler("/check/[a-z0-9]+(/.*)?", &check_words, (void*) this);
+    server_->add_url_handler("/suggest/([a-z0-9]+)/([A-Za-z]+)/?", &suggest, (void*) this);
+    server_->add_url_handler("/grep/[a-z0-9]+/.+", &grep, (void*) this);
+    server_->add_url_handler("/admin/reload/?", &reload_dictionaries, (void*) this);
     server_->set_not_found_handler(&not_found, this);
+    server_->add_signal_handler(SIGHUP, &reload_signal, (void*) this);
     return has_initialized_word_picker;
 }
 
@@ -126,16 +258,12 @@ void PageHandler::main_page(struct evhttp_request* request, void* page_handler_p
     //Compose the main page.
     std::string words("var words = ");
     words += this_->make_words_to_guess("/") + ';';
-    const int page_size = 
-        sprintf(this_->page_buffer_.get(), this_->main_page_template_.c_str(), words.c_str());
-    const size_t u_page_size = static_cast<size_t>(page_size);
+    const std::string page = 
+        fill_page_template(this_->fingerprinted_pages()->main_page_template, words.c_str());
     
     //Return the page.
     response_set_never_cache(request);
-    this_->server_->send_response_data(request, 
-                                       this_->page_buffer_.get(), 
-                                       u_page_size, 
-                                       HTTP_OK);
+    this_->server_->send_response(request, page, HTTP_OK);
 }
 
 /**
@@ -144,7 +272,9 @@ void PageHandler::main_page(struct evhttp_request* request, void* page_handler_p
 void PageHandler::about(struct evhttp_request* request, void* page_handler_ptr) {
     PageHandler* this_ = (PageHandler*) page_handler_ptr;
     response_set_never_cache(request);
-    this_->server_->send_response(request, this_->about_page_, HTTP_OK);
+    this_->server_->send_response(request, 
+                                  this_->fingerprinted_pages()->about_page, 
+                                  HTTP_OK);
 }
 
 /**
@@ -153,26 +283,533 @@ void PageHandler::about(struct evhttp_request* request, void* page_handler_ptr)
 void PageHandler::fine_print(struct evhttp_request* request, void* page_handler_ptr) {
     PageHandler* this_ = (PageHandler*) page_handler_ptr;
     response_set_never_cache(request);
-    this_->server_->send_response(request, this_->fine_print_page_, HTTP_OK);
+    this_->server_->send_response(request, 
+                                  this_->fingerprinted_pages()->fine_print_page, 
+                                  HTTP_OK);
 }
 
 /**
- * Display the words to guess.
+ * Display the words to guess.  Seeded lists never change (as long as
+ * the dictionary doesn't), so they may be cached, and are tagged with
+ * a hash of their contents.
  */
-void PageHandler::words(struct evhttp_request* request, void* page_handler_ptr) {
+void PageHandler::words(struct evhttp_request* request, 
+                        const PathParams& params, 
+                        void* page_handler_ptr) {
     //Get the words to send in JSON format.
     PageHandler* this_ = (PageHandler*) page_handler_ptr;
-    std::string uri = request_uri_path(request);
-    std::string words = this_->make_words_to_guess(uri.substr(6));
+    const char* query_string = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(request));
+    bool is_seeded = false;
+    size_t dictionary_generation = 0;
+    std::string words = 
+        this_->make_words_to_guess(params[0], query_string, &is_seeded, &dictionary_generation);
     
     //Set the proper Content-Type header
     struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
     evhttp_add_header(response_headers, "Content-Type", "application/json");
     
-    response_set_never_cache(request);
+    if (!is_seeded) {
+        response_set_never_cache(request);
+        this_->server_->send_response(request, words, HTTP_OK);
+        return;
+    }
+    
+    //Tag the list like the static files, with the dictionaries it was
+    //picked from mixed in, so that a tag never outlives a reload.
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", 
+             static_cast<unsigned long long>(
+                 content_hash(words.data(), words.size(), dictionary_generation)));
+    evhttp_add_header(response_headers, "ETag", etag);
+    response_cache_public(request, kSeededWordsMaxAge);
+    
+    struct evkeyvalq* request_headers = evhttp_request_get_input_headers(request);
+    const char* if_none_match = evhttp_find_header(request_headers, "If-None-Match");
+    
+    if (if_none_match != NULL && FileHandler::etag_matches(if_none_match, etag)) {
+        this_->server_->send_response(request, std::string(""), HTTP_NOTMODIFIED);
+        return;
+    }
+    
     this_->server_->send_response(request, words, HTTP_OK);
 }
 
+/**
+ * Find the words matching a crossword-style pattern.  The request URI
+ * should have the format "/search/<dictionary>/<pattern>[/<page>]",
+ * where the pattern has '?', '_' or '.' for unknown letters, e.g.
+ *     "/search/owl2/?A??E"
+ *     "/search/owl2/_a__e/2"
+ * Since a '?' starts the query string, the URI is taken as a whole.
+ * The results are sent out as JSON, a chunk at a time.
+ */
+void PageHandler::search(struct evhttp_request* request, void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    
+    //Split the URI into the dictionary, the pattern and the page.
+    char* decoded_uri = evhttp_uridecode(evhttp_request_get_uri(request), 0, NULL);
+    const std::string uri(decoded_uri != NULL ? decoded_uri : "");
+    free(decoded_uri);
+    
+    const std::string search_root("/search/");
+    std::vector<std::string> description;
+    size_t start = search_root.length();
+    
+    while (start <= uri.length()) {
+        size_t end = uri.find_first_of('/', start);
+        if (end == std::string::npos) {
+            end = uri.length();
+        }
+        
+        description.push_back(uri.substr(start, end - start));
+        start = end + 1;
+    }
+    
+    std::string pattern(description.size() > 1 ? description[1] : "");
+    
+    for (size_t i = 0; i < pattern.length(); i++) {
+        if (pattern[i] == '_' || pattern[i] == '.') {
+            pattern[i] = PatternIndex::kAnyLetter;
+        } else {
+            pattern[i] = static_cast<char>(toupper(pattern[i]));
+        }
+    }
+    
+    size_t page = 1;
+    
+    if (description.size() > 2) {
+        try {
+            page = std::max(lexical_cast<size_t, std::string>(description[2]), (size_t) 1);
+        } catch (bad_lexical_cast&) {
+        }
+    }
+    
+    if (page > kMaxSearchPage) {
+        this_->server_->send_response(request, 
+                                      "{\"error\": \"Page out of range.\"}", 
+                                      HTTP_BADREQUEST);
+        return;
+    }
+    
+    //Look up the words.
+    DictionarySetPtr dictionaries(this_->dictionaries_->current());
+    shared_ptr<WordPicker> word_picker(dictionaries->find_word_picker(description[0]));
+    std::vector<WordDescriptionPtr> words;
+    const size_t num_matches = 
+        word_picker->find_words(pattern, (page - 1) * kSearchPageSize, kSearchPageSize, words);
+    
+    //Stream out the results.
+    struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
+    evhttp_add_header(response_headers, "Content-Type", "application/json");
+    response_cache_public(request, 3600 /* sec */);
+    evhttp_send_reply_start(request, HTTP_OK, "OK");
+    
+    struct evbuffer* buffer = evbuffer_new();
+    evbuffer_add_printf(buffer, 
+                        "{\n\t\"pattern\": \"%s\",\n\t\"page\": %lu,\n\t\"page_size\": %lu,"
+                        "\n\t\"num_matches\": %lu,\n\t\"words\": [",
+                        json_escape(pattern).c_str(),
+                        static_cast<unsigned long>(page),
+                        static_cast<unsigned long>(kSearchPageSize),
+                        static_cast<unsigned long>(num_matches));
+    
+    const size_t words_per_chunk = 25;
+    
+    for (size_t i = 0; i < words.size(); i++) {
+        evbuffer_add_printf(buffer, 
+                            "%s\n\t\t{\"word\": \"%s\", \"description\": \"%s\"}",
+                            i == 0 ? "" : ",",
+                            words[i]->word.c_str(),
+                            json_escape(words[i]->description).c_str());
+        
+        if ((i + 1) % words_per_chunk == 0) {
+            evhttp_send_reply_chunk(request, buffer);
+        }
+    }
+    
+    evbuffer_add_printf(buffer, "\n\t]\n}");
+    evhttp_send_reply_chunk(request, buffer);
+    evhttp_send_reply_end(request);
+    evbuffer_free(buffer);
+}
+
+/**
+ * Find the words that can be made from a rack of letters.  The request
+ * URI should have the format "/anagrams/<dictionary>/<letters>", e.g.
+ *     "/anagrams/owl2/retains"
+ * The response lists the exact anagrams of the letters, and the shorter
+ * words that can be made from some of them, longest first.
+ */
+void PageHandler::anagrams(struct evhttp_request* request, 
+                           const PathParams& params, 
+                           void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    const std::string& dictionary_name = params[0];
+    std::string rack = params[1];
+    
+    for (size_t i = 0; i < rack.length(); i++) {
+        rack[i] = static_cast<char>(toupper(rack[i]));
+    }
+    
+    //Look up the words.
+    DictionarySetPtr dictionaries(this_->dictionaries_->current());
+    shared_ptr<WordPicker> word_picker(dictionaries->find_word_picker(dictionary_name));
+    std::vector<WordDescriptionPtr> anagram_words;
+    std::vector<WordDescriptionPtr> subwords;
+    
+    struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
+    evhttp_add_header(response_headers, "Content-Type", "application/json");
+    
+    if (!word_picker->find_anagrams(rack, anagram_words, subwords)) {
+        this_->server_->send_response(request, 
+                                      "{\"error\": \"Too many letters.\"}", 
+                                      HTTP_BADREQUEST);
+        return;
+    }
+    
+    //Compose the JSON object.
+    std::stringstream result;
+    result << "{\n\t\"letters\": \"" << rack << "\",";
+    result << "\n\t\"anagrams\": [";
+    
+    for (size_t i = 0; i < anagram_words.size(); i++) {
+        result << (i == 0 ? "" : ",")
+               << "\n\t\t{\"word\": \"" << anagram_words[i]->word 
+               << "\", \"description\": \"" << json_escape(anagram_words[i]->description) << "\"}";
+    }
+    
+    result << "\n\t],\n\t\"words\": [";
+    
+    for (size_t i = 0; i < subwords.size(); i++) {
+        result << (i == 0 ? "" : ",")
+               << "\n\t\t{\"word\": \"" << subwords[i]->word 
+               << "\", \"description\": \"" << json_escape(subwords[i]->description) << "\"}";
+    }
+    
+    result << "\n\t]\n}";
+    
+    response_cache_public(request, 3600 /* sec */);
+    this_->server_->send_response(request, result.str(), HTTP_OK);
+}
+
+/**
+ * Check whether a batch of words are real, and get their descriptions.
+ * The words are separated by spaces, commas or '+' signs, and are
+ * either listed in the request URI, e.g.
+ *     "/check/owl2/qi+za+zq"
+ * or posted in the request body to "/check/<dictionary>".  The JSON
+ * response is written straight into the output buffer.
+ */
+void PageHandler::check_words(struct evhttp_request* request, void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    const enum evhttp_cmd_type command = evhttp_request_get_command(request);
+    
+    if (command != EVHTTP_REQ_GET && command != EVHTTP_REQ_POST) {
+        this_->server_->send_response(request, "Use GET or POST.\n", HTTP_BADREQUEST);
+        return;
+    }
+    
+    //Split the URI into the dictionary and the words.
+    char* decoded_path = evhttp_uridecode(request_uri_path(request).c_str(), 0, NULL);
+    const std::string path(decoded_path != NULL ? decoded_path : "");
+    free(decoded_path);
+    
+    const size_t dictionary_start = std::string("/check/").length();
+    const size_t dictionary_end = std::min(path.find_first_of('/', dictionary_start), path.length());
+    const std::string dictionary_name = path.substr(dictionary_start, dictionary_end - dictionary_start);
+    
+    std::vector<std::string> words;
+    bool is_within_limit = true;
+    
+    if (dictionary_end < path.length()) {
+        is_within_limit = split_words(path.data() + dictionary_end + 1, 
+                                      path.length() - dictionary_end - 1, 
+                                      kMaxCheckWords,
+                                      words);
+    }
+    
+    //The server caps the size of the body (HttpServer::kMaxBodySize),
+    //and the words past the limit aren't even split off.
+    if (is_within_limit && command == EVHTTP_REQ_POST) {
+        struct evbuffer* input = evhttp_request_get_input_buffer(request);
+        const size_t input_length = evbuffer_get_length(input);
+        const char* input_data = (const char*) evbuffer_pullup(input, -1);
+        
+        if (input_data != NULL) {
+            is_within_limit = split_words(input_data, input_length, kMaxCheckWords, words);
+        }
+    }
+    
+    struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
+    evhttp_add_header(response_headers, "Content-Type", "application/json");
+    
+    if (!is_within_limit) {
+        this_->server_->send_response(request, 
+                                      "{\"error\": \"Too many words.\"}", 
+                                      HTTP_BADREQUEST);
+        return;
+    }
+    
+    //Look up the words.
+    DictionarySetPtr dictionaries(this_->dictionaries_->current());
+    shared_ptr<WordPicker> word_picker(dictionaries->find_word_picker(dictionary_name));
+    std::vector<WordDescriptionPtr> descriptions;
+    word_picker->check_words(words, descriptions);
+    
+    //Write the response.
+    struct evbuffer* buffer = evhttp_request_get_output_buffer(request);
+    evbuffer_add_printf(buffer, "{\n\t\"words\": [");
+    
+    for (size_t i = 0; i < words.size(); i++) {
+        if (descriptions[i]) {
+            evbuffer_add_printf(buffer, 
+                                "%s\n\t\t{\"word\": \"%s\", \"is_real\": true, \"description\": \"%s\"}",
+                                i == 0 ? "" : ",",
+                                json_escape(words[i]).c_str(),
+                                json_escape(descriptions[i]->description).c_str());
+        } else {
+            evbuffer_add_printf(buffer, 
+                                "%s\n\t\t{\"word\": \"%s\", \"is_real\": false}",
+                                i == 0 ? "" : ",",
+                                json_escape(words[i]).c_str());
+        }
+    }
+    
+    evbuffer_add_printf(buffer, "\n\t]\n}");
+    
+    if (command == EVHTTP_REQ_GET) {
+        response_cache_public(request, 3600 /* sec */);
+    } else {
+        response_set_never_cache(request);
+    }
+    
+    evhttp_send_reply(request, HTTP_OK, "OK", NULL);
+}
+
+/**
+ * Suggest real words close to a possibly misspelled word.  The request
+ * URI should have the format "/suggest/<dictionary>/<word>", e.g.
+ *     "/suggest/owl2/recieve"
+ * The suggestions come closest first, with the number of edits needed
+ * to get to each of them.
+ */
+void PageHandler::suggest(struct evhttp_request* request, 
+                          const PathParams& params, 
+                          void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    const std::string& dictionary_name = params[0];
+    std::string word = params[1];
+    
+    for (size_t i = 0; i < word.length(); i++) {
+        word[i] = static_cast<char>(toupper(word[i]));
+    }
+    
+    //Look up the suggestions.
+    DictionarySetPtr dictionaries(this_->dictionaries_->current());
+    shared_ptr<WordPicker> word_picker(dictionaries->find_word_picker(dictionary_name));
+    std::vector<WordDescriptionPtr> suggestions;
+    std::vector<size_t> distances;
+    word_picker->suggest_words(word, kMaxSuggestions, suggestions, distances);
+    
+    //Compose the JSON object.
+    std::stringstream result;
+    result << "{\n\t\"word\": \"" << word << "\",";
+    result << "\n\t\"suggestions\": [";
+    
+    for (size_t i = 0; i < suggestions.size(); i++) {
+        result << (i == 0 ? "" : ",")
+               << "\n\t\t{\"word\": \"" << suggestions[i]->word 
+               << "\", \"distance\": " << distances[i]
+               << ", \"description\": \"" << json_escape(suggestions[i]->description) << "\"}";
+    }
+    
+    result << "\n\t]\n}";
+    
+    struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
+    evhttp_add_header(response_headers, "Content-Type", "application/json");
+    response_cache_public(request, 3600 /* sec */);
+    this_->server_->send_response(request, result.str(), HTTP_OK);
+}
+
+/**
+ * A regular expression search handed to the search threads, and the
+ * event loop its request is to be completed on.
+ */
+class PageHandler::PendingGrep {
+public:
+    PageHandler* handler;
+    struct evhttp_request* request;
+    struct event_base* base;
+    std::string pattern;
+    
+    /// Keeps the dictionaries searched alive until the search is done.
+    DictionarySetPtr dictionaries;
+    shared_ptr<WordPicker> word_picker;
+    
+    /// The results, filled in by the search thread.
+    bool is_valid_pattern;
+    bool is_complete;
+    std::vector<WordDescriptionPtr> words;
+};
+
+/**
+ * Find the words matching a regular expression, in Perl syntax and
+ * regardless of case.  The request URI should have the format
+ * "/grep/<dictionary>/<expression>", e.g.
+ *     "/grep/owl2/^[^AEIOU]*Y$"
+ * Since the expression may have '?' and '/' in it, the URI is taken as
+ * a whole.  The search stops after kMaxGrepWords words or after
+ * kGrepTimeBudgetMillisec; "is_complete" in the results tells whether
+ * it did.  It runs on the search threads, so that the other requests
+ * on this event loop don't wait for it.
+ */
+void PageHandler::grep(struct evhttp_request* request, void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    
+    //Split the URI into the dictionary and the expression.
+    char* decoded_uri = evhttp_uridecode(evhttp_request_get_uri(request), 0, NULL);
+    const std::string uri(decoded_uri != NULL ? decoded_uri : "");
+    free(decoded_uri);
+    
+    const size_t dictionary_start = std::string("/grep/").length();
+    const size_t dictionary_end = std::min(uri.find_first_of('/', dictionary_start), uri.length());
+    const std::string dictionary_name = uri.substr(dictionary_start, dictionary_end - dictionary_start);
+    
+    PendingGrep* pending_grep = new PendingGrep();
+    pending_grep->handler = this_;
+    pending_grep->request = request;
+    pending_grep->base = evhttp_connection_get_base(evhttp_request_get_connection(request));
+    pending_grep->pattern = uri.substr(std::min(dictionary_end + 1, uri.length()));
+    pending_grep->dictionaries = this_->dictionaries_->current();
+    pending_grep->word_picker = pending_grep->dictionaries->find_word_picker(dictionary_name);
+    pending_grep->is_valid_pattern = false;
+    pending_grep->is_complete = false;
+    
+    this_->grep_request_pool_->post(boost::bind(&PageHandler::run_grep, pending_grep));
+}
+
+/**
+ * Run a regular expression search, then hand the results over to the
+ * event loop of the request.  Runs on a search thread, which works on
+ * the search together with the helper threads.
+ */
+void PageHandler::run_grep(PendingGrep* pending_grep) {
+    pending_grep->is_valid_pattern = 
+        pending_grep->word_picker->grep_words(pending_grep->pattern, 
+                                              kMaxGrepWords, 
+                                              kGrepTimeBudgetMillisec, 
+                                              *pending_grep->handler->grep_pool_, 
+                                              pending_grep->words, 
+                                              pending_grep->is_complete);
+    
+    //The request can't be completed from this thread.
+    if (event_base_once(pending_grep->base, -1, EV_TIMEOUT, 
+                        &PageHandler::finish_grep_callback, 
+                        (void*) pending_grep, NULL) != 0) {
+        // Nothing more can be done; the connection will time out.
+        delete pending_grep;
+    }
+}
+
+/**
+ * Send the results of a regular expression search.
+ */
+void PageHandler::finish_grep_callback(evutil_socket_t, short, void* pending_grep_ptr) {
+    PendingGrep* pending_grep = (PendingGrep*) pending_grep_ptr;
+    PageHandler* this_ = pending_grep->handler;
+    struct evhttp_request* request = pending_grep->request;
+    const std::vector<WordDescriptionPtr>& words = pending_grep->words;
+    
+    struct evkeyvalq* response_headers = evhttp_request_get_output_headers(request);
+    evhttp_add_header(response_headers, "Content-Type", "application/json");
+    
+    if (!pending_grep->is_valid_pattern) {
+        this_->server_->send_response(request, 
+                                      "{\"error\": \"Invalid regular expression.\"}", 
+                                      HTTP_BADREQUEST);
+        delete pending_grep;
+        return;
+    }
+    
+    //Stream out the results.  Searches cut short by time may 
+    //find more on another try, so they're not cached.
+    if (pending_grep->is_complete) {
+        response_cache_public(request, 3600 /* sec */);
+    } else {
+        response_set_never_cache(request);
+    }
+    
+    evhttp_send_reply_start(request, HTTP_OK, "OK");
+    
+    struct evbuffer* buffer = evbuffer_new();
+    evbuffer_add_printf(buffer, 
+                        "{\n\t\"pattern\": \"%s\",\n\t\"is_complete\": %s,"
+                        "\n\t\"num_matches\": %lu,\n\t\"words\": [",
+                        json_escape(pending_grep->pattern).c_str(),
+                        pending_grep->is_complete ? "true" : "false",
+                        static_cast<unsigned long>(words.size()));
+    
+    const size_t words_per_chunk = 25;
+    
+    for (size_t i = 0; i < words.size(); i++) {
+        evbuffer_add_printf(buffer, 
+                            "%s\n\t\t{\"word\": \"%s\", \"description\": \"%s\"}",
+                            i == 0 ? "" : ",",
+                            words[i]->word.c_str(),
+                            json_escape(words[i]->description).c_str());
+        
+        if ((i + 1) % words_per_chunk == 0) {
+            evhttp_send_reply_chunk(request, buffer);
+        }
+    }
+    
+    evbuffer_add_printf(buffer, "\n\t]\n}");
+    evhttp_send_reply_chunk(request, buffer);
+    evhttp_send_reply_end(request);
+    evbuffer_free(buffer);
+    delete pending_grep;
+}
+
+/**
+ * Reload the dictionaries without stopping the server.
+ */
+void PageHandler::reload_dictionaries(struct evhttp_request* request, void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    
+    //Pretend that the page doesn't exist for the rest of the world.
+    if (!this_->server_->is_admin_request(request)) {
+        not_found(request, page_handler_ptr);
+        return;
+    }
+    
+    response_set_never_cache(request);
+    
+    //A reload changes the server's state, so a link or a prefetch
+    //must not start one.
+    if (evhttp_request_get_command(request) != EVHTTP_REQ_POST) {
+        evhttp_add_header(evhttp_request_get_output_headers(request), "Allow", "POST");
+        this_->server_->send_response(request, "Use POST.\n", HTTP_BADMETHOD);
+        return;
+    }
+    
+    if (this_->dictionaries_->start_reload()) {
+        this_->server_->send_response(request, "Reloading dictionaries.\n", HTTP_OK);
+        
+    } else {
+        this_->server_->send_response(request, 
+                                      "The dictionaries are already being reloaded.\n",
+                                      HTTP_SERVUNAVAIL);
+    }
+}
+
+/**
+ * Reload the dictionaries on SIGHUP.
+ */
+void PageHandler::reload_signal(evutil_socket_t, short, void* page_handler_ptr) {
+    PageHandler* this_ = (PageHandler*) page_handler_ptr;
+    this_->dictionaries_->start_reload();
+}
+
 /**
  * Display the 404 Not Found page.
  */
@@ -182,15 +819,12 @@ void PageHandler::not_found(struct evhttp_request* request, void* page_handler_p
     
     //Compose the not found page.
     shared_array<char> escaped_uri(evhttp_htmlescape(uri.c_str()));
-    const int page_size = 
-        sprintf(this_->page_buffer_.get(), this_->not_found_template_.c_str(), escaped_uri.get());
-    const size_t u_page_size = static_cast<size_t>(page_size);
+    const std::string page = 
+        fill_page_template(this_->fingerprinted_pages()->not_found_template, 
+                           escaped_uri.get());
     
     response_cache_public(request, 3600 /* sec */);
-    this_->server_->send_response_data(request, 
-                                       this_->page_buffer_.get(), 
-                                       u_page_size, 
-                                       HTTP_OK);
+    this_->server_->send_response(request, page, HTTP_OK);
 }
 
 /*================ Useful functions =====================*/
@@ -206,13 +840,48 @@ void PageHandler::not_found(struct evhttp_request* request, void* page_handler_p
  * "/<dictionary>/<num_words>/<index|length>/<index_name|length_from[/length_to]>", e.g.:
  *     "/owl2/10/index/q_words"
  *     "/owl2/20/length/2/4" 
+ * Several indexes can be combined with '+', and the words from
+ * indexes can be limited by length, e.g.:
+ *     "/owl2/10/index/x_words+re_words"
+ *     "/owl2/10/index/q_words/4/6"
+ * A seed may follow the number of words, so that the same URI always
+ * gives the same words, e.g.:
+ *     "/owl2/10/seed/12345/length/2/4"
  */
-std::string PageHandler::make_words_to_guess(const std::string& description_uri) {
+std::string PageHandler::make_words_to_guess(const std::string& description_uri,
+                                             const char* query_string,
+                                             bool* is_seeded,
+                                             size_t* dictionary_generation) {
     std::stringstream result;
     result << "[";
     
+    //Find out how hard the fake words should be.
+    FakeWordMode fake_word_mode = MIXED_FAKE_WORDS;
+    makewords::Difficulty difficulty = makewords::NORMAL_DIFFICULTY;
+    struct evkeyvalq query_args;
+    
+    if (query_string != NULL && evhttp_parse_query_str(query_string, &query_args) == 0) {
+        const char* mode_name = evhttp_find_header(&query_args, "mode");
+        
+        if (mode_name != NULL && strcmp(mode_name, "easy") == 0) {
+            fake_word_mode = EASY_FAKE_WORDS;
+        } else if (mode_name != NULL && strcmp(mode_name, "hard") == 0) {
+            fake_word_mode = HARD_FAKE_WORDS;
+        }
+        
+        const char* difficulty_name = evhttp_find_header(&query_args, "difficulty");
+        
+        if (difficulty_name != NULL && strcmp(difficulty_name, "easy") == 0) {
+            difficulty = makewords::EASY_DIFFICULTY;
+        } else if (difficulty_name != NULL && strcmp(difficulty_name, "tricky") == 0) {
+            difficulty = makewords::TRICKY_DIFFICULTY;
+        }
+        
+        evhttp_clear_headers(&query_args);
+    }
+    
     //Parse the description uri.
-    const size_t max_parts = 5;
+    const size_t max_parts = 8;
     std::vector<std::string> description;
     size_t end = 0;
     size_t part_number = 1;
@@ -236,11 +905,16 @@ std::string PageHandler::make_words_to_guess(const std::string& description_uri)
         part_number++;
     };
     
-    //Ignore the dictionary; it'll always be owl2.
-//    if (description[0] != "owl2") {
-//        return result;
-//    }
-    shared_ptr<WordPicker> word_picker(word_picker_);
+    //Find the dictionary; use the default one if it's not known.  Hold
+    //on to the current snapshot of the dictionaries until we're done,
+    //in case they get reloaded.
+    DictionarySetPtr dictionaries(dictionaries_->current());
+    shared_ptr<WordPicker> word_picker(
+        dictionaries->find_word_picker(description.empty() ? "" : description[0]));
+    
+    if (dictionary_generation != NULL) {
+        *dictionary_generation = dictionaries->generation();
+    }
     
     //Find the number of words to generate.
     const size_t max_num_words = 40;
@@ -260,6 +934,25 @@ std::string PageHandler::make_words_to_guess(const std::string& description_uri)
         }
     }
     
+    //Take out the seed, if there is one.
+    bool has_seed = false;
+    boost::uint64_t seed = 0;
+    
+    if (description.size() >= 4 && description[2] == "seed") {
+        try {
+            seed = lexical_cast<boost::uint64_t, std::string>(description[3]);
+            has_seed = true;
+        
+        } catch (bad_lexical_cast&) {
+        }
+        
+        description.erase(description.begin() + 2, description.begin() + 4);
+    }
+    
+    if (is_seeded != NULL) {
+        *is_seeded = has_seed;
+    }
+    
     // Proceed differently depending on the what needs to be generated.
     std::vector<WordDescriptionPtr> words;
     
@@ -302,31 +995,82 @@ std::string PageHandler::make_words_to_guess(const std::string& description_uri)
             }
         }
         
-        words = word_picker->get_words_by_length(from, to, num_words);
+        WordQuery query(from, to);
+        query.fake_word_mode = fake_word_mode;
+        query.fake_word_difficulty = difficulty;
+        query.has_seed = has_seed;
+        query.seed = seed;
+        words = word_picker->get_words(query, num_words);
         
     } else {
-        //Pick words from an index.
-        //Find the index to use.  Since we made it this far, we're 
+        //Pick words from one or more indexes.
+        //Find the indexes to use.  Since we made it this far, we're 
         //guaranteed to have the fourth element in description vector.
-        //Use the first index by default.
-        std::string index_name = description[3];
-        size_t index_num = 0;
-        
-        for (size_t i = 0; i < index_descriptions_.size(); i++) {
-            if (index_descriptions_[i]->name() == index_name) {
-                index_num = i;
-                break;
+        //Unknown index names are skipped; use the first index if none
+        //of the names are known.
+        WordQuery query(WordPicker::kMinWordLength, WordPicker::kMaxWordLength);
+        query.fake_word_mode = fake_word_mode;
+        query.fake_word_difficulty = difficulty;
+        query.has_seed = has_seed;
+        query.seed = seed;
+        const std::string& index_names = description[3];
+        size_t name_end = 0;
+        
+        while (name_end < index_names.length()) {
+            const size_t name_start = name_end;
+            name_end = index_names.find_first_of('+', name_start);
+            
+            if (name_end == std::string::npos) {
+                name_end = index_names.length();
+            }
+            
+            const std::string index_name = index_names.substr(name_start, name_end - name_start);
+            name_end++;
+            
+            for (size_t i = 0; i < index_descriptions_.size(); i++) {
+                if (index_descriptions_[i]->name() == index_name) {
+                    query.index_nums.push_back(i);
+                    break;
+                }
+            }
+        }
+        
+        if (query.index_nums.empty()) {
+            query.index_nums.push_back(0);
+        }
+        
+        //Get the optional length limits.
+        const size_t min_word_length = 2;
+        const size_t max_word_length = 15;
+        
+        if (description.size() >= 5) {
+            try {
+                query.from = lexical_cast<size_t, std::string>(description[4]);
+                query.from = std::max(std::min(query.from, max_word_length), min_word_length);
+                
+            } catch (bad_lexical_cast&) {
+                query.from = min_word_length;
+            }
+        }
+        
+        if (description.size() >= 6) {
+            try {
+                query.to = lexical_cast<size_t, std::string>(description[5]);
+                query.to = std::max(std::min(query.to, max_word_length), query.from);
+                
+            } catch (bad_lexical_cast&) {
+                query.to = std::max(max_word_length, query.from);
             }
         }
         
-        words = word_picker->get_words_from_index(index_num, num_words);
+        words = word_picker->get_words(query, num_words);
     }
     
     //Compose the JSON object.
     for (size_t i = 0; i < words.size(); i++) {
         result << "\n\t{";
         result << "\n\t\t\"word\": \"" << words[i]->word << "\",";
-        result << "\n\t\t\"description\": \"" << words[i]->description << "\",";
+        result << "\n\t\t\"description\": \"" << json_escape(words[i]->description) << "\",";
         result << "\n\t\t\"is_real\": " << (words[i]->is_real ? "true" : "false") << "";
         result << "\n\t}";
         
@@ -339,13 +1083,20 @@ std::string PageHandler::make_words_to_guess(const std::string& description_uri)
     return result.str();
 }
 
-/// Ensure that the page buffer can fit the page to be generated.
-void PageHandler::reserve_page_buffer(size_t bytes) {
-    if (page_buffer_size_ < 2 * bytes) {
-        page_buffer_size_ = 2 * bytes;
+/// Fill in the single "%s" of a page template.  Pages are built in
+/// their own buffer so that several server workers can build them
+/// at once.
+std::string PageHandler::fill_page_template(const std::string& page_template,
+                                            const char* value) {
+    const size_t buffer_size = page_template.length() + strlen(value) + 1;
+    std::vector<char> buffer(buffer_size);
+    const int page_size = snprintf(&buffer[0], buffer_size, page_template.c_str(), value);
+    
+    if (page_size < 0) {
+        return std::string();
     }
     
-    page_buffer_ = shared_array<char>(new char[page_buffer_size_]);
+    return std::string(&buffer[0], std::min(static_cast<size_t>(page_size), buffer_size - 1));
 }
 
 /// Build the template for the main page.
@@ -415,7 +1166,8 @@ std::string PageHandler::build_main_page_template() {
     return this->insert_into_main_layout("%s", main_content.get());
 }
 
-/// Insert page content into the main page layout.
+/// Insert page content into the main page layout.  The fingerprints
+/// of the static files it refers to are recorded for fingerprinted_pages().
 std::string PageHandler::insert_into_main_layout(const std::string& extra_scripts,
                                                  const std::string& content) {
     size_t layout_chars = 0;
@@ -441,9 +1193,51 @@ std::string PageHandler::insert_into_main_layout(const std::string& extra_script
             content.c_str()); 
     
     std::string page(sz_page.get());
+    
+    if (asset_pipeline_) {
+        asset_pipeline_->track_urls(page);
+    }
+    
     return page;
 }
 
+/// Refer to the static files in the pages by their current fingerprinted
+/// URLs, so that browsers can keep them for good.  The fingerprints 
+/// change with the files, so the pages are rewritten whenever the 
+/// generation of the fingerprints moves on; the workers that see it 
+/// first may each rewrite them, which is harmless.
+PageHandler::FingerprintedPagesPtr PageHandler::fingerprinted_pages() const {
+    FingerprintedPagesPtr pages = boost::atomic_load(&fingerprinted_pages_);
+    
+    //Get the generation first: the pages rewritten next are at least 
+    //as recent.
+    const size_t generation = asset_pipeline_ ? asset_pipeline_->generation() : 0;
+    
+    if (pages && pages->generation == generation) {
+        return pages;
+    }
+    
+    shared_ptr<FingerprintedPages> rewritten(new FingerprintedPages());
+    rewritten->generation = generation;
+    
+    if (asset_pipeline_) {
+        rewritten->main_page_template = asset_pipeline_->rewrite_urls(main_page_template_);
+        rewritten->about_page = asset_pipeline_->rewrite_urls(about_page_);
+        rewritten->fine_print_page = asset_pipeline_->rewrite_urls(fine_print_page_);
+        rewritten->not_found_template = asset_pipeline_->rewrite_urls(not_found_template_);
+    
+    } else {
+        rewritten->main_page_template = main_page_template_;
+        rewritten->about_page = about_page_;
+        rewritten->fine_print_page = fine_print_page_;
+        rewritten->not_found_template = not_found_template_;
+    }
+    
+    pages = rewritten;
+    boost::atomic_store(&fingerprinted_pages_, pages);
+    return pages;
+}
+
 /// Insert page content into the main page layout from a content file.
 std::string PageHandler::insert_into_main_layout(const std::string& content_file) {
     shared_array<char> content;
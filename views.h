@@ -31,15 +31,18 @@
 #include <boost/shared_array.hpp>
 #include <event2/event.h>
 #include <event2/http.h>
+#include "router.h"
 
 struct evhttp_request;
 
 namespace isaword {
 
 class HttpServer;
+class AssetPipeline;
 class FileCache;
-class WordPicker;
+class DictionaryReloader;
 class WordIndexDescription;
+class WorkerPool;
 
 class PageHandler {
 public:
@@ -48,14 +51,39 @@ public:
     
     /// Default maximum word length.
     static const size_t kDefaultMaxWordLength = 8;
+    
+    /// Number of words on a page of search results.
+    static const size_t kSearchPageSize = 100;
+    
+    /// Last page of search results that can be asked for, so that the
+    /// offset of its first word fits into a size_t.
+    static const size_t kMaxSearchPage = static_cast<size_t>(-1) / kSearchPageSize;
+    
+    /// Maximum number of words to check in one request.
+    static const size_t kMaxCheckWords = 1000;
+    
+    /// Maximum number of suggestions for a misspelled word.
+    static const size_t kMaxSuggestions = 10;
+    
+    /// Maximum number of words found by a regular expression search.
+    static const size_t kMaxGrepWords = 1000;
+    
+    /// How long a regular expression search may take.
+    static const long kGrepTimeBudgetMillisec = 100;
+    
+    /// Maximum number of threads working on a regular expression search.
+    static const size_t kMaxGrepThreads = 4;
+    
+    /// How long caches may keep a seeded list of words (in sec).  A
+    /// reload of the dictionaries reaches the caches within this time.
+    static const size_t kSeededWordsMaxAge = 3600;
 
     /**
      * Construct an instance of PageHandler.
      */
     PageHandler(const boost::shared_ptr<HttpServer>& server)
     : server_(server),
-      template_root_(""),
-      page_buffer_size_(kDefaultPageBufferSize){
+      template_root_("") {
     }
     
     /**
@@ -84,7 +112,49 @@ public:
     /**
      * Load the words to guess.
      */
-    static void words(struct evhttp_request* request, void* page_handler_ptr);
+    static void words(struct evhttp_request* request, 
+                      const PathParams& params, 
+                      void* page_handler_ptr);
+    
+    /**
+     * Find the words matching a crossword-style pattern.
+     */
+    static void search(struct evhttp_request* request, void* page_handler_ptr);
+    
+    /**
+     * Find the words that can be made from a rack of letters.
+     */
+    static void anagrams(struct evhttp_request* request, 
+                         const PathParams& params, 
+                         void* page_handler_ptr);
+    
+    /**
+     * Check whether a batch of words are real.
+     */
+    static void check_words(struct evhttp_request* request, void* page_handler_ptr);
+    
+    /**
+     * Suggest real words close to a possibly misspelled word.
+     */
+    static void suggest(struct evhttp_request* request, 
+                        const PathParams& params, 
+                        void* page_handler_ptr);
+    
+    /**
+     * Find the words matching a regular expression.
+     */
+    static void grep(struct evhttp_request* request, void* page_handler_ptr);
+    
+    /**
+     * Reload the dictionaries without stopping the server.  Only
+     * accepted as a POST with the administrator token.
+     */
+    static void reload_dictionaries(struct evhttp_request* request, void* page_handler_ptr);
+    
+    /**
+     * Reload the dictionaries on SIGHUP.
+     */
+    static void reload_signal(evutil_socket_t signal_number, short events, void* page_handler_ptr);
     
     /**
      * 404 Not Found page.
@@ -96,21 +166,59 @@ public:
      * Get the JSON object associated with the words to guess.
      * Returns an string containing a JSON object, some of which
      * would be real (in that case they'd have a definition as well),
-     * and some of which would be fake.
+     * and some of which would be fake.  The query string may ask for
+     * "mode=easy" or "mode=hard" fake words, and for "difficulty=easy"
+     * or "difficulty=tricky" ones.  If is_seeded is not NULL, it tells
+     * whether the words were picked from a seed given in the path.  If
+     * dictionary_generation is not NULL, it gets the generation of the
+     * dictionaries the words were picked from.
      */
-    std::string make_words_to_guess(const std::string& template_path);
+    std::string make_words_to_guess(const std::string& template_path,
+                                    const char* query_string = NULL,
+                                    bool* is_seeded = NULL,
+                                    size_t* dictionary_generation = NULL);
     
     /*================ Getters/setters =====================*/
     /// Get the HttpServer instance associated with this
-    /// object.
+    /// object.
     boost::shared_ptr<HttpServer> server() const    {return server_;}
     
+    /// Set the pipeline rewriting the URLs of the static files in the
+    /// pages to their fingerprinted URLs.  Should be called before 
+    /// initialize(), as the pages are built there.
+    void set_asset_pipeline(const boost::shared_ptr<AssetPipeline>& asset_pipeline) {
+        asset_pipeline_ = asset_pipeline;
+    }
+    
 private:
-    /// Default size of the page buffer.
-    static const size_t kDefaultPageBufferSize = 51200; //50 kB
+    /// A regular expression search waiting for its results.
+    class PendingGrep;
     
-    /// Ensure that the page buffer can fit the page to be generated.
-    void reserve_page_buffer(size_t bytes);
+    /// The pages pointing to the fingerprinted URLs of one generation
+    /// of the static files (see AssetPipeline::generation()).
+    class FingerprintedPages {
+    public:
+        size_t generation;
+        std::string main_page_template;
+        std::string about_page;
+        std::string fine_print_page;
+        std::string not_found_template;
+    };
+    
+    typedef boost::shared_ptr<const FingerprintedPages> FingerprintedPagesPtr;
+    
+    /// Run a regular expression search on a search thread.
+    static void run_grep(PendingGrep* pending_grep);
+    
+    /// Send the results of a regular expression search.  Runs on the
+    /// event loop of the request.
+    static void finish_grep_callback(evutil_socket_t, short, void* pending_grep_ptr);
+    
+    /// Fill in the single "%s" of a page template.  Pages are built in
+    /// their own buffer so that several server workers can build them
+    /// at once.
+    static std::string fill_page_template(const std::string& page_template,
+                                          const char* value);
     
     /// Build the template for the main page.
     std::string build_main_page_template();
@@ -120,13 +228,18 @@ private:
         return template_root_ + path;
     }
     
-    /// Insert page content into the main page layout.
+    /// Insert page content into the main page layout, recording the
+    /// fingerprints of the static files it refers to.
     std::string insert_into_main_layout(const std::string& extra_scripts,
                                         const std::string& content);
     
     /// Insert page content into the main page layout from a content file.
     std::string insert_into_main_layout(const std::string& content_file);
     
+    /// Get the pages pointing to the current fingerprinted URLs of the
+    /// static files.  The pages are only rewritten once the URLs change.
+    FingerprintedPagesPtr fingerprinted_pages() const;
+    
     /// The main server responsible for the requests and responses.
     boost::shared_ptr<HttpServer> server_;
     
@@ -135,18 +248,22 @@ private:
     
     /// Template cache.
     boost::shared_ptr<FileCache> template_cache_;
-
-    /// A place to temporarily generate web pages.
-    boost::shared_array<char> page_buffer_;
     
+    /// Rewrites the URLs of the static files; none if not set.
+    boost::shared_ptr<AssetPipeline> asset_pipeline_;
+
     /// A piece of memory to use while generating web pages.
     boost::shared_array<char> template_buffer_;
     
-    /// Size of the page buffer.
-    size_t page_buffer_size_;
+    /// The dictionaries to pick lists of words to guess from.
+    boost::shared_ptr<DictionaryReloader> dictionaries_;
+    
+    /// Threads helping with regular expression searches.
+    boost::shared_ptr<WorkerPool> grep_pool_;
     
-    /// An object to pick lists of words to guess.
-    boost::shared_ptr<WordPicker> word_picker_;
+    /// Threads running regular expression searches, one search each
+    /// at a time.
+    boost::shared_ptr<WorkerPool> grep_request_pool_;
     
     /// A list of indexes for words.
     std::vector<boost::shared_ptr<WordIndexDescription> > index_descriptions_;
@@ -160,8 +277,12 @@ private:
     /// Cached Fine Print page.
     std::string fine_print_page_;
 
-    /// Cached Fine Print page.
+    /// Cached Not Found page template.
     std::string not_found_template_;
+    
+    /// The cached pages pointing to the fingerprinted URLs.  Only 
+    /// accessed with the atomic shared_ptr operations.
+    mutable FingerprintedPagesPtr fingerprinted_pages_;
 };
 
 } /* namespace isaword */
@@ -0,0 +1,507 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Compressed sets of word ids.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "word_bitmap.h"
+
+using boost::uint16_t;
+using boost::uint64_t;
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    WordBitmap class.
+----------------------------------------------------------*/
+const size_t WordBitmap::kContainerBits;
+const size_t WordBitmap::kMaxArrayCardinality;
+const size_t WordBitmap::kBitmapWords;
+
+/// Check whether the lower 16 bits of an id are in the container.
+bool WordBitmap::Container::contains(uint16_t low) const {
+    if (this->is_bitmap()) {
+        return (bits[low >> 6] >> (low & 63)) & 1;
+    }
+
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+/// Add an id to the set.
+void WordBitmap::add(WordId id) {
+    const uint16_t key = static_cast<uint16_t>(id >> kContainerBits);
+    const uint16_t low = static_cast<uint16_t>(id & 0xFFFF);
+
+    //Find the container, creating it if necessary.  Ids usually come
+    //in increasing order, so check the last container first.
+    std::vector<Container>::iterator container;
+
+    if (!containers_.empty() && containers_.back().key == key) {
+        container = containers_.end() - 1;
+
+    } else {
+        container = containers_.begin();
+        while (container != containers_.end() && container->key < key) {
+            ++container;
+        }
+
+        if (container == containers_.end() || container->key != key) {
+            container = containers_.insert(container, Container(key));
+        }
+    }
+
+    //Add the id to the container.
+    if (container->is_bitmap()) {
+        uint64_t& word = container->bits[low >> 6];
+        const uint64_t mask = static_cast<uint64_t>(1) << (low & 63);
+
+        if (word & mask) {
+            return;
+        }
+
+        word |= mask;
+
+    } else {
+        std::vector<uint16_t>& array = container->array;
+
+        if (array.empty() || array.back() < low) {
+            array.push_back(low);
+
+        } else {
+            std::vector<uint16_t>::iterator position =
+                std::lower_bound(array.begin(), array.end(), low);
+
+            if (*position == low) {
+                return;
+            }
+
+            array.insert(position, low);
+        }
+
+        if (array.size() > kMaxArrayCardinality) {
+            convert_to_bitmap(*container);
+        }
+    }
+
+    container->cardinality++;
+    cardinality_++;
+}
+
+/// Check whether the id is in the set.
+bool WordBitmap::contains(WordId id) const {
+    const Container* container = this->find_container(static_cast<uint16_t>(id >> kContainerBits));
+    return container != NULL && container->contains(static_cast<uint16_t>(id & 0xFFFF));
+}
+
+/**
+ * Find the id of a given rank, i.e. the (rank + 1)-th smallest id.
+ */
+bool WordBitmap::select(size_t rank, WordId& id) const {
+    for (size_t i = 0; i < containers_.size(); ++i) {
+        const Container& container = containers_[i];
+
+        if (rank >= container.cardinality) {
+            rank -= container.cardinality;
+            continue;
+        }
+
+        const WordId high = static_cast<WordId>(container.key) << kContainerBits;
+
+        if (!container.is_bitmap()) {
+            id = high | container.array[rank];
+            return true;
+        }
+
+        //Skip whole words of the bitmap, then find the bit.
+        for (size_t w = 0; w < kBitmapWords; ++w) {
+            uint64_t word = container.bits[w];
+            const size_t word_count = static_cast<size_t>(__builtin_popcountll(word));
+
+            if (rank >= word_count) {
+                rank -= word_count;
+                continue;
+            }
+
+            for (; rank > 0; --rank) {
+                word &= word - 1;
+            }
+
+            id = high | static_cast<WordId>(w * 64 + __builtin_ctzll(word));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Compute the intersection of this set with another one.
+WordBitmap WordBitmap::intersect(const WordBitmap& other) const {
+    std::vector<const WordBitmap*> bitmaps;
+    bitmaps.push_back(this);
+    bitmaps.push_back(&other);
+    WordBitmapIntersection intersection(bitmaps, 0, 0xFFFFFFFF);
+
+    WordIdList ids;
+    intersection.to_ids(ids);
+
+    WordBitmap result;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        result.add(ids[i]);
+    }
+
+    return result;
+}
+
+/// Get the number of bytes used by the set's containers.
+size_t WordBitmap::memory_bytes() const {
+    size_t bytes = containers_.capacity() * sizeof(Container);
+
+    for (size_t i = 0; i < containers_.size(); ++i) {
+        bytes += containers_[i].array.capacity() * sizeof(uint16_t);
+        bytes += containers_[i].bits.capacity() * sizeof(uint64_t);
+    }
+
+    return bytes;
+}
+
+/// Find the container for a chunk key; NULL if there is none.
+const WordBitmap::Container* WordBitmap::find_container(uint16_t key) const {
+    for (size_t i = 0; i < containers_.size(); ++i) {
+        if (containers_[i].key == key) {
+            return &containers_[i];
+
+        } else if (containers_[i].key > key) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/// Convert a sparse container into a bitmap container.
+void WordBitmap::convert_to_bitmap(Container& container) {
+    container.bits.resize(kBitmapWords, 0);
+
+    for (size_t i = 0; i < container.array.size(); ++i) {
+        const uint16_t low = container.array[i];
+        container.bits[low >> 6] |= static_cast<uint64_t>(1) << (low & 63);
+    }
+
+    std::vector<uint16_t> empty_array;
+    container.array.swap(empty_array);
+}
+
+/*---------------------------------------------------------
+                WordBitmapIntersection class.
+----------------------------------------------------------*/
+/// Create an intersection of the given bitmaps, limited to ids
+/// in [range_begin, range_end).
+WordBitmapIntersection::WordBitmapIntersection(
+        const std::vector<const WordBitmap*>& bitmaps,
+        WordId range_begin,
+        WordId range_end)
+: range_begin_(range_begin),
+  range_end_(range_end),
+  cardinality_(0) {
+    if (bitmaps.empty() || range_begin >= range_end) {
+        return;
+    }
+
+    //Only the chunks present in every bitmap can have shared ids.
+    const std::vector<WordBitmap::Container>& first = bitmaps[0]->containers();
+    const WordId first_key = range_begin >> WordBitmap::kContainerBits;
+    const WordId last_key = (range_end - 1) >> WordBitmap::kContainerBits;
+
+    for (size_t i = 0; i < first.size(); ++i) {
+        if (first[i].key < first_key || first[i].key > last_key) {
+            continue;
+        }
+
+        Chunk chunk;
+        chunk.key = first[i].key;
+        chunk.containers.push_back(&first[i]);
+
+        for (size_t b = 1; b < bitmaps.size(); ++b) {
+            const std::vector<WordBitmap::Container>& containers = bitmaps[b]->containers();
+            const WordBitmap::Container* match = NULL;
+
+            for (size_t c = 0; c < containers.size(); ++c) {
+                if (containers[c].key == chunk.key) {
+                    match = &containers[c];
+                    break;
+                }
+            }
+
+            if (match == NULL) {
+                break;
+            }
+
+            chunk.containers.push_back(match);
+        }
+
+        if (chunk.containers.size() != bitmaps.size()) {
+            continue;
+        }
+
+        //Count the shared ids without storing them.
+        chunk.cardinality = this->walk_chunk(chunk, static_cast<size_t>(-1), NULL, NULL);
+
+        if (chunk.cardinality > 0) {
+            cardinality_ += chunk.cardinality;
+            chunks_.push_back(chunk);
+        }
+    }
+}
+
+/**
+ * Find the id of a given rank in the intersection.
+ */
+bool WordBitmapIntersection::select(size_t rank, WordId& id) const {
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        if (rank < chunks_[i].cardinality) {
+            this->walk_chunk(chunks_[i], rank, &id, NULL);
+            return true;
+        }
+
+        rank -= chunks_[i].cardinality;
+    }
+
+    return false;
+}
+
+/// Write all ids in the intersection, in increasing order, to ids.
+void WordBitmapIntersection::to_ids(WordIdList& ids) const {
+    ids.reserve(ids.size() + cardinality_);
+
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        this->walk_chunk(chunks_[i], static_cast<size_t>(-1), NULL, &ids);
+    }
+}
+
+/// Write a page of the ids in the intersection, in increasing order, to ids.
+void WordBitmapIntersection::to_ids(size_t first_rank, size_t max_ids, WordIdList& ids) const {
+    WordIdList chunk_ids;
+
+    for (size_t i = 0; i < chunks_.size() && max_ids > 0; ++i) {
+        //Skip the chunks before the page.
+        if (first_rank >= chunks_[i].cardinality) {
+            first_rank -= chunks_[i].cardinality;
+            continue;
+        }
+
+        chunk_ids.clear();
+        this->walk_chunk(chunks_[i], static_cast<size_t>(-1), NULL, &chunk_ids);
+
+        const size_t num_ids = std::min(chunk_ids.size() - first_rank, max_ids);
+        ids.insert(ids.end(), chunk_ids.begin() + first_rank, chunk_ids.begin() + first_rank + num_ids);
+        max_ids -= num_ids;
+        first_rank = 0;
+    }
+}
+
+/**
+ * Walk the ids of a chunk in increasing order.
+ */
+size_t WordBitmapIntersection::walk_chunk(const Chunk& chunk,
+                                          size_t rank,
+                                          WordId* id,
+                                          WordIdList* ids) const {
+    const WordId high = static_cast<WordId>(chunk.key) << WordBitmap::kContainerBits;
+    const std::vector<const WordBitmap::Container*>& containers = chunk.containers;
+    size_t num_visited = 0;
+
+    //Find the sparsest array container, if there is one.  Its elements
+    //are the only candidates, and the other containers are probed.
+    const WordBitmap::Container* sparsest = NULL;
+
+    for (size_t c = 0; c < containers.size(); ++c) {
+        if (!containers[c]->is_bitmap() &&
+            (sparsest == NULL || containers[c]->cardinality < sparsest->cardinality)) {
+            sparsest = containers[c];
+        }
+    }
+
+    if (sparsest != NULL) {
+        for (size_t i = 0; i < sparsest->array.size(); ++i) {
+            const uint16_t low = sparsest->array[i];
+            const WordId candidate = high | low;
+            bool is_shared = this->is_in_range(candidate);
+
+            for (size_t c = 0; is_shared && c < containers.size(); ++c) {
+                is_shared = (containers[c] == sparsest) || containers[c]->contains(low);
+            }
+
+            if (!is_shared) {
+                continue;
+            }
+
+            if (num_visited == rank) {
+                *id = candidate;
+                return num_visited + 1;
+            }
+
+            if (ids != NULL) {
+                ids->push_back(candidate);
+            }
+
+            num_visited++;
+        }
+
+        return num_visited;
+    }
+
+    //All containers are bitmaps: AND them one 64-bit word at a time.
+    for (size_t w = 0; w < WordBitmap::kBitmapWords; ++w) {
+        uint64_t word = containers[0]->bits[w];
+
+        for (size_t c = 1; word != 0 && c < containers.size(); ++c) {
+            word &= containers[c]->bits[w];
+        }
+
+        //Mask out the ids outside of the range.
+        const WordId word_begin = high | static_cast<WordId>(w * 64);
+
+        if (word_begin < range_begin_) {
+            const WordId skip = range_begin_ - word_begin;
+            word = (skip >= 64) ? 0 : (word & (~static_cast<uint64_t>(0) << skip));
+        }
+
+        if (word_begin + 64 > range_end_) {
+            const WordId keep = (range_end_ > word_begin) ? range_end_ - word_begin : 0;
+            word &= (static_cast<uint64_t>(1) << keep) - 1;
+        }
+
+        if (word == 0) {
+            continue;
+        }
+
+        const size_t word_count = static_cast<size_t>(__builtin_popcountll(word));
+
+        if (ids == NULL && rank - num_visited >= word_count) {
+            //The requested rank is not in this word; skip it whole.
+            num_visited += word_count;
+            continue;
+        }
+
+        while (word != 0) {
+            const WordId candidate = word_begin | static_cast<WordId>(__builtin_ctzll(word));
+            word &= word - 1;
+
+            if (num_visited == rank) {
+                *id = candidate;
+                return num_visited + 1;
+            }
+
+            if (ids != NULL) {
+                ids->push_back(candidate);
+            }
+
+            num_visited++;
+        }
+    }
+
+    return num_visited;
+}
+
+/*---------------------------------------------------------
+                    WordIdListCache class.
+----------------------------------------------------------*/
+const size_t WordIdListCache::kDefaultHotThreshold;
+const size_t WordIdListCache::kDefaultMaxIds;
+const size_t WordIdListCache::kMaxTrackedQueries;
+
+/**
+ * Look up the id list for a query, and count the query as seen.
+ */
+WordIdListPtr WordIdListCache::get(const std::string& key) {
+    clock_++;
+    EntryMap::iterator it = entries_.find(key);
+
+    if (it == entries_.end()) {
+        if (entries_.size() >= kMaxTrackedQueries) {
+            this->evict_one(false);
+        }
+
+        Entry& entry = entries_[key];
+        entry.num_requests = 1;
+        entry.last_used = clock_;
+        return WordIdListPtr();
+    }
+
+    it->second.num_requests++;
+    it->second.last_used = clock_;
+    return it->second.ids;
+}
+
+/// Check whether a query has been seen often enough to be cached.
+bool WordIdListCache::is_hot(const std::string& key) const {
+    EntryMap::const_iterator it = entries_.find(key);
+    return it != entries_.end() && it->second.num_requests >= hot_threshold_;
+}
+
+/// Store the id list for a query, evicting older lists if needed.
+void WordIdListCache::put(const std::string& key, const WordIdListPtr& ids) {
+    if (!ids || ids->size() > max_ids_) {
+        return;
+    }
+
+    Entry& entry = entries_[key];
+
+    if (entry.ids) {
+        num_cached_ids_ -= entry.ids->size();
+    }
+
+    entry.ids = ids;
+    entry.last_used = ++clock_;
+    num_cached_ids_ += ids->size();
+
+    while (num_cached_ids_ > max_ids_) {
+        this->evict_one(true);
+    }
+}
+
+/// Evict the least recently used entry (cached or not).
+void WordIdListCache::evict_one(bool only_cached) {
+    EntryMap::iterator oldest = entries_.end();
+
+    for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        if (only_cached && !it->second.ids) {
+            continue;
+        }
+
+        if (oldest == entries_.end() || it->second.last_used < oldest->second.last_used) {
+            oldest = it;
+        }
+    }
+
+    if (oldest == entries_.end()) {
+        return;
+    }
+
+    if (oldest->second.ids) {
+        num_cached_ids_ -= oldest->second.ids->size();
+    }
+
+    entries_.erase(oldest);
+}
+
+} /* namespace isaword */
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Compressed sets of word ids, used to combine word indexes
+// (e.g. "X words" that are also "RE- words") without copying
+// the words around.
+
+#ifndef ISAWORD_WORD_BITMAP_H
+#define ISAWORD_WORD_BITMAP_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <google/dense_hash_map>
+
+namespace isaword {
+
+typedef boost::uint32_t WordId;
+typedef std::vector<WordId> WordIdList;
+typedef boost::shared_ptr<const WordIdList> WordIdListPtr;
+
+/*---------------------------------------------------------
+                    WordBitmap class.
+----------------------------------------------------------*/
+/**
+ * A compressed set of word ids, organized the same way as a roaring
+ * bitmap: the ids are split into chunks of 65536 by their upper 16 bits,
+ * and each chunk is stored either as a sorted array of the lower 16 bits
+ * (when sparse) or as a plain 65536-bit bitmap (when dense).
+ */
+class WordBitmap {
+public:
+    /// Number of bits in the lower part of the id kept in a container.
+    static const size_t kContainerBits = 16;
+
+    /// Containers with more elements than this are stored as bitmaps.
+    static const size_t kMaxArrayCardinality = 4096;
+
+    /// Number of 64-bit words in a bitmap container.
+    static const size_t kBitmapWords = 1024;
+
+    /**
+     * One chunk of the set: ids sharing the same upper 16 bits.
+     * Exactly one of array and bits is in use.
+     */
+    class Container {
+    public:
+        Container(boost::uint16_t chunk_key)
+        : key(chunk_key), cardinality(0) {
+        }
+
+        /// Check whether the lower 16 bits of an id are in the container.
+        bool contains(boost::uint16_t low) const;
+
+        /// Check whether the container is stored as a bitmap.
+        bool is_bitmap() const          {return !bits.empty();}
+
+        /// Upper 16 bits of all ids in this container.
+        boost::uint16_t key;
+
+        /// Number of ids in the container.
+        size_t cardinality;
+
+        /// Sorted lower 16 bits of the ids, for sparse containers.
+        std::vector<boost::uint16_t> array;
+
+        /// Bitmap of the lower 16 bits of the ids, for dense containers.
+        std::vector<boost::uint64_t> bits;
+    };
+
+    WordBitmap()
+    : cardinality_(0) {
+    }
+
+    /// Add an id to the set.  Adding ids in increasing order is the
+    /// cheapest way to build the set.
+    void add(WordId id);
+
+    /// Check whether the id is in the set.
+    bool contains(WordId id) const;
+
+    /**
+     * Find the id of a given rank, i.e. the (rank + 1)-th smallest id.
+     * @return true if rank is less than the cardinality of the set,
+     * false otherwise.
+     */
+    bool select(size_t rank, WordId& id) const;
+
+    /// Compute the intersection of this set with another one.
+    WordBitmap intersect(const WordBitmap& other) const;
+
+    /// Get the number of bytes used by the set's containers.
+    size_t memory_bytes() const;
+
+    /*=============== Getters/Setters ====================*/
+    /// Get the number of ids in the set.
+    size_t cardinality() const                          {return cardinality_;}
+
+    /// Get the containers, ordered by key.
+    const std::vector<Container>& containers() const    {return containers_;}
+
+private:
+    /// Find the container for a chunk key; NULL if there is none.
+    const Container* find_container(boost::uint16_t key) const;
+
+    /// Convert a sparse container into a bitmap container.
+    static void convert_to_bitmap(Container& container);
+
+    /// The containers, ordered by key.
+    std::vector<Container> containers_;
+
+    /// The number of ids in the set.
+    size_t cardinality_;
+};
+
+/*---------------------------------------------------------
+                WordBitmapIntersection class.
+----------------------------------------------------------*/
+/**
+ * The intersection of several WordBitmaps and, optionally, a range of
+ * ids.  The intersection is never stored; its size is counted chunk by
+ * chunk when the intersection is built, and select() walks only the
+ * chunk that contains the requested rank.  The bitmaps must outlive
+ * the intersection.
+ */
+class WordBitmapIntersection {
+public:
+    /// Create an intersection of the given bitmaps, limited to ids
+    /// in [range_begin, range_end).
+    WordBitmapIntersection(const std::vector<const WordBitmap*>& bitmaps,
+                           WordId range_begin,
+                           WordId range_end);
+
+    /**
+     * Find the id of a given rank in the intersection.
+     * @return true if rank is less than the cardinality, false otherwise.
+     */
+    bool select(size_t rank, WordId& id) const;
+
+    /// Write all ids in the intersection, in increasing order, to ids.
+    void to_ids(WordIdList& ids) const;
+
+    /// Write at most max_ids ids in the intersection, starting from
+    /// the id of rank first_rank, in increasing order, to ids.
+    void to_ids(size_t first_rank, size_t max_ids, WordIdList& ids) const;
+
+    /// Get the number of ids in the intersection.
+    size_t cardinality() const          {return cardinality_;}
+
+private:
+    /// One chunk of the intersection: the matching containers of
+    /// all bitmaps, and how many ids they share.
+    class Chunk {
+    public:
+        boost::uint16_t key;
+        size_t cardinality;
+        std::vector<const WordBitmap::Container*> containers;
+    };
+
+    /**
+     * Walk the ids of a chunk in increasing order.  Stops after the
+     * id of the given rank within the chunk, which is returned in id,
+     * or after the whole chunk if rank is past its end; any other ids
+     * seen along the way are appended to ids, if it's not NULL.
+     *
+     * @return the number of ids visited.
+     */
+    size_t walk_chunk(const Chunk& chunk,
+                      size_t rank,
+                      WordId* id,
+                      WordIdList* ids) const;
+
+    /// Check whether the id falls into the range of the intersection.
+    bool is_in_range(WordId id) const {
+        return id >= range_begin_ && id < range_end_;
+    }
+
+    /// Chunks with at least one shared id.
+    std::vector<Chunk> chunks_;
+
+    /// The range of ids to consider.
+    WordId range_begin_;
+    WordId range_end_;
+
+    /// Total number of ids in the intersection.
+    size_t cardinality_;
+};
+
+/*---------------------------------------------------------
+                    WordIdListCache class.
+----------------------------------------------------------*/
+/**
+ * A small cache of materialized id lists for popular queries, e.g.
+ * intersections of word indexes.  A query only gets materialized after
+ * it's been seen a few times; the cache is limited by the total number
+ * of ids it holds, and evicts the least recently used lists first.
+ */
+class WordIdListCache {
+public:
+    /// Number of times a query must be seen before it's worth caching.
+    static const size_t kDefaultHotThreshold = 3;
+
+    /// Default limit on the total number of cached ids.
+    static const size_t kDefaultMaxIds = 1 << 20;
+
+    /// Limit on the number of queries tracked.
+    static const size_t kMaxTrackedQueries = 1024;
+
+    WordIdListCache(size_t max_ids = kDefaultMaxIds,
+                    size_t hot_threshold = kDefaultHotThreshold)
+    : max_ids_(max_ids),
+      hot_threshold_(hot_threshold),
+      num_cached_ids_(0),
+      clock_(0) {
+        entries_.set_empty_key("");
+        entries_.set_deleted_key("\x01");
+    }
+
+    /**
+     * Look up the id list for a query, and count the query as seen.
+     * @return the cached list, or an empty pointer if the query hasn't
+     * been materialized yet.  Use is_hot() to find out whether it
+     * should be.
+     */
+    WordIdListPtr get(const std::string& key);
+
+    /// Check whether a query has been seen often enough to be cached.
+    bool is_hot(const std::string& key) const;
+
+    /// Store the id list for a query, evicting older lists if needed.
+    void put(const std::string& key, const WordIdListPtr& ids);
+
+    /*=============== Getters/Setters ====================*/
+    /// Get the total number of ids in the cached lists.
+    size_t num_cached_ids() const       {return num_cached_ids_;}
+
+    /// Get the number of queries being tracked.
+    size_t num_tracked_queries() const  {return entries_.size();}
+
+private:
+    class Entry {
+    public:
+        Entry() : num_requests(0), last_used(0) {}
+
+        WordIdListPtr ids;
+        size_t num_requests;
+        size_t last_used;
+    };
+
+    /**
+     * A functor used to compare the strings in the hash map.
+     */
+    struct eqstr {
+        bool operator()(const std::string& first, const std::string& second) const {
+            return (first == second);
+        }
+    };
+
+    typedef google::dense_hash_map<std::string,
+                                   Entry,
+                                   boost::hash<std::string>,
+                                   eqstr>
+            EntryMap;
+
+    /// Evict the least recently used entry (cached or not).
+    void evict_one(bool only_cached);
+
+    EntryMap entries_;
+    size_t max_ids_;
+    size_t hot_threshold_;
+    size_t num_cached_ids_;
+    size_t clock_;
+};
+
+} /* namespace isaword */
+#endif
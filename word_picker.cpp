@@ -18,28 +18,112 @@
 
 // This is the header for the module responsible for picking
 // lists of fake and real words to be guessed.
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sstream>
 #include <vector>
 #include <utility>
+#include <stdexcept>
 
-#include <boost/random.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_01.hpp>
-#include <boost/random/variate_generator.hpp>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
 
+#include "generator/counter_random.h"
 #include "generator/pseudoword_generator.h"
+#include "word_bitmap.h"
 #include "word_picker.h"
+#include "word_store.h"
+#include "worker_pool.h"
 
 using boost::shared_ptr;
 
 namespace isaword {
 
+/*---------------------------------------------------------
+                WordCandidates implementations.
+----------------------------------------------------------*/
+/**
+ * Candidates stored one after another in an array.
+ */
+class WordArrayCandidates : public WordCandidates {
+public:
+    WordArrayCandidates(const WordDescriptionPtr* words, size_t num_words)
+    : words_(words), num_words_(num_words) {
+    }
+    
+    size_t size() const                             {return num_words_;}
+    WordDescriptionPtr at(size_t rank) const        {return words_[rank];}
+    
+private:
+    const WordDescriptionPtr* words_;
+    size_t num_words_;
+};
+
+/**
+ * Candidates listed by their positions in the list of all words.
+ */
+class WordIdListCandidates : public WordCandidates {
+public:
+    WordIdListCandidates(const std::vector<WordDescriptionPtr>& all_words, 
+                         const WordIdList& ids)
+    : all_words_(all_words), ids_(ids) {
+    }
+    
+    size_t size() const                             {return ids_.size();}
+    WordDescriptionPtr at(size_t rank) const        {return all_words_[ids_[rank]];}
+    
+private:
+    const std::vector<WordDescriptionPtr>& all_words_;
+    const WordIdList& ids_;
+};
+
+/**
+ * Candidates given by an intersection of bitmaps of positions in the
+ * list of all words.
+ */
+class WordIntersectionCandidates : public WordCandidates {
+public:
+    WordIntersectionCandidates(const std::vector<WordDescriptionPtr>& all_words, 
+                               const WordBitmapIntersection& intersection)
+    : all_words_(all_words), intersection_(intersection) {
+    }
+    
+    size_t size() const {
+        return intersection_.cardinality();
+    }
+    
+    WordDescriptionPtr at(size_t rank) const {
+        WordId id = 0;
+        intersection_.select(rank, id);
+        return all_words_[id];
+    }
+    
+private:
+    const std::vector<WordDescriptionPtr>& all_words_;
+    const WordBitmapIntersection& intersection_;
+};
+
 /*---------------------------------------------------------
                     WordPicker class.
 ----------------------------------------------------------*/
+const size_t WordPicker::kMaxWordsPerPick;
+const size_t WordPicker::kMaxFakeWordAttempts;
+const size_t WordPicker::kMaxCombinedFakeWordAttempts;
+const size_t WordPicker::kMaxFakeWordModeAttempts;
+const size_t WordPicker::kGrepChunkSize;
+
+/**
+ * Compare words by length only, so that a stable sort keeps
+ * words of the same length in dictionary order.
+ */
+static bool is_shorter_word(const WordDescriptionPtr& first, const WordDescriptionPtr& second) {
+    return first->word.length() < second->word.length();
+}
+
 /**
  * Ininitalize the word picker by providing it a path
  * to a dictionary to work with.
@@ -47,53 +131,64 @@ namespace isaword {
  * @return true if the initialization was successfull, 
  * false otherwise.
  */
-bool WordPicker::initialize(const std::string& dictionary_path) {
+bool WordPicker::initialize(const std::string& dictionary_path, 
+                            const std::string& dictionary_name) {
     //std::cout << max_index_pseudoword_length_ << std::endl;
     indexes_.resize(index_descriptions_.size());
+    index_bitmaps_.resize(index_descriptions_.size());
     
-    // Load the dictionary line by line, adding the words to the
-    // pseudorandom word generator, the in-memory dictionary,
-    // and all the indexes.
-    // 
-    // We assume that the dictionary contains words in order of
-    // increasing length.
     std::ifstream dictionary_file(dictionary_path.c_str());
-    if (dictionary_file.bad()) {
-        dictionary_file.close();
+    if (!dictionary_file.is_open()) {
         return false;
     }
     
-    const size_t buffer_size = 500;
-    char buffer[buffer_size];
+    // Load the dictionary line by line into the word store.  Words 
+    // already loaded for another dictionary are shared with it.
+    dictionary_num_ = word_store_->add_dictionary(
+        dictionary_name.empty() ? dictionary_path : dictionary_name);
+    
     std::string line;
     std::string word;
     std::string description;
     words_by_length_.reserve(200000);
     
-    size_t current_length = 2;
-    size_t current_word_index = 0;
-    word_length_ends_.push_back(0);
-    word_length_ends_.push_back(0);
-    
-    while(!dictionary_file.eof()) {
+    while (std::getline(dictionary_file, line)) {
         // Read the word data.
-        dictionary_file.getline(buffer, buffer_size);
-        line = &(buffer[0]);
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line.erase(line.length() - 1);
+        }
+        
         const size_t first_space = line.find_first_of(' ');
         word = line.substr(0, first_space);
-        description = line.substr(first_space + 1);
+        description = (first_space == std::string::npos) ? "" : line.substr(first_space + 1);
         
-        // Put the word into the main index.
-        WordDescriptionPtr word_description(new WordDescription);
-        word_description->word = word;
-        word_description->description = description;
-        word_description->is_real = true;
+        if (word.empty()) {
+            continue;
+        }
         
-        words_by_length_.push_back(word_description);
+        words_by_length_.push_back(word_store_->add_word(dictionary_num_, word, description));
+    }
+    
+    dictionary_file.close();
+    
+    // Not all dictionaries come sorted by length.
+    std::stable_sort(words_by_length_.begin(), words_by_length_.end(), is_shorter_word);
+    
+    // Add the words to the pseudorandom word generator and all 
+    // the indexes, and find where the words of each length end.
+    size_t current_length = 2;
+    word_length_ends_.push_back(0);
+    word_length_ends_.push_back(0);
+    
+    for (size_t current_word_index = 0; 
+         current_word_index < words_by_length_.size(); 
+         current_word_index++) {
+        const WordDescriptionPtr& word_description = words_by_length_[current_word_index];
+        const std::string& word = word_description->word;
         
         // Check whether this block of words by length
         // is over.
-        if (word.length() > current_length) {
+        while (word.length() > current_length) {
             word_length_ends_.push_back(current_word_index);
             current_length++;
         }
@@ -102,15 +197,29 @@ bool WordPicker::initialize(const std::string& dictionary_path) {
         for (size_t i = 0; i < index_descriptions_.size(); ++i) {
             if (index_descriptions_[i]->should_be_indexed(word)) {
                 indexes_[i].push_back(word_description);
+                index_bitmaps_[i].add(static_cast<WordId>(current_word_index));
             }
         }
         
+        pattern_index_.add(static_cast<WordId>(current_word_index), word);
+        anagram_index_.add(word);
+        word_hash_.add(word);
+        suggestion_index_.add(word);
+        letter_masks_.add(word);
+        
         // Add the word to the pseudoword generator.
         pseudoword_generator_->add_dictionary_word(word);
-        current_word_index++;
     }
     
-    word_length_ends_.push_back(current_word_index);
+    word_length_ends_.push_back(words_by_length_.size());
+    anagram_index_.finish(word_length_ends_);
+    
+    if (!word_hash_.finish()) {
+        return false;
+    }
+    
+    suggestion_index_.finish();
+    
     pseudoword_generator_->prepare_for_generation();
     
     // Initialize the regex patterns for max and min word lengths.
@@ -130,19 +239,345 @@ bool WordPicker::initialize(const std::string& dictionary_path) {
     return true;
 }
 
+/**
+ * Find the words matching a crossword-style pattern.
+ */
+size_t WordPicker::find_words(const std::string& pattern,
+                              size_t first_word,
+                              size_t max_words,
+                              std::vector<WordDescriptionPtr>& words) const {
+    const size_t length = pattern.length();
+    
+    if (!pattern_index_.is_valid_pattern(pattern) || length >= word_length_ends_.size()) {
+        return 0;
+    }
+    
+    // Only look among the words of the pattern's length.
+    WordIdList ids;
+    const size_t num_matches = pattern_index_.find(pattern, 
+                                                   static_cast<WordId>(word_length_ends_[length - 1]),
+                                                   static_cast<WordId>(word_length_ends_[length]),
+                                                   first_word,
+                                                   max_words,
+                                                   ids);
+    words.reserve(words.size() + ids.size());
+    
+    for (size_t i = 0; i < ids.size(); i++) {
+        words.push_back(words_by_length_[ids[i]]);
+    }
+    
+    return num_matches;
+}
+
+/**
+ * Compare words by length only, so that a stable sort puts longer 
+ * words first and keeps words of the same length in dictionary order.
+ */
+static bool is_longer_word(const WordDescriptionPtr& first, const WordDescriptionPtr& second) {
+    return first->word.length() > second->word.length();
+}
+
+/**
+ * Find the words that can be made from a rack of letters.
+ */
+bool WordPicker::find_anagrams(const std::string& rack,
+                               std::vector<WordDescriptionPtr>& anagrams,
+                               std::vector<WordDescriptionPtr>& subwords) const {
+    if (rack.length() > max_word_length_) {
+        return false;
+    }
+    
+    WordIdList anagram_ids;
+    WordIdList subword_ids;
+    
+    if (rack.empty() ||
+        !anagram_index_.find_anagrams(rack, anagram_ids) ||
+        !anagram_index_.find_subwords(rack, rack.length() - 1, subword_ids)) {
+        return false;
+    }
+    
+    for (size_t i = 0; i < anagram_ids.size(); i++) {
+        anagrams.push_back(words_by_length_[anagram_ids[i]]);
+    }
+    
+    for (size_t i = 0; i < subword_ids.size(); i++) {
+        subwords.push_back(words_by_length_[subword_ids[i]]);
+    }
+    
+    std::stable_sort(subwords.begin(), subwords.end(), is_longer_word);
+    return true;
+}
+
+/**
+ * Check whether a word is one edit away from a real word.  Only the
+ * words of nearby lengths sharing a string with it after deleting a
+ * letter from each can be, so only those are checked.
+ */
+bool WordPicker::is_near_real_word(const std::string& word) const {
+    //Only words one letter shorter or longer can be one edit away, and
+    //since the words are sorted by length, those form a range of ids.
+    const size_t longest_word_length = word_length_ends_.size() - 1;
+    const size_t from = std::max(word.length(), static_cast<size_t>(2)) - 1;
+    const size_t to = std::min(word.length() + 1, longest_word_length);
+    
+    if (from > to) {
+        return false;
+    }
+    
+    WordIdList candidate_ids;
+    suggestion_index_.find_candidates(word, 
+                                      1, 
+                                      static_cast<WordId>(word_length_ends_[from - 1]),
+                                      static_cast<WordId>(word_length_ends_[to]),
+                                      candidate_ids);
+    
+    //One edit changes at most two of the letters a word has, which
+    //rules out most candidates without touching their text.
+    const boost::uint32_t letters = LetterMaskIndex::summarize(word) & LetterMaskIndex::kLetterBits;
+    
+    for (size_t i = 0; i < candidate_ids.size(); i++) {
+        const boost::uint32_t different_letters = 
+            (letter_masks_.summary(candidate_ids[i]) ^ letters) & LetterMaskIndex::kLetterBits;
+        
+        if (__builtin_popcount(different_letters) > 2) {
+            continue;
+        }
+        
+        const std::string& candidate = words_by_length_[candidate_ids[i]]->word;
+        
+        if (SuggestionIndex::is_one_edit_apart(word, candidate)) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+/**
+ * Look up many words at once.
+ */
+void WordPicker::check_words(const std::vector<std::string>& words,
+                             std::vector<WordDescriptionPtr>& descriptions) const {
+    WordIdList ids;
+    word_hash_.find(words, ids);
+    descriptions.assign(words.size(), WordDescriptionPtr());
+    
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (ids[i] != PerfectHashIndex::kNotFound) {
+            descriptions[i] = words_by_length_[ids[i]];
+        }
+    }
+}
+
+/**
+ * A real word close to a misspelling, for ranking the suggestions.
+ */
+class Suggestion {
+public:
+    Suggestion(size_t edit_distance, size_t word_length_difference, WordId word_id)
+    : distance(edit_distance), length_difference(word_length_difference), id(word_id) {
+    }
+    
+    /// Closer words come first, then words of a closer length, then 
+    /// words in dictionary order.
+    bool operator<(const Suggestion& other) const {
+        if (distance != other.distance) {
+            return distance < other.distance;
+        }
+        
+        if (length_difference != other.length_difference) {
+            return length_difference < other.length_difference;
+        }
+        
+        return id < other.id;
+    }
+    
+    size_t distance;
+    size_t length_difference;
+    WordId id;
+};
+
+/**
+ * Find the real words closest to a possibly misspelled word.
+ */
+void WordPicker::suggest_words(const std::string& word,
+                               size_t max_suggestions,
+                               std::vector<WordDescriptionPtr>& suggestions,
+                               std::vector<size_t>& distances) const {
+    const size_t max_distance = suggestion_index_.max_distance();
+    
+    if (word.empty() || word.length() > max_word_length_ + max_distance) {
+        return;
+    }
+    
+    WordIdList candidate_ids;
+    suggestion_index_.find_candidates(word, candidate_ids);
+    
+    std::vector<Suggestion> ranked;
+    
+    for (size_t i = 0; i < candidate_ids.size(); i++) {
+        const std::string& candidate = words_by_length_[candidate_ids[i]]->word;
+        const size_t distance = SuggestionIndex::edit_distance(word, candidate, max_distance);
+        
+        if (distance <= max_distance) {
+            const size_t length_difference = (word.length() > candidate.length()) ?
+                                             word.length() - candidate.length() :
+                                             candidate.length() - word.length();
+            ranked.push_back(Suggestion(distance, length_difference, candidate_ids[i]));
+        }
+    }
+    
+    const size_t num_suggestions = std::min(max_suggestions, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + num_suggestions, ranked.end());
+    
+    for (size_t i = 0; i < num_suggestions; i++) {
+        suggestions.push_back(words_by_length_[ranked[i].id]);
+        distances.push_back(ranked[i].distance);
+    }
+}
+
+/**
+ * A slice of the candidates for a regular expression, scanned
+ * as one task.
+ */
+class GrepChunk {
+public:
+    const boost::regex* pattern;
+    const std::vector<WordDescriptionPtr>* words;
+    const WordId* ids_begin;
+    const WordId* ids_end;
+    size_t max_matches;
+    boost::system_time deadline;
+    
+    /// The ids of the matching words.
+    WordIdList matches;
+    
+    /// Whether all the candidates were checked.
+    bool is_complete;
+};
+
+/**
+ * Scan a slice of the candidates for a regular expression, until
+ * the candidates, the time or the room for the matches run out.
+ */
+static void scan_grep_chunk(GrepChunk* chunk) {
+    const size_t kDeadlineCheckInterval = 256;
+    chunk->is_complete = false;
+    
+    for (const WordId* id = chunk->ids_begin; id != chunk->ids_end; ++id) {
+        if ((id - chunk->ids_begin) % kDeadlineCheckInterval == 0 && 
+            boost::get_system_time() >= chunk->deadline) {
+            return;
+        }
+        
+        try {
+            if (boost::regex_search((*chunk->words)[*id]->word, *chunk->pattern)) {
+                chunk->matches.push_back(*id);
+                
+                if (chunk->matches.size() >= chunk->max_matches) {
+                    return;
+                }
+            }
+        
+        } catch (std::runtime_error&) {
+            //The expression is too expensive to match.
+            return;
+        }
+    }
+    
+    chunk->is_complete = true;
+}
+
+/**
+ * Find the words matching a regular expression.
+ */
+bool WordPicker::grep_words(const std::string& pattern,
+                            size_t max_words,
+                            long time_budget_millisec,
+                            WorkerPool& pool,
+                            std::vector<WordDescriptionPtr>& words,
+                            bool& is_complete) const {
+    const boost::system_time deadline = 
+        boost::get_system_time() + boost::posix_time::milliseconds(time_budget_millisec);
+    is_complete = false;
+    boost::regex compiled_pattern;
+    
+    try {
+        compiled_pattern.assign(pattern, boost::regex::perl | boost::regex::icase);
+    } catch (boost::regex_error&) {
+        return false;
+    }
+    
+    // Rule out the words that lack the required letters before 
+    // running the expression.
+    WordIdList candidate_ids;
+    letter_masks_.find_candidates(LetterMaskIndex::find_requirements(pattern), candidate_ids);
+    
+    // Split the candidates into chunks for the worker pool.
+    const size_t num_chunks = (candidate_ids.size() + kGrepChunkSize - 1) / kGrepChunkSize;
+    std::vector<GrepChunk> chunks(num_chunks);
+    std::vector<WorkerPool::Task> tasks;
+    
+    for (size_t i = 0; i < num_chunks; i++) {
+        GrepChunk& chunk = chunks[i];
+        chunk.pattern = &compiled_pattern;
+        chunk.words = &words_by_length_;
+        chunk.ids_begin = &candidate_ids[0] + i * kGrepChunkSize;
+        chunk.ids_end = &candidate_ids[0] + std::min((i + 1) * kGrepChunkSize, candidate_ids.size());
+        chunk.max_matches = max_words;
+        chunk.deadline = deadline;
+        chunk.is_complete = false;
+        tasks.push_back(boost::bind(&scan_grep_chunk, &chunk));
+    }
+    
+    pool.run(tasks);
+    
+    // Collect the matches in dictionary order.
+    is_complete = true;
+    
+    for (size_t i = 0; i < num_chunks; i++) {
+        const WordIdList& matches = chunks[i].matches;
+        
+        for (size_t j = 0; j < matches.size() && words.size() < max_words; j++) {
+            words.push_back(words_by_length_[matches[j]]);
+        }
+        
+        if (!chunks[i].is_complete || 
+            (words.size() == max_words && i + 1 < num_chunks)) {
+            is_complete = false;
+        }
+    }
+    
+    return true;
+}
+
 /**
  * Pick a number of words by length.
  */
 std::vector<WordDescriptionPtr> WordPicker::get_words_by_length(size_t from, 
                                                                 size_t to, 
-                                                                size_t num_words) {
+                                                                size_t num_words,
+                                                                FakeWordMode fake_word_mode,
+                                                                makewords::Difficulty difficulty) {
+    makewords::CounterRandom random(this->next_random_key());
+    return this->get_words_by_length(from, to, num_words, fake_word_mode, difficulty, random);
+}
+
+/**
+ * Pick a number of words by length, drawing from the given stream of
+ * random numbers.
+ */
+std::vector<WordDescriptionPtr> WordPicker::get_words_by_length(size_t from, 
+                                                                size_t to, 
+                                                                size_t num_words,
+                                                                FakeWordMode fake_word_mode,
+                                                                makewords::Difficulty difficulty,
+                                                                makewords::CounterRandom& random) {
     std::vector<WordDescriptionPtr> words;
     if (from > to || num_words == 0) {
         return words;
     }
     
-    words.reserve(num_words);
-    
     // Find the range of real words to pick from.
     const size_t first_possible_word = word_length_ends_[from - 1];
     const size_t end_of_possible_words = word_length_ends_[to];
@@ -153,69 +588,376 @@ std::vector<WordDescriptionPtr> WordPicker::get_words_by_length(size_t from,
         (to - min_word_length_) * (to - min_word_length_ + 1) / 2 + (from - min_word_length_);
     boost::regex& length_pattern = word_length_patterns_[length_pattern_index];
     
-    //Compose a list of words.
-    for (size_t i = 0; i < num_words; i++) {
-        //Decide whether this word will be real or fake.
-        //TODO: remove duplicates.
-        if (0.5 > random_01_()) {
-            // Real word.
-            const double d_word_offset = static_cast<double>(num_possible_words) *random_01_();
-            const size_t word_index = static_cast<size_t>(d_word_offset) + first_possible_word;
-            words.push_back(words_by_length_[word_index]);
-            
-        } else {
-            // Fake word.
-            WordDescriptionPtr fake_word(new WordDescription());
-            fake_word->word = pseudoword_generator_->make_word(length_pattern);
-            fake_word->description = "";
-            fake_word->is_real = false;
-            words.push_back(fake_word);
-        }
-    }
+    WordArrayCandidates candidates(
+        num_possible_words > 0 ? &words_by_length_[first_possible_word] : NULL,
+        num_possible_words);
+    FakeWordCriteria fake_word_criteria(&length_pattern, 0, fake_word_mode, difficulty);
     
+    this->pick_words(candidates, fake_word_criteria, num_words, random, words);
     return words;
 }
 
 /**
  * Pick a number of words satisfying a certain criteria.
  */
-std::vector<WordDescriptionPtr> WordPicker::get_words_from_index(size_t index_num, size_t num_words) {
+std::vector<WordDescriptionPtr> WordPicker::get_words_from_index(size_t index_num, 
+                                                                 size_t num_words,
+                                                                 FakeWordMode fake_word_mode,
+                                                                 makewords::Difficulty difficulty) {
+    makewords::CounterRandom random(this->next_random_key());
+    return this->get_words_from_index(index_num, num_words, fake_word_mode, difficulty, random);
+}
+
+/**
+ * Pick a number of words satisfying a certain criteria, drawing from
+ * the given stream of random numbers.
+ */
+std::vector<WordDescriptionPtr> WordPicker::get_words_from_index(size_t index_num, 
+                                                                 size_t num_words,
+                                                                 FakeWordMode fake_word_mode,
+                                                                 makewords::Difficulty difficulty,
+                                                                 makewords::CounterRandom& random) {
     std::vector<WordDescriptionPtr> words;
     if (index_num >= index_descriptions_.size() || num_words == 0) {
         return words;
     }
     
-    words.reserve(num_words);
-    
     // Find the index to select the words from.
     shared_ptr<WordIndexDescription> index_description = index_descriptions_[index_num];
     std::vector<WordDescriptionPtr>& index = indexes_[index_num];
-    const double index_size = static_cast<double>(index.size());
+    WordArrayCandidates candidates(index.empty() ? NULL : &index[0], index.size());
+    FakeWordCriteria fake_word_criteria(&index_description->pattern(), 
+                                        max_index_pseudoword_length_,
+                                        fake_word_mode,
+                                        difficulty);
     
-    //std::cout << max_index_pseudoword_length_ << std::endl;
+    this->pick_words(candidates, fake_word_criteria, num_words, random, words);
+    return words;
+}
+
+/**
+ * Pick a number of words that are in all indexes listed in the query
+ * and have the length given by the query.
+ */
+std::vector<WordDescriptionPtr> WordPicker::get_words(const WordQuery& query, size_t num_words) {
+    std::vector<WordDescriptionPtr> words;
+    const size_t longest_word_length = word_length_ends_.size() - 1;
+    const size_t from = std::max(query.from, min_word_length_);
+    const size_t to = std::min(std::min(query.to, max_word_length_), longest_word_length);
+    
+    if (from > to || num_words == 0) {
+        return words;
+    }
+    
+    // Use each valid index once, in a fixed order.
+    std::vector<size_t> index_nums;
+    for (size_t i = 0; i < query.index_nums.size(); i++) {
+        if (query.index_nums[i] < index_descriptions_.size()) {
+            index_nums.push_back(query.index_nums[i]);
+        }
+    }
+    
+    std::sort(index_nums.begin(), index_nums.end());
+    index_nums.erase(std::unique(index_nums.begin(), index_nums.end()), index_nums.end());
+    
+    // A seeded list is keyed on the seed and on everything that makes
+    // up the query, after it's been cleaned up above.  Only the lists
+    // without a seed draw on the shared keys.
+    boost::uint64_t random_key;
+    
+    if (!query.has_seed) {
+        random_key = this->next_random_key();
+    
+    } else {
+        using makewords::CounterRandom;
+        random_key = CounterRandom::combine(CounterRandom::mix(query.seed), num_words);
+        random_key = CounterRandom::combine(random_key, from);
+        random_key = CounterRandom::combine(random_key, to);
+        random_key = CounterRandom::combine(random_key, query.fake_word_mode);
+        random_key = CounterRandom::combine(random_key, query.fake_word_difficulty);
+        
+        for (size_t i = 0; i < index_nums.size(); i++) {
+            random_key = CounterRandom::combine(random_key, index_nums[i]);
+        }
+    }
+    
+    makewords::CounterRandom random(random_key);
+    
+    // Simple queries have their own ways to pick the words.
+    if (index_nums.empty()) {
+        return this->get_words_by_length(from, to, num_words, 
+                                         query.fake_word_mode, query.fake_word_difficulty, random);
+    
+    } else if (index_nums.size() == 1 && from == min_word_length_ && to == longest_word_length) {
+        return this->get_words_from_index(index_nums[0], num_words, 
+                                          query.fake_word_mode, query.fake_word_difficulty, random);
+    }
+    
+    // Fake words are generated from the first index's pattern, and
+    // checked against the rest of the criteria.  Let the generator make
+    // words at least as long as it does for a single index, so that it
+    // always has some non-dictionary words to choose from.
+    const size_t length_pattern_index = 
+        (to - min_word_length_) * (to - min_word_length_ + 1) / 2 + (from - min_word_length_);
+    FakeWordCriteria fake_word_criteria(&index_descriptions_[index_nums[0]]->pattern(), 
+                                        std::max(from, max_index_pseudoword_length_),
+                                        query.fake_word_mode,
+                                        query.fake_word_difficulty);
+    fake_word_criteria.extra_patterns.push_back(&word_length_patterns_[length_pattern_index]);
+    
+    for (size_t i = 1; i < index_nums.size(); i++) {
+        fake_word_criteria.extra_patterns.push_back(&index_descriptions_[index_nums[i]]->pattern());
+    }
+    
+    // Use the cached list of real words if this is a popular query.
+    std::stringstream query_key;
+    for (size_t i = 0; i < index_nums.size(); i++) {
+        query_key << index_nums[i] << '+';
+    }
+    query_key << from << '-' << to;
+    
+    WordIdListPtr cached_ids;
+    {
+        boost::mutex::scoped_lock lock(query_cache_mutex_);
+        cached_ids = query_cache_.get(query_key.str());
+    }
+    
+    if (cached_ids) {
+        WordIdListCandidates candidates(words_by_length_, *cached_ids);
+        this->pick_words(candidates, fake_word_criteria, num_words, random, words);
+        return words;
+    }
+    
+    // Otherwise, sample straight from the intersection of the indexes.
+    // Words are sorted by length, so the lengths are a range of ids.
+    std::vector<const WordBitmap*> bitmaps;
+    for (size_t i = 0; i < index_nums.size(); i++) {
+        bitmaps.push_back(&index_bitmaps_[index_nums[i]]);
+    }
+    
+    WordBitmapIntersection intersection(bitmaps, 
+                                        static_cast<WordId>(word_length_ends_[from - 1]),
+                                        static_cast<WordId>(word_length_ends_[to]));
+    
+    bool is_hot_query = false;
+    {
+        boost::mutex::scoped_lock lock(query_cache_mutex_);
+        is_hot_query = query_cache_.is_hot(query_key.str());
+    }
+    
+    if (is_hot_query) {
+        boost::shared_ptr<WordIdList> ids(new WordIdList());
+        intersection.to_ids(*ids);
+        boost::mutex::scoped_lock lock(query_cache_mutex_);
+        query_cache_.put(query_key.str(), ids);
+    }
+    
+    WordIntersectionCandidates candidates(words_by_length_, intersection);
+    this->pick_words(candidates, fake_word_criteria, num_words, random, words);
+    return words;
+}
+
+/**
+ * Compose a list of real and fake words.  Real words are drawn
+ * without replacement from the candidates array; fake words are
+ * generated to match fake_word_pattern and are unique within the list.
+ * Each fake word gets a stream of random numbers of its own, so that
+ * however many tries one of them takes, the others stay the same.
+ */
+void WordPicker::pick_words(const WordCandidates& candidates,
+                            const FakeWordCriteria& fake_word_criteria,
+                            size_t num_words,
+                            makewords::CounterRandom& random,
+                            std::vector<WordDescriptionPtr>& words) {
+    num_words = std::min(num_words, kMaxWordsPerPick);
+    words.reserve(num_words);
+    const size_t num_candidates = candidates.size();
+    
+    //Decide which words will be real and which will be fake.  If there
+    //are not enough candidates to go around, the rest will be fake.
+    bool is_real[kMaxWordsPerPick];
+    size_t num_real_words = 0;
+    
+    for (size_t i = 0; i < num_words; i++) {
+        is_real[i] = (0.5 > random()) && (num_real_words < num_candidates);
+        
+        if (is_real[i]) {
+            num_real_words++;
+        }
+    }
+    
+    //Pick the real words without replacement.  Pick a few spare ones
+    //to stand in for fake words that can't be generated.
+    const size_t num_picks = std::min(num_words, num_candidates);
+    size_t picks[kMaxWordsPerPick];
+    this->sample_without_replacement(num_candidates, num_picks, random, picks);
     
     //Compose a list of words.
+    SmallKeySet fake_word_hashes;
+    boost::hash<std::string> hash_string;
+    size_t next_pick = 0;
+    bool can_make_fake_words = true;
+    
     for (size_t i = 0; i < num_words; i++) {
-        //Decide whether this word will be real or fake.
-        //TODO: remove duplicates.
-        if (0.5 > random_01_()) {
-            // Real word.
-            const size_t word_position = static_cast<size_t>(random_01_() * index_size);
-            words.push_back(index[word_position]);
-            
-        } else {
-            // Fake word.
+        if (!is_real[i] && can_make_fake_words) {
+            // Fake word.  Regenerate it if it has already been used in
+            // this list, but don't insist for too long on small models.
             WordDescriptionPtr fake_word(new WordDescription());
-            fake_word->word = 
-                pseudoword_generator_->make_word(index_description->pattern(), 
-                                                 max_index_pseudoword_length_);
-            fake_word->description = "";
-            fake_word->is_real = false;
-            words.push_back(fake_word);
+            makewords::CounterRandom fake_word_random(random.fork(i));
+            
+            for (size_t attempt = 0; attempt < kMaxFakeWordAttempts; attempt++) {
+                can_make_fake_words = 
+                    this->make_fake_word(fake_word_criteria, fake_word_random, fake_word->word);
+                
+                if (!can_make_fake_words || fake_word_hashes.insert(hash_string(fake_word->word))) {
+                    break;
+                }
+            }
+            
+            if (can_make_fake_words) {
+                fake_word->description = "";
+                fake_word->is_real = false;
+                words.push_back(fake_word);
+                continue;
+            }
+        }
+        
+        // Real word.
+        if (next_pick < num_picks) {
+            words.push_back(candidates.at(picks[next_pick]));
+            next_pick++;
         }
     }
+}
+
+/// Get the key for a list of words picked without a seed.  Safe to
+/// call from several threads at once.
+boost::uint64_t WordPicker::next_random_key() {
+    boost::mutex::scoped_lock lock(random_keys_mutex_);
+    return random_keys_.next();
+}
+
+/**
+ * Generate a fake word satisfying the criteria.  The patterns must be
+ * matched; the fake word mode is only a preference, and the last word
+ * that matched the patterns is used if no word suits the mode.
+ */
+bool WordPicker::make_fake_word(const FakeWordCriteria& criteria, 
+                                makewords::CounterRandom& random,
+                                std::string& word) {
+    size_t max_attempts = 
+        criteria.extra_patterns.empty() ? 1 : kMaxCombinedFakeWordAttempts;
     
-    return words;
+    if (criteria.mode != MIXED_FAKE_WORDS) {
+        max_attempts = std::max(max_attempts, kMaxFakeWordModeAttempts);
+    }
+    
+    std::string matching_word;
+    size_t num_mode_checks = 0;
+    
+    for (size_t attempt = 0; attempt < max_attempts; attempt++) {
+        word = pseudoword_generator_->make_word(random, 
+                                                *criteria.pattern, 
+                                                criteria.max_length, 
+                                                criteria.difficulty);
+        bool is_good_word = true;
+        
+        for (size_t i = 0; is_good_word && i < criteria.extra_patterns.size(); i++) {
+            is_good_word = boost::regex_match(word, *criteria.extra_patterns[i]);
+        }
+        
+        if (is_good_word && criteria.mode != MIXED_FAKE_WORDS) {
+            matching_word = word;
+            is_good_word = (this->is_near_real_word(word) == (criteria.mode == HARD_FAKE_WORDS));
+            num_mode_checks++;
+            
+            if (!is_good_word && num_mode_checks >= kMaxFakeWordModeAttempts) {
+                break;
+            }
+        }
+        
+        if (is_good_word) {
+            return true;
+        }
+    }
+    
+    if (!matching_word.empty()) {
+        word = matching_word;
+        return true;
+    }
+    
+    return false;
+}
+
+/**
+ * Pick num_picks distinct offsets from [0, range_size) using Floyd's
+ * algorithm, and write them to picks in random order.
+ */
+void WordPicker::sample_without_replacement(size_t range_size,
+                                            size_t num_picks,
+                                            makewords::CounterRandom& random,
+                                            size_t* picks) {
+    //Floyd's algorithm makes exactly one draw per pick, and never
+    //looks at the range itself.
+    SmallKeySet picked;
+    
+    for (size_t i = 0; i < num_picks; i++) {
+        const size_t j = range_size - num_picks + i;
+        size_t pick = static_cast<size_t>(random() * static_cast<double>(j + 1));
+        
+        if (!picked.insert(pick)) {
+            pick = j;
+            picked.insert(pick);
+        }
+        
+        picks[i] = pick;
+    }
+    
+    //Floyd's algorithm favours placing the larger offsets last; shuffle
+    //the picks so that the order of the words is random as well.
+    for (size_t i = num_picks; i > 1; i--) {
+        const size_t j = static_cast<size_t>(random() * static_cast<double>(i));
+        std::swap(picks[i - 1], picks[j]);
+    }
+}
+
+/*---------------------------------------------------------
+                    SmallKeySet class.
+----------------------------------------------------------*/
+const size_t SmallKeySet::kCapacity;
+
+/**
+ * Insert a key into the set.
+ *
+ * @return true if the key was inserted, false if it was already
+ * in the set or the set is full.
+ */
+bool SmallKeySet::insert(size_t key) {
+    //Zero marks empty slots, so shift the keys by one.  A key that
+    //wraps around to zero collides with key 0, which only costs
+    //a spurious duplicate.
+    key++;
+    
+    if (key == 0) {
+        key = 1;
+    }
+    
+    //Mix the bits so that consecutive offsets don't cluster.
+    size_t slot = (key * 2654435761u) & (kCapacity - 1);
+    
+    for (size_t probe = 0; probe < kCapacity; probe++) {
+        if (keys_[slot] == key) {
+            return false;
+        
+        } else if (keys_[slot] == 0) {
+            keys_[slot] = key;
+            return true;
+        }
+        
+        slot = (slot + 1) & (kCapacity - 1);
+    }
+    
+    return false;
 }
 
 } /* namespace isaword */
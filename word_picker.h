@@ -22,38 +22,138 @@
 #ifndef ISAWORD_WORD_PICKER_H
 #define ISAWORD_WORD_PICKER_H
 
+#include <cstring>
 #include <ctime>
 #include <string>
 #include <vector>
 #include <utility>
 
-#include <boost/random.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_01.hpp>
-#include <boost/random/variate_generator.hpp>
 #include <boost/regex.hpp>
+#include <boost/thread/mutex.hpp>
 
+#include "generator/counter_random.h"
 #include "generator/pseudoword_generator.h"
+#include "anagram_index.h"
+#include "pattern_index.h"
+#include "perfect_hash_index.h"
+#include "letter_mask_index.h"
+#include "suggestion_index.h"
+#include "word_bitmap.h"
+#include "word_store.h"
 
 namespace isaword {
 
 //typedef std::pair<std::string, std::string> WordDefinition;
 
+class WordIndexDescription;
+class WorkerPool;
+
+/// How close the fake words in a list may be to real words.
+enum FakeWordMode {
+    /// Any fake words.
+    MIXED_FAKE_WORDS = 0,
+    
+    /// No fake words one edit away from a real word, where possible.
+    EASY_FAKE_WORDS = 1,
+    
+    /// Only fake words one edit away from a real word, where possible.
+    HARD_FAKE_WORDS = 2,
+};
+
 /*---------------------------------------------------------
-                    WordDescription class.
+                    WordQuery class.
 ----------------------------------------------------------*/
 /**
- * A simple structure containing description of a word.
+ * A description of a combination of words to pick: words that are
+ * in all of the listed indexes and have a length in [from, to].
  */
-class WordDescription {
+class WordQuery {
 public:
-    std::string word;
-    std::string description;
-    bool is_real;
+    WordQuery(size_t from_length, size_t to_length)
+    : from(from_length),
+      to(to_length),
+      fake_word_mode(MIXED_FAKE_WORDS),
+      fake_word_difficulty(makewords::NORMAL_DIFFICULTY),
+      has_seed(false),
+      seed(0) {
+    }
+    
+    /// Numbers of the indexes all words must be in.
+    std::vector<size_t> index_nums;
+    
+    /// Minimum word length.
+    size_t from;
+    
+    /// Maximum word length.
+    size_t to;
+    
+    /// How close the fake words may be to real words.
+    FakeWordMode fake_word_mode;
+    
+    /// How word-like the fake words should be.
+    makewords::Difficulty fake_word_difficulty;
+    
+    /// Whether the words should be picked deterministically from the seed.
+    bool has_seed;
+    
+    /// The seed; the same seed and query always give the same words.
+    boost::uint64_t seed;
 };
 
-typedef boost::shared_ptr<WordDescription> WordDescriptionPtr ;
-class WordIndexDescription;
+/*---------------------------------------------------------
+                    WordCandidates class.
+----------------------------------------------------------*/
+/**
+ * A list of real words to pick from, accessed by rank.  This allows
+ * picking words from an array as well as from a bitmap without
+ * copying the words.
+ */
+class WordCandidates {
+public:
+    virtual ~WordCandidates() {}
+    
+    /// Get the number of words in the list.
+    virtual size_t size() const = 0;
+    
+    /// Get the word of a given rank; rank must be less than size().
+    virtual WordDescriptionPtr at(size_t rank) const = 0;
+};
+
+/*---------------------------------------------------------
+                    FakeWordCriteria class.
+----------------------------------------------------------*/
+/**
+ * What the fake words in a list should look like.  The pseudoword
+ * generator produces words that match the main pattern; the other
+ * criteria are checked afterwards.
+ */
+class FakeWordCriteria {
+public:
+    FakeWordCriteria(const boost::regex* main_pattern, 
+                     size_t max_word_length,
+                     FakeWordMode fake_word_mode = MIXED_FAKE_WORDS,
+                     makewords::Difficulty fake_word_difficulty = makewords::NORMAL_DIFFICULTY)
+    : pattern(main_pattern),
+      max_length(max_word_length),
+      mode(fake_word_mode),
+      difficulty(fake_word_difficulty) {
+    }
+    
+    /// Pattern passed to the pseudoword generator.
+    const boost::regex* pattern;
+    
+    /// Other patterns the fake words must match.
+    std::vector<const boost::regex*> extra_patterns;
+    
+    /// Maximum length of the generated words; 0 if there is no maximum.
+    size_t max_length;
+    
+    /// How close the fake words may be to real words.
+    FakeWordMode mode;
+    
+    /// How word-like the fake words should be.
+    makewords::Difficulty difficulty;
+};
 
 /*---------------------------------------------------------
                     WordPicker class.
@@ -73,37 +173,157 @@ public:
     static const size_t kMaxWordLength = 15;
     static const size_t kMaxIndexPseudowordLength = 8;
 
-    WordPicker(const std::vector<boost::shared_ptr<WordIndexDescription> >& index_descriptions)
+    /// Maximum number of words that can be picked in one list.
+    static const size_t kMaxWordsPerPick = 64;
+
+    /// Number of times to regenerate a fake word that duplicates another
+    /// fake word in the same list before accepting the duplicate.
+    static const size_t kMaxFakeWordAttempts = 10;
+
+    /// Number of pseudowords to try when looking for a fake word that
+    /// satisfies several criteria at once.
+    static const size_t kMaxCombinedFakeWordAttempts = 2000;
+
+    /// Number of pseudowords to try when looking for a fake word that
+    /// is close enough to, or far enough from, the real words.  If none
+    /// is, the last one is used anyway.
+    static const size_t kMaxFakeWordModeAttempts = 20;
+
+    /// Number of candidates for a regular expression scanned as one
+    /// task of the worker pool.
+    static const size_t kGrepChunkSize = 8192;
+
+    /**
+     * Create a word picker.  Word pickers for different dictionaries
+     * should share a WordStore, so that the words the dictionaries have
+     * in common are only stored once.  If no store is given, the word
+     * picker creates its own.
+     */
+    WordPicker(const std::vector<boost::shared_ptr<WordIndexDescription> >& index_descriptions,
+               const boost::shared_ptr<WordStore>& word_store = boost::shared_ptr<WordStore>())
     : index_descriptions_(index_descriptions),
+      pattern_index_(kMaxWordLength),
       pseudoword_generator_(new makewords::PseudowordGenerator("ABCDEFGHIJKLMNOPQRSTUVWXYZ")),
-      random_numbers_generator_(time(0)),
-      uniform_01_(),
-      random_01_(random_numbers_generator_, uniform_01_),
+      random_keys_(makewords::CounterRandom::mix(static_cast<boost::uint64_t>(time(0)))),
       max_word_length_(kMaxWordLength),
       min_word_length_(kMinWordLength),
-      max_index_pseudoword_length_(kMaxIndexPseudowordLength) {
+      max_index_pseudoword_length_(kMaxIndexPseudowordLength),
+      word_store_(word_store ? word_store : boost::shared_ptr<WordStore>(new WordStore())),
+      dictionary_num_(WordStore::kNoDictionary) {
     }
     
     /**
      * Ininitalize the word picker by providing it a path
-     * to a dictionary to work with.
+     * to a dictionary to work with.  The dictionary is added to the
+     * word store under the given name (or under its path, if the name
+     * is empty).  The words in the dictionary may come in any order.
      *
      * @return true if the initialization was successfull, 
      * false otherwise.
      */
-    bool initialize(const std::string& dictionary_path);
+    bool initialize(const std::string& dictionary_path, 
+                    const std::string& dictionary_name = "");
     
     /**
-     * Pick a number of words by length.
+     * Pick a number of words by length.  Neither real nor fake words
+     * are repeated within the list; at most kMaxWordsPerPick words are
+     * returned.
+     */
+    std::vector<WordDescriptionPtr> get_words_by_length(size_t from,
+                                                        size_t to,
+                                                        size_t num_words,
+                                                        FakeWordMode fake_word_mode = MIXED_FAKE_WORDS,
+                                                        makewords::Difficulty difficulty = makewords::NORMAL_DIFFICULTY);
+
+    /**
+     * Pick a number of words satisfying a certain criteria.  Neither real
+     * nor fake words are repeated within the list; at most kMaxWordsPerPick
+     * words are returned.
      */
-    std::vector<WordDescriptionPtr> get_words_by_length(size_t from, 
-                                                        size_t to, 
-                                                        size_t num_words);
+    std::vector<WordDescriptionPtr> get_words_from_index(size_t index, 
+                                                         size_t num_words,
+                                                         FakeWordMode fake_word_mode = MIXED_FAKE_WORDS,
+                                                         makewords::Difficulty difficulty = makewords::NORMAL_DIFFICULTY);
     
     /**
-     * Pick a number of words satisfying a certain criteria.
+     * Pick a number of words that are in all indexes listed in the query
+     * and have the length given by the query.  Real words are sampled
+     * directly from the intersection of the index bitmaps.  If the
+     * pseudoword generator can't come up with enough fake words that
+     * satisfy all criteria, real words are used instead, and if there
+     * are not enough of those either, the list will be shorter.  If the
+     * query has a seed, the list depends only on the seed, the query and
+     * the dictionary.
      */
-    std::vector<WordDescriptionPtr> get_words_from_index(size_t index, size_t num_words);
+    std::vector<WordDescriptionPtr> get_words(const WordQuery& query, size_t num_words);
+    
+    /**
+     * Find the words matching a crossword-style pattern such as "?A??E",
+     * where PatternIndex::kAnyLetter stands for any letter.  Up to
+     * max_words words are written to words, starting from the match
+     * number first_word; the matches come in dictionary order.
+     *
+     * @return the total number of matching words; 0 if the pattern is
+     * not valid.
+     */
+    size_t find_words(const std::string& pattern,
+                      size_t first_word,
+                      size_t max_words,
+                      std::vector<WordDescriptionPtr>& words) const;
+    
+    /**
+     * Find the words that can be made from a rack of letters.  Words
+     * made of exactly the letters of the rack are written to anagrams;
+     * shorter words made of some of the letters are written to subwords,
+     * longest first.
+     *
+     * @return false if the rack is empty, has characters other than 'A'
+     * to 'Z' or too many of the same letter, or is longer than the
+     * longest word length; true otherwise.
+     */
+    bool find_anagrams(const std::string& rack,
+                       std::vector<WordDescriptionPtr>& anagrams,
+                       std::vector<WordDescriptionPtr>& subwords) const;
+    
+    /**
+     * Look up many words at once.  For each word, the description of
+     * the word in this dictionary is written to descriptions, or an 
+     * empty pointer if the word isn't in the dictionary.
+     */
+    void check_words(const std::vector<std::string>& words,
+                     std::vector<WordDescriptionPtr>& descriptions) const;
+    
+    /**
+     * Find up to max_suggestions real words within a couple of edits
+     * of a possibly misspelled word, closest first.  The words are
+     * written to suggestions, and their edit distances to distances.
+     * A real word is suggested first, at distance 0.
+     */
+    void suggest_words(const std::string& word,
+                       size_t max_suggestions,
+                       std::vector<WordDescriptionPtr>& suggestions,
+                       std::vector<size_t>& distances) const;
+    
+    /// Check whether a word is one edit away from a real word.
+    bool is_near_real_word(const std::string& word) const;
+    
+    /**
+     * Find up to max_words words matching a regular expression (Perl
+     * syntax, any case), in dictionary order.  Words that lack the 
+     * letters the expression requires are ruled out first; the rest
+     * are split among the threads of the pool, which stop once the
+     * time budget runs out.
+     *
+     * @param is_complete set to false if the search was cut short by
+     * the time budget or by max_words, true otherwise.
+     * @return false if the expression is not valid, true otherwise.
+     */
+    bool grep_words(const std::string& pattern,
+                    size_t max_words,
+                    long time_budget_millisec,
+                    WorkerPool& pool,
+                    std::vector<WordDescriptionPtr>& words,
+                    bool& is_complete) const;
     
     /*==================== Getters/setters ======================*/
     /// Get all words by length.
@@ -118,7 +338,77 @@ public:
     /// Get the contents of the word indexes.
     IndexList& indexes()                                    {return indexes_;}
     
+    /// Get the word indexes as bitmaps of positions in words_by_length().
+    const std::vector<WordBitmap>& index_bitmaps() const    {return index_bitmaps_;}
+    
+    /// Get the index of words by letter positions.
+    const PatternIndex& pattern_index() const               {return pattern_index_;}
+    
+    /// Get the index used for suggesting real words.
+    const SuggestionIndex& suggestion_index() const         {return suggestion_index_;}
+    
+    /// Get the cache of popular index intersections.
+    const WordIdListCache& query_cache() const              {return query_cache_;}
+    
+    /// Get the store holding the words.
+    boost::shared_ptr<WordStore> word_store() const         {return word_store_;}
+    
+    /// Get the number of the dictionary in the word store.
+    size_t dictionary_num() const                           {return dictionary_num_;}
+    
 private:
+    /**
+     * Compose a list of real and fake words.  Real words are drawn
+     * without replacement from the candidates; fake words are generated
+     * to match the criteria and are unique within the list.
+     */
+    void pick_words(const WordCandidates& candidates,
+                    const FakeWordCriteria& fake_word_criteria,
+                    size_t num_words,
+                    makewords::CounterRandom& random,
+                    std::vector<WordDescriptionPtr>& words);
+    
+    /// Get the key for a list of words picked without a seed.  Safe to
+    /// call from several threads at once.
+    boost::uint64_t next_random_key();
+    
+    /// Pick a number of words by length, drawing from the given stream
+    /// of random numbers.
+    std::vector<WordDescriptionPtr> get_words_by_length(size_t from,
+                                                        size_t to,
+                                                        size_t num_words,
+                                                        FakeWordMode fake_word_mode,
+                                                        makewords::Difficulty difficulty,
+                                                        makewords::CounterRandom& random);
+    
+    /// Pick a number of words satisfying a certain criteria, drawing from
+    /// the given stream of random numbers.
+    std::vector<WordDescriptionPtr> get_words_from_index(size_t index, 
+                                                         size_t num_words,
+                                                         FakeWordMode fake_word_mode,
+                                                         makewords::Difficulty difficulty,
+                                                         makewords::CounterRandom& random);
+    
+    /**
+     * Generate a fake word satisfying the criteria.
+     * @return true on success, false if no fitting word was found
+     * within kMaxCombinedFakeWordAttempts tries.
+     */
+    bool make_fake_word(const FakeWordCriteria& criteria, 
+                        makewords::CounterRandom& random,
+                        std::string& word);
+
+    /**
+     * Pick num_picks distinct offsets from [0, range_size) using Floyd's
+     * algorithm, and write them to picks in random order.  The picks array
+     * must have room for num_picks entries; num_picks may not exceed
+     * range_size or kMaxWordsPerPick.
+     */
+    void sample_without_replacement(size_t range_size,
+                                    size_t num_picks,
+                                    makewords::CounterRandom& random,
+                                    size_t* picks);
+
     /// Main list of words by length.
     std::vector<WordDescriptionPtr> words_by_length_;
     
@@ -131,17 +421,40 @@ private:
     /// Other word indexes.
     IndexList indexes_;
     
+    /// The same indexes, as bitmaps of positions in words_by_length_.
+    std::vector<WordBitmap> index_bitmaps_;
+    
+    /// Index of words by the letters at each position.
+    PatternIndex pattern_index_;
+    
+    /// Index of words by the letters they're made of.
+    AnagramIndex anagram_index_;
+    
+    /// Perfect hash of the words, for checking whether a word is real.
+    PerfectHashIndex word_hash_;
+    
+    /// Index of words by their deletes, for suggesting real words.
+    SuggestionIndex suggestion_index_;
+    
+    /// Letters and lengths of the words, for ruling out words
+    /// before running a regular expression.
+    LetterMaskIndex letter_masks_;
+    
+    /// Materialized intersections for popular queries.
+    WordIdListCache query_cache_;
+    
+    /// Guards query_cache_, which changes on every lookup.
+    boost::mutex query_cache_mutex_;
+    
     /// Pseudoword generator.
     boost::shared_ptr<makewords::PseudowordGenerator> pseudoword_generator_;
     
-    /// Random numbers generator.
-    mutable boost::mt19937 random_numbers_generator_;
+    /// Keys for the random number streams of the lists picked
+    /// without a seed.
+    makewords::CounterRandom random_keys_;
     
-    /// Uniform [0, 1] distribution.
-    mutable boost::uniform_01<> uniform_01_;
-    
-    /// The main generator.
-    mutable boost::variate_generator<boost::mt19937&, boost::uniform_01<> > random_01_;
+    /// Guards random_keys_.
+    boost::mutex random_keys_mutex_;
     
     /// Regex expressions to use for word length checks when generating pseudowords.
     std::vector<boost::regex> word_length_patterns_;
@@ -154,6 +467,12 @@ private:
 
     /// Maximum length for a pseudoword generated for an index.
     size_t max_index_pseudoword_length_;
+    
+    /// Storage for the words, possibly shared with other dictionaries.
+    boost::shared_ptr<WordStore> word_store_;
+    
+    /// Number of the dictionary in the word store.
+    size_t dictionary_num_;
 };
 
 /*---------------------------------------------------------
@@ -195,6 +514,37 @@ private:
     boost::regex pattern_;
 };
 
+/*---------------------------------------------------------
+                    SmallKeySet class.
+----------------------------------------------------------*/
+/**
+ * A tiny fixed-capacity open-addressing set of integer keys.  It is
+ * meant to be kept on the stack while picking a single list of words,
+ * so that checking for duplicates does not allocate.
+ */
+class SmallKeySet {
+public:
+    /// Number of slots; a power of two, and at least twice
+    /// WordPicker::kMaxWordsPerPick to keep the probe chains short.
+    static const size_t kCapacity = 128;
+
+    SmallKeySet() {
+        memset(keys_, 0, sizeof(keys_));
+    }
+
+    /**
+     * Insert a key into the set.
+     *
+     * @return true if the key was inserted, false if it was already
+     * in the set or the set is full.
+     */
+    bool insert(size_t key);
+
+private:
+    /// The slots; zero marks an empty slot.
+    size_t keys_[kCapacity];
+};
+
 } /* namespace isaword */
 
 #endif
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Storage for the words of all loaded dictionaries.
+
+#include <string>
+#include <vector>
+
+#include "word_store.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    WordStore class.
+----------------------------------------------------------*/
+const size_t WordStore::kNoDictionary;
+
+/**
+ * Register a new dictionary.
+ */
+size_t WordStore::add_dictionary(const std::string& name) {
+    dictionary_names_.push_back(name);
+    members_.push_back(WordBitmap());
+    return dictionary_names_.size() - 1;
+}
+
+/**
+ * Add a word to a dictionary, reusing the stored word if possible.
+ */
+WordDescriptionPtr WordStore::add_word(size_t dictionary_num,
+                                       const std::string& word,
+                                       const std::string& description) {
+    //Look through the stored variants of the word for one with
+    //the same description.
+    WordId id = 0;
+    const bool has_word = this->find_first_id(word, id);
+    
+    if (has_word) {
+        while (true) {
+            if (words_[id]->description == description) {
+                members_[dictionary_num].add(id);
+                return words_[id];
+            }
+            
+            VariantMap::const_iterator next = next_variants_.find(id);
+            if (next == next_variants_.end()) {
+                break;
+            }
+            
+            id = next->second;
+        }
+    }
+    
+    //Store a new word or a new variant.
+    const WordId new_id = static_cast<WordId>(words_.size());
+    WordDescriptionPtr word_description(new WordDescription);
+    word_description->word = word;
+    word_description->description = description;
+    word_description->is_real = true;
+    words_.push_back(word_description);
+    
+    if (has_word) {
+        next_variants_[id] = new_id;
+    
+    } else {
+        word_ids_[word_description->word.c_str()] = new_id;
+    }
+    
+    members_[dictionary_num].add(new_id);
+    return word_description;
+}
+
+/**
+ * Find a dictionary by name.
+ */
+size_t WordStore::find_dictionary(const std::string& name) const {
+    for (size_t i = 0; i < dictionary_names_.size(); i++) {
+        if (dictionary_names_[i] == name) {
+            return i;
+        }
+    }
+    
+    return kNoDictionary;
+}
+
+/**
+ * Check whether a word is in a dictionary.
+ */
+bool WordStore::contains(size_t dictionary_num, const std::string& word) const {
+    WordId id = 0;
+    if (dictionary_num >= members_.size() || !this->find_first_id(word, id)) {
+        return false;
+    }
+    
+    while (true) {
+        if (members_[dictionary_num].contains(id)) {
+            return true;
+        }
+        
+        VariantMap::const_iterator next = next_variants_.find(id);
+        if (next == next_variants_.end()) {
+            return false;
+        }
+        
+        id = next->second;
+    }
+}
+
+/**
+ * Find the first id under which a word is stored.
+ * @return true if the word is stored, false otherwise.
+ */
+bool WordStore::find_first_id(const std::string& word, WordId& id) const {
+    WordIdMap::const_iterator it = word_ids_.find(word.c_str());
+    
+    if (it == word_ids_.end()) {
+        return false;
+    }
+    
+    id = it->second;
+    return true;
+}
+
+} /* namespace isaword */
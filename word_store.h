@@ -0,0 +1,158 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Storage for the words of all loaded dictionaries.  Most words
+// are in several dictionaries at once, so each word is stored once
+// and shared by all dictionaries that have it.
+
+#ifndef ISAWORD_WORD_STORE_H
+#define ISAWORD_WORD_STORE_H
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/shared_ptr.hpp>
+#include <google/dense_hash_map>
+
+#include "word_bitmap.h"
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    WordDescription class.
+----------------------------------------------------------*/
+/**
+ * A simple structure containing description of a word.
+ */
+class WordDescription {
+public:
+    std::string word;
+    std::string description;
+    bool is_real;
+};
+
+typedef boost::shared_ptr<WordDescription> WordDescriptionPtr ;
+
+/*---------------------------------------------------------
+                    WordStore class.
+----------------------------------------------------------*/
+/**
+ * The words of all loaded dictionaries.  A word that appears in several
+ * dictionaries with the same description is stored only once, under a
+ * single id; each dictionary keeps a bitmap of the ids of its words.
+ * Words whose descriptions differ between dictionaries are stored once
+ * per description.
+ */
+class WordStore {
+public:
+    /// Returned by find_dictionary() when there is no such dictionary.
+    static const size_t kNoDictionary = static_cast<size_t>(-1);
+    
+    WordStore() {
+        word_ids_.set_empty_key(NULL);
+        next_variants_.set_empty_key(static_cast<WordId>(-1));
+    }
+    
+    /**
+     * Register a new dictionary.
+     * @return the number of the dictionary, used to add words to it.
+     */
+    size_t add_dictionary(const std::string& name);
+    
+    /**
+     * Add a word to a dictionary.  If another dictionary already has
+     * the same word with the same description, the stored word is reused.
+     *
+     * @return the stored word.
+     */
+    WordDescriptionPtr add_word(size_t dictionary_num,
+                                const std::string& word,
+                                const std::string& description);
+    
+    /// Find a dictionary by name; kNoDictionary if there is none.
+    size_t find_dictionary(const std::string& name) const;
+    
+    /// Check whether a word is in a dictionary.
+    bool contains(size_t dictionary_num, const std::string& word) const;
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the number of dictionaries.
+    size_t num_dictionaries() const                 {return dictionary_names_.size();}
+    
+    /// Get the name of a dictionary.
+    const std::string& dictionary_name(size_t dictionary_num) const {
+        return dictionary_names_[dictionary_num];
+    }
+    
+    /// Get the ids of the words in a dictionary.
+    const WordBitmap& members(size_t dictionary_num) const {
+        return members_[dictionary_num];
+    }
+    
+    /// Get all stored words, by id.
+    const std::vector<WordDescriptionPtr>& words() const {return words_;}
+    
+private:
+    /**
+     * Functors used to hash and compare the words in the hash map.
+     * The keys point into the stored words, so that the words are
+     * not copied.
+     */
+    struct hash_cstr {
+        size_t operator()(const char* str) const {
+            return boost::hash_range(str, str + strlen(str));
+        }
+    };
+    
+    struct eqcstr {
+        bool operator()(const char* first, const char* second) const {
+            return (first == second) || 
+                   (first != NULL && second != NULL && strcmp(first, second) == 0);
+        }
+    };
+    
+    typedef google::dense_hash_map<const char*, WordId, hash_cstr, eqcstr> WordIdMap;
+    typedef google::dense_hash_map<WordId, 
+                                   WordId, 
+                                   boost::hash<WordId>, 
+                                   std::equal_to<WordId> > 
+            VariantMap;
+    
+    /// Find the first id under which a word is stored.
+    bool find_first_id(const std::string& word, WordId& id) const;
+    
+    /// All stored words, by id.
+    std::vector<WordDescriptionPtr> words_;
+    
+    /// Id of the first stored variant of each word.
+    WordIdMap word_ids_;
+    
+    /// Next variant (with a different description) of a word, if any.
+    VariantMap next_variants_;
+    
+    /// Names of the dictionaries.
+    std::vector<std::string> dictionary_names_;
+    
+    /// Ids of the words in each dictionary.
+    std::vector<WordBitmap> members_;
+};
+
+} /* namespace isaword */
+#endif
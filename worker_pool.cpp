@@ -0,0 +1,144 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A small pool of threads for splitting up long scans.
+
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "worker_pool.h"
+
+using boost::shared_ptr;
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    WorkerPool class.
+----------------------------------------------------------*/
+/**
+ * Start the worker threads.
+ */
+WorkerPool::WorkerPool(size_t num_threads)
+: is_stopping_(false) {
+    for (size_t i = 0; i < num_threads; i++) {
+        threads_.push_back(shared_ptr<boost::thread>(
+            new boost::thread(boost::bind(&WorkerPool::work, this))));
+    }
+}
+
+/**
+ * Stop the worker threads.
+ */
+WorkerPool::~WorkerPool() {
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        is_stopping_ = true;
+        has_tasks_.notify_all();
+    }
+    
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i]->join();
+    }
+}
+
+/**
+ * Run a batch of tasks, and wait until all of them are done.  While
+ * there are queued tasks, the calling thread runs them itself.
+ */
+void WorkerPool::run(const std::vector<Task>& tasks) {
+    if (tasks.empty()) {
+        return;
+    }
+    
+    Batch batch(tasks.size());
+    boost::mutex::scoped_lock lock(mutex_);
+    
+    for (size_t i = 0; i < tasks.size(); i++) {
+        tasks_.push_back(QueuedTask(tasks[i], &batch));
+    }
+    
+    has_tasks_.notify_all();
+    
+    while (batch.num_tasks_left > 0) {
+        if (!tasks_.empty()) {
+            const QueuedTask queued_task = tasks_.front();
+            tasks_.pop_front();
+            this->run_task(queued_task, lock);
+        
+        } else {
+            batch.is_done.wait(lock);
+        }
+    }
+}
+
+/**
+ * Hand in a task to be run by one of the worker threads, without 
+ * waiting for it.  The tasks still queued when the pool is destroyed
+ * are run before the threads stop.
+ */
+void WorkerPool::post(const Task& task) {
+    boost::mutex::scoped_lock lock(mutex_);
+    tasks_.push_back(QueuedTask(task, NULL));
+    has_tasks_.notify_one();
+}
+
+/**
+ * Run the tasks handed in until the pool is stopped.
+ */
+void WorkerPool::work() {
+    boost::mutex::scoped_lock lock(mutex_);
+    
+    while (true) {
+        while (tasks_.empty() && !is_stopping_) {
+            has_tasks_.wait(lock);
+        }
+        
+        if (tasks_.empty()) {
+            return;
+        }
+        
+        const QueuedTask queued_task = tasks_.front();
+        tasks_.pop_front();
+        this->run_task(queued_task, lock);
+    }
+}
+
+/**
+ * Run a queued task, and count it as done.
+ */
+void WorkerPool::run_task(const QueuedTask& queued_task, boost::mutex::scoped_lock& lock) {
+    lock.unlock();
+    queued_task.task();
+    lock.lock();
+    
+    if (queued_task.batch == NULL) {
+        return;
+    }
+    
+    queued_task.batch->num_tasks_left--;
+    
+    if (queued_task.batch->num_tasks_left == 0) {
+        queued_task.batch->is_done.notify_all();
+    }
+}
+
+} /* namespace isaword */
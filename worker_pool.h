@@ -0,0 +1,109 @@
+/*
+ * Copyright 2011 Iouri Khramtsov.
+ *
+ * This software is available under Apache License, Version 
+ * 2.0 (the "License"); you may not use this file except in 
+ * compliance with the License. You may obtain a copy of the
+ * License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied. See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A small pool of threads for splitting up long scans.
+
+#ifndef ISAWORD_WORKER_POOL_H
+#define ISAWORD_WORKER_POOL_H
+
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace isaword {
+
+/*---------------------------------------------------------
+                    WorkerPool class.
+----------------------------------------------------------*/
+/**
+ * A fixed set of threads that run batches of tasks.  The thread that
+ * hands in a batch works on it too, and gets control back once every
+ * task of the batch is done.  Tasks must not throw.
+ */
+class WorkerPool {
+public:
+    typedef boost::function<void ()> Task;
+    
+    /// Start a pool with a number of worker threads, in addition to 
+    /// the threads handing in the batches.  There may be none.
+    WorkerPool(size_t num_threads);
+    
+    /// Stop the worker threads, once the tasks handed in are done.
+    ~WorkerPool();
+    
+    /// Run a batch of tasks, and wait until all of them are done.
+    void run(const std::vector<Task>& tasks);
+    
+    /// Hand in a task to be run by one of the worker threads, without
+    /// waiting for it.  The pool must have at least one thread.
+    void post(const Task& task);
+    
+    /*=============== Getters/Setters ====================*/
+    /// Get the number of worker threads.
+    size_t num_threads() const          {return threads_.size();}
+    
+private:
+    /// A batch of tasks being run.
+    class Batch {
+    public:
+        Batch(size_t num_tasks) : num_tasks_left(num_tasks) {}
+        
+        size_t num_tasks_left;
+        boost::condition_variable is_done;
+    };
+    
+    /// A task waiting to run, and the batch it's from, if any.
+    class QueuedTask {
+    public:
+        QueuedTask(const Task& queued_task, Batch* task_batch) 
+        : task(queued_task), batch(task_batch) {
+        }
+        
+        Task task;
+        Batch* batch;
+    };
+    
+    /// Run the tasks handed in until the pool is stopped.
+    void work();
+    
+    /// Run a queued task, and count it as done.  Called with
+    /// the lock held; releases it while the task runs.
+    void run_task(const QueuedTask& queued_task, boost::mutex::scoped_lock& lock);
+    
+    /// The worker threads.
+    std::vector<boost::shared_ptr<boost::thread> > threads_;
+    
+    /// Guards the fields below.
+    boost::mutex mutex_;
+    
+    /// Signalled when tasks are queued or the pool is stopped.
+    boost::condition_variable has_tasks_;
+    
+    /// The tasks waiting to run.
+    std::deque<QueuedTask> tasks_;
+    
+    /// Whether the pool is being stopped.
+    bool is_stopping_;
+};
+
+} /* namespace isaword */
+#endif